@@ -18,6 +18,9 @@ elif [ "$1" = "requests" ]; then
     CONFIG="-framework CoreFoundation -framework Security"
 elif [ "$1" = "sqlite" ]; then
     CONFIG="-lsqlite3"
+elif [ "$1" = "http" ]; then
+    CONFIG="../../../src/**/*.cpp"
+    DIRECT_LIBS=""
 elif [ "$1" = "websockets" ]; then
     # CONFIG="-framework CoreFoundation -framework Security Vortex/**/*.cpp"
     CONFIG="-framework CoreFoundation -framework Security ../../../src/**/*.cpp"
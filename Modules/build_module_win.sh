@@ -22,6 +22,9 @@ elif [ "$1" = "requests" ]; then
     DIRECT_LIBS="-Llib -lws2_32 -l:libssl-3-x64.dll -l:libcrypto-3-x64.dll -lcrypt32"
 elif [ "$1" = "sqlite" ]; then
     DIRECT_LIBS="-lsqlite3"
+elif [ "$1" = "http" ]; then
+    CONFIG="../../../src/**/*.cpp"
+    DIRECT_LIBS="-DWIN32_LEAN_AND_MEAN -lpthread -lws2_32 -lmswsock"
 elif [ "$1" = "websockets" ]; then
     # CONFIG="lib/*.dll Vortex/**/*.cpp"
     CONFIG="lib/*.dll ../../../src/**/*.cpp"
@@ -27,6 +27,9 @@ elif [ "$FILE" = "requests" ]; then
     CONFIG="-framework CoreFoundation -framework Security"
 elif [ "$FILE" = "sqlite" ]; then
     CONFIG="-lsqlite3"
+elif [ "$FILE" = "http" ]; then
+    CONFIG="../../src/**/*.cpp"
+    DIRECT_LIBS=""
 elif [ "$FILE" = "websockets" ]; then
     # CONFIG="-framework CoreFoundation -framework Security $FILE/Vortex/**/*.cpp"
     CONFIG="-framework CoreFoundation -framework Security ../../src/**/*.cpp"
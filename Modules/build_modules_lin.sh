@@ -28,6 +28,9 @@ elif [ "$FILE" = "requests" ]; then
     DIRECT_LIBS=""
 elif [ "$FILE" = "sqlite" ]; then
     CONFIG="-lsqlite3"
+elif [ "$FILE" = "http" ]; then
+    CONFIG="../../src/**/*.cpp"
+    DIRECT_LIBS=""
 elif [ "$FILE" = "websockets" ]; then
     # CONFIG="$FILE/Vortex/**/*.cpp"
     CONFIG="../../src/**/*.cpp"
@@ -30,6 +30,9 @@ elif [ "$FILE" = "requests" ]; then
     DIRECT_LIBS="-L$FILE/lib -lws2_32 -l:libssl-3-x64.dll -l:libcrypto-3-x64.dll -lcrypt32"
 elif [ "$FILE" = "sqlite" ]; then
     DIRECT_LIBS="-lsqlite3"
+elif [ "$FILE" = "http" ]; then
+    CONFIG="../../src/**/*.cpp"
+    DIRECT_LIBS="-DWIN32_LEAN_AND_MEAN -lpthread -lws2_32 -lmswsock"
 elif [ "$FILE" = "websockets" ]; then
     # CONFIG="$FILE/lib/*.dll $FILE/Vortex/**/*.cpp"
     CONFIG="$FILE/lib/*.dll ../../src/**/*.cpp"
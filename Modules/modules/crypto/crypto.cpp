@@ -56,8 +56,8 @@ extern "C" Value evp_encrypt(std::vector<Value> &args)
         return error_object("Parameter 'key' must be a string");
     }
 
-    std::string &key = key_.get_string();
-    std::string &plainText = str.get_string();
+    const std::string &key = key_.get_string();
+    const std::string &plainText = str.get_string();
 
     if (key.length() < 32)
     {
@@ -141,8 +141,8 @@ extern "C" Value evp_decrypt(std::vector<Value> &args)
         return error_object("Parameter 'key' must be a string");
     }
 
-    std::string &key = key_.get_string();
-    std::string &encryptedText = str.get_string();
+    const std::string &key = key_.get_string();
+    const std::string &encryptedText = str.get_string();
 
     if (key.length() < 32)
     {
@@ -307,8 +307,8 @@ extern "C" Value rsa_encrypt(std::vector<Value> &args)
         return error_object("Parameter 'key' must be a string");
     }
 
-    std::string &keyString = key_.get_string();
-    std::string &plainText = str.get_string();
+    const std::string &keyString = key_.get_string();
+    const std::string &plainText = str.get_string();
 
     if (keyString.length() * 8 < 2048)
     {
@@ -373,8 +373,8 @@ extern "C" Value rsa_decrypt(std::vector<Value> &args)
         return error_object("Parameter 'key' must be a string");
     }
 
-    std::string &keyString = key_.get_string();
-    std::string &encryptedText = str.get_string();
+    const std::string &keyString = key_.get_string();
+    const std::string &encryptedText = str.get_string();
 
     if (keyString.length() * 8 < 2048)
     {
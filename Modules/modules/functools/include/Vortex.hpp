@@ -28,6 +28,14 @@ struct Closure;
 
 std::string toString(Value value);
 
+struct ExceptionHandler
+{
+    int start;
+    int end;
+    int handler;
+    int depth;
+};
+
 struct Chunk
 {
     std::vector<uint8_t> code;
@@ -35,6 +43,7 @@ struct Chunk
     std::vector<Value> constants;
     std::vector<std::string> variables;
     std::vector<std::string> public_variables;
+    std::vector<ExceptionHandler> exception_table;
     std::string import_path;
 };
 
@@ -61,6 +70,8 @@ struct FunctionObj
     bool generator_init = false;
     bool generator_done = false;
     bool is_type_generator = false;
+    std::vector<Value> generator_stack;
+    int generator_ip = 0;
     std::string import_path;
 };
 
@@ -108,16 +119,22 @@ struct ValueHooks
     std::string onAccessHookName;
 };
 
-static long long int v_counter = 0;
+// String buffers are shared between copies of a Value and never written
+// in place while shared, see Value::get_mutable_string
+static const std::shared_ptr<std::string> &empty_string()
+{
+    static const std::shared_ptr<std::string> empty = std::make_shared<std::string>();
+    return empty;
+}
+
 struct Value
 {
     ValueType type;
     Meta meta;
     ValueHooks hooks;
-    long long int id;
     std::variant<
         double,
-        std::string,
+        std::shared_ptr<std::string>,
         bool,
         std::shared_ptr<std::vector<Value>>,
         std::shared_ptr<FunctionObj>,
@@ -129,18 +146,16 @@ struct Value
 
     Value() : type(ValueType::None)
     {
-        id = ++v_counter;
     }
     Value(ValueType type) : type(type)
     {
-        id = ++v_counter;
         switch (type)
         {
         case ValueType::Number:
             value = 0.0f;
             break;
         case ValueType::String:
-            value = "";
+            value = empty_string();
             break;
         case ValueType::Boolean:
             value = false;
@@ -172,9 +187,18 @@ struct Value
     {
         return std::get<double>(this->value);
     }
-    std::string &get_string()
+    const std::string &get_string()
+    {
+        return *std::get<std::shared_ptr<std::string>>(this->value);
+    }
+    std::string &get_mutable_string()
     {
-        return std::get<std::string>(this->value);
+        auto &str = std::get<std::shared_ptr<std::string>>(this->value);
+        if (str.use_count() > 1)
+        {
+            str = std::make_shared<std::string>(*str);
+        }
+        return *str;
     }
     bool &get_boolean()
     {
@@ -311,7 +335,7 @@ Value number_val(double value)
 Value string_val(std::string value)
 {
     Value val(ValueType::String);
-    val.value = value;
+    val.value = std::make_shared<std::string>(std::move(value));
     return val;
 }
 
@@ -371,16 +395,133 @@ void error(std::string message)
     exit(1);
 }
 
+#define STACK_MAX 100000
+#define STACK_HEADROOM 256
+#define FRAMES_MAX 3000
+
+// Thrown when a push would run past the end of a stack, run() reports it as
+// a RecursionError so it can be caught like any other error
+struct StackOverflow
+{
+};
+
+// Value and frame stacks are allocated once per VM and never move, closures
+// and the frames keep raw pointers into them
+template <typename T>
+struct FixedStack
+{
+    T *items;
+    T *top;
+    T *limit;
+
+    FixedStack(size_t capacity)
+    {
+        items = top = (T *)::operator new(capacity * sizeof(T));
+        limit = items + capacity;
+    }
+    ~FixedStack()
+    {
+        clear();
+        ::operator delete(items);
+    }
+    FixedStack(const FixedStack &) = delete;
+    FixedStack &operator=(const FixedStack &) = delete;
+
+    [[noreturn]] static void overflow()
+    {
+        throw StackOverflow();
+    }
+
+    void push_back(const T &item)
+    {
+        if (top == limit)
+        {
+            overflow();
+        }
+        new (top++) T(item);
+    }
+    void push_back(T &&item)
+    {
+        if (top == limit)
+        {
+            overflow();
+        }
+        new (top++) T(std::move(item));
+    }
+    void pop_back()
+    {
+        (--top)->~T();
+    }
+    T &back()
+    {
+        return top[-1];
+    }
+    T &operator[](size_t index)
+    {
+        return items[index];
+    }
+    size_t size() const
+    {
+        return top - items;
+    }
+    size_t capacity() const
+    {
+        return limit - items;
+    }
+    bool empty() const
+    {
+        return top == items;
+    }
+    T *data()
+    {
+        return items;
+    }
+    T *begin()
+    {
+        return items;
+    }
+    T *end()
+    {
+        return top;
+    }
+    void erase(T *first, T *last)
+    {
+        T *new_top = std::move(last, top, first);
+        while (top != new_top)
+        {
+            pop_back();
+        }
+    }
+    void erase(T *position)
+    {
+        erase(position, position + 1);
+    }
+    template <typename Iterator>
+    void append(Iterator first, Iterator last)
+    {
+        for (; first != last; ++first)
+        {
+            push_back(*first);
+        }
+    }
+    void clear()
+    {
+        while (top != items)
+        {
+            pop_back();
+        }
+    }
+};
+
 struct CallFrame
 {
-    std::string name;
     std::shared_ptr<FunctionObj> function;
     uint8_t *ip;
     int frame_start;
     int sp;
     int instruction_index;
-    std::vector<Value> gen_stack;
 };
+
 struct CachedImport
 {
     Value import_object;
@@ -388,28 +529,23 @@ struct CachedImport
 };
 struct VM
 {
-    std::vector<Value> stack;
-    Value *sp;
-    /* Possibly change to array with specified MAX_DEPTH */
-    std::vector<CallFrame> frames;
-    std::unordered_map<std::string, std::shared_ptr<CallFrame>> gen_frames;
+    FixedStack<Value> stack;
+    FixedStack<CallFrame> frames;
     std::vector<Value *> objects;
     std::unordered_map<std::string, Value> globals;
     int status = 0;
     std::vector<std::shared_ptr<Closure>> closed_values;
-    int coro_count = 0;
-    std::vector<int> try_instructions;
-    int call_stack_limit = 3000;
+    int call_stack_limit = FRAMES_MAX;
     std::unordered_map<std::string, CachedImport> import_cache;
     int argc = 0;
     char **argv;
 
-    VM()
+    VM() : stack(STACK_MAX), frames(FRAMES_MAX + 1)
     {
-        stack.reserve(100000);
     }
 };
 
+
 Value error_object(std::string message, std::string error_type = "GenericError")
 {
     Value error_obj = object_val();
@@ -447,7 +583,7 @@ static void runtimeError(VM &vm, std::string message, ...)
                 function->chunk.lines[instruction]);
         if (function->name == "")
         {
-            std::string name = frame->name;
+            std::string name = function->import_path;
             if (name == "")
             {
                 name = "script";
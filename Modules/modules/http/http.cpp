@@ -0,0 +1,671 @@
+#include <atomic>
+#include <functional>
+#include <thread>
+#include "../../../src/Node/Node.hpp"
+#include "../../../src/Lexer/Lexer.hpp"
+#include "../../../src/Parser/Parser.hpp"
+#include "../../../src/Bytecode/Bytecode.hpp"
+#include "../../../src/Bytecode/Generator.hpp"
+#include "../../../src/VirtualMachine/VirtualMachine.hpp"
+#include "../requests/include/httplib.h"
+
+// Requests are handled on the server's worker threads. Each worker keeps one
+// VM for as long as it lives and runs every handler it is given on it, so a
+// request costs a function call rather than setting up a new interpreter.
+// Workers run their own copies of the handlers, made when the server starts,
+// so no heap value is shared between threads
+
+struct Route
+{
+    std::string method;
+    // Literal segments, ":name" parameters and a trailing "*" for the rest
+    std::vector<std::string> segments;
+    Value handler;
+};
+
+struct HttpServer
+{
+    httplib::Server server;
+    std::vector<Route> routes;
+    Value not_found;
+    int workers = 0;
+    // One copy of the route handlers and not_found per worker
+    std::vector<std::vector<Value>> copies;
+    std::atomic<int> next_copy{0};
+    std::thread thread;
+    std::atomic<bool> running{false};
+};
+
+struct Worker
+{
+    CallbackVM caller;
+    HttpServer *server = nullptr;
+    std::vector<Value> handlers;
+
+    bool call(Value &function, Value *argument, Value &result)
+    {
+        return caller.call(function, argument, argument ? 1 : 0, &result);
+    }
+};
+
+// Set on the server's worker threads, which never join their own server
+static thread_local bool server_thread = false;
+
+static Worker &thread_worker()
+{
+    thread_local Worker worker;
+    server_thread = true;
+    return worker;
+}
+
+// Worker threads belong to one run of one server, the first request a
+// thread handles claims one of the copies made by listen()
+static std::vector<Value> *worker_handlers(HttpServer *server)
+{
+    Worker &worker = thread_worker();
+    if (worker.server != server)
+    {
+        int index = server->next_copy++;
+        if (index >= server->copies.size())
+        {
+            return nullptr;
+        }
+        worker.server = server;
+        worker.handlers = std::move(server->copies[index]);
+    }
+    return &worker.handlers;
+}
+
+static std::vector<std::string> split_path(const std::string &path)
+{
+    std::vector<std::string> segments;
+    size_t start = 0;
+    while (start <= path.size())
+    {
+        size_t end = path.find('/', start);
+        if (end == std::string::npos)
+        {
+            end = path.size();
+        }
+        if (end > start)
+        {
+            segments.push_back(path.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return segments;
+}
+
+static bool match_route(Route &route, const std::vector<std::string> &segments, Value &params)
+{
+    size_t i = 0;
+    for (; i < route.segments.size(); i++)
+    {
+        const std::string &segment = route.segments[i];
+        if (segment == "*")
+        {
+            std::string rest;
+            for (size_t j = i; j < segments.size(); j++)
+            {
+                rest += (j > i ? "/" : "") + segments[j];
+            }
+            params.get_object()->keys.push_back("*");
+            params.get_object()->values["*"] = string_val(rest);
+            return true;
+        }
+        if (i >= segments.size())
+        {
+            return false;
+        }
+        if (segment[0] == ':')
+        {
+            std::string name = segment.substr(1);
+            params.get_object()->keys.push_back(name);
+            params.get_object()->values[name] = string_val(segments[i]);
+        }
+        else if (segment != segments[i])
+        {
+            return false;
+        }
+    }
+    return i == segments.size();
+}
+
+static Value headers_value(const httplib::Headers &headers)
+{
+    Value object = object_val();
+    for (auto &header : headers)
+    {
+        if (!object.get_object()->values.count(header.first))
+        {
+            object.get_object()->keys.push_back(header.first);
+        }
+        object.get_object()->values[header.first] = string_val(header.second);
+    }
+    return object;
+}
+
+static Value request_value(const httplib::Request &req, Value &params)
+{
+    Value query = object_val();
+    for (auto &param : req.params)
+    {
+        if (!query.get_object()->values.count(param.first))
+        {
+            query.get_object()->keys.push_back(param.first);
+        }
+        query.get_object()->values[param.first] = string_val(param.second);
+    }
+
+    Value request = object_val();
+    ObjectObj &object = *request.get_object();
+    object.keys = {"method", "path", "query", "params", "headers", "body", "remote"};
+    object.values["method"] = string_val(req.method);
+    object.values["path"] = string_val(req.path);
+    object.values["query"] = query;
+    object.values["params"] = params;
+    object.values["headers"] = headers_value(req.headers);
+    object.values["body"] = string_val(req.body);
+    object.values["remote"] = string_val(req.remote_addr);
+    return request;
+}
+
+static void server_error(httplib::Response &res)
+{
+    res.status = 500;
+    res.set_content("Internal Server Error", "text/plain; charset=utf-8");
+}
+
+// Handlers return a string for a 200 text response, or an object with
+// status, headers, body and type. An object with a 'stream' function sends
+// a chunked response, calling it for each chunk until it returns None
+static void apply_response(Value &result, httplib::Response &res)
+{
+    if (result.is_none())
+    {
+        res.status = 204;
+        return;
+    }
+
+    if (!result.is_object())
+    {
+        res.set_content(result.is_string() ? result.get_string() : toString(result), "text/plain; charset=utf-8");
+        return;
+    }
+
+    auto &values = result.get_object()->values;
+    std::string type = "text/plain; charset=utf-8";
+
+    if (values.count("status") && values["status"].is_number())
+    {
+        res.status = (int)values["status"].get_number();
+    }
+
+    if (values.count("headers") && values["headers"].is_object())
+    {
+        for (auto &header : values["headers"].get_object()->values)
+        {
+            std::string value = header.second.is_string() ? header.second.get_string() : toString(header.second);
+            if (httplib::detail::compare_case_ignore(header.first, "Content-Type"))
+            {
+                type = value;
+                continue;
+            }
+            res.set_header(header.first.c_str(), value);
+        }
+    }
+
+    if (values.count("type") && values["type"].is_string())
+    {
+        type = values["type"].get_string();
+    }
+
+    if (values.count("stream") && values["stream"].is_function())
+    {
+        Value stream = values["stream"];
+        // The provider runs on the same worker thread once the handler
+        // has returned, while the response is being written
+        res.set_chunked_content_provider(type, [stream](size_t, httplib::DataSink &sink) mutable
+                                         {
+            Value chunk;
+            if (!thread_worker().call(stream, nullptr, chunk))
+            {
+                return false;
+            }
+            if (chunk.is_none())
+            {
+                sink.done();
+                return true;
+            }
+            std::string data = chunk.is_string() ? chunk.get_string() : toString(chunk);
+            return sink.write(data.data(), data.size()); });
+        return;
+    }
+
+    if (values.count("body"))
+    {
+        Value &body = values["body"];
+        res.set_content(body.is_string() ? body.get_string() : toString(body), type);
+    }
+    else
+    {
+        res.set_content("", type);
+    }
+}
+
+static void dispatch(HttpServer *server, const httplib::Request &req, httplib::Response &res)
+{
+    std::vector<std::string> segments = split_path(req.path);
+    std::string method = req.method == "HEAD" ? "GET" : req.method;
+
+    int handler = -1;
+    Value params = object_val();
+    bool allowed = false;
+    for (int i = 0; i < server->routes.size(); i++)
+    {
+        Route &route = server->routes[i];
+        Value candidate = object_val();
+        if (!match_route(route, segments, candidate))
+        {
+            continue;
+        }
+        allowed = true;
+        if (route.method == "*" || route.method == method)
+        {
+            handler = i;
+            params = candidate;
+            break;
+        }
+    }
+    bool found = handler >= 0;
+
+    if (!found && !server->not_found.is_function())
+    {
+        res.status = allowed ? 405 : 404;
+        res.set_content(allowed ? "Method Not Allowed" : "Not Found", "text/plain; charset=utf-8");
+        return;
+    }
+
+    // not_found comes after the routes
+    if (!found)
+    {
+        handler = server->routes.size();
+    }
+
+    std::vector<Value> *handlers = worker_handlers(server);
+    if (!handlers)
+    {
+        server_error(res);
+        return;
+    }
+
+    Value request = request_value(req, params);
+    Value result;
+    if (!thread_worker().call((*handlers)[handler], &request, result))
+    {
+        server_error(res);
+        return;
+    }
+    apply_response(result, res);
+}
+
+static HttpServer *get_server(Value &server, std::string &error)
+{
+    if (!server.is_pointer())
+    {
+        error = "Parameter 'server' must be a pointer";
+        return nullptr;
+    }
+    HttpServer *ptr = (HttpServer *)server.get_pointer()->value;
+    if (!ptr)
+    {
+        error = "Server is closed";
+    }
+    return ptr;
+}
+
+extern "C" Value _server(std::vector<Value> &args)
+{
+    int num_required_args = 1;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'server' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    Value options = args[0];
+
+    if (!options.is_object())
+    {
+        return error_object("Function 'server' expects argument 'options' to be an object");
+    }
+
+    auto &values = options.get_object()->values;
+    auto number_option = [&](const char *name, double fallback, double &out)
+    {
+        if (!values.count(name))
+        {
+            out = fallback;
+            return true;
+        }
+        if (!values[name].is_number() || values[name].get_number() < 0)
+        {
+            return false;
+        }
+        out = values[name].get_number();
+        return true;
+    };
+
+    double workers, keep_alive_count, keep_alive_timeout, timeout, max_body;
+    if (!number_option("workers", CPPHTTPLIB_THREAD_POOL_COUNT, workers) ||
+        !number_option("keepAliveCount", 100, keep_alive_count) ||
+        !number_option("keepAliveTimeout", 5, keep_alive_timeout) ||
+        !number_option("timeout", 5, timeout) ||
+        !number_option("maxBodySize", 0, max_body))
+    {
+        return error_object("Server options must be positive numbers");
+    }
+
+    auto server = new HttpServer();
+    server->workers = std::max(1, (int)workers);
+    server->not_found = none_val();
+
+    httplib::Server &http = server->server;
+    int count = server->workers;
+    http.new_task_queue = [count]
+    { return new httplib::ThreadPool(count); };
+    http.set_tcp_nodelay(true);
+    http.set_keep_alive_max_count((size_t)keep_alive_count);
+    http.set_keep_alive_timeout((time_t)keep_alive_timeout);
+    http.set_read_timeout((time_t)timeout);
+    http.set_write_timeout((time_t)timeout);
+    if (max_body > 0)
+    {
+        http.set_payload_max_length((size_t)max_body);
+    }
+
+    auto handler = [server](const httplib::Request &req, httplib::Response &res)
+    {
+        dispatch(server, req, res);
+    };
+    http.Get(".*", handler);
+    http.Post(".*", handler);
+    http.Put(".*", handler);
+    http.Patch(".*", handler);
+    http.Delete(".*", handler);
+    http.Options(".*", handler);
+
+    Value server_ptr = pointer_val();
+    server_ptr.get_pointer()->value = server;
+    return server_ptr;
+}
+
+extern "C" Value _server_route(std::vector<Value> &args)
+{
+    int num_required_args = 4;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'route' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    HttpServer *server = get_server(args[0], error);
+    if (!server)
+    {
+        return error_object(error);
+    }
+
+    Value method = args[1];
+    Value path = args[2];
+    Value handler = args[3];
+
+    if (!method.is_string())
+    {
+        return error_object("Function 'route' expects argument 'method' to be a string");
+    }
+
+    if (!path.is_string() || path.get_string().empty() || path.get_string()[0] != '/')
+    {
+        return error_object("Function 'route' expects argument 'path' to be a string starting with '/'");
+    }
+
+    if (!handler.is_function() || handler.get_function()->arity != 1)
+    {
+        return error_object("Function 'route' expects argument 'handler' to be a Function with 1 parameter");
+    }
+
+    if (server->running)
+    {
+        return error_object("Routes cannot be added while the server is running");
+    }
+
+    Route route;
+    route.method = method.get_string();
+    std::transform(route.method.begin(), route.method.end(), route.method.begin(), ::toupper);
+    route.segments = split_path(path.get_string());
+    for (size_t i = 0; i < route.segments.size(); i++)
+    {
+        if (route.segments[i] == "*" && i + 1 != route.segments.size())
+        {
+            return error_object("'*' can only be the last segment of a route");
+        }
+    }
+    route.handler = handler;
+    server->routes.push_back(std::move(route));
+
+    return none_val();
+}
+
+extern "C" Value _server_not_found(std::vector<Value> &args)
+{
+    int num_required_args = 2;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'not_found' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    HttpServer *server = get_server(args[0], error);
+    if (!server)
+    {
+        return error_object(error);
+    }
+
+    Value handler = args[1];
+
+    if (!handler.is_function() || handler.get_function()->arity != 1)
+    {
+        return error_object("Function 'not_found' expects argument 'handler' to be a Function with 1 parameter");
+    }
+
+    if (server->running)
+    {
+        return error_object("The not found handler cannot be changed while the server is running");
+    }
+
+    server->not_found = handler;
+    return none_val();
+}
+
+extern "C" Value _server_mount(std::vector<Value> &args)
+{
+    int num_required_args = 3;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'mount' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    HttpServer *server = get_server(args[0], error);
+    if (!server)
+    {
+        return error_object(error);
+    }
+
+    Value prefix = args[1];
+    Value directory = args[2];
+
+    if (!prefix.is_string() || !directory.is_string())
+    {
+        return error_object("Function 'mount' expects arguments 'prefix' and 'directory' to be strings");
+    }
+
+    if (!server->server.set_mount_point(prefix.get_string(), directory.get_string()))
+    {
+        return error_object("Directory '" + directory.get_string() + "' does not exist");
+    }
+
+    return none_val();
+}
+
+// Binds first so that a port in use is reported as an error, then either
+// serves on this thread until stopped or on a background thread
+static Value listen(std::vector<Value> &args, const char *name, bool background)
+{
+    int num_required_args = 3;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function '" + std::string(name) + "' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    HttpServer *server = get_server(args[0], error);
+    if (!server)
+    {
+        return error_object(error);
+    }
+
+    Value host = args[1];
+    Value port = args[2];
+
+    if (!host.is_string())
+    {
+        return error_object("Function '" + std::string(name) + "' expects argument 'host' to be a string");
+    }
+
+    if (!port.is_number())
+    {
+        return error_object("Function '" + std::string(name) + "' expects argument 'port' to be a number");
+    }
+
+    if (server->running.exchange(true))
+    {
+        return error_object("Server is already running");
+    }
+
+    if (server->thread.joinable())
+    {
+        server->thread.join();
+    }
+
+    int bound = (int)port.get_number();
+    bool ok = bound == 0 ? (bound = server->server.bind_to_any_port(host.get_string())) > 0
+                         : server->server.bind_to_port(host.get_string(), bound);
+    if (!ok)
+    {
+        server->running = false;
+        return error_object("Could not listen on " + host.get_string() + ":" + std::to_string((int)port.get_number()));
+    }
+
+    // Copied here, while the program is stopped in this call, so that the
+    // values captured by the handlers are not read while they change
+    std::vector<Value> handlers;
+    for (Route &route : server->routes)
+    {
+        handlers.push_back(route.handler);
+    }
+    handlers.push_back(server->not_found);
+    server->copies.clear();
+    for (int i = 0; i < server->workers; i++)
+    {
+        server->copies.push_back(thread_copy(handlers));
+    }
+    server->next_copy = 0;
+
+    if (background)
+    {
+        server->thread = std::thread([server]()
+                                     {
+            server->server.listen_after_bind();
+            server->running = false; });
+        server->server.wait_until_ready();
+        return number_val(bound);
+    }
+
+    server->server.listen_after_bind();
+    server->running = false;
+    return number_val(bound);
+}
+
+extern "C" Value _server_listen(std::vector<Value> &args)
+{
+    return listen(args, "listen", false);
+}
+
+extern "C" Value _server_start(std::vector<Value> &args)
+{
+    return listen(args, "start", true);
+}
+
+extern "C" Value _server_stop(std::vector<Value> &args)
+{
+    int num_required_args = 1;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'stop' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    HttpServer *server = get_server(args[0], error);
+    if (!server)
+    {
+        return error_object(error);
+    }
+
+    server->server.stop();
+
+    // A handler can stop the server too, it runs on one of the server's
+    // own threads and the listening thread is joined later by close()
+    if (server->thread.joinable() && !server_thread)
+    {
+        server->thread.join();
+    }
+
+    return none_val();
+}
+
+extern "C" Value _server_close(std::vector<Value> &args)
+{
+    int num_required_args = 1;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'close' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    HttpServer *server = get_server(args[0], error);
+    if (!server)
+    {
+        return error_object(error);
+    }
+
+    if (server->running)
+    {
+        return error_object("Server is still running, stop it first");
+    }
+
+    if (server->thread.joinable())
+    {
+        server->thread.join();
+    }
+
+    delete server;
+    args[0].get_pointer()->value = nullptr;
+    return none_val();
+}
@@ -1,12 +1,70 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <cstring>
 #include <stdio.h>
 #include "include/Vortex.hpp"
 
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// The stream writes through 'buffer', so writes only reach the file when it
+// fills up, on flush and on close
+struct FileHandle
+{
+    std::fstream stream;
+    std::vector<char> buffer;
+};
+
+struct MappedFile
+{
+    const char *data = nullptr;
+    size_t size = 0;
+    size_t pos = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+};
+
+static FileHandle *get_handle(Value &fileHandle, std::string &error)
+{
+    if (!fileHandle.is_pointer())
+    {
+        error = "Parameter 'fileHandle' must be a pointer";
+        return nullptr;
+    }
+    FileHandle *handle = (FileHandle *)fileHandle.get_pointer()->value;
+    if (!handle)
+    {
+        error = "File is closed";
+    }
+    return handle;
+}
+
+static MappedFile *get_mapping(Value &mapping, std::string &error)
+{
+    if (!mapping.is_pointer())
+    {
+        error = "Parameter 'mapping' must be a pointer";
+        return nullptr;
+    }
+    MappedFile *file = (MappedFile *)mapping.get_pointer()->value;
+    if (!file)
+    {
+        error = "Mapping is closed";
+    }
+    return file;
+}
+
 extern "C" Value open(std::vector<Value> &args)
 {
-    int num_required_args = 2;
+    int num_required_args = 3;
 
     if (args.size() != num_required_args)
     {
@@ -15,6 +73,7 @@ extern "C" Value open(std::vector<Value> &args)
 
     Value filePath = args[0];
     Value openMode = args[1];
+    Value bufferSize = args[2];
 
     if (!filePath.is_string())
     {
@@ -26,15 +85,31 @@ extern "C" Value open(std::vector<Value> &args)
         return error_object("Parameter 'openMode' must be a number");
     }
 
-    std::fstream *handle = new std::fstream(filePath.get_string(), (std::ios_base::openmode)(unsigned int)openMode.get_number());
+    if (!bufferSize.is_number() || bufferSize.get_number() < 0)
+    {
+        return error_object("Parameter 'bufferSize' must be a positive number");
+    }
+
+    FileHandle *handle = new FileHandle();
+    handle->buffer.resize((size_t)bufferSize.get_number());
+    // A size of 0 leaves the stream unbuffered
+    handle->stream.rdbuf()->pubsetbuf(handle->buffer.empty() ? nullptr : handle->buffer.data(), handle->buffer.size());
+    handle->stream.open(filePath.get_string(), (std::ios_base::openmode)(unsigned int)openMode.get_number());
+
+    if (!handle->stream.is_open())
+    {
+        delete handle;
+        return error_object("Could not open '" + filePath.get_string() + "'");
+    }
+
     Value handlePtr = pointer_val();
-    handlePtr.get_pointer()->value = std::move(handle);
+    handlePtr.get_pointer()->value = handle;
     return handlePtr;
 }
 
 extern "C" Value read(std::vector<Value> &args)
 {
-    int num_required_args = 1;
+    int num_required_args = 2;
 
     if (args.size() != num_required_args)
     {
@@ -42,19 +117,87 @@ extern "C" Value read(std::vector<Value> &args)
     }
 
     Value fileHandle = args[0];
+    Value size = args[1];
 
-    if (!fileHandle.is_pointer())
+    std::string error;
+    FileHandle *handle = get_handle(fileHandle, error);
+    if (!handle)
+    {
+        return error_object(error);
+    }
+
+    if (!size.is_number())
     {
-        return error_object("Parameter 'fileHandle' must be a pointer");
+        return error_object("Parameter 'size' must be a number");
     }
 
-    std::fstream *handle = (std::fstream *)fileHandle.get_pointer()->value;
+    std::fstream &stream = handle->stream;
+
+    // Up to 'size' bytes from the current position
+    if (size.get_number() >= 0)
+    {
+        std::string buffer((size_t)size.get_number(), '\0');
+        stream.read(buffer.data(), buffer.size());
+        buffer.resize(stream.gcount());
+        if (stream.eof())
+        {
+            stream.clear();
+        }
+        return string_val(std::move(buffer));
+    }
 
-    std::stringstream buffer;
-    buffer << handle->rdbuf();
-    handle->seekp(0);
+    // The rest of the file, read straight into the result when its size is
+    // known. The handle is rewound afterwards
+    std::string buffer;
+    std::streampos start = stream.tellg();
+    stream.seekg(0, std::ios::end);
+    std::streampos end = stream.tellg();
+    if (start != std::streampos(-1) && end != std::streampos(-1) && end >= start)
+    {
+        stream.seekg(start);
+        buffer.resize((size_t)(end - start));
+        stream.read(buffer.data(), buffer.size());
+        buffer.resize(stream.gcount());
+    }
+    else
+    {
+        stream.clear();
+        std::stringstream contents;
+        contents << stream.rdbuf();
+        buffer = contents.str();
+    }
+    stream.clear();
+    stream.seekp(0);
 
-    return string_val(buffer.str());
+    return string_val(std::move(buffer));
+}
+
+extern "C" Value readline(std::vector<Value> &args)
+{
+    int num_required_args = 1;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'readline' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    Value fileHandle = args[0];
+
+    std::string error;
+    FileHandle *handle = get_handle(fileHandle, error);
+    if (!handle)
+    {
+        return error_object(error);
+    }
+
+    std::string line;
+    if (!std::getline(handle->stream, line))
+    {
+        handle->stream.clear();
+        return none_val();
+    }
+
+    return string_val(std::move(line));
 }
 
 extern "C" Value write(std::vector<Value> &args)
@@ -69,9 +212,11 @@ extern "C" Value write(std::vector<Value> &args)
     Value fileHandle = args[0];
     Value text = args[1];
 
-    if (!fileHandle.is_pointer())
+    std::string error;
+    FileHandle *handle = get_handle(fileHandle, error);
+    if (!handle)
     {
-        return error_object("Parameter 'fileHandle' must be a pointer");
+        return error_object(error);
     }
 
     if (!text.is_string())
@@ -79,10 +224,31 @@ extern "C" Value write(std::vector<Value> &args)
         return error_object("Parameter 'text' must be a string");
     }
 
-    std::fstream *handle = (std::fstream *)fileHandle.get_pointer()->value;
+    const std::string &content = text.get_string();
+    handle->stream.write(content.data(), content.size());
+
+    return none_val();
+}
+
+extern "C" Value flush(std::vector<Value> &args)
+{
+    int num_required_args = 1;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'flush' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    Value fileHandle = args[0];
 
-    (*handle) << text.get_string();
-    handle->flush();
+    std::string error;
+    FileHandle *handle = get_handle(fileHandle, error);
+    if (!handle)
+    {
+        return error_object(error);
+    }
+
+    handle->stream.flush();
 
     return none_val();
 }
@@ -98,16 +264,17 @@ extern "C" Value close(std::vector<Value> &args)
 
     Value fileHandle = args[0];
 
-    if (!fileHandle.is_pointer())
+    std::string error;
+    FileHandle *handle = get_handle(fileHandle, error);
+    if (!handle)
     {
-        return error_object("Parameter 'fileHandle' must be a pointer");
+        return error_object(error);
     }
 
-    std::fstream *handle = (std::fstream *)fileHandle.get_pointer()->value;
-
-    handle->flush();
-    handle->close();
+    handle->stream.flush();
+    handle->stream.close();
     delete handle;
+    fileHandle.get_pointer()->value = nullptr;
 
     return none_val();
 }
@@ -125,4 +292,246 @@ extern "C" Value input(std::vector<Value> &args)
     std::getline(std::cin, line);
 
     return string_val(line);
-}
\ No newline at end of file
+}
+
+// Maps a whole file read-only. Only the slices and lines asked for are
+// copied into strings
+
+extern "C" Value map_open(std::vector<Value> &args)
+{
+    int num_required_args = 1;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'map_open' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    Value filePath = args[0];
+
+    if (!filePath.is_string())
+    {
+        return error_object("Parameter 'filePath' must be a string");
+    }
+
+    const std::string &path = filePath.get_string();
+    MappedFile *file = new MappedFile();
+
+#ifdef _WIN32
+    file->file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    LARGE_INTEGER size;
+    if (file->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file->file, &size))
+    {
+        if (file->file != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(file->file);
+        }
+        delete file;
+        return error_object("Could not open '" + path + "'");
+    }
+    file->size = (size_t)size.QuadPart;
+    if (file->size > 0)
+    {
+        file->mapping = CreateFileMappingA(file->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        file->data = file->mapping ? (const char *)MapViewOfFile(file->mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        if (!file->data)
+        {
+            if (file->mapping)
+            {
+                CloseHandle(file->mapping);
+            }
+            CloseHandle(file->file);
+            delete file;
+            return error_object("Could not map '" + path + "'");
+        }
+    }
+#else
+    FILE *fp = fopen(path.c_str(), "rb");
+    struct stat info;
+    if (!fp || fstat(fileno(fp), &info) != 0)
+    {
+        if (fp)
+        {
+            fclose(fp);
+        }
+        delete file;
+        return error_object("Could not open '" + path + "'");
+    }
+    file->size = (size_t)info.st_size;
+    if (file->size > 0)
+    {
+        void *data = mmap(nullptr, file->size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+        if (data == MAP_FAILED)
+        {
+            fclose(fp);
+            delete file;
+            return error_object("Could not map '" + path + "'");
+        }
+        file->data = (const char *)data;
+    }
+    fclose(fp);
+#endif
+
+    Value mapping = pointer_val();
+    mapping.get_pointer()->value = file;
+    return mapping;
+}
+
+extern "C" Value map_size(std::vector<Value> &args)
+{
+    int num_required_args = 1;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'map_size' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    MappedFile *file = get_mapping(args[0], error);
+    if (!file)
+    {
+        return error_object(error);
+    }
+
+    return number_val((double)file->size);
+}
+
+extern "C" Value map_read(std::vector<Value> &args)
+{
+    int num_required_args = 3;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'map_read' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    MappedFile *file = get_mapping(args[0], error);
+    if (!file)
+    {
+        return error_object(error);
+    }
+
+    Value start = args[1];
+    Value length = args[2];
+
+    if (!start.is_number() || start.get_number() < 0)
+    {
+        return error_object("Parameter 'start' must be a positive number");
+    }
+
+    if (!length.is_number())
+    {
+        return error_object("Parameter 'length' must be a number");
+    }
+
+    size_t from = std::min((size_t)start.get_number(), file->size);
+    size_t count = file->size - from;
+    if (length.get_number() >= 0)
+    {
+        count = std::min(count, (size_t)length.get_number());
+    }
+
+    return string_val(std::string(file->data + from, count));
+}
+
+extern "C" Value map_readline(std::vector<Value> &args)
+{
+    int num_required_args = 1;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'map_readline' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    MappedFile *file = get_mapping(args[0], error);
+    if (!file)
+    {
+        return error_object(error);
+    }
+
+    if (file->pos >= file->size)
+    {
+        return none_val();
+    }
+
+    const char *line = file->data + file->pos;
+    size_t remaining = file->size - file->pos;
+    const char *newline = (const char *)memchr(line, '\n', remaining);
+    size_t length = newline ? newline - line : remaining;
+    file->pos += newline ? length + 1 : length;
+
+    return string_val(std::string(line, length));
+}
+
+extern "C" Value map_find(std::vector<Value> &args)
+{
+    int num_required_args = 3;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'map_find' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    MappedFile *file = get_mapping(args[0], error);
+    if (!file)
+    {
+        return error_object(error);
+    }
+
+    Value needle = args[1];
+    Value start = args[2];
+
+    if (!needle.is_string())
+    {
+        return error_object("Parameter 'needle' must be a string");
+    }
+
+    if (!start.is_number() || start.get_number() < 0)
+    {
+        return error_object("Parameter 'start' must be a positive number");
+    }
+
+    std::string_view contents(file->data ? file->data : "", file->size);
+    size_t index = contents.find(needle.get_string(), (size_t)start.get_number());
+
+    return number_val(index == std::string_view::npos ? -1 : (double)index);
+}
+
+extern "C" Value map_close(std::vector<Value> &args)
+{
+    int num_required_args = 1;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'map_close' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    Value mapping = args[0];
+
+    std::string error;
+    MappedFile *file = get_mapping(mapping, error);
+    if (!file)
+    {
+        return error_object(error);
+    }
+
+#ifdef _WIN32
+    if (file->data)
+    {
+        UnmapViewOfFile(file->data);
+        CloseHandle(file->mapping);
+    }
+    CloseHandle(file->file);
+#else
+    if (file->data)
+    {
+        munmap((void *)file->data, file->size);
+    }
+#endif
+    delete file;
+    mapping.get_pointer()->value = nullptr;
+
+    return none_val();
+}
@@ -1,202 +1,951 @@
-#include "include/json.hpp"
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include "include/Vortex.hpp"
 
-int indent_level = 0;
-std::string indent = "    ";
+#define JSON_MAX_DEPTH 512
+#define JSON_READ_SIZE (1 << 16)
 
-std::string toString(Value value, bool quote_strings = false)
+// Values are built straight from the text in one pass, without an
+// intermediate document. Errors record the offset into the text
+
+struct JsonParser
 {
-    switch (value.type)
+    const char *start;
+    const char *p;
+    const char *end;
+    int depth = 0;
+    std::string error;
+    const char *error_at = nullptr;
+
+    JsonParser(const char *text, size_t size) : start(text), p(text), end(text + size)
+    {
+    }
+
+    bool fail(std::string message)
     {
-    case ValueType::Number:
+        if (error.empty())
+        {
+            error = message;
+            error_at = p;
+        }
+        return false;
+    }
+
+    void skip_whitespace()
     {
-        double number = value.get_number();
-        if (std::floor(number) == number)
+        while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t'))
         {
-            return std::to_string((long long)number);
+            p++;
         }
-        char buff[100];
-        snprintf(buff, sizeof(buff), "%.8g", number);
-        std::string buffAsStdStr = buff;
-        return buffAsStdStr;
     }
-    case ValueType::String:
+
+    bool literal(const char *word, size_t size)
     {
-        if (quote_strings)
+        if ((size_t)(end - p) < size || memcmp(p, word, size) != 0)
         {
-            return "\"" + value.get_string() + "\"";
+            return fail("invalid literal");
         }
-        return (value.get_string());
+        p += size;
+        return true;
     }
-    case ValueType::Boolean:
+
+    bool parse_document(Value &out)
     {
-        return (value.get_boolean() ? "true" : "false");
+        skip_whitespace();
+        if (!parse_value(out))
+        {
+            return false;
+        }
+        skip_whitespace();
+        if (p != end)
+        {
+            return fail("unexpected character after the value");
+        }
+        return true;
     }
-    case ValueType::List:
+
+    bool parse_value(Value &out)
     {
-        std::string repr = "[";
-        for (int i = 0; i < value.get_list()->size(); i++)
+        if (p == end)
+        {
+            return fail("unexpected end of input");
+        }
+        switch (*p)
         {
-            Value &v = value.get_list()->at(i);
-            repr += toString(v, quote_strings);
-            if (i < value.get_list()->size() - 1)
+        case '{':
+            return parse_object(out);
+        case '[':
+            return parse_list(out);
+        case '"':
+        {
+            out = string_val("");
+            return parse_string(out.get_mutable_string());
+        }
+        case 't':
+            out = boolean_val(true);
+            return literal("true", 4);
+        case 'f':
+            out = boolean_val(false);
+            return literal("false", 5);
+        case 'n':
+            out = none_val();
+            return literal("null", 4);
+        default:
+            return parse_number(out);
+        }
+    }
+
+    bool parse_object(Value &out)
+    {
+        if (++depth > JSON_MAX_DEPTH)
+        {
+            return fail("nesting is too deep");
+        }
+        p++;
+        out = object_val();
+        ObjectObj &object = *out.get_object();
+        skip_whitespace();
+        if (p < end && *p == '}')
+        {
+            p++;
+            depth--;
+            return true;
+        }
+        std::string key;
+        while (true)
+        {
+            if (p == end || *p != '"')
+            {
+                return fail("expected a string key");
+            }
+            key.clear();
+            if (!parse_string(key))
+            {
+                return false;
+            }
+            skip_whitespace();
+            if (p == end || *p != ':')
+            {
+                return fail("expected ':'");
+            }
+            p++;
+            skip_whitespace();
+            auto [slot, inserted] = object.values.try_emplace(key);
+            if (inserted)
             {
-                repr += ", ";
+                object.keys.push_back(key);
             }
+            if (!parse_value(slot->second))
+            {
+                return false;
+            }
+            skip_whitespace();
+            if (p < end && *p == ',')
+            {
+                p++;
+                skip_whitespace();
+                continue;
+            }
+            if (p < end && *p == '}')
+            {
+                p++;
+                depth--;
+                return true;
+            }
+            return fail("expected ',' or '}'");
         }
-        repr += "]";
-        return repr;
     }
-    case ValueType::Object:
+
+    bool parse_list(Value &out)
     {
-        auto &obj = value.get_object();
-        std::string repr;
-        if (obj->type)
+        if (++depth > JSON_MAX_DEPTH)
+        {
+            return fail("nesting is too deep");
+        }
+        p++;
+        out = list_val();
+        std::vector<Value> &items = *out.get_list();
+        skip_whitespace();
+        if (p < end && *p == ']')
         {
-            repr += value.get_object()->type->name + " ";
+            p++;
+            depth--;
+            return true;
         }
-        repr += "{ ";
-        int i = 0;
-        int size = obj->keys.size();
-        for (std::string key : obj->keys)
+        while (true)
         {
-            auto k = key;
+            items.emplace_back();
+            if (!parse_value(items.back()))
+            {
+                return false;
+            }
+            skip_whitespace();
+            if (p < end && *p == ',')
+            {
+                p++;
+                skip_whitespace();
+                continue;
+            }
+            if (p < end && *p == ']')
+            {
+                p++;
+                depth--;
+                return true;
+            }
+            return fail("expected ',' or ']'");
+        }
+    }
 
-            if (quote_strings)
+    bool parse_hex(unsigned &code)
+    {
+        if (end - p < 4)
+        {
+            return fail("invalid \\u escape");
+        }
+        code = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            char c = *p++;
+            code <<= 4;
+            if (c >= '0' && c <= '9')
+            {
+                code |= c - '0';
+            }
+            else if (c >= 'a' && c <= 'f')
+            {
+                code |= c - 'a' + 10;
+            }
+            else if (c >= 'A' && c <= 'F')
+            {
+                code |= c - 'A' + 10;
+            }
+            else
             {
-                key = "\"" + key + "\"";
+                p--;
+                return fail("invalid \\u escape");
             }
-            repr += key + ": " + toString(obj->values[k], quote_strings);
+        }
+        return true;
+    }
+
+    static void append_utf8(std::string &out, unsigned code)
+    {
+        if (code < 0x80)
+        {
+            out += (char)code;
+        }
+        else if (code < 0x800)
+        {
+            out += (char)(0xC0 | (code >> 6));
+            out += (char)(0x80 | (code & 0x3F));
+        }
+        else if (code < 0x10000)
+        {
+            out += (char)(0xE0 | (code >> 12));
+            out += (char)(0x80 | ((code >> 6) & 0x3F));
+            out += (char)(0x80 | (code & 0x3F));
+        }
+        else
+        {
+            out += (char)(0xF0 | (code >> 18));
+            out += (char)(0x80 | ((code >> 12) & 0x3F));
+            out += (char)(0x80 | ((code >> 6) & 0x3F));
+            out += (char)(0x80 | (code & 0x3F));
+        }
+    }
 
-            if (i < size - 1)
+    bool parse_string(std::string &out)
+    {
+        p++;
+        while (true)
+        {
+            const char *run = p;
+            while (p < end && *p != '"' && *p != '\\' && (unsigned char)*p >= 0x20)
+            {
+                p++;
+            }
+            out.append(run, p - run);
+            if (p == end)
+            {
+                return fail("unterminated string");
+            }
+            if (*p == '"')
+            {
+                p++;
+                return true;
+            }
+            if (*p != '\\')
+            {
+                return fail("control character in string");
+            }
+            p++;
+            if (p == end)
+            {
+                return fail("unterminated string");
+            }
+            switch (*p++)
+            {
+            case '"':
+                out += '"';
+                break;
+            case '\\':
+                out += '\\';
+                break;
+            case '/':
+                out += '/';
+                break;
+            case 'b':
+                out += '\b';
+                break;
+            case 'f':
+                out += '\f';
+                break;
+            case 'n':
+                out += '\n';
+                break;
+            case 'r':
+                out += '\r';
+                break;
+            case 't':
+                out += '\t';
+                break;
+            case 'u':
             {
-                repr += ", ";
+                unsigned code;
+                if (!parse_hex(code))
+                {
+                    return false;
+                }
+                if (code >= 0xDC00 && code <= 0xDFFF)
+                {
+                    return fail("unpaired surrogate in \\u escape");
+                }
+                if (code >= 0xD800 && code <= 0xDBFF)
+                {
+                    unsigned low;
+                    if (end - p < 2 || p[0] != '\\' || p[1] != 'u')
+                    {
+                        return fail("unpaired surrogate in \\u escape");
+                    }
+                    p += 2;
+                    if (!parse_hex(low))
+                    {
+                        return false;
+                    }
+                    if (low < 0xDC00 || low > 0xDFFF)
+                    {
+                        return fail("unpaired surrogate in \\u escape");
+                    }
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                }
+                append_utf8(out, code);
+                break;
+            }
+            default:
+                p--;
+                return fail("invalid escape in string");
             }
-            i++;
         }
-        repr += " }";
-        return repr;
     }
-    case ValueType::None:
+
+    bool parse_number(Value &out)
     {
-        return "null";
+        const char *number_start = p;
+        bool negative = false;
+        if (p < end && *p == '-')
+        {
+            negative = true;
+            p++;
+        }
+        if (p == end || *p < '0' || *p > '9')
+        {
+            return fail("unexpected character");
+        }
+
+        uint64_t mantissa = 0;
+        int digits = 0;
+        if (*p == '0')
+        {
+            p++;
+        }
+        else
+        {
+            while (p < end && *p >= '0' && *p <= '9')
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits++;
+                p++;
+            }
+        }
+
+        bool integer = true;
+        if (p < end && *p == '.')
+        {
+            integer = false;
+            p++;
+            if (p == end || *p < '0' || *p > '9')
+            {
+                return fail("expected a digit after '.'");
+            }
+            while (p < end && *p >= '0' && *p <= '9')
+            {
+                p++;
+            }
+        }
+        if (p < end && (*p == 'e' || *p == 'E'))
+        {
+            integer = false;
+            p++;
+            if (p < end && (*p == '+' || *p == '-'))
+            {
+                p++;
+            }
+            if (p == end || *p < '0' || *p > '9')
+            {
+                return fail("expected a digit in the exponent");
+            }
+            while (p < end && *p >= '0' && *p <= '9')
+            {
+                p++;
+            }
+        }
+
+        // Integers of up to 15 digits are exact as doubles
+        if (integer && digits <= 15)
+        {
+            double number = (double)mantissa;
+            out = number_val(negative ? -number : number);
+            return true;
+        }
+
+        std::string text(number_start, p - number_start);
+        out = number_val(strtod(text.c_str(), nullptr));
+        return true;
     }
-    default:
+};
+
+struct JsonWriter
+{
+    std::string out;
+    int depth = 0;
+    std::string error;
+
+    void write_number(double number)
     {
-        return "null";
+        // Checked on the bits, modules are built with -Ofast where
+        // std::isfinite may be assumed true
+        uint64_t bits;
+        memcpy(&bits, &number, sizeof(bits));
+        if ((bits & 0x7FF0000000000000ull) == 0x7FF0000000000000ull)
+        {
+            out += "null";
+            return;
+        }
+        if (std::floor(number) == number && std::fabs(number) < 1e15)
+        {
+            char buffer[24];
+            auto result = std::to_chars(buffer, buffer + sizeof(buffer), (long long)number);
+            out.append(buffer, result.ptr - buffer);
+            return;
+        }
+        // Shortest text that reads back as the same number
+        char buffer[32];
+        auto result = std::to_chars(buffer, buffer + sizeof(buffer), number);
+        out.append(buffer, result.ptr - buffer);
     }
+
+    void write_string(const std::string &string)
+    {
+        static const char hex[] = "0123456789abcdef";
+        out += '"';
+        const char *p = string.data();
+        const char *end = p + string.size();
+        while (p < end)
+        {
+            const char *run = p;
+            while (p < end && *p != '"' && *p != '\\' && (unsigned char)*p >= 0x20)
+            {
+                p++;
+            }
+            out.append(run, p - run);
+            if (p == end)
+            {
+                break;
+            }
+            unsigned char c = *p++;
+            switch (c)
+            {
+            case '"':
+                out += "\\\"";
+                break;
+            case '\\':
+                out += "\\\\";
+                break;
+            case '\b':
+                out += "\\b";
+                break;
+            case '\f':
+                out += "\\f";
+                break;
+            case '\n':
+                out += "\\n";
+                break;
+            case '\r':
+                out += "\\r";
+                break;
+            case '\t':
+                out += "\\t";
+                break;
+            default:
+                out += "\\u00";
+                out += hex[c >> 4];
+                out += hex[c & 0xF];
+            }
+        }
+        out += '"';
     }
+
+    bool write(Value &value)
+    {
+        switch (value.type)
+        {
+        case ValueType::Number:
+            write_number(value.get_number());
+            return true;
+        case ValueType::String:
+            write_string(value.get_string());
+            return true;
+        case ValueType::Boolean:
+            out += value.get_boolean() ? "true" : "false";
+            return true;
+        case ValueType::List:
+        {
+            if (++depth > JSON_MAX_DEPTH)
+            {
+                error = "Value is nested too deeply or contains itself";
+                return false;
+            }
+            std::vector<Value> &items = *value.get_list();
+            out += '[';
+            for (size_t i = 0; i < items.size(); i++)
+            {
+                if (i > 0)
+                {
+                    out += ',';
+                }
+                if (!write(items[i]))
+                {
+                    return false;
+                }
+            }
+            out += ']';
+            depth--;
+            return true;
+        }
+        case ValueType::Object:
+        {
+            if (++depth > JSON_MAX_DEPTH)
+            {
+                error = "Value is nested too deeply or contains itself";
+                return false;
+            }
+            ObjectObj &object = *value.get_object();
+            out += '{';
+            bool first = true;
+            for (std::string &key : object.keys)
+            {
+                auto entry = object.values.find(key);
+                if (entry == object.values.end())
+                {
+                    continue;
+                }
+                if (!first)
+                {
+                    out += ',';
+                }
+                first = false;
+                write_string(key);
+                out += ':';
+                if (!write(entry->second))
+                {
+                    return false;
+                }
+            }
+            out += '}';
+            depth--;
+            return true;
+        }
+        default:
+            out += "null";
+            return true;
+        }
+    }
+};
+
+static std::string position_message(const char *start, const char *at)
+{
+    int line = 1;
+    const char *line_start = start;
+    for (const char *c = start; c < at; c++)
+    {
+        if (*c == '\n')
+        {
+            line++;
+            line_start = c + 1;
+        }
+    }
+    return "line " + std::to_string(line) + ", column " + std::to_string(at - line_start + 1);
 }
 
-Value json_type_to_vtx_type(nlohmann::json_abi_v3_11_2::ordered_json json_obj)
+extern "C" Value parse(std::vector<Value> &args)
 {
+    int num_required_args = 1;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'parse' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    Value jsonStr = args[0];
+
+    if (!jsonStr.is_string())
+    {
+        return error_object("Parameter 'jsonStr' must be a string");
+    }
+
+    const std::string &json_body = jsonStr.get_string();
+    JsonParser parser(json_body.data(), json_body.size());
+    Value result;
+    if (!parser.parse_document(result))
+    {
+        return error_object("Invalid JSON: " + parser.error + " at " + position_message(parser.start, parser.error_at));
+    }
+    return result;
+}
 
-    auto type = json_obj.type();
+extern "C" Value serialize(std::vector<Value> &args)
+{
+    int num_required_args = 1;
 
-    if (type == nlohmann::ordered_json::value_t::string)
+    if (args.size() != num_required_args)
     {
-        return string_val(json_obj);
+        return error_object("Function 'serialize' expects " + std::to_string(num_required_args) + " argument(s)");
     }
-    if (type == nlohmann::ordered_json::value_t::boolean)
+
+    static thread_local size_t last_size = 256;
+
+    JsonWriter writer;
+    writer.out.reserve(last_size + last_size / 4);
+    if (!writer.write(args[0]))
     {
-        return boolean_val(json_obj);
+        return error_object(writer.error);
     }
-    if (type == nlohmann::ordered_json::value_t::number_integer || type == nlohmann::ordered_json::value_t::number_unsigned || type == nlohmann::ordered_json::value_t::number_float)
+    last_size = writer.out.size();
+    return string_val(std::move(writer.out));
+}
+
+// Reads one value at a time from a file, so files larger than memory can be
+// processed. Values may be separated by whitespace or newlines (NDJSON), or,
+// with 'elements' set, be the elements of one top-level list. Only the text
+// of the current value is held in memory
+
+struct JsonReader
+{
+    FILE *file;
+    std::vector<char> buffer;
+    size_t pos = 0;
+    size_t len = 0;
+    bool elements;
+    bool in_list = false;
+    bool finished = false;
+    bool done = false;
+    long long record = 0;
+    std::string text;
+
+    int peek()
     {
-        return number_val(json_obj);
+        if (pos == len)
+        {
+            len = fread(buffer.data(), 1, buffer.size(), file);
+            pos = 0;
+            if (len == 0)
+            {
+                return EOF;
+            }
+        }
+        return (unsigned char)buffer[pos];
     }
-    if (type == nlohmann::ordered_json::value_t::null)
+
+    int get()
     {
-        return none_val();
+        int c = peek();
+        if (c != EOF)
+        {
+            pos++;
+        }
+        return c;
     }
-    if (type == nlohmann::ordered_json::value_t::array)
+
+    int skip_whitespace()
     {
-        Value list = list_val();
-        for (auto val : json_obj)
+        int c = peek();
+        while (c == ' ' || c == '\n' || c == '\r' || c == '\t')
         {
-            list.get_list()->push_back(json_type_to_vtx_type(val));
+            pos++;
+            c = peek();
         }
-        return list;
+        return c;
     }
-    if (type == nlohmann::ordered_json::value_t::object)
+
+    // Copies the text of the next value into 'text' by matching brackets and
+    // strings. The parser checks the text afterwards
+    void read_value()
     {
-        Value object = object_val();
-        for (auto val : json_obj.items())
+        text.clear();
+        int c = peek();
+        if (c != '{' && c != '[' && c != '"')
         {
-            object.get_object()->values[val.key()] = json_type_to_vtx_type(val.value());
-            object.get_object()->keys.push_back(val.key());
+            while ((c = peek()) != EOF && c != ' ' && c != '\n' && c != '\r' && c != '\t' && c != ',' && c != ']' && c != '}')
+            {
+                text += (char)get();
+            }
+            return;
+        }
+
+        int nesting = 0;
+        bool in_string = false;
+        bool escaped = false;
+        while (peek() != EOF)
+        {
+            const char *run = buffer.data() + pos;
+            const char *run_end = buffer.data() + len;
+            const char *p = run;
+            bool complete = false;
+            for (; p < run_end; p++)
+            {
+                char c = *p;
+                if (escaped)
+                {
+                    escaped = false;
+                }
+                else if (in_string)
+                {
+                    if (c == '\\')
+                    {
+                        escaped = true;
+                    }
+                    else if (c == '"')
+                    {
+                        in_string = false;
+                        if (nesting == 0)
+                        {
+                            complete = true;
+                            p++;
+                            break;
+                        }
+                    }
+                }
+                else if (c == '"')
+                {
+                    in_string = true;
+                }
+                else if (c == '{' || c == '[')
+                {
+                    nesting++;
+                }
+                else if ((c == '}' || c == ']') && --nesting == 0)
+                {
+                    complete = true;
+                    p++;
+                    break;
+                }
+            }
+            text.append(run, p - run);
+            pos = p - buffer.data();
+            if (complete)
+            {
+                return;
+            }
         }
-        return object;
     }
+};
 
-    return none_val();
+extern "C" Value stream_open(std::vector<Value> &args)
+{
+    int num_required_args = 2;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'stream_open' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    Value filePath = args[0];
+    Value elements = args[1];
+
+    if (!filePath.is_string())
+    {
+        return error_object("Parameter 'filePath' must be a string");
+    }
+
+    if (!elements.is_boolean())
+    {
+        return error_object("Parameter 'elements' must be a boolean");
+    }
+
+    FILE *file = fopen(filePath.get_string().c_str(), "rb");
+    if (!file)
+    {
+        return error_object("Could not open '" + filePath.get_string() + "'");
+    }
+
+    JsonReader *reader = new JsonReader();
+    reader->file = file;
+    reader->buffer.resize(JSON_READ_SIZE);
+    reader->elements = elements.get_boolean();
+
+    Value readerPtr = pointer_val();
+    readerPtr.get_pointer()->value = reader;
+    return readerPtr;
 }
 
-extern "C" Value parse(std::vector<Value> &args)
+extern "C" Value stream_next(std::vector<Value> &args)
 {
     int num_required_args = 1;
 
     if (args.size() != num_required_args)
     {
-        return error_object("Function 'parse' expects " + std::to_string(num_required_args) + " argument(s)");
+        return error_object("Function 'stream_next' expects " + std::to_string(num_required_args) + " argument(s)");
     }
 
-    Value jsonStr = args[0];
+    Value readerPtr = args[0];
 
-    if (!jsonStr.is_string())
+    if (!readerPtr.is_pointer())
     {
-        return error_object("Parameter 'jsonStr' must be a string");
+        return error_object("Parameter 'reader' must be a pointer");
     }
 
-    std::string json_body = jsonStr.get_string();
+    JsonReader *reader = (JsonReader *)readerPtr.get_pointer()->value;
+    if (!reader)
+    {
+        return error_object("Reader is closed");
+    }
 
-    try
+    reader->done = false;
+    if (reader->finished)
     {
-        auto json = nlohmann::ordered_json::parse(json_body);
-        // If it's a list
-        if (json.type() == nlohmann::json::value_t::array)
+        reader->done = true;
+        return none_val();
+    }
+
+    int c = reader->skip_whitespace();
+
+    if (reader->elements && !reader->in_list)
+    {
+        if (c != '[')
         {
-            Value json_obj = list_val();
-            for (auto &prop : json.items())
-            {
-                auto value = prop.value();
-                json_obj.get_list()->push_back(json_type_to_vtx_type(value));
-            }
-            return json_obj;
+            reader->finished = true;
+            return error_object("Invalid JSON: expected a list at the start of the file");
         }
-        // Otherwise it's an object
-        Value json_obj = object_val();
-        for (auto &prop : json.items())
+        reader->get();
+        reader->in_list = true;
+        c = reader->skip_whitespace();
+        if (c == ']')
         {
-            auto value = prop.value();
-            auto key = prop.key();
-            json_obj.get_object()->values[key] = json_type_to_vtx_type(value);
-            json_obj.get_object()->keys.push_back(key);
+            reader->finished = true;
+            reader->done = true;
+            return none_val();
         }
-        return json_obj;
     }
-    catch (const std::exception &exc)
+
+    if (c == EOF)
     {
-        return object_val();
+        reader->finished = true;
+        if (reader->in_list)
+        {
+            return error_object("Invalid JSON: unexpected end of file inside the list");
+        }
+        reader->done = true;
+        return none_val();
     }
+
+    reader->record++;
+    reader->read_value();
+
+    JsonParser parser(reader->text.data(), reader->text.size());
+    Value result;
+    if (!parser.parse_document(result))
+    {
+        reader->finished = true;
+        return error_object("Invalid JSON in value " + std::to_string(reader->record) + ": " + parser.error + " at " + position_message(parser.start, parser.error_at));
+    }
+
+    if (reader->in_list)
+    {
+        c = reader->skip_whitespace();
+        if (c == ',')
+        {
+            reader->get();
+        }
+        else if (c == ']')
+        {
+            reader->get();
+            reader->finished = true;
+        }
+        else
+        {
+            reader->finished = true;
+            return error_object("Invalid JSON after value " + std::to_string(reader->record) + ": expected ',' or ']'");
+        }
+    }
+
+    return result;
 }
 
-extern "C" Value serialize(std::vector<Value> &args)
+extern "C" Value stream_done(std::vector<Value> &args)
 {
     int num_required_args = 1;
 
     if (args.size() != num_required_args)
     {
-        return error_object("Function 'serialize' expects " + std::to_string(num_required_args) + " argument(s)");
+        return error_object("Function 'stream_done' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    Value readerPtr = args[0];
+
+    if (!readerPtr.is_pointer() || !readerPtr.get_pointer()->value)
+    {
+        return boolean_val(true);
     }
 
-    Value jsonObj = args[0];
+    JsonReader *reader = (JsonReader *)readerPtr.get_pointer()->value;
+    return boolean_val(reader->done);
+}
 
-    if (!jsonObj.is_list() && !jsonObj.is_object())
+extern "C" Value stream_close(std::vector<Value> &args)
+{
+    int num_required_args = 1;
+
+    if (args.size() != num_required_args)
     {
-        return error_object("Parameter 'jsonObj' must be a list or object");
+        return error_object("Function 'stream_close' expects " + std::to_string(num_required_args) + " argument(s)");
     }
 
-    Value serialized_object = string_val(toString(jsonObj, true));
-    return serialized_object;
-}
\ No newline at end of file
+    Value readerPtr = args[0];
+
+    if (!readerPtr.is_pointer())
+    {
+        return error_object("Parameter 'reader' must be a pointer");
+    }
+
+    JsonReader *reader = (JsonReader *)readerPtr.get_pointer()->value;
+    if (reader)
+    {
+        fclose(reader->file);
+        delete reader;
+        readerPtr.get_pointer()->value = nullptr;
+    }
+
+    return none_val();
+}
@@ -1 +1,627 @@
-#include "include/Vortex.hpp"
\ No newline at end of file
+#include <atomic>
+#include <cmath>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include "include/Vortex.hpp"
+
+// Loggers only capture a record and push it onto a lock-free stack. One
+// background thread takes everything pending at once, formats it and writes
+// each sink's share of the batch with a single write and flush
+
+enum Field
+{
+    FIELD_LITERAL,
+    FIELD_NAME,
+    FIELD_MESSAGE,
+    FIELD_CLOCK,
+    FIELD_DATETIME,
+    FIELD_LEVEL,
+    FIELD_LEVELNUM,
+    FIELD_BASELEVEL,
+    FIELD_BASELEVELNUM,
+    FIELD_FORMAT,
+    FIELD_HOURS,
+    FIELD_MINUTES,
+    FIELD_SECONDS,
+    FIELD_DAY,
+    FIELD_MONTHNAME,
+    FIELD_MONTH,
+    FIELD_YEAR,
+    FIELD_DAYNAME
+};
+
+static const std::unordered_map<std::string, Field> fields = {
+    {"name", FIELD_NAME},
+    {"message", FIELD_MESSAGE},
+    {"time", FIELD_CLOCK},
+    {"datetime", FIELD_DATETIME},
+    {"level", FIELD_LEVEL},
+    {"levelnum", FIELD_LEVELNUM},
+    {"baselevel", FIELD_BASELEVEL},
+    {"baselevelnum", FIELD_BASELEVELNUM},
+    {"format", FIELD_FORMAT},
+    {"hh", FIELD_HOURS},
+    {"mm", FIELD_MINUTES},
+    {"ss", FIELD_SECONDS},
+    {"day", FIELD_DAY},
+    {"monthname", FIELD_MONTHNAME},
+    {"month", FIELD_MONTH},
+    {"year", FIELD_YEAR},
+    {"dayname", FIELD_DAYNAME}};
+
+struct Segment
+{
+    Field field;
+    std::string text;
+};
+
+// Loggers swap in a new config when a setting changes, so records queued
+// before the change are still written with the settings they were logged with
+struct LoggerConfig
+{
+    std::string name;
+    int base_level = 2;
+    std::string path;
+    std::string format;
+    std::unordered_map<std::string, std::string> store;
+    std::vector<Segment> segments;
+};
+
+struct Logger
+{
+    std::mutex lock;
+    std::shared_ptr<const LoggerConfig> config;
+    std::atomic<int> base_level{2};
+};
+
+struct Record
+{
+    Record *next;
+    std::shared_ptr<const LoggerConfig> config;
+    int level;
+    std::string message;
+    std::time_t time;
+    double cpu;
+};
+
+// %key% is a field, a key added with add_format, or kept as it is
+static void compile_format(LoggerConfig &config)
+{
+    config.segments.clear();
+    const std::string &format = config.format;
+    std::string literal;
+    size_t i = 0;
+
+    while (i < format.size())
+    {
+        size_t end = format[i] == '%' ? format.find('%', i + 1) : std::string::npos;
+        if (end == std::string::npos)
+        {
+            literal += format[i++];
+            continue;
+        }
+
+        std::string key = format.substr(i + 1, end - i - 1);
+        auto field = fields.find(key);
+        if (field != fields.end())
+        {
+            if (!literal.empty())
+            {
+                config.segments.push_back({FIELD_LITERAL, literal});
+                literal.clear();
+            }
+            config.segments.push_back({field->second, ""});
+            i = end + 1;
+        }
+        else if (config.store.count(key))
+        {
+            literal += config.store.at(key);
+            i = end + 1;
+        }
+        else
+        {
+            // The closing '%' may open the next key
+            literal += '%';
+            i++;
+        }
+    }
+
+    if (!literal.empty())
+    {
+        config.segments.push_back({FIELD_LITERAL, literal});
+    }
+}
+
+static const char *level_name(int level)
+{
+    static const char *names[] = {"DEBUG", "INFO", "WARNING", "ERROR", "CRITICAL"};
+    return level >= 0 && level < 5 ? names[level] : "";
+}
+
+// Formats numbers the way string() does
+static std::string number_string(double number)
+{
+    if (std::floor(number) == number)
+    {
+        return std::to_string((long long)number);
+    }
+    char buffer[100];
+    snprintf(buffer, sizeof(buffer), "%.8g", number);
+    return buffer;
+}
+
+// The date parts of a record, worked out once per second on the writer
+struct DateParts
+{
+    std::time_t time = -1;
+    std::string datetime, hours, minutes, seconds, day, monthname, month, year, dayname;
+
+    void update(std::time_t now)
+    {
+        if (now == time)
+        {
+            return;
+        }
+        time = now;
+
+        std::tm tm;
+#ifdef _WIN32
+        localtime_s(&tm, &now);
+#else
+        localtime_r(&now, &tm);
+#endif
+        static const char *days[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+        static const char *months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "%.3s %.3s%3d %.2d:%.2d:%.2d %d", days[tm.tm_wday], months[tm.tm_mon], tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, 1900 + tm.tm_year);
+        datetime = buffer;
+        snprintf(buffer, sizeof(buffer), "%.2d", tm.tm_hour);
+        hours = buffer;
+        snprintf(buffer, sizeof(buffer), "%.2d", tm.tm_min);
+        minutes = buffer;
+        snprintf(buffer, sizeof(buffer), "%.2d", tm.tm_sec);
+        seconds = buffer;
+        day = std::to_string(tm.tm_mday);
+        monthname = months[tm.tm_mon];
+        month = std::to_string(tm.tm_mon + 1);
+        year = std::to_string(1900 + tm.tm_year);
+        dayname = days[tm.tm_wday];
+    }
+};
+
+static void format_record(Record &record, DateParts &date, std::string &out)
+{
+    const LoggerConfig &config = *record.config;
+
+    if (config.format.empty())
+    {
+        out += record.message;
+        out += '\n';
+        return;
+    }
+
+    date.update(record.time);
+
+    for (const Segment &segment : config.segments)
+    {
+        switch (segment.field)
+        {
+        case FIELD_LITERAL:
+            out += segment.text;
+            break;
+        case FIELD_NAME:
+            out += config.name;
+            break;
+        case FIELD_MESSAGE:
+            out += record.message;
+            break;
+        case FIELD_CLOCK:
+            out += number_string(record.cpu);
+            break;
+        case FIELD_DATETIME:
+            out += date.datetime;
+            break;
+        case FIELD_LEVEL:
+            out += level_name(record.level);
+            break;
+        case FIELD_LEVELNUM:
+            out += std::to_string(record.level);
+            break;
+        case FIELD_BASELEVEL:
+            out += level_name(config.base_level);
+            break;
+        case FIELD_BASELEVELNUM:
+            out += std::to_string(config.base_level);
+            break;
+        case FIELD_FORMAT:
+            out += config.format;
+            break;
+        case FIELD_HOURS:
+            out += date.hours;
+            break;
+        case FIELD_MINUTES:
+            out += date.minutes;
+            break;
+        case FIELD_SECONDS:
+            out += date.seconds;
+            break;
+        case FIELD_DAY:
+            out += date.day;
+            break;
+        case FIELD_MONTHNAME:
+            out += date.monthname;
+            break;
+        case FIELD_MONTH:
+            out += date.month;
+            break;
+        case FIELD_YEAR:
+            out += date.year;
+            break;
+        case FIELD_DAYNAME:
+            out += date.dayname;
+            break;
+        }
+    }
+    out += '\n';
+}
+
+struct Writer
+{
+    std::atomic<Record *> pending{nullptr};
+    // Bumped after every push, the writer sleeps on it while idle
+    std::atomic<uint64_t> queued{0};
+    std::atomic<uint64_t> written{0};
+    std::atomic<bool> stopping{false};
+    std::once_flag started;
+    std::thread thread;
+
+    // Only touched by the writer thread
+    std::unordered_map<std::string, FILE *> files;
+    DateParts date;
+
+    void push(Record *record)
+    {
+        std::call_once(started, [this]()
+                       { thread = std::thread([this]()
+                                              { run(); }); });
+
+        Record *head = pending.load(std::memory_order_relaxed);
+        do
+        {
+            record->next = head;
+        } while (!pending.compare_exchange_weak(head, record, std::memory_order_release, std::memory_order_relaxed));
+
+        queued.fetch_add(1, std::memory_order_release);
+        queued.notify_one();
+    }
+
+    // Waits until everything pushed so far has been written
+    void wait()
+    {
+        uint64_t target = queued.load(std::memory_order_acquire);
+        uint64_t done = written.load(std::memory_order_acquire);
+        while (done < target)
+        {
+            written.wait(done);
+            done = written.load(std::memory_order_acquire);
+        }
+    }
+
+    void run()
+    {
+        std::string console;
+        std::unordered_map<std::string, std::string> buffers;
+
+        for (;;)
+        {
+            uint64_t seen = queued.load(std::memory_order_acquire);
+            Record *batch = pending.exchange(nullptr, std::memory_order_acquire);
+
+            if (!batch)
+            {
+                if (stopping.load())
+                {
+                    break;
+                }
+                queued.wait(seen);
+                continue;
+            }
+
+            // The stack hands records back newest first
+            Record *ordered = nullptr;
+            while (batch)
+            {
+                Record *next = batch->next;
+                batch->next = ordered;
+                ordered = batch;
+                batch = next;
+            }
+
+            uint64_t count = 0;
+            while (ordered)
+            {
+                Record *record = ordered;
+                ordered = record->next;
+                const std::string &path = record->config->path;
+                format_record(*record, date, path.empty() ? console : buffers[path]);
+                delete record;
+                count++;
+            }
+
+            if (!console.empty())
+            {
+                fwrite(console.data(), 1, console.size(), stdout);
+                fflush(stdout);
+                console.clear();
+            }
+
+            for (auto &buffer : buffers)
+            {
+                if (buffer.second.empty())
+                {
+                    continue;
+                }
+                FILE *&file = files[buffer.first];
+                if (!file)
+                {
+                    file = fopen(buffer.first.c_str(), "ab");
+                }
+                if (!file)
+                {
+                    fprintf(stderr, "logging: could not open '%s'\n", buffer.first.c_str());
+                }
+                else
+                {
+                    fwrite(buffer.second.data(), 1, buffer.second.size(), file);
+                    fflush(file);
+                }
+                buffer.second.clear();
+            }
+
+            written.fetch_add(count, std::memory_order_release);
+            written.notify_all();
+        }
+
+        for (auto &file : files)
+        {
+            if (file.second)
+            {
+                fclose(file.second);
+            }
+        }
+    }
+
+    // Writes out what is still queued when the program exits
+    ~Writer()
+    {
+        if (thread.joinable())
+        {
+            stopping = true;
+            queued.fetch_add(1);
+            queued.notify_one();
+            thread.join();
+        }
+    }
+};
+
+static Writer writer;
+
+static Logger *get_logger(Value &handle)
+{
+    if (!handle.is_pointer())
+    {
+        return nullptr;
+    }
+    return (Logger *)handle.get_pointer()->value;
+}
+
+// Copies the current config, applies the change and publishes the copy
+template <typename F>
+static void update_config(Logger *logger, F change)
+{
+    std::lock_guard<std::mutex> lock(logger->lock);
+    auto config = std::make_shared<LoggerConfig>(*logger->config);
+    change(*config);
+    compile_format(*config);
+    logger->base_level = config->base_level;
+    logger->config = config;
+}
+
+extern "C" Value logger(std::vector<Value> &args)
+{
+    int num_required_args = 1;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'logger' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    Value name = args[0];
+
+    if (!name.is_string())
+    {
+        return error_object("Function 'logger' expects argument 'name' to be a string");
+    }
+
+    auto config = std::make_shared<LoggerConfig>();
+    config->name = name.get_string();
+
+    Logger *logger = new Logger();
+    logger->config = config;
+
+    Value handle = pointer_val();
+    handle.get_pointer()->value = logger;
+    return handle;
+}
+
+static Value set_string(std::vector<Value> &args, const char *name, void (*apply)(LoggerConfig &, const std::string &))
+{
+    int num_required_args = 2;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function '" + std::string(name) + "' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    Logger *logger = get_logger(args[0]);
+    Value value = args[1];
+
+    if (!logger)
+    {
+        return error_object("Function '" + std::string(name) + "' expects argument 'logger' to be a logger");
+    }
+
+    if (!value.is_string())
+    {
+        return error_object("Function '" + std::string(name) + "' expects argument 'value' to be a string");
+    }
+
+    std::string text = value.get_string();
+    update_config(logger, [&](LoggerConfig &config)
+                  { apply(config, text); });
+    return none_val();
+}
+
+extern "C" Value set_name(std::vector<Value> &args)
+{
+    return set_string(args, "set_name", [](LoggerConfig &config, const std::string &value)
+                      { config.name = value; });
+}
+
+extern "C" Value set_file(std::vector<Value> &args)
+{
+    return set_string(args, "set_file", [](LoggerConfig &config, const std::string &value)
+                      { config.path = value; });
+}
+
+extern "C" Value set_format(std::vector<Value> &args)
+{
+    return set_string(args, "set_format", [](LoggerConfig &config, const std::string &value)
+                      { config.format = value; });
+}
+
+extern "C" Value set_level(std::vector<Value> &args)
+{
+    int num_required_args = 2;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'set_level' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    Logger *logger = get_logger(args[0]);
+    Value level = args[1];
+
+    if (!logger)
+    {
+        return error_object("Function 'set_level' expects argument 'logger' to be a logger");
+    }
+
+    if (!level.is_number())
+    {
+        return error_object("Function 'set_level' expects argument 'level' to be a number");
+    }
+
+    int value = (int)level.get_number();
+    update_config(logger, [&](LoggerConfig &config)
+                  { config.base_level = value; });
+    return none_val();
+}
+
+extern "C" Value add_format(std::vector<Value> &args)
+{
+    int num_required_args = 3;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'add_format' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    Logger *logger = get_logger(args[0]);
+    Value key = args[1];
+    Value value = args[2];
+
+    if (!logger)
+    {
+        return error_object("Function 'add_format' expects argument 'logger' to be a logger");
+    }
+
+    if (!key.is_string() || !value.is_string())
+    {
+        return error_object("Function 'add_format' expects arguments 'key' and 'value' to be strings");
+    }
+
+    std::string name = key.get_string();
+    std::string text = value.get_string();
+    update_config(logger, [&](LoggerConfig &config)
+                  { config.store[name] = text; });
+    return none_val();
+}
+
+extern "C" Value log_record(std::vector<Value> &args)
+{
+    int num_required_args = 3;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'log' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    Logger *logger = get_logger(args[0]);
+    Value level = args[1];
+    Value message = args[2];
+
+    if (!logger)
+    {
+        return error_object("Function 'log' expects argument 'logger' to be a logger");
+    }
+
+    if (!level.is_number())
+    {
+        return error_object("Function 'log' expects argument 'level' to be a number");
+    }
+
+    int value = (int)level.get_number();
+    if (value < logger->base_level.load(std::memory_order_relaxed))
+    {
+        return none_val();
+    }
+
+    if (!message.is_string())
+    {
+        return error_object("Function 'log' expects argument 'message' to be a string");
+    }
+
+    Record *record = new Record();
+    {
+        std::lock_guard<std::mutex> lock(logger->lock);
+        record->config = logger->config;
+    }
+    record->level = value;
+    record->message = message.get_string();
+    record->time = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    record->cpu = (double)std::clock() / CLOCKS_PER_SEC;
+
+    writer.push(record);
+    return none_val();
+}
+
+extern "C" Value flush_logs(std::vector<Value> &args)
+{
+    int num_required_args = 0;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'flush' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    writer.wait();
+    return none_val();
+}
@@ -1,6 +1,19 @@
 #include <cmath>
+#include <cstring>
+#include <algorithm>
 #include "include/Vortex.hpp"
 
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define MATH_SSE2
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(_WIN32)
+#define MATH_AVX2
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define MATH_NEON
+#endif
+
 extern "C" Value ceil_(std::vector<Value> &args)
 {
     int num_required_args = 1;
@@ -232,6 +245,1158 @@ extern "C" Value cos_(std::vector<Value> &args)
     return number_val(new_value);
 }
 
+/* Typed Arrays */
+
+// Float64Array and Int32Array keep their elements in one contiguous buffer
+// behind a pointer value, so the kernels below can run over them with SIMD
+// instead of unpacking a list of Values
+
+enum class ArrayKind
+{
+    Float64,
+    Int32
+};
+
+enum class ArrayOp
+{
+    Add,
+    Sub,
+    Mul,
+    Div
+};
+
+struct TypedArray
+{
+    ArrayKind kind;
+    std::vector<double> f64;
+    std::vector<int32_t> i32;
+
+    size_t size()
+    {
+        return kind == ArrayKind::Float64 ? f64.size() : i32.size();
+    }
+};
+
+#ifdef MATH_AVX2
+static const bool has_avx2 = __builtin_cpu_supports("avx2");
+
+template <ArrayOp OP>
+__attribute__((target("avx2"))) static size_t f64_binary_avx2(const double *a, const double *b, bool scalar, double *out, size_t n)
+{
+    size_t i = 0;
+    __m256d s = _mm256_set1_pd(*b);
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256d x = _mm256_loadu_pd(a + i);
+        __m256d y = scalar ? s : _mm256_loadu_pd(b + i);
+        __m256d r;
+        if constexpr (OP == ArrayOp::Add)
+            r = _mm256_add_pd(x, y);
+        else if constexpr (OP == ArrayOp::Sub)
+            r = _mm256_sub_pd(x, y);
+        else if constexpr (OP == ArrayOp::Mul)
+            r = _mm256_mul_pd(x, y);
+        else
+            r = _mm256_div_pd(x, y);
+        _mm256_storeu_pd(out + i, r);
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) static size_t f64_axpy_avx2(double k, const double *x, double *y, size_t n)
+{
+    size_t i = 0;
+    __m256d s = _mm256_set1_pd(k);
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256d r = _mm256_add_pd(_mm256_loadu_pd(y + i), _mm256_mul_pd(s, _mm256_loadu_pd(x + i)));
+        _mm256_storeu_pd(y + i, r);
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) static size_t f64_dot_avx2(const double *a, const double *b, size_t n, double &result)
+{
+    size_t i = 0;
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    for (; i + 8 <= n; i += 8)
+    {
+        acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(a + i), b ? _mm256_loadu_pd(b + i) : _mm256_set1_pd(1)));
+        acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), b ? _mm256_loadu_pd(b + i + 4) : _mm256_set1_pd(1)));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    result = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    return i;
+}
+
+__attribute__((target("avx2"))) static size_t f64_minmax_avx2(const double *a, size_t n, double &low, double &high)
+{
+    if (n < 4)
+    {
+        return 0;
+    }
+    size_t i = 4;
+    __m256d lo = _mm256_loadu_pd(a);
+    __m256d hi = lo;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m256d x = _mm256_loadu_pd(a + i);
+        lo = _mm256_min_pd(lo, x);
+        hi = _mm256_max_pd(hi, x);
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, lo);
+    low = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+    _mm256_storeu_pd(lanes, hi);
+    high = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+    return i;
+}
+
+__attribute__((target("avx2"))) static void transform_avx2(const double *points, const double *m, double *out, size_t count)
+{
+    __m256d r0 = _mm256_loadu_pd(m);
+    __m256d r1 = _mm256_loadu_pd(m + 4);
+    __m256d r2 = _mm256_loadu_pd(m + 8);
+    __m256d r3 = _mm256_loadu_pd(m + 12);
+    double lanes[4];
+    for (size_t p = 0; p < count; p++)
+    {
+        const double *v = points + p * 3;
+        __m256d r = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(v[0]), r0), _mm256_mul_pd(_mm256_set1_pd(v[1]), r1)),
+                                  _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(v[2]), r2), r3));
+        _mm256_storeu_pd(lanes, r);
+        double w = lanes[3] != 0 ? lanes[3] : 1;
+        out[p * 3] = lanes[0] / w;
+        out[p * 3 + 1] = lanes[1] / w;
+        out[p * 3 + 2] = lanes[2] / w;
+    }
+}
+#endif
+
+#ifdef MATH_SSE2
+template <ArrayOp OP>
+static size_t f64_binary_simd(const double *a, const double *b, bool scalar, double *out, size_t n)
+{
+    size_t i = 0;
+    __m128d s = _mm_set1_pd(*b);
+    for (; i + 2 <= n; i += 2)
+    {
+        __m128d x = _mm_loadu_pd(a + i);
+        __m128d y = scalar ? s : _mm_loadu_pd(b + i);
+        __m128d r;
+        if constexpr (OP == ArrayOp::Add)
+            r = _mm_add_pd(x, y);
+        else if constexpr (OP == ArrayOp::Sub)
+            r = _mm_sub_pd(x, y);
+        else if constexpr (OP == ArrayOp::Mul)
+            r = _mm_mul_pd(x, y);
+        else
+            r = _mm_div_pd(x, y);
+        _mm_storeu_pd(out + i, r);
+    }
+    return i;
+}
+
+static size_t f64_axpy_simd(double k, const double *x, double *y, size_t n)
+{
+    size_t i = 0;
+    __m128d s = _mm_set1_pd(k);
+    for (; i + 2 <= n; i += 2)
+    {
+        _mm_storeu_pd(y + i, _mm_add_pd(_mm_loadu_pd(y + i), _mm_mul_pd(s, _mm_loadu_pd(x + i))));
+    }
+    return i;
+}
+
+static size_t f64_dot_simd(const double *a, const double *b, size_t n, double &result)
+{
+    size_t i = 0;
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    for (; i + 4 <= n; i += 4)
+    {
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(a + i), b ? _mm_loadu_pd(b + i) : _mm_set1_pd(1)));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), b ? _mm_loadu_pd(b + i + 2) : _mm_set1_pd(1)));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    result = lanes[0] + lanes[1];
+    return i;
+}
+
+static size_t f64_minmax_simd(const double *a, size_t n, double &low, double &high)
+{
+    if (n < 2)
+    {
+        return 0;
+    }
+    size_t i = 2;
+    __m128d lo = _mm_loadu_pd(a);
+    __m128d hi = lo;
+    for (; i + 2 <= n; i += 2)
+    {
+        __m128d x = _mm_loadu_pd(a + i);
+        lo = _mm_min_pd(lo, x);
+        hi = _mm_max_pd(hi, x);
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, lo);
+    low = std::min(lanes[0], lanes[1]);
+    _mm_storeu_pd(lanes, hi);
+    high = std::max(lanes[0], lanes[1]);
+    return i;
+}
+
+static void transform_simd(const double *points, const double *m, double *out, size_t count)
+{
+    __m128d r0a = _mm_loadu_pd(m), r0b = _mm_loadu_pd(m + 2);
+    __m128d r1a = _mm_loadu_pd(m + 4), r1b = _mm_loadu_pd(m + 6);
+    __m128d r2a = _mm_loadu_pd(m + 8), r2b = _mm_loadu_pd(m + 10);
+    __m128d r3a = _mm_loadu_pd(m + 12), r3b = _mm_loadu_pd(m + 14);
+    double lanes[4];
+    for (size_t p = 0; p < count; p++)
+    {
+        const double *v = points + p * 3;
+        __m128d x = _mm_set1_pd(v[0]), y = _mm_set1_pd(v[1]), z = _mm_set1_pd(v[2]);
+        _mm_storeu_pd(lanes, _mm_add_pd(_mm_add_pd(_mm_mul_pd(x, r0a), _mm_mul_pd(y, r1a)), _mm_add_pd(_mm_mul_pd(z, r2a), r3a)));
+        _mm_storeu_pd(lanes + 2, _mm_add_pd(_mm_add_pd(_mm_mul_pd(x, r0b), _mm_mul_pd(y, r1b)), _mm_add_pd(_mm_mul_pd(z, r2b), r3b)));
+        double w = lanes[3] != 0 ? lanes[3] : 1;
+        out[p * 3] = lanes[0] / w;
+        out[p * 3 + 1] = lanes[1] / w;
+        out[p * 3 + 2] = lanes[2] / w;
+    }
+}
+#endif
+
+#ifdef MATH_NEON
+template <ArrayOp OP>
+static size_t f64_binary_simd(const double *a, const double *b, bool scalar, double *out, size_t n)
+{
+    size_t i = 0;
+    float64x2_t s = vdupq_n_f64(*b);
+    for (; i + 2 <= n; i += 2)
+    {
+        float64x2_t x = vld1q_f64(a + i);
+        float64x2_t y = scalar ? s : vld1q_f64(b + i);
+        float64x2_t r;
+        if constexpr (OP == ArrayOp::Add)
+            r = vaddq_f64(x, y);
+        else if constexpr (OP == ArrayOp::Sub)
+            r = vsubq_f64(x, y);
+        else if constexpr (OP == ArrayOp::Mul)
+            r = vmulq_f64(x, y);
+        else
+            r = vdivq_f64(x, y);
+        vst1q_f64(out + i, r);
+    }
+    return i;
+}
+
+static size_t f64_axpy_simd(double k, const double *x, double *y, size_t n)
+{
+    size_t i = 0;
+    float64x2_t s = vdupq_n_f64(k);
+    for (; i + 2 <= n; i += 2)
+    {
+        vst1q_f64(y + i, vaddq_f64(vld1q_f64(y + i), vmulq_f64(s, vld1q_f64(x + i))));
+    }
+    return i;
+}
+
+static size_t f64_dot_simd(const double *a, const double *b, size_t n, double &result)
+{
+    size_t i = 0;
+    float64x2_t acc0 = vdupq_n_f64(0);
+    float64x2_t acc1 = vdupq_n_f64(0);
+    for (; i + 4 <= n; i += 4)
+    {
+        acc0 = vaddq_f64(acc0, vmulq_f64(vld1q_f64(a + i), b ? vld1q_f64(b + i) : vdupq_n_f64(1)));
+        acc1 = vaddq_f64(acc1, vmulq_f64(vld1q_f64(a + i + 2), b ? vld1q_f64(b + i + 2) : vdupq_n_f64(1)));
+    }
+    result = vaddvq_f64(vaddq_f64(acc0, acc1));
+    return i;
+}
+
+static size_t f64_minmax_simd(const double *a, size_t n, double &low, double &high)
+{
+    if (n < 2)
+    {
+        return 0;
+    }
+    size_t i = 2;
+    float64x2_t lo = vld1q_f64(a);
+    float64x2_t hi = lo;
+    for (; i + 2 <= n; i += 2)
+    {
+        float64x2_t x = vld1q_f64(a + i);
+        lo = vminq_f64(lo, x);
+        hi = vmaxq_f64(hi, x);
+    }
+    low = vminvq_f64(lo);
+    high = vmaxvq_f64(hi);
+    return i;
+}
+
+static void transform_simd(const double *points, const double *m, double *out, size_t count)
+{
+    float64x2_t r0a = vld1q_f64(m), r0b = vld1q_f64(m + 2);
+    float64x2_t r1a = vld1q_f64(m + 4), r1b = vld1q_f64(m + 6);
+    float64x2_t r2a = vld1q_f64(m + 8), r2b = vld1q_f64(m + 10);
+    float64x2_t r3a = vld1q_f64(m + 12), r3b = vld1q_f64(m + 14);
+    for (size_t p = 0; p < count; p++)
+    {
+        const double *v = points + p * 3;
+        float64x2_t xy = vaddq_f64(vaddq_f64(vmulq_n_f64(r0a, v[0]), vmulq_n_f64(r1a, v[1])), vaddq_f64(vmulq_n_f64(r2a, v[2]), r3a));
+        float64x2_t zw = vaddq_f64(vaddq_f64(vmulq_n_f64(r0b, v[0]), vmulq_n_f64(r1b, v[1])), vaddq_f64(vmulq_n_f64(r2b, v[2]), r3b));
+        double w = vgetq_lane_f64(zw, 1);
+        w = w != 0 ? w : 1;
+        out[p * 3] = vgetq_lane_f64(xy, 0) / w;
+        out[p * 3 + 1] = vgetq_lane_f64(xy, 1) / w;
+        out[p * 3 + 2] = vgetq_lane_f64(zw, 0) / w;
+    }
+}
+#endif
+
+template <ArrayOp OP, typename T>
+static inline T apply_op(T a, T b)
+{
+    if constexpr (OP == ArrayOp::Add)
+        return a + b;
+    else if constexpr (OP == ArrayOp::Sub)
+        return a - b;
+    else if constexpr (OP == ArrayOp::Mul)
+        return a * b;
+    else
+        return a / b;
+}
+
+template <ArrayOp OP>
+static void f64_binary(const double *a, const double *b, bool scalar, double *out, size_t n)
+{
+    size_t i = 0;
+#ifdef MATH_AVX2
+    if (has_avx2)
+    {
+        i = f64_binary_avx2<OP>(a, b, scalar, out, n);
+    }
+    else
+#endif
+#if defined(MATH_SSE2) || defined(MATH_NEON)
+    {
+        i = f64_binary_simd<OP>(a, b, scalar, out, n);
+    }
+#endif
+    for (; i < n; i++)
+    {
+        out[i] = apply_op<OP>(a[i], scalar ? *b : b[i]);
+    }
+}
+
+// Int32 arithmetic wraps around like the hardware does: add, sub and mul are
+// done unsigned, where overflow is defined. Division is signed so it rounds
+// toward zero, with INT32_MIN / -1 wrapping too. Zero divisors are rejected
+// before getting here
+template <ArrayOp OP>
+static inline int32_t i32_op(int32_t a, int32_t b)
+{
+    if constexpr (OP == ArrayOp::Div)
+        return b == -1 ? (int32_t)(0u - (uint32_t)a) : a / b;
+    else
+        return (int32_t)apply_op<OP>((uint32_t)a, (uint32_t)b);
+}
+
+// The plain loops are left to the compiler's vectorizer
+template <ArrayOp OP>
+static void i32_binary(const int32_t *a, const int32_t *b, bool scalar, int32_t *out, size_t n)
+{
+    if (scalar)
+    {
+        int32_t k = *b;
+        for (size_t i = 0; i < n; i++)
+        {
+            out[i] = i32_op<OP>(a[i], k);
+        }
+        return;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        out[i] = i32_op<OP>(a[i], b[i]);
+    }
+}
+
+// Numbers are truncated toward zero when stored in an Int32Array. Converting
+// NaN, infinities or anything outside the Int32 range is undefined, so those
+// are refused
+static bool to_i32(double value, int32_t &out)
+{
+    if (!(value > (double)INT32_MIN - 1 && value < (double)INT32_MAX + 1))
+    {
+        return false;
+    }
+    out = (int32_t)value;
+    return true;
+}
+
+static void f64_axpy(double k, const double *x, double *y, size_t n)
+{
+    size_t i = 0;
+#ifdef MATH_AVX2
+    if (has_avx2)
+    {
+        i = f64_axpy_avx2(k, x, y, n);
+    }
+    else
+#endif
+#if defined(MATH_SSE2) || defined(MATH_NEON)
+    {
+        i = f64_axpy_simd(k, x, y, n);
+    }
+#endif
+    for (; i < n; i++)
+    {
+        y[i] += k * x[i];
+    }
+}
+
+// Sums a[i] * b[i], or just a[i] when b is null
+static double f64_dot(const double *a, const double *b, size_t n)
+{
+    size_t i = 0;
+    double result = 0;
+#ifdef MATH_AVX2
+    if (has_avx2)
+    {
+        i = f64_dot_avx2(a, b, n, result);
+    }
+    else
+#endif
+#if defined(MATH_SSE2) || defined(MATH_NEON)
+    {
+        i = f64_dot_simd(a, b, n, result);
+    }
+#endif
+    for (; i < n; i++)
+    {
+        result += a[i] * (b ? b[i] : 1);
+    }
+    return result;
+}
+
+static void f64_minmax(const double *a, size_t n, double &low, double &high)
+{
+    size_t i = 0;
+    low = INFINITY;
+    high = -INFINITY;
+#ifdef MATH_AVX2
+    if (has_avx2)
+    {
+        i = f64_minmax_avx2(a, n, low, high);
+    }
+    else
+#endif
+#if defined(MATH_SSE2) || defined(MATH_NEON)
+    {
+        i = f64_minmax_simd(a, n, low, high);
+    }
+#endif
+    for (; i < n; i++)
+    {
+        low = std::min(low, a[i]);
+        high = std::max(high, a[i]);
+    }
+}
+
+static void transform(const double *points, const double *m, double *out, size_t count)
+{
+#ifdef MATH_AVX2
+    if (has_avx2)
+    {
+        transform_avx2(points, m, out, count);
+        return;
+    }
+#endif
+#if defined(MATH_SSE2) || defined(MATH_NEON)
+    transform_simd(points, m, out, count);
+#else
+    for (size_t p = 0; p < count; p++)
+    {
+        const double *v = points + p * 3;
+        double r[4];
+        for (int c = 0; c < 4; c++)
+        {
+            r[c] = v[0] * m[c] + v[1] * m[4 + c] + v[2] * m[8 + c] + m[12 + c];
+        }
+        double w = r[3] != 0 ? r[3] : 1;
+        out[p * 3] = r[0] / w;
+        out[p * 3 + 1] = r[1] / w;
+        out[p * 3 + 2] = r[2] / w;
+    }
+#endif
+}
+
+static TypedArray *get_array(Value &array, const char *name, std::string &error)
+{
+    if (!array.is_pointer())
+    {
+        error = std::string("Parameter '") + name + "' must be a typed array";
+        return nullptr;
+    }
+    TypedArray *typed = (TypedArray *)array.get_pointer()->value;
+    if (!typed)
+    {
+        error = "Typed array has been freed";
+    }
+    return typed;
+}
+
+static Value wrap_array(TypedArray *typed)
+{
+    Value handle = pointer_val();
+    handle.get_pointer()->value = typed;
+    return handle;
+}
+
+// Resolves the optional 'out' parameter: None allocates a new array,
+// otherwise it must match the kind and length of the result
+static TypedArray *output_array(Value &out, ArrayKind kind, size_t size, std::string &error)
+{
+    if (out.is_none())
+    {
+        TypedArray *typed = new TypedArray{kind};
+        if (kind == ArrayKind::Float64)
+        {
+            typed->f64.resize(size);
+        }
+        else
+        {
+            typed->i32.resize(size);
+        }
+        return typed;
+    }
+    TypedArray *typed = get_array(out, "out", error);
+    if (typed && (typed->kind != kind || typed->size() != size))
+    {
+        error = "Parameter 'out' must be a typed array of the same type and length as the result";
+        return nullptr;
+    }
+    return typed;
+}
+
+// A 4x4 matrix from a 16 element Float64Array or a list of 4 rows, in the
+// row-vector layout used by multMat4
+static bool read_mat4(Value &mat, double *m, std::string &error)
+{
+    if (mat.is_pointer())
+    {
+        TypedArray *typed = get_array(mat, "mat", error);
+        if (!typed)
+        {
+            return false;
+        }
+        if (typed->kind != ArrayKind::Float64 || typed->f64.size() != 16)
+        {
+            error = "Parameter 'mat' must be a Float64Array of 16 numbers";
+            return false;
+        }
+        memcpy(m, typed->f64.data(), 16 * sizeof(double));
+        return true;
+    }
+    if (!mat.is_list() || mat.get_list()->size() != 4)
+    {
+        error = "Parameter 'mat' must be a 4x4 list or a Float64Array";
+        return false;
+    }
+    for (int row = 0; row < 4; row++)
+    {
+        Value &values = mat.get_list()->at(row);
+        if (!values.is_list() || values.get_list()->size() != 4)
+        {
+            error = "Parameter 'mat' must be a 4x4 list or a Float64Array";
+            return false;
+        }
+        for (int col = 0; col < 4; col++)
+        {
+            Value &value = values.get_list()->at(col);
+            if (!value.is_number())
+            {
+                error = "Parameter 'mat' must only contain numbers";
+                return false;
+            }
+            m[row * 4 + col] = value.get_number();
+        }
+    }
+    return true;
+}
+
+extern "C" Value array_new(std::vector<Value> &args)
+{
+    int num_required_args = 2;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'array_new' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    Value kind = args[0];
+    Value data = args[1];
+
+    if (!kind.is_string() || (kind.get_string() != "f64" && kind.get_string() != "i32"))
+    {
+        return error_object("Parameter 'kind' must be 'f64' or 'i32'");
+    }
+
+    TypedArray typed{kind.get_string() == "f64" ? ArrayKind::Float64 : ArrayKind::Int32};
+
+    if (data.is_number())
+    {
+        if (data.get_number() < 0)
+        {
+            return error_object("Parameter 'data' must be a positive number or a list of numbers");
+        }
+        size_t size = (size_t)data.get_number();
+        typed.f64.resize(typed.kind == ArrayKind::Float64 ? size : 0);
+        typed.i32.resize(typed.kind == ArrayKind::Int32 ? size : 0);
+    }
+    else if (data.is_list())
+    {
+        auto &list = *data.get_list();
+        if (typed.kind == ArrayKind::Float64)
+        {
+            typed.f64.reserve(list.size());
+        }
+        else
+        {
+            typed.i32.reserve(list.size());
+        }
+        for (Value &value : list)
+        {
+            if (!value.is_number())
+            {
+                return error_object("Parameter 'data' must only contain numbers");
+            }
+            if (typed.kind == ArrayKind::Float64)
+            {
+                typed.f64.push_back(value.get_number());
+            }
+            else
+            {
+                int32_t i32;
+                if (!to_i32(value.get_number(), i32))
+                {
+                    return error_object("Parameter 'data' must only contain numbers in the Int32 range");
+                }
+                typed.i32.push_back(i32);
+            }
+        }
+    }
+    else
+    {
+        return error_object("Parameter 'data' must be a positive number or a list of numbers");
+    }
+
+    return wrap_array(new TypedArray(std::move(typed)));
+}
+
+extern "C" Value array_length(std::vector<Value> &args)
+{
+    int num_required_args = 1;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'array_length' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    TypedArray *typed = get_array(args[0], "array", error);
+    if (!typed)
+    {
+        return error_object(error);
+    }
+
+    return number_val(typed->size());
+}
+
+extern "C" Value array_get(std::vector<Value> &args)
+{
+    int num_required_args = 2;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'array_get' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    TypedArray *typed = get_array(args[0], "array", error);
+    if (!typed)
+    {
+        return error_object(error);
+    }
+
+    Value index = args[1];
+
+    if (!index.is_number() || index.get_number() < 0 || index.get_number() >= typed->size())
+    {
+        return error_object("Index out of range");
+    }
+
+    size_t i = (size_t)index.get_number();
+    return number_val(typed->kind == ArrayKind::Float64 ? typed->f64[i] : typed->i32[i]);
+}
+
+extern "C" Value array_set(std::vector<Value> &args)
+{
+    int num_required_args = 3;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'array_set' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    TypedArray *typed = get_array(args[0], "array", error);
+    if (!typed)
+    {
+        return error_object(error);
+    }
+
+    Value index = args[1];
+    Value value = args[2];
+
+    if (!index.is_number() || index.get_number() < 0 || index.get_number() >= typed->size())
+    {
+        return error_object("Index out of range");
+    }
+
+    if (!value.is_number())
+    {
+        return error_object("Parameter 'value' must be a number");
+    }
+
+    size_t i = (size_t)index.get_number();
+    if (typed->kind == ArrayKind::Float64)
+    {
+        typed->f64[i] = value.get_number();
+    }
+    else if (!to_i32(value.get_number(), typed->i32[i]))
+    {
+        return error_object("Parameter 'value' must be in the Int32 range");
+    }
+
+    return none_val();
+}
+
+extern "C" Value array_fill(std::vector<Value> &args)
+{
+    int num_required_args = 2;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'array_fill' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    TypedArray *typed = get_array(args[0], "array", error);
+    if (!typed)
+    {
+        return error_object(error);
+    }
+
+    Value value = args[1];
+
+    if (!value.is_number())
+    {
+        return error_object("Parameter 'value' must be a number");
+    }
+
+    if (typed->kind == ArrayKind::Float64)
+    {
+        std::fill(typed->f64.begin(), typed->f64.end(), value.get_number());
+    }
+    else
+    {
+        int32_t i32;
+        if (!to_i32(value.get_number(), i32))
+        {
+            return error_object("Parameter 'value' must be in the Int32 range");
+        }
+        std::fill(typed->i32.begin(), typed->i32.end(), i32);
+    }
+
+    return none_val();
+}
+
+extern "C" Value array_to_list(std::vector<Value> &args)
+{
+    int num_required_args = 1;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'array_to_list' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    TypedArray *typed = get_array(args[0], "array", error);
+    if (!typed)
+    {
+        return error_object(error);
+    }
+
+    Value list = list_val();
+    auto &values = *list.get_list();
+    values.reserve(typed->size());
+    for (size_t i = 0; i < typed->size(); i++)
+    {
+        values.push_back(number_val(typed->kind == ArrayKind::Float64 ? typed->f64[i] : typed->i32[i]));
+    }
+
+    return list;
+}
+
+extern "C" Value array_copy(std::vector<Value> &args)
+{
+    int num_required_args = 1;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'array_copy' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    TypedArray *typed = get_array(args[0], "array", error);
+    if (!typed)
+    {
+        return error_object(error);
+    }
+
+    return wrap_array(new TypedArray(*typed));
+}
+
+extern "C" Value array_free(std::vector<Value> &args)
+{
+    int num_required_args = 1;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'array_free' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    TypedArray *typed = get_array(args[0], "array", error);
+    if (!typed)
+    {
+        return error_object(error);
+    }
+
+    delete typed;
+    args[0].get_pointer()->value = nullptr;
+
+    return none_val();
+}
+
+template <ArrayOp OP>
+static void binary(TypedArray *a, TypedArray *b, double scalar, int32_t scalar_i32, TypedArray *out)
+{
+    size_t n = a->size();
+    if (a->kind == ArrayKind::Float64)
+    {
+        f64_binary<OP>(a->f64.data(), b ? b->f64.data() : &scalar, !b, out->f64.data(), n);
+    }
+    else
+    {
+        i32_binary<OP>(a->i32.data(), b ? b->i32.data() : &scalar_i32, !b, out->i32.data(), n);
+    }
+}
+
+extern "C" Value array_op(std::vector<Value> &args)
+{
+    int num_required_args = 4;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'array_op' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    TypedArray *a = get_array(args[0], "array", error);
+    if (!a)
+    {
+        return error_object(error);
+    }
+
+    Value op = args[1];
+    Value other = args[2];
+
+    if (!op.is_string())
+    {
+        return error_object("Parameter 'op' must be a string");
+    }
+
+    TypedArray *b = nullptr;
+    double scalar = 0;
+    int32_t scalar_i32 = 0;
+    if (other.is_number())
+    {
+        scalar = other.get_number();
+        if (a->kind == ArrayKind::Int32 && !to_i32(scalar, scalar_i32))
+        {
+            return error_object("Parameter 'other' must be in the Int32 range");
+        }
+    }
+    else
+    {
+        b = get_array(other, "other", error);
+        if (!b)
+        {
+            return error_object("Parameter 'other' must be a number or a typed array");
+        }
+        if (b->kind != a->kind || b->size() != a->size())
+        {
+            return error_object("Typed arrays must have the same type and length");
+        }
+    }
+
+    const std::string &name = op.get_string();
+    if (name != "add" && name != "sub" && name != "mul" && name != "div")
+    {
+        return error_object("Unknown operation '" + name + "'");
+    }
+
+    if (name == "div" && a->kind == ArrayKind::Int32)
+    {
+        bool zero = b ? std::find(b->i32.begin(), b->i32.end(), 0) != b->i32.end() : scalar_i32 == 0;
+        if (zero)
+        {
+            return error_object("Division by zero");
+        }
+    }
+
+    TypedArray *out = output_array(args[3], a->kind, a->size(), error);
+    if (!out)
+    {
+        return error_object(error);
+    }
+
+    if (name == "add")
+    {
+        binary<ArrayOp::Add>(a, b, scalar, scalar_i32, out);
+    }
+    else if (name == "sub")
+    {
+        binary<ArrayOp::Sub>(a, b, scalar, scalar_i32, out);
+    }
+    else if (name == "mul")
+    {
+        binary<ArrayOp::Mul>(a, b, scalar, scalar_i32, out);
+    }
+    else
+    {
+        binary<ArrayOp::Div>(a, b, scalar, scalar_i32, out);
+    }
+
+    return args[3].is_none() ? wrap_array(out) : args[3];
+}
+
+extern "C" Value array_reduce(std::vector<Value> &args)
+{
+    int num_required_args = 2;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'array_reduce' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    TypedArray *typed = get_array(args[0], "array", error);
+    if (!typed)
+    {
+        return error_object(error);
+    }
+
+    Value op = args[1];
+
+    if (!op.is_string())
+    {
+        return error_object("Parameter 'op' must be a string");
+    }
+
+    const std::string &name = op.get_string();
+    size_t n = typed->size();
+
+    if (name == "sum")
+    {
+        if (typed->kind == ArrayKind::Float64)
+        {
+            return number_val(f64_dot(typed->f64.data(), nullptr, n));
+        }
+        int64_t sum = 0;
+        for (int32_t value : typed->i32)
+        {
+            sum += value;
+        }
+        return number_val((double)sum);
+    }
+
+    if (name != "min" && name != "max")
+    {
+        return error_object("Unknown reduction '" + name + "'");
+    }
+
+    if (n == 0)
+    {
+        return none_val();
+    }
+
+    if (typed->kind == ArrayKind::Float64)
+    {
+        double low, high;
+        f64_minmax(typed->f64.data(), n, low, high);
+        return number_val(name == "min" ? low : high);
+    }
+
+    auto range = std::minmax_element(typed->i32.begin(), typed->i32.end());
+    return number_val(name == "min" ? *range.first : *range.second);
+}
+
+extern "C" Value array_dot(std::vector<Value> &args)
+{
+    int num_required_args = 2;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'array_dot' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    TypedArray *a = get_array(args[0], "a", error);
+    TypedArray *b = a ? get_array(args[1], "b", error) : nullptr;
+    if (!b)
+    {
+        return error_object(error);
+    }
+
+    if (a->kind != b->kind || a->size() != b->size())
+    {
+        return error_object("Typed arrays must have the same type and length");
+    }
+
+    if (a->kind == ArrayKind::Float64)
+    {
+        return number_val(f64_dot(a->f64.data(), b->f64.data(), a->size()));
+    }
+
+    int64_t sum = 0;
+    for (size_t i = 0; i < a->size(); i++)
+    {
+        sum += (int64_t)a->i32[i] * b->i32[i];
+    }
+    return number_val((double)sum);
+}
+
+extern "C" Value array_matmul(std::vector<Value> &args)
+{
+    int num_required_args = 6;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'array_matmul' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    TypedArray *a = get_array(args[0], "a", error);
+    TypedArray *b = a ? get_array(args[1], "b", error) : nullptr;
+    if (!b)
+    {
+        return error_object(error);
+    }
+
+    for (int i = 2; i < 5; i++)
+    {
+        if (!args[i].is_number() || args[i].get_number() < 0)
+        {
+            return error_object("Matrix dimensions must be positive numbers");
+        }
+    }
+
+    size_t rows = (size_t)args[2].get_number();
+    size_t inner = (size_t)args[3].get_number();
+    size_t cols = (size_t)args[4].get_number();
+
+    if (a->kind != ArrayKind::Float64 || b->kind != ArrayKind::Float64)
+    {
+        return error_object("Function 'matmul' expects Float64Arrays");
+    }
+
+    if (a->size() != rows * inner || b->size() != inner * cols)
+    {
+        return error_object("Matrix dimensions do not match the array lengths");
+    }
+
+    TypedArray *out = output_array(args[5], ArrayKind::Float64, rows * cols, error);
+    if (!out)
+    {
+        return error_object(error);
+    }
+
+    if (out == a || out == b)
+    {
+        return error_object("Parameter 'out' must not be one of the inputs");
+    }
+
+    // Row i of the result is the sum of the rows of b scaled by row i of a,
+    // which keeps every inner loop on contiguous memory
+    double *result = out->f64.data();
+    std::fill(out->f64.begin(), out->f64.end(), 0.0);
+    for (size_t i = 0; i < rows; i++)
+    {
+        for (size_t k = 0; k < inner; k++)
+        {
+            f64_axpy(a->f64[i * inner + k], &b->f64[k * cols], result + i * cols, cols);
+        }
+    }
+
+    return args[5].is_none() ? wrap_array(out) : args[5];
+}
+
+extern "C" Value array_transform(std::vector<Value> &args)
+{
+    int num_required_args = 3;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'array_transform' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    TypedArray *points = get_array(args[0], "points", error);
+    if (!points)
+    {
+        return error_object(error);
+    }
+
+    if (points->kind != ArrayKind::Float64 || points->size() % 3 != 0)
+    {
+        return error_object("Parameter 'points' must be a Float64Array of x, y, z triples");
+    }
+
+    double m[16];
+    if (!read_mat4(args[1], m, error))
+    {
+        return error_object(error);
+    }
+
+    TypedArray *out = output_array(args[2], ArrayKind::Float64, points->size(), error);
+    if (!out)
+    {
+        return error_object(error);
+    }
+
+    transform(points->f64.data(), m, out->f64.data(), points->size() / 3);
+
+    return args[2].is_none() ? wrap_array(out) : args[2];
+}
+
 extern "C" Value multMat4(std::vector<Value> &args)
 {
     int num_required_args = 2;
@@ -249,47 +1414,24 @@ extern "C" Value multMat4(std::vector<Value> &args)
         return error_object("Parameter 'vec' must be an object");
     }
 
-    auto &in = vec.get_object();
+    auto &in = vec.get_object()->values;
+    double v[3] = {in["x"].get_number(), in["y"].get_number(), in["z"].get_number()};
 
-    if (!mat.is_list())
+    double m[16];
+    std::string error;
+    if (!read_mat4(mat, m, error))
     {
-        return error_object("Parameter 'mat' must be an object");
+        return error_object(error);
     }
 
-    auto &list = mat.get_list();
+    double r[3];
+    transform(v, m, r, 1);
 
     Value vecOut = object_val();
     auto &out = vecOut.get_object();
-    out->values["x"] = number_val(
-        in->values["x"].get_number() * list->at(0).get_list()->at(0).get_number() +
-        in->values["y"].get_number() * list->at(1).get_list()->at(0).get_number() +
-        in->values["z"].get_number() * list->at(2).get_list()->at(0).get_number() +
-        list->at(3).get_list()->at(0).get_number());
-
-    out->values["y"] = number_val(
-        in->values["x"].get_number() * list->at(0).get_list()->at(1).get_number() +
-        in->values["y"].get_number() * list->at(1).get_list()->at(1).get_number() +
-        in->values["z"].get_number() * list->at(2).get_list()->at(1).get_number() +
-        list->at(3).get_list()->at(1).get_number());
-
-    out->values["z"] = number_val(
-        in->values["x"].get_number() * list->at(0).get_list()->at(2).get_number() +
-        in->values["y"].get_number() * list->at(1).get_list()->at(2).get_number() +
-        in->values["z"].get_number() * list->at(2).get_list()->at(2).get_number() +
-        list->at(3).get_list()->at(2).get_number());
-
-    double w =
-        in->values["x"].get_number() * list->at(0).get_list()->at(3).get_number() +
-        in->values["y"].get_number() * list->at(1).get_list()->at(3).get_number() +
-        in->values["z"].get_number() * list->at(2).get_list()->at(3).get_number() +
-        list->at(3).get_list()->at(3).get_number();
-
-    if (w != 0)
-    {
-        out->values["x"] = number_val(out->values["x"].get_number() / w);
-        out->values["y"] = number_val(out->values["y"].get_number() / w);
-        out->values["z"] = number_val(out->values["z"].get_number() / w);
-    }
+    out->values["x"] = number_val(r[0]);
+    out->values["y"] = number_val(r[1]);
+    out->values["z"] = number_val(r[2]);
 
     vecOut.get_object()->keys = {"x",
                                  "y",
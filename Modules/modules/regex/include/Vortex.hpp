@@ -0,0 +1,688 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <string>
+#include <iostream>
+#include <variant>
+#include <cstdarg>
+#include <cmath>
+
+enum class ValueType
+{
+    Number,
+    String,
+    Boolean,
+    List,
+    Type,
+    Object,
+    Function,
+    Native,
+    Pointer,
+    None
+};
+
+struct Value;
+struct Closure;
+
+std::string toString(Value value);
+
+struct ExceptionHandler
+{
+    int start;
+    int end;
+    int handler;
+    int depth;
+};
+
+struct Chunk
+{
+    std::vector<uint8_t> code;
+    std::vector<int> lines;
+    std::vector<Value> constants;
+    std::vector<std::string> variables;
+    std::vector<std::string> public_variables;
+    std::vector<ExceptionHandler> exception_table;
+    std::string import_path;
+};
+
+struct ClosedVar
+{
+    std::string name;
+    int index;
+    bool is_local;
+};
+
+struct FunctionObj
+{
+    std::string name;
+    int arity;
+    int defaults;
+    Chunk chunk;
+    std::vector<int> instruction_offsets;
+    std::vector<ClosedVar> closed_var_indexes;
+    std::vector<std::shared_ptr<Closure>> closed_vars;
+    std::vector<Value> default_values;
+    std::shared_ptr<Value> object;
+    std::vector<std::string> params;
+    bool is_generator = false;
+    bool generator_init = false;
+    bool generator_done = false;
+    bool is_type_generator = false;
+    std::vector<Value> generator_stack;
+    int generator_ip = 0;
+    std::string import_path;
+};
+
+struct TypeObj
+{
+    std::string name;
+    std::unordered_map<std::string, Value> types;
+    std::unordered_map<std::string, Value> defaults;
+};
+
+struct ObjectObj
+{
+    std::shared_ptr<TypeObj> type;
+    std::unordered_map<std::string, Value> values;
+    std::vector<std::string> keys;
+    std::string type_name;
+};
+
+struct PointerObj
+{
+    void *value;
+};
+
+typedef Value (*NativeFunction)(std::vector<Value> &args);
+
+struct NativeFunctionObj
+{
+    std::string name;
+    NativeFunction function = nullptr;
+};
+
+struct Meta
+{
+    bool unpack = false;
+    bool packer = false;
+    bool is_const = false;
+    bool temp_non_const = false;
+};
+
+struct ValueHooks
+{
+    std::shared_ptr<Value> onChangeHook = nullptr;
+    std::string onChangeHookName;
+    std::shared_ptr<Value> onAccessHook = nullptr;
+    std::string onAccessHookName;
+};
+
+// String buffers are shared between copies of a Value and never written
+// in place while shared, see Value::get_mutable_string
+static const std::shared_ptr<std::string> &empty_string()
+{
+    static const std::shared_ptr<std::string> empty = std::make_shared<std::string>();
+    return empty;
+}
+
+struct Value
+{
+    ValueType type;
+    Meta meta;
+    ValueHooks hooks;
+    std::variant<
+        double,
+        std::shared_ptr<std::string>,
+        bool,
+        std::shared_ptr<std::vector<Value>>,
+        std::shared_ptr<FunctionObj>,
+        std::shared_ptr<TypeObj>,
+        std::shared_ptr<ObjectObj>,
+        std::shared_ptr<NativeFunctionObj>,
+        std::shared_ptr<PointerObj>>
+        value;
+
+    Value() : type(ValueType::None)
+    {
+    }
+    Value(ValueType type) : type(type)
+    {
+        switch (type)
+        {
+        case ValueType::Number:
+            value = 0.0f;
+            break;
+        case ValueType::String:
+            value = empty_string();
+            break;
+        case ValueType::Boolean:
+            value = false;
+            break;
+        case ValueType::List:
+            value = std::make_shared<std::vector<Value>>();
+            break;
+        case ValueType::Type:
+            value = std::make_shared<TypeObj>();
+            break;
+        case ValueType::Object:
+            value = std::make_shared<ObjectObj>();
+            break;
+        case ValueType::Function:
+            value = std::make_shared<FunctionObj>();
+            break;
+        case ValueType::Native:
+            value = std::make_shared<NativeFunctionObj>();
+            break;
+        case ValueType::Pointer:
+            value = std::make_shared<PointerObj>();
+            break;
+        default:
+            break;
+        }
+    }
+
+    double &get_number()
+    {
+        return std::get<double>(this->value);
+    }
+    const std::string &get_string()
+    {
+        return *std::get<std::shared_ptr<std::string>>(this->value);
+    }
+    std::string &get_mutable_string()
+    {
+        auto &str = std::get<std::shared_ptr<std::string>>(this->value);
+        if (str.use_count() > 1)
+        {
+            str = std::make_shared<std::string>(*str);
+        }
+        return *str;
+    }
+    bool &get_boolean()
+    {
+        return std::get<bool>(this->value);
+    }
+
+    std::shared_ptr<std::vector<Value>> &get_list()
+    {
+        return std::get<std::shared_ptr<std::vector<Value>>>(this->value);
+    }
+
+    std::shared_ptr<TypeObj> &get_type()
+    {
+        return std::get<std::shared_ptr<TypeObj>>(this->value);
+    }
+
+    std::shared_ptr<ObjectObj> &get_object()
+    {
+        return std::get<std::shared_ptr<ObjectObj>>(this->value);
+    }
+
+    std::shared_ptr<FunctionObj> &get_function()
+    {
+        return std::get<std::shared_ptr<FunctionObj>>(this->value);
+    }
+
+    std::shared_ptr<NativeFunctionObj> &get_native()
+    {
+        return std::get<std::shared_ptr<NativeFunctionObj>>(this->value);
+    }
+
+    std::shared_ptr<PointerObj> &get_pointer()
+    {
+        return std::get<std::shared_ptr<PointerObj>>(this->value);
+    }
+
+    bool is_number()
+    {
+        return type == ValueType::Number;
+    }
+    bool is_string()
+    {
+        return type == ValueType::String;
+    }
+    bool is_boolean()
+    {
+        return type == ValueType::Boolean;
+    }
+    bool is_list()
+    {
+        return type == ValueType::List;
+    }
+    bool is_type()
+    {
+        return type == ValueType::Type;
+    }
+    bool is_object()
+    {
+        return type == ValueType::Object;
+    }
+    bool is_function()
+    {
+        return type == ValueType::Function;
+    }
+    bool is_native()
+    {
+        return type == ValueType::Native;
+    }
+    bool is_pointer()
+    {
+        return type == ValueType::Pointer;
+    }
+    bool is_none()
+    {
+        return type == ValueType::None;
+    }
+    std::string type_repr()
+    {
+        switch (type)
+        {
+        case ValueType::Number:
+            return "Number";
+        case ValueType::String:
+            return "String";
+        case ValueType::Boolean:
+            return "Boolean";
+        case ValueType::List:
+            return "List";
+        case ValueType::Object:
+            return "Object";
+        case ValueType::Function:
+            return "Function";
+        case ValueType::Native:
+            return "Native";
+        case ValueType::Pointer:
+            return "Pointer";
+        case ValueType::Type:
+            return "Type";
+        case ValueType::None:
+            return "None";
+        default:
+            return "Unknown";
+        }
+    }
+    std::string value_repr()
+    {
+        return toString(*this);
+    }
+};
+
+std::string toString(Value value)
+{
+    switch (value.type)
+    {
+    case ValueType::Number:
+    {
+        double number = value.get_number();
+        if (std::floor(number) == number)
+        {
+            return std::to_string((long long)number);
+        }
+        char buff[100];
+        snprintf(buff, sizeof(buff), "%.8g", number);
+        std::string buffAsStdStr = buff;
+        return buffAsStdStr;
+        // return std::to_string(number);
+    }
+    case ValueType::String:
+    {
+        return (value.get_string());
+    }
+    case ValueType::Boolean:
+    {
+        return (value.get_boolean() ? "true" : "false");
+    }
+    case ValueType::List:
+    {
+        std::string repr = "[";
+        for (int i = 0; i < value.get_list()->size(); i++)
+        {
+            Value &v = value.get_list()->at(i);
+            repr += toString(v);
+            if (i < value.get_list()->size() - 1)
+            {
+                repr += ", ";
+            }
+        }
+        repr += "]";
+        return repr;
+    }
+    case ValueType::Type:
+    {
+        return "Type: " + value.get_type()->name;
+    }
+    case ValueType::Object:
+    {
+        auto &obj = value.get_object();
+        std::string repr;
+        if (obj->type)
+        {
+            repr += value.get_object()->type->name + " ";
+        }
+        repr += "{ ";
+        int i = 0;
+        int size = obj->values.size();
+        for (std::string &key : obj->keys)
+        {
+            repr += key + ": " + toString(obj->values[key]);
+            i++;
+            if (i < size)
+            {
+                repr += ", ";
+            }
+        }
+        repr += " }";
+        return repr;
+    }
+    case ValueType::Function:
+    {
+        return "Function: " + value.get_function()->name;
+    }
+    case ValueType::Native:
+    {
+        return "Native Function: " + value.get_native()->name;
+    }
+    case ValueType::Pointer:
+    {
+        return "<Pointer>";
+    }
+    case ValueType::None:
+    {
+        return "None";
+    }
+    default:
+    {
+        return "Undefined";
+    }
+    }
+}
+
+struct Closure
+{
+    std::string name;
+    std::string frame_name;
+    bool is_local;
+    int index;
+    Value *location;
+    Value closed;
+    Value *initial_location;
+};
+
+Value new_val()
+{
+    return Value(ValueType::None);
+}
+
+Value number_val(double value)
+{
+    Value val(ValueType::Number);
+    val.value = value;
+    return val;
+}
+
+Value string_val(std::string value)
+{
+    Value val(ValueType::String);
+    val.value = std::make_shared<std::string>(std::move(value));
+    return val;
+}
+
+Value boolean_val(bool value)
+{
+    Value val(ValueType::Boolean);
+    val.value = value;
+    return val;
+}
+
+Value list_val()
+{
+    Value val(ValueType::List);
+    return val;
+}
+
+Value type_val(std::string name)
+{
+    Value val(ValueType::Type);
+    val.get_type()->name = name;
+    return val;
+}
+
+Value object_val()
+{
+    Value val(ValueType::Object);
+    return val;
+}
+
+Value function_val()
+{
+    Value val(ValueType::Function);
+    return val;
+}
+
+Value native_val()
+{
+    Value val(ValueType::Native);
+    return val;
+}
+
+Value pointer_val()
+{
+    Value val(ValueType::Pointer);
+    return val;
+}
+
+Value none_val()
+{
+    Value val(ValueType::None);
+    return val;
+}
+
+void error(std::string message)
+{
+    std::cout << message << "\n";
+    exit(1);
+}
+
+#define STACK_MAX 100000
+#define STACK_HEADROOM 256
+#define FRAMES_MAX 3000
+
+// Thrown when a push would run past the end of a stack, run() reports it as
+// a RecursionError so it can be caught like any other error
+struct StackOverflow
+{
+};
+
+// Value and frame stacks are allocated once per VM and never move, closures
+// and the frames keep raw pointers into them
+template <typename T>
+struct FixedStack
+{
+    T *items;
+    T *top;
+    T *limit;
+
+    FixedStack(size_t capacity)
+    {
+        items = top = (T *)::operator new(capacity * sizeof(T));
+        limit = items + capacity;
+    }
+    ~FixedStack()
+    {
+        clear();
+        ::operator delete(items);
+    }
+    FixedStack(const FixedStack &) = delete;
+    FixedStack &operator=(const FixedStack &) = delete;
+
+    [[noreturn]] static void overflow()
+    {
+        throw StackOverflow();
+    }
+
+    void push_back(const T &item)
+    {
+        if (top == limit)
+        {
+            overflow();
+        }
+        new (top++) T(item);
+    }
+    void push_back(T &&item)
+    {
+        if (top == limit)
+        {
+            overflow();
+        }
+        new (top++) T(std::move(item));
+    }
+    void pop_back()
+    {
+        (--top)->~T();
+    }
+    T &back()
+    {
+        return top[-1];
+    }
+    T &operator[](size_t index)
+    {
+        return items[index];
+    }
+    size_t size() const
+    {
+        return top - items;
+    }
+    size_t capacity() const
+    {
+        return limit - items;
+    }
+    bool empty() const
+    {
+        return top == items;
+    }
+    T *data()
+    {
+        return items;
+    }
+    T *begin()
+    {
+        return items;
+    }
+    T *end()
+    {
+        return top;
+    }
+    void erase(T *first, T *last)
+    {
+        T *new_top = std::move(last, top, first);
+        while (top != new_top)
+        {
+            pop_back();
+        }
+    }
+    void erase(T *position)
+    {
+        erase(position, position + 1);
+    }
+    template <typename Iterator>
+    void append(Iterator first, Iterator last)
+    {
+        for (; first != last; ++first)
+        {
+            push_back(*first);
+        }
+    }
+    void clear()
+    {
+        while (top != items)
+        {
+            pop_back();
+        }
+    }
+};
+
+struct CallFrame
+{
+    std::shared_ptr<FunctionObj> function;
+    uint8_t *ip;
+    int frame_start;
+    int sp;
+    int instruction_index;
+};
+
+struct CachedImport
+{
+    Value import_object;
+    std::unordered_map<std::string, Value> import_globals;
+};
+struct VM
+{
+    FixedStack<Value> stack;
+    FixedStack<CallFrame> frames;
+    std::vector<Value *> objects;
+    std::unordered_map<std::string, Value> globals;
+    int status = 0;
+    std::vector<std::shared_ptr<Closure>> closed_values;
+    int call_stack_limit = FRAMES_MAX;
+    std::unordered_map<std::string, CachedImport> import_cache;
+    int argc = 0;
+    char **argv;
+
+    VM() : stack(STACK_MAX), frames(FRAMES_MAX + 1)
+    {
+    }
+};
+
+
+Value error_object(std::string message, std::string error_type = "GenericError")
+{
+    Value error_obj = object_val();
+    error_obj.get_object()->type_name = "Error";
+    error_obj.get_object()->keys = {"message", "type"};
+    error_obj.get_object()->values["message"] = string_val(message);
+    error_obj.get_object()->values["type"] = string_val(error_type);
+
+    return error_obj;
+}
+
+static void runtimeError(VM &vm, std::string message, ...)
+{
+
+    vm.status = 1;
+
+    CallFrame frame = vm.frames.back();
+
+    va_list args;
+    va_start(args, message);
+    vfprintf(stderr, message.c_str(), args);
+    va_end(args);
+    fputs("\n", stderr);
+
+    for (int i = vm.frames.size() - 1; i >= 0; i--)
+    {
+        CallFrame *frame = &vm.frames[i];
+        auto &function = frame->function;
+        size_t instruction = frame->ip - function->chunk.code.data() - 1;
+        if (function->name == "error")
+        {
+            continue;
+        }
+        fprintf(stderr, "[line %d] in ",
+                function->chunk.lines[instruction]);
+        if (function->name == "")
+        {
+            std::string name = function->import_path;
+            if (name == "")
+            {
+                name = "script";
+            }
+            fprintf(stderr, "%s", (name + "\n").c_str());
+        }
+        else
+        {
+            fprintf(stderr, "%s()\n", function->name.c_str());
+        }
+    }
+}
\ No newline at end of file
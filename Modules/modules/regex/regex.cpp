@@ -0,0 +1,1532 @@
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include "include/Vortex.hpp"
+
+#define REGEX_MAX_REPEAT 1000
+#define REGEX_MAX_PROGRAM 100000
+#define REGEX_MAX_DEPTH 500
+#define REGEX_CACHE_SIZE 256
+
+// Patterns are compiled to a small instruction set and run on a Pike VM: all
+// possible matches advance through the text together, one byte at a time, so
+// matching is linear in the length of the text for every pattern. Features
+// that need backtracking (backreferences, lookaround) are rejected. Text is
+// matched as bytes and case folding only covers ASCII
+
+enum class Op : uint8_t
+{
+    Char,
+    Any,
+    AnyNewline,
+    Class,
+    Split,
+    Jmp,
+    Save,
+    Assert,
+    Match
+};
+
+enum Assertion
+{
+    BeginLine,
+    EndLine,
+    BeginText,
+    EndText,
+    WordBoundary,
+    NotWordBoundary
+};
+
+struct Inst
+{
+    Op op;
+    uint8_t c = 0;
+    int x = 0;
+    int y = 0;
+};
+
+struct Node
+{
+    enum Kind
+    {
+        Empty,
+        Literal,
+        Any,
+        Class,
+        Group,
+        Concat,
+        Alternate,
+        Repeat,
+        Assert
+    } kind = Empty;
+    uint8_t c = 0;
+    int index = -1;
+    int min = 0;
+    int max = 0;
+    bool greedy = true;
+    std::vector<Node> children;
+};
+
+struct Regex
+{
+    std::vector<Inst> code;
+    std::vector<std::bitset<256>> classes;
+    std::vector<std::string> names;
+    int groups = 1;
+    bool anchored = false;
+    bool has_first = false;
+    std::bitset<256> first;
+};
+
+static bool is_word(uint8_t c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+struct Parser
+{
+    const std::string &pattern;
+    size_t pos = 0;
+    bool icase = false;
+    bool multiline = false;
+    bool dotall = false;
+    Regex &regex;
+    std::string error;
+    int depth = 0;
+
+    Parser(const std::string &pattern, Regex &regex) : pattern(pattern), regex(regex)
+    {
+    }
+
+    bool fail(std::string message)
+    {
+        if (error.empty())
+        {
+            error = message + " at position " + std::to_string(pos);
+        }
+        return false;
+    }
+
+    bool more()
+    {
+        return pos < pattern.size();
+    }
+
+    char peek()
+    {
+        return pattern[pos];
+    }
+
+    int add_class(std::bitset<256> set)
+    {
+        if (icase)
+        {
+            for (int c = 'a'; c <= 'z'; c++)
+            {
+                if (set[c] || set[c - 32])
+                {
+                    set[c] = set[c - 32] = true;
+                }
+            }
+        }
+        regex.classes.push_back(set);
+        return (int)regex.classes.size() - 1;
+    }
+
+    static std::bitset<256> named_class(char name)
+    {
+        std::bitset<256> set;
+        switch (name)
+        {
+        case 'd':
+        case 'D':
+            for (int c = '0'; c <= '9'; c++)
+            {
+                set[c] = true;
+            }
+            break;
+        case 'w':
+        case 'W':
+            for (int c = 0; c < 256; c++)
+            {
+                set[c] = is_word(c);
+            }
+            break;
+        case 's':
+        case 'S':
+            for (char c : std::string(" \t\n\r\f\v"))
+            {
+                set[(uint8_t)c] = true;
+            }
+            break;
+        }
+        if (name >= 'A' && name <= 'Z')
+        {
+            set.flip();
+        }
+        return set;
+    }
+
+    bool parse_hex(int digits, uint8_t &out)
+    {
+        int value = 0;
+        for (int i = 0; i < digits; i++)
+        {
+            if (!more() || !isxdigit((unsigned char)peek()))
+            {
+                return fail("invalid \\x escape");
+            }
+            char c = pattern[pos++];
+            value = value * 16 + (isdigit((unsigned char)c) ? c - '0' : (tolower(c) - 'a' + 10));
+        }
+        out = (uint8_t)value;
+        return true;
+    }
+
+    // A single escaped byte, shared by atoms and classes
+    bool escaped_byte(char c, uint8_t &out)
+    {
+        switch (c)
+        {
+        case 'n':
+            out = '\n';
+            return true;
+        case 't':
+            out = '\t';
+            return true;
+        case 'r':
+            out = '\r';
+            return true;
+        case 'f':
+            out = '\f';
+            return true;
+        case 'v':
+            out = '\v';
+            return true;
+        case '0':
+            out = 0;
+            return true;
+        case 'x':
+            return parse_hex(2, out);
+        default:
+            if (isalnum((unsigned char)c))
+            {
+                return fail(std::string("unknown escape \\") + c);
+            }
+            out = (uint8_t)c;
+            return true;
+        }
+    }
+
+    bool parse_class(Node &node)
+    {
+        pos++;
+        bool negate = false;
+        if (more() && peek() == '^')
+        {
+            negate = true;
+            pos++;
+        }
+        std::bitset<256> set;
+        bool first = true;
+        while (true)
+        {
+            if (!more())
+            {
+                return fail("missing ']'");
+            }
+            char c = pattern[pos];
+            if (c == ']' && !first)
+            {
+                pos++;
+                break;
+            }
+            first = false;
+            pos++;
+
+            uint8_t low;
+            if (c == '\\')
+            {
+                if (!more())
+                {
+                    return fail("trailing '\\'");
+                }
+                char e = pattern[pos++];
+                if (e && strchr("dDwWsS", e))
+                {
+                    set |= named_class(e);
+                    continue;
+                }
+                if (e == 'b')
+                {
+                    low = '\b';
+                }
+                else if (!escaped_byte(e, low))
+                {
+                    return false;
+                }
+            }
+            else
+            {
+                low = (uint8_t)c;
+            }
+
+            uint8_t high = low;
+            if (pos + 1 < pattern.size() && pattern[pos] == '-' && pattern[pos + 1] != ']')
+            {
+                pos++;
+                char h = pattern[pos++];
+                if (h == '\\')
+                {
+                    if (!more())
+                    {
+                        return fail("trailing '\\'");
+                    }
+                    char e = pattern[pos++];
+                    if (e && strchr("dDwWsS", e))
+                    {
+                        return fail("invalid range in class");
+                    }
+                    if (e == 'b')
+                    {
+                        high = '\b';
+                    }
+                    else if (!escaped_byte(e, high))
+                    {
+                        return false;
+                    }
+                }
+                else
+                {
+                    high = (uint8_t)h;
+                }
+                if (high < low)
+                {
+                    return fail("invalid range in class");
+                }
+            }
+            for (int b = low; b <= high; b++)
+            {
+                set[b] = true;
+            }
+        }
+        if (icase)
+        {
+            for (int c = 'a'; c <= 'z'; c++)
+            {
+                if (set[c] || set[c - 32])
+                {
+                    set[c] = set[c - 32] = true;
+                }
+            }
+        }
+        if (negate)
+        {
+            set.flip();
+        }
+        node.kind = Node::Class;
+        regex.classes.push_back(set);
+        node.index = (int)regex.classes.size() - 1;
+        return true;
+    }
+
+    // {n}, {n,} or {n,m}. Anything else is a literal '{'
+    bool parse_braces(int &min, int &max)
+    {
+        size_t p = pos + 1;
+        auto number = [&](int &out)
+        {
+            size_t start = p;
+            long value = 0;
+            while (p < pattern.size() && isdigit((unsigned char)pattern[p]))
+            {
+                value = std::min(value * 10 + (pattern[p] - '0'), (long)REGEX_MAX_REPEAT + 1);
+                p++;
+            }
+            out = (int)value;
+            return p > start;
+        };
+        if (!number(min))
+        {
+            return false;
+        }
+        max = min;
+        if (p < pattern.size() && pattern[p] == ',')
+        {
+            p++;
+            if (!number(max))
+            {
+                max = -1;
+            }
+        }
+        if (p >= pattern.size() || pattern[p] != '}')
+        {
+            return false;
+        }
+        pos = p + 1;
+        return true;
+    }
+
+    bool parse_atom(Node &node)
+    {
+        char c = pattern[pos];
+        switch (c)
+        {
+        case '(':
+        {
+            pos++;
+            int index = -1;
+            if (pattern.compare(pos, 2, "?:") == 0)
+            {
+                pos += 2;
+            }
+            else if ((pattern.compare(pos, 2, "?<") == 0 && pattern.compare(pos, 3, "?<=") != 0 && pattern.compare(pos, 3, "?<!") != 0) || pattern.compare(pos, 3, "?P<") == 0)
+            {
+                pos += pattern[pos + 1] == 'P' ? 3 : 2;
+                size_t end = pattern.find('>', pos);
+                if (end == std::string::npos || end == pos)
+                {
+                    return fail("invalid group name");
+                }
+                std::string name = pattern.substr(pos, end - pos);
+                for (char n : name)
+                {
+                    if (!is_word(n))
+                    {
+                        return fail("invalid group name");
+                    }
+                }
+                for (std::string &existing : regex.names)
+                {
+                    if (existing == name)
+                    {
+                        return fail("duplicate group name '" + name + "'");
+                    }
+                }
+                pos = end + 1;
+                index = regex.groups++;
+                regex.names.resize(regex.groups);
+                regex.names[index] = name;
+            }
+            else if (more() && peek() == '?')
+            {
+                return fail("lookaround and inline flags are not supported");
+            }
+            else
+            {
+                index = regex.groups++;
+                regex.names.resize(regex.groups);
+            }
+            // Groups are parsed and compiled recursively
+            if (++depth > REGEX_MAX_DEPTH)
+            {
+                return fail("groups are nested deeper than " + std::to_string(REGEX_MAX_DEPTH));
+            }
+            Node inner;
+            if (!parse_alternate(inner))
+            {
+                return false;
+            }
+            depth--;
+            if (!more() || peek() != ')')
+            {
+                return fail("missing ')'");
+            }
+            pos++;
+            node.kind = Node::Group;
+            node.index = index;
+            node.children.push_back(std::move(inner));
+            return true;
+        }
+        case '[':
+            return parse_class(node);
+        case '.':
+            pos++;
+            node.kind = Node::Any;
+            return true;
+        case '^':
+            pos++;
+            node.kind = Node::Assert;
+            node.index = multiline ? BeginLine : BeginText;
+            return true;
+        case '$':
+            pos++;
+            node.kind = Node::Assert;
+            node.index = multiline ? EndLine : EndText;
+            return true;
+        case '*':
+        case '+':
+        case '?':
+            return fail("nothing to repeat");
+        case '{':
+        {
+            int min, max;
+            size_t start = pos;
+            if (parse_braces(min, max))
+            {
+                pos = start;
+                return fail("nothing to repeat");
+            }
+            pos++;
+            node.kind = Node::Literal;
+            node.c = '{';
+            return true;
+        }
+        case '\\':
+        {
+            pos++;
+            if (!more())
+            {
+                return fail("trailing '\\'");
+            }
+            char e = pattern[pos++];
+            if (e && strchr("dDwWsS", e))
+            {
+                node.kind = Node::Class;
+                node.index = add_class(named_class(e));
+                return true;
+            }
+            if (e == 'b' || e == 'B')
+            {
+                node.kind = Node::Assert;
+                node.index = e == 'b' ? WordBoundary : NotWordBoundary;
+                return true;
+            }
+            if (e == 'A' || e == 'z')
+            {
+                node.kind = Node::Assert;
+                node.index = e == 'A' ? BeginText : EndText;
+                return true;
+            }
+            if (e >= '1' && e <= '9')
+            {
+                return fail("backreferences are not supported");
+            }
+            node.kind = Node::Literal;
+            return escaped_byte(e, node.c);
+        }
+        default:
+            pos++;
+            node.kind = Node::Literal;
+            node.c = (uint8_t)c;
+            return true;
+        }
+    }
+
+    bool parse_concat(Node &node)
+    {
+        node.kind = Node::Concat;
+        while (more() && peek() != '|' && peek() != ')')
+        {
+            Node atom;
+            if (!parse_atom(atom))
+            {
+                return false;
+            }
+            if (more() && (peek() == '*' || peek() == '+' || peek() == '?' || peek() == '{'))
+            {
+                int min = 0, max = -1;
+                char q = peek();
+                if (q == '{')
+                {
+                    if (!parse_braces(min, max))
+                    {
+                        node.children.push_back(std::move(atom));
+                        continue;
+                    }
+                    if (min > REGEX_MAX_REPEAT || max > REGEX_MAX_REPEAT)
+                    {
+                        return fail("repeat count is larger than " + std::to_string(REGEX_MAX_REPEAT));
+                    }
+                    if (max != -1 && max < min)
+                    {
+                        return fail("invalid repeat range");
+                    }
+                }
+                else
+                {
+                    pos++;
+                    min = q == '+' ? 1 : 0;
+                    max = q == '?' ? 1 : -1;
+                }
+                if (atom.kind == Node::Assert)
+                {
+                    return fail("nothing to repeat");
+                }
+                Node repeat;
+                repeat.kind = Node::Repeat;
+                repeat.min = min;
+                repeat.max = max;
+                if (more() && peek() == '?')
+                {
+                    pos++;
+                    repeat.greedy = false;
+                }
+                if (more() && (peek() == '*' || peek() == '+' || peek() == '?'))
+                {
+                    return fail("multiple repeat");
+                }
+                repeat.children.push_back(std::move(atom));
+                atom = std::move(repeat);
+            }
+            node.children.push_back(std::move(atom));
+        }
+        return true;
+    }
+
+    bool parse_alternate(Node &node)
+    {
+        Node first;
+        if (!parse_concat(first))
+        {
+            return false;
+        }
+        if (!more() || peek() != '|')
+        {
+            node = std::move(first);
+            return true;
+        }
+        node.kind = Node::Alternate;
+        node.children.push_back(std::move(first));
+        while (more() && peek() == '|')
+        {
+            pos++;
+            Node branch;
+            if (!parse_concat(branch))
+            {
+                return false;
+            }
+            node.children.push_back(std::move(branch));
+        }
+        return true;
+    }
+
+    bool parse(Node &root)
+    {
+        if (!parse_alternate(root))
+        {
+            return false;
+        }
+        if (more())
+        {
+            return fail("unbalanced ')'");
+        }
+        return true;
+    }
+};
+
+struct Emitter
+{
+    Regex &regex;
+    bool icase;
+    bool dotall;
+    std::string error;
+
+    int emit(Op op, int x = 0, int y = 0, uint8_t c = 0)
+    {
+        Inst inst;
+        inst.op = op;
+        inst.x = x;
+        inst.y = y;
+        inst.c = c;
+        regex.code.push_back(inst);
+        return (int)regex.code.size() - 1;
+    }
+
+    int here()
+    {
+        return (int)regex.code.size();
+    }
+
+    bool compile(Node &node)
+    {
+        if (regex.code.size() > REGEX_MAX_PROGRAM)
+        {
+            error = "pattern is too large";
+            return false;
+        }
+        switch (node.kind)
+        {
+        case Node::Empty:
+            return true;
+        case Node::Literal:
+        {
+            uint8_t c = node.c;
+            if (icase && isalpha(c))
+            {
+                std::bitset<256> set;
+                set[tolower(c)] = set[toupper(c)] = true;
+                regex.classes.push_back(set);
+                emit(Op::Class, (int)regex.classes.size() - 1);
+            }
+            else
+            {
+                emit(Op::Char, 0, 0, c);
+            }
+            return true;
+        }
+        case Node::Any:
+            emit(dotall ? Op::AnyNewline : Op::Any);
+            return true;
+        case Node::Class:
+            emit(Op::Class, node.index);
+            return true;
+        case Node::Assert:
+            emit(Op::Assert, node.index);
+            return true;
+        case Node::Group:
+            if (node.index < 0)
+            {
+                return compile(node.children[0]);
+            }
+            emit(Op::Save, node.index * 2);
+            if (!compile(node.children[0]))
+            {
+                return false;
+            }
+            emit(Op::Save, node.index * 2 + 1);
+            return true;
+        case Node::Concat:
+            for (Node &child : node.children)
+            {
+                if (!compile(child))
+                {
+                    return false;
+                }
+            }
+            return true;
+        case Node::Alternate:
+        {
+            std::vector<int> jumps;
+            for (size_t i = 0; i < node.children.size(); i++)
+            {
+                if (i + 1 < node.children.size())
+                {
+                    int split = emit(Op::Split);
+                    regex.code[split].x = here();
+                    if (!compile(node.children[i]))
+                    {
+                        return false;
+                    }
+                    jumps.push_back(emit(Op::Jmp));
+                    regex.code[split].y = here();
+                }
+                else if (!compile(node.children[i]))
+                {
+                    return false;
+                }
+            }
+            for (int jump : jumps)
+            {
+                regex.code[jump].x = here();
+            }
+            return true;
+        }
+        case Node::Repeat:
+            return compile_repeat(node);
+        }
+        return true;
+    }
+
+    // Split prefers x, so greedy loops put the body first and lazy ones the
+    // exit
+    void set_split(int split, int body, int exit, bool greedy)
+    {
+        regex.code[split].x = greedy ? body : exit;
+        regex.code[split].y = greedy ? exit : body;
+    }
+
+    bool compile_repeat(Node &node)
+    {
+        Node &child = node.children[0];
+        bool unbounded_plus = node.max == -1 && node.min > 0;
+        for (int i = 0; i < node.min - (unbounded_plus ? 1 : 0); i++)
+        {
+            if (!compile(child))
+            {
+                return false;
+            }
+        }
+        if (node.max == -1)
+        {
+            if (unbounded_plus)
+            {
+                // x{n,} ends with x+, a copy of x that loops back to itself
+                int loop = here();
+                if (!compile(child))
+                {
+                    return false;
+                }
+                int split = emit(Op::Split);
+                set_split(split, loop, here(), node.greedy);
+                return true;
+            }
+            int split = emit(Op::Split);
+            int body = here();
+            if (!compile(child))
+            {
+                return false;
+            }
+            emit(Op::Jmp, split);
+            set_split(split, body, here(), node.greedy);
+            return true;
+        }
+        std::vector<int> splits;
+        for (int i = node.min; i < node.max; i++)
+        {
+            int split = emit(Op::Split);
+            splits.push_back(split);
+            regex.code[split].x = here();
+            if (!compile(child))
+            {
+                return false;
+            }
+        }
+        int end = here();
+        for (int split : splits)
+        {
+            set_split(split, split + 1, end, node.greedy);
+        }
+        return true;
+    }
+};
+
+static void compute_first(Regex &regex)
+{
+    std::vector<bool> seen(regex.code.size());
+    std::vector<int> stack = {0};
+    std::bitset<256> first;
+    while (!stack.empty())
+    {
+        int pc = stack.back();
+        stack.pop_back();
+        if (seen[pc])
+        {
+            continue;
+        }
+        seen[pc] = true;
+        Inst &inst = regex.code[pc];
+        switch (inst.op)
+        {
+        case Op::Char:
+            first[inst.c] = true;
+            break;
+        case Op::Any:
+            first.set();
+            first['\n'] = false;
+            break;
+        case Op::AnyNewline:
+            first.set();
+            break;
+        case Op::Class:
+            first |= regex.classes[inst.x];
+            break;
+        case Op::Split:
+            stack.push_back(inst.x);
+            stack.push_back(inst.y);
+            break;
+        case Op::Jmp:
+            stack.push_back(inst.x);
+            break;
+        case Op::Save:
+        case Op::Assert:
+            stack.push_back(pc + 1);
+            break;
+        case Op::Match:
+            return;
+        }
+    }
+    regex.has_first = !first.all();
+    regex.first = first;
+}
+
+static std::shared_ptr<Regex> compile_regex(const std::string &pattern, const std::string &flags, std::string &error)
+{
+    auto regex = std::make_shared<Regex>();
+    Parser parser(pattern, *regex);
+    for (char flag : flags)
+    {
+        if (flag == 'i')
+        {
+            parser.icase = true;
+        }
+        else if (flag == 'm')
+        {
+            parser.multiline = true;
+        }
+        else if (flag == 's')
+        {
+            parser.dotall = true;
+        }
+        else
+        {
+            error = std::string("Unknown regex flag '") + flag + "'";
+            return nullptr;
+        }
+    }
+    regex->names.resize(1);
+
+    Node root;
+    if (!parser.parse(root))
+    {
+        error = "Invalid regex: " + parser.error;
+        return nullptr;
+    }
+
+    Emitter emitter{*regex, parser.icase, parser.dotall};
+    emitter.emit(Op::Save, 0);
+    if (!emitter.compile(root))
+    {
+        error = "Invalid regex: " + emitter.error;
+        return nullptr;
+    }
+    emitter.emit(Op::Save, 1);
+    emitter.emit(Op::Match);
+
+    int pc = 1;
+    regex->anchored = regex->code[pc].op == Op::Assert && regex->code[pc].x == BeginText;
+    compute_first(*regex);
+    return regex;
+}
+
+// Compiled patterns are shared by every thread, keyed by flags and source
+static std::shared_ptr<Regex> get_regex(const std::string &pattern, const std::string &flags, std::string &error)
+{
+    static std::mutex cache_mutex;
+    static std::unordered_map<std::string, std::shared_ptr<Regex>> cache;
+
+    std::string key = flags + "/" + pattern;
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        auto cached = cache.find(key);
+        if (cached != cache.end())
+        {
+            return cached->second;
+        }
+    }
+
+    std::shared_ptr<Regex> regex = compile_regex(pattern, flags, error);
+    if (!regex)
+    {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    if (cache.size() >= REGEX_CACHE_SIZE)
+    {
+        cache.clear();
+    }
+    cache[key] = regex;
+    return regex;
+}
+
+struct ThreadList
+{
+    std::vector<int> dense;
+    std::vector<int> sparse;
+    std::vector<int> caps;
+    int count = 0;
+
+    void init(size_t size, int slots)
+    {
+        dense.resize(size);
+        sparse.resize(size);
+        caps.resize(size * slots);
+        count = 0;
+    }
+
+    bool contains(int pc)
+    {
+        int index = sparse[pc];
+        return index < count && dense[index] == pc;
+    }
+
+    int insert(int pc)
+    {
+        sparse[pc] = count;
+        dense[count] = pc;
+        return count++;
+    }
+};
+
+struct Matcher
+{
+    Regex &regex;
+    const std::string &text;
+    int slots;
+    ThreadList current;
+    ThreadList next;
+    std::vector<int> working;
+    std::vector<int> stack;
+
+    Matcher(Regex &regex, const std::string &text) : regex(regex), text(text), slots(regex.groups * 2)
+    {
+        current.init(regex.code.size(), slots);
+        next.init(regex.code.size(), slots);
+        working.resize(slots);
+    }
+
+    bool check(int kind, size_t pos)
+    {
+        size_t size = text.size();
+        switch (kind)
+        {
+        case BeginLine:
+            return pos == 0 || text[pos - 1] == '\n';
+        case EndLine:
+            return pos == size || text[pos] == '\n';
+        case BeginText:
+            return pos == 0;
+        case EndText:
+            return pos == size;
+        case WordBoundary:
+        case NotWordBoundary:
+        {
+            bool before = pos > 0 && is_word(text[pos - 1]);
+            bool after = pos < size && is_word(text[pos]);
+            return (before != after) == (kind == WordBoundary);
+        }
+        }
+        return false;
+    }
+
+    // Follows jumps, splits, saves and assertions from pc, adding every
+    // instruction reached to the list in priority order. Saves are undone
+    // on the way back, so 'caps' is unchanged afterwards
+    void add(ThreadList &list, int start_pc, int *caps, size_t pos)
+    {
+        // Entries >= 0 are pcs to visit, entries < 0 restore a slot
+        stack.clear();
+        stack.push_back(start_pc);
+        while (!stack.empty())
+        {
+            int entry = stack.back();
+            stack.pop_back();
+            if (entry < 0)
+            {
+                int slot = -entry - 1;
+                caps[slot] = stack.back();
+                stack.pop_back();
+                continue;
+            }
+            int pc = entry;
+            if (list.contains(pc))
+            {
+                continue;
+            }
+            int index = list.insert(pc);
+            Inst &inst = regex.code[pc];
+            switch (inst.op)
+            {
+            case Op::Jmp:
+                stack.push_back(inst.x);
+                break;
+            case Op::Split:
+                stack.push_back(inst.y);
+                stack.push_back(inst.x);
+                break;
+            case Op::Save:
+                stack.push_back(caps[inst.x]);
+                stack.push_back(-inst.x - 1);
+                caps[inst.x] = (int)pos;
+                stack.push_back(pc + 1);
+                break;
+            case Op::Assert:
+                if (check(inst.x, pos))
+                {
+                    stack.push_back(pc + 1);
+                }
+                break;
+            default:
+                memcpy(&list.caps[index * slots], caps, slots * sizeof(int));
+            }
+        }
+    }
+
+    // Finds the leftmost match starting at or after 'start' (or exactly at
+    // 'start' when anchored) and fills 'result' with its capture offsets
+    bool search(size_t start, bool anchored, std::vector<int> &result)
+    {
+        size_t size = text.size();
+        const uint8_t *bytes = (const uint8_t *)text.data();
+        bool matched = false;
+        current.count = 0;
+
+        for (size_t pos = start; pos <= size; pos++)
+        {
+            if (!matched && (pos == start || (!anchored && !regex.anchored)))
+            {
+                if (current.count == 0 && regex.has_first && !anchored)
+                {
+                    while (pos < size && !regex.first[bytes[pos]])
+                    {
+                        pos++;
+                    }
+                    if (pos == size)
+                    {
+                        break;
+                    }
+                }
+                std::fill(working.begin(), working.end(), -1);
+                add(current, 0, working.data(), pos);
+            }
+            if (current.count == 0)
+            {
+                break;
+            }
+
+            next.count = 0;
+            for (int i = 0; i < current.count; i++)
+            {
+                int pc = current.dense[i];
+                Inst &inst = regex.code[pc];
+                int *caps = &current.caps[i * slots];
+                bool advance = false;
+                switch (inst.op)
+                {
+                case Op::Char:
+                    advance = pos < size && bytes[pos] == inst.c;
+                    break;
+                case Op::Any:
+                    advance = pos < size && bytes[pos] != '\n';
+                    break;
+                case Op::AnyNewline:
+                    advance = pos < size;
+                    break;
+                case Op::Class:
+                    advance = pos < size && regex.classes[inst.x][bytes[pos]];
+                    break;
+                case Op::Match:
+                    result.assign(caps, caps + slots);
+                    matched = true;
+                    // Threads after this one have lower priority
+                    i = current.count;
+                    break;
+                default:
+                    break;
+                }
+                if (advance)
+                {
+                    add(next, pc + 1, caps, pos + 1);
+                }
+            }
+            std::swap(current, next);
+        }
+        return matched;
+    }
+};
+
+static Value match_value(const std::string &text, Regex &regex, std::vector<int> &caps)
+{
+    Value groups = list_val();
+    Value named = object_val();
+    for (int group = 1; group < regex.groups; group++)
+    {
+        int start = caps[group * 2];
+        int end = caps[group * 2 + 1];
+        Value value = start >= 0 && end >= 0 ? string_val(text.substr(start, end - start)) : none_val();
+        groups.get_list()->push_back(value);
+        if (!regex.names[group].empty())
+        {
+            named.get_object()->keys.push_back(regex.names[group]);
+            named.get_object()->values[regex.names[group]] = value;
+        }
+    }
+
+    Value match = object_val();
+    ObjectObj &object = *match.get_object();
+    object.keys = {"match", "start", "end", "groups", "named"};
+    object.values["match"] = string_val(text.substr(caps[0], caps[1] - caps[0]));
+    object.values["start"] = number_val(caps[0]);
+    object.values["end"] = number_val(caps[1]);
+    object.values["groups"] = groups;
+    object.values["named"] = named;
+    return match;
+}
+
+// Calls 'found' for each match, left to right. After an empty match the
+// next search starts one byte further on
+template <typename Callback>
+static void each_match(Regex &regex, const std::string &text, double limit, Callback found)
+{
+    Matcher matcher(regex, text);
+    std::vector<int> caps;
+    size_t pos = 0;
+    double count = 0;
+    while (pos <= text.size() && (limit < 0 || count < limit))
+    {
+        if (!matcher.search(pos, false, caps))
+        {
+            break;
+        }
+        found(caps);
+        count++;
+        pos = caps[1] == caps[0] ? caps[1] + 1 : caps[1];
+    }
+}
+
+static void expand_template(const std::string &text, Regex &regex, std::vector<int> &caps, const std::string &replacement, std::string &out)
+{
+    auto append_group = [&](int group)
+    {
+        if (group < regex.groups && caps[group * 2] >= 0 && caps[group * 2 + 1] >= 0)
+        {
+            out.append(text, caps[group * 2], caps[group * 2 + 1] - caps[group * 2]);
+        }
+    };
+
+    for (size_t i = 0; i < replacement.size(); i++)
+    {
+        char c = replacement[i];
+        if (c != '$' || i + 1 == replacement.size())
+        {
+            out += c;
+            continue;
+        }
+        char n = replacement[i + 1];
+        if (n == '$')
+        {
+            out += '$';
+            i++;
+        }
+        else if (isdigit((unsigned char)n))
+        {
+            int group = n - '0';
+            i++;
+            if (i + 1 < replacement.size() && isdigit((unsigned char)replacement[i + 1]) && group * 10 + (replacement[i + 1] - '0') < regex.groups)
+            {
+                group = group * 10 + (replacement[++i] - '0');
+            }
+            append_group(group);
+        }
+        else if (n == '{')
+        {
+            size_t end = replacement.find('}', i + 2);
+            if (end == std::string::npos)
+            {
+                out += c;
+                continue;
+            }
+            std::string name = replacement.substr(i + 2, end - i - 2);
+            int group = -1;
+            if (!name.empty() && std::all_of(name.begin(), name.end(), [](char d)
+                                             { return isdigit((unsigned char)d); }))
+            {
+                group = atoi(name.c_str());
+            }
+            else
+            {
+                for (int g = 1; g < regex.groups; g++)
+                {
+                    if (regex.names[g] == name)
+                    {
+                        group = g;
+                    }
+                }
+            }
+            if (group >= 0)
+            {
+                append_group(group);
+            }
+            i = end;
+        }
+        else
+        {
+            out += c;
+        }
+    }
+}
+
+static std::shared_ptr<Regex> regex_arg(std::vector<Value> &args, std::string &error)
+{
+    if (!args[0].is_string())
+    {
+        error = "Parameter 'pattern' must be a string";
+        return nullptr;
+    }
+    if (!args[1].is_string())
+    {
+        error = "Parameter 'flags' must be a string";
+        return nullptr;
+    }
+    return get_regex(args[0].get_string(), args[1].get_string(), error);
+}
+
+extern "C" Value compile(std::vector<Value> &args)
+{
+    int num_required_args = 2;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'compile' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    std::shared_ptr<Regex> regex = regex_arg(args, error);
+    if (!regex)
+    {
+        return error_object(error);
+    }
+
+    return number_val(regex->groups - 1);
+}
+
+static Value find_one(std::vector<Value> &args, const char *name, bool anchored)
+{
+    int num_required_args = 4;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function '" + std::string(name) + "' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    std::shared_ptr<Regex> regex = regex_arg(args, error);
+    if (!regex)
+    {
+        return error_object(error);
+    }
+
+    Value text = args[2];
+    Value start = args[3];
+
+    if (!text.is_string())
+    {
+        return error_object("Parameter 'text' must be a string");
+    }
+
+    if (!start.is_number() || start.get_number() < 0)
+    {
+        return error_object("Parameter 'start' must be a positive number");
+    }
+
+    const std::string &str = text.get_string();
+    if (start.get_number() > str.size())
+    {
+        return none_val();
+    }
+
+    Matcher matcher(*regex, str);
+    std::vector<int> caps;
+    if (!matcher.search((size_t)start.get_number(), anchored, caps))
+    {
+        return none_val();
+    }
+
+    return match_value(str, *regex, caps);
+}
+
+extern "C" Value match(std::vector<Value> &args)
+{
+    return find_one(args, "match", true);
+}
+
+extern "C" Value search(std::vector<Value> &args)
+{
+    return find_one(args, "search", false);
+}
+
+extern "C" Value test(std::vector<Value> &args)
+{
+    int num_required_args = 3;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'test' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    std::shared_ptr<Regex> regex = regex_arg(args, error);
+    if (!regex)
+    {
+        return error_object(error);
+    }
+
+    Value text = args[2];
+
+    if (!text.is_string())
+    {
+        return error_object("Parameter 'text' must be a string");
+    }
+
+    Matcher matcher(*regex, text.get_string());
+    std::vector<int> caps;
+    return boolean_val(matcher.search(0, false, caps));
+}
+
+extern "C" Value findall(std::vector<Value> &args)
+{
+    int num_required_args = 4;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'findall' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    std::shared_ptr<Regex> regex = regex_arg(args, error);
+    if (!regex)
+    {
+        return error_object(error);
+    }
+
+    Value text = args[2];
+    Value limit = args[3];
+
+    if (!text.is_string())
+    {
+        return error_object("Parameter 'text' must be a string");
+    }
+
+    if (!limit.is_number())
+    {
+        return error_object("Parameter 'limit' must be a number");
+    }
+
+    const std::string &str = text.get_string();
+    Value matches = list_val();
+    each_match(*regex, str, limit.get_number(), [&](std::vector<int> &caps)
+               { matches.get_list()->push_back(match_value(str, *regex, caps)); });
+
+    return matches;
+}
+
+extern "C" Value replace(std::vector<Value> &args)
+{
+    int num_required_args = 5;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'replace' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    std::shared_ptr<Regex> regex = regex_arg(args, error);
+    if (!regex)
+    {
+        return error_object(error);
+    }
+
+    Value text = args[2];
+    Value replacement = args[3];
+    Value limit = args[4];
+
+    if (!text.is_string())
+    {
+        return error_object("Parameter 'text' must be a string");
+    }
+
+    if (!replacement.is_string())
+    {
+        return error_object("Parameter 'replacement' must be a string or function");
+    }
+
+    if (!limit.is_number())
+    {
+        return error_object("Parameter 'count' must be a number");
+    }
+
+    const std::string &str = text.get_string();
+    const std::string &with = replacement.get_string();
+    std::string out;
+    out.reserve(str.size());
+    size_t last = 0;
+    each_match(*regex, str, limit.get_number(), [&](std::vector<int> &caps)
+               {
+        out.append(str, last, caps[0] - last);
+        expand_template(str, *regex, caps, with, out);
+        last = caps[1]; });
+    out.append(str, last, std::string::npos);
+
+    return string_val(std::move(out));
+}
+
+extern "C" Value split(std::vector<Value> &args)
+{
+    int num_required_args = 4;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'split' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    std::shared_ptr<Regex> regex = regex_arg(args, error);
+    if (!regex)
+    {
+        return error_object(error);
+    }
+
+    Value text = args[2];
+    Value limit = args[3];
+
+    if (!text.is_string())
+    {
+        return error_object("Parameter 'text' must be a string");
+    }
+
+    if (!limit.is_number())
+    {
+        return error_object("Parameter 'limit' must be a number");
+    }
+
+    const std::string &str = text.get_string();
+    Value pieces = list_val();
+    size_t last = 0;
+    each_match(*regex, str, limit.get_number(), [&](std::vector<int> &caps)
+               {
+        pieces.get_list()->push_back(string_val(str.substr(last, caps[0] - last)));
+        last = caps[1]; });
+    pieces.get_list()->push_back(string_val(str.substr(last)));
+
+    return pieces;
+}
+
+// Joins the text around 'matches' (from findall) with 'replacements', for
+// replacements computed in Vortex
+extern "C" Value splice(std::vector<Value> &args)
+{
+    int num_required_args = 3;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'splice' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    Value text = args[0];
+    Value matches = args[1];
+    Value replacements = args[2];
+
+    if (!text.is_string() || !matches.is_list() || !replacements.is_list() || matches.get_list()->size() != replacements.get_list()->size())
+    {
+        return error_object("Function 'splice' expects a string and two lists of the same length");
+    }
+
+    const std::string &str = text.get_string();
+    std::string out;
+    out.reserve(str.size());
+    size_t last = 0;
+    for (size_t i = 0; i < matches.get_list()->size(); i++)
+    {
+        Value &match = matches.get_list()->at(i);
+        Value &with = replacements.get_list()->at(i);
+        if (!match.is_object() || !with.is_string())
+        {
+            return error_object("Function 'splice' expects match objects and string replacements");
+        }
+        size_t start = (size_t)match.get_object()->values["start"].get_number();
+        size_t end = (size_t)match.get_object()->values["end"].get_number();
+        if (start < last || end < start || end > str.size())
+        {
+            return error_object("Function 'splice' expects matches in order");
+        }
+        out.append(str, last, start - last);
+        out += with.get_string();
+        last = end;
+    }
+    out.append(str, last, std::string::npos);
+
+    return string_val(std::move(out));
+}
@@ -2,6 +2,9 @@
 #if defined(__APPLE__)
 #define CPPHTTPLIB_USE_CERTS_FROM_MACOSX_KEYCHAIN
 #endif
+#include <atomic>
+#include <mutex>
+#include <thread>
 #include "include/Vortex.hpp"
 #include "include/httplib.h"
 
@@ -103,530 +106,728 @@ std::string valueToString(Value value, bool quote_strings = false)
     }
 }
 
-extern "C" Value _get(std::vector<Value> &args)
+struct Url
 {
-    int num_required_args = 3;
+    std::string scheme;
+    std::string host;
+    int port = 0;
+    std::string path;
+    std::string query;
+    std::string fragment;
 
-    if (args.size() != num_required_args)
+    // scheme://host:port, the key clients are pooled by
+    std::string origin() const
     {
-        return error_object("Function 'get' expects " + std::to_string(num_required_args) + " argument(s)");
+        std::string out = scheme + "://";
+        out += host.find(':') != std::string::npos ? "[" + host + "]" : host;
+        return out + ":" + std::to_string(port);
     }
 
-    Value url = args[0];
-    Value endpoint = args[1];
-    Value headers = args[2];
-
-    if (!url.is_string())
+    std::string target() const
     {
-        return error_object("Function 'get' expects argument 'url' to be a string");
+        return query.empty() ? path : path + "?" + query;
     }
+};
 
-    if (!endpoint.is_string())
+static bool parse_url(const std::string &text, Url &url, std::string &error)
+{
+    size_t pos = 0;
+    size_t scheme_end = text.find("://");
+    if (scheme_end != std::string::npos)
     {
-        return error_object("Function 'get' expects argument 'endpoint' to be a string");
+        url.scheme = text.substr(0, scheme_end);
+        std::transform(url.scheme.begin(), url.scheme.end(), url.scheme.begin(), ::tolower);
+        pos = scheme_end + 3;
     }
-
-    if (!headers.is_object())
+    else
     {
-        return error_object("Function 'get' expects argument 'headers' to be a object");
+        url.scheme = "http";
     }
 
-    httplib::Headers _headers;
-    for (auto &prop : headers.get_object()->values)
+    if (url.scheme != "http" && url.scheme != "https")
     {
-        _headers.insert({prop.first, valueToString(prop.second)});
+        error = "Unsupported URL scheme '" + url.scheme + "'";
+        return false;
     }
 
-    httplib::Client cli(url.get_string());
-#if defined(__APPLE__) || defined(__linux__)
-    cli.enable_server_certificate_verification(false);
-#endif
-
-    auto res = cli.Get(endpoint.get_string(), _headers);
-
-    Value response = object_val();
-    response.get_object()->keys = {"version", "status", "body", "location", "headers"};
-
-    if (!res)
+    size_t authority_end = text.find_first_of("/?#", pos);
+    if (authority_end == std::string::npos)
     {
-        response.get_object()->values["version"] = string_val("");
-        response.get_object()->values["status"] = number_val(-1);
-        response.get_object()->values["body"] = string_val("");
-        response.get_object()->values["location"] = string_val("");
-        response.get_object()->values["headers"] = list_val();
-        return response;
+        authority_end = text.size();
     }
-
-    response.get_object()->values["version"] = string_val(res->version);
-    response.get_object()->values["status"] = number_val(res->status);
-    response.get_object()->values["body"] = string_val(res->body);
-    response.get_object()->values["location"] = string_val(res->location);
-    response.get_object()->values["headers"] = list_val();
-    for (auto &elem : res->headers)
+    std::string authority = text.substr(pos, authority_end - pos);
+    size_t at = authority.rfind('@');
+    if (at != std::string::npos)
     {
-        response.get_object()->values["headers"].get_list()->push_back(string_val(elem.first));
+        authority = authority.substr(at + 1);
     }
 
-    return response;
-}
-
-extern "C" Value _post(std::vector<Value> &args)
-{
-    int num_required_args = 4;
-
-    if (args.size() != num_required_args)
+    std::string port;
+    if (!authority.empty() && authority[0] == '[')
     {
-        return error_object("Function 'post' expects " + std::to_string(num_required_args) + " argument(s)");
+        size_t close = authority.find(']');
+        if (close == std::string::npos)
+        {
+            error = "Invalid URL '" + text + "'";
+            return false;
+        }
+        url.host = authority.substr(1, close - 1);
+        if (close + 1 < authority.size())
+        {
+            if (authority[close + 1] != ':')
+            {
+                error = "Invalid URL '" + text + "'";
+                return false;
+            }
+            port = authority.substr(close + 2);
+        }
     }
-
-    Value url = args[0];
-    Value endpoint = args[1];
-    Value payload = args[2];
-    Value headers = args[3];
-
-    if (!url.is_string())
+    else
     {
-        return error_object("Function 'post' expects argument 'url' to be a string");
+        size_t colon = authority.find(':');
+        url.host = authority.substr(0, colon);
+        if (colon != std::string::npos)
+        {
+            port = authority.substr(colon + 1);
+        }
     }
 
-    if (!endpoint.is_string())
+    if (url.host.empty())
     {
-        return error_object("Function 'post' expects argument 'endpoint' to be a string");
+        error = "Invalid URL '" + text + "': missing host";
+        return false;
     }
 
-    if (!payload.is_object() && !payload.is_string())
+    if (port.empty())
     {
-        return error_object("Function 'post' expects argument 'payload' to be an object or string");
+        url.port = url.scheme == "https" ? 443 : 80;
+    }
+    else
+    {
+        if (port.size() > 5 || !std::all_of(port.begin(), port.end(), ::isdigit) || std::stoi(port) > 65535)
+        {
+            error = "Invalid URL '" + text + "': bad port";
+            return false;
+        }
+        url.port = std::stoi(port);
     }
 
-    if (!headers.is_object())
+    pos = authority_end;
+    size_t fragment = text.find('#', pos);
+    if (fragment != std::string::npos)
+    {
+        url.fragment = text.substr(fragment + 1);
+    }
+    std::string rest = text.substr(pos, fragment == std::string::npos ? std::string::npos : fragment - pos);
+    size_t query = rest.find('?');
+    url.path = rest.substr(0, query);
+    if (query != std::string::npos)
     {
-        return error_object("Function 'post' expects argument 'headers' to be an object");
+        url.query = rest.substr(query + 1);
     }
+    if (url.path.empty())
+    {
+        url.path = "/";
+    }
+    return true;
+}
 
-    httplib::Client cli(url.get_string());
+// Everything a request needs, copied out of Values so that it can be sent
+// from a worker thread
+struct RequestSpec
+{
+    std::string method;
+    Url url;
+    httplib::Headers headers;
+    bool has_body = false;
+    bool multipart = false;
+    std::string body;
+    httplib::MultipartFormDataItems items;
+    double timeout = 0;
+};
+
+struct ResponseData
+{
+    bool ok = false;
+    std::string error;
+    std::string version;
+    int status = -1;
+    std::string body;
+    std::string location;
+    httplib::Headers headers;
+};
+
+// Idle clients are kept per origin. A client holds its connection open
+// between requests, so taking one from the pool skips the TCP and TLS
+// handshakes
+struct Session
+{
+    std::mutex mutex;
+    std::unordered_map<std::string, std::vector<std::unique_ptr<httplib::Client>>> idle;
+    httplib::Headers headers;
+    double timeout = 30;
+    size_t pool_size = 8;
 #if defined(__APPLE__)
-    cli.enable_server_certificate_verification(false);
+    bool verify = false;
+#else
+    bool verify = true;
 #endif
 
-    httplib::Headers _headers;
-    for (auto &prop : headers.get_object()->values)
+    std::unique_ptr<httplib::Client> acquire(const std::string &origin)
     {
-        _headers.insert({prop.first, valueToString(prop.second)});
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto &clients = idle[origin];
+            if (!clients.empty())
+            {
+                std::unique_ptr<httplib::Client> client = std::move(clients.back());
+                clients.pop_back();
+                return client;
+            }
+        }
+        auto client = std::make_unique<httplib::Client>(origin);
+        client->set_keep_alive(true);
+        client->set_tcp_nodelay(true);
+#ifdef CPPHTTPLIB_OPENSSL_SUPPORT
+        client->enable_server_certificate_verification(verify);
+#endif
+        return client;
     }
 
-    httplib::Result res = httplib::Result(nullptr, httplib::Error());
-
-    if (payload.is_object())
+    void release(const std::string &origin, std::unique_ptr<httplib::Client> client)
     {
-        httplib::MultipartFormDataItems items;
-        for (auto &prop : payload.get_object()->values)
+        std::lock_guard<std::mutex> lock(mutex);
+        auto &clients = idle[origin];
+        if (clients.size() < pool_size)
         {
-            items.push_back({prop.first, valueToString(prop.second), "", ""});
+            clients.push_back(std::move(client));
         }
-        res = cli.Post(endpoint.get_string(), _headers, items);
     }
-    else
+};
+
+static Session default_session;
+
+static ResponseData perform(Session &session, const RequestSpec &spec)
+{
+    ResponseData data;
+    std::string origin = spec.url.origin();
+    std::unique_ptr<httplib::Client> client = session.acquire(origin);
+
+    double timeout = spec.timeout > 0 ? spec.timeout : session.timeout;
+    time_t sec = (time_t)timeout;
+    time_t usec = (time_t)((timeout - sec) * 1000000);
+    client->set_connection_timeout(sec, usec);
+    client->set_read_timeout(sec, usec);
+    client->set_write_timeout(sec, usec);
+
+    httplib::Headers headers = session.headers;
+    for (auto &header : spec.headers)
     {
-        res = cli.Post(endpoint.get_string(), _headers, payload.get_string(), "");
+        headers.erase(header.first);
     }
+    headers.insert(spec.headers.begin(), spec.headers.end());
 
-    Value response = object_val();
-    response.get_object()->keys = {"version", "status", "body", "location", "headers"};
+    std::string target = spec.url.target();
+    const std::string &method = spec.method;
+    httplib::Result res(nullptr, httplib::Error::Unknown);
+
+    if (method == "GET")
+    {
+        res = client->Get(target, headers);
+    }
+    else if (method == "POST")
+    {
+        res = spec.multipart ? client->Post(target, headers, spec.items) : client->Post(target, headers, spec.body, "");
+    }
+    else if (method == "PUT")
+    {
+        res = spec.multipart ? client->Put(target, headers, spec.items) : client->Put(target, headers, spec.body, "");
+    }
+    else if (method == "PATCH")
+    {
+        res = client->Patch(target, headers, spec.body, "");
+    }
+    else if (method == "DELETE")
+    {
+        res = spec.has_body ? client->Delete(target, headers, spec.body, "") : client->Delete(target, headers);
+    }
+    else if (method == "OPTIONS")
+    {
+        res = client->Options(target, headers);
+    }
+    else if (method == "HEAD")
+    {
+        res = client->Head(target, headers);
+    }
 
     if (!res)
     {
-        response.get_object()->values["version"] = string_val("");
-        response.get_object()->values["status"] = number_val(-1);
-        response.get_object()->values["body"] = string_val("");
-        response.get_object()->values["location"] = string_val("");
-        response.get_object()->values["headers"] = list_val();
-        return response;
+        data.error = httplib::to_string(res.error());
+        return data;
     }
 
-    response.get_object()->values["version"] = string_val(res->version);
-    response.get_object()->values["status"] = number_val(res->status);
-    response.get_object()->values["body"] = string_val(res->body);
-    response.get_object()->values["location"] = string_val(res->location);
+    data.ok = true;
+    data.version = res->version;
+    data.status = res->status;
+    data.body = std::move(res->body);
+    data.location = res->location;
+    data.headers = res->headers;
+
+    // A client whose connection failed or was closed by the server is
+    // simply dropped
+    session.release(origin, std::move(client));
+    return data;
+}
+
+static Value response_value(ResponseData &data)
+{
+    Value response = object_val();
+    response.get_object()->keys = {"version", "status", "body", "location", "headers", "error"};
+    response.get_object()->values["version"] = string_val(data.version);
+    response.get_object()->values["status"] = number_val(data.status);
+    response.get_object()->values["body"] = string_val(std::move(data.body));
+    response.get_object()->values["location"] = string_val(data.location);
     response.get_object()->values["headers"] = list_val();
-    for (auto &elem : res->headers)
+    for (auto &elem : data.headers)
     {
         response.get_object()->values["headers"].get_list()->push_back(string_val(elem.first));
     }
-
+    response.get_object()->values["error"] = data.ok ? none_val() : string_val(data.error);
     return response;
 }
 
-extern "C" Value _put(std::vector<Value> &args)
+static bool read_headers(Value &headers, httplib::Headers &out, std::string &error)
 {
-    int num_required_args = 4;
-
-    if (args.size() != num_required_args)
+    if (headers.is_none())
     {
-        return error_object("Function 'put' expects " + std::to_string(num_required_args) + " argument(s)");
+        return true;
     }
-
-    Value url = args[0];
-    Value endpoint = args[1];
-    Value payload = args[2];
-    Value headers = args[3];
-
-    if (!url.is_string())
+    if (!headers.is_object())
     {
-        return error_object("Function 'put' expects argument 'url' to be a string");
+        error = "Parameter 'headers' must be an object";
+        return false;
     }
-
-    if (!endpoint.is_string())
+    for (auto &prop : headers.get_object()->values)
     {
-        return error_object("Function 'put' expects argument 'endpoint' to be a string");
+        out.insert({prop.first, valueToString(prop.second)});
     }
+    return true;
+}
 
-    if (!payload.is_object() && !payload.is_string())
+static bool read_request(const std::string &method, Value &url, Value &payload, Value &headers, RequestSpec &spec, std::string &error)
+{
+    static const std::vector<std::string> methods = {"GET", "POST", "PUT", "PATCH", "DELETE", "OPTIONS", "HEAD"};
+    spec.method = method;
+    std::transform(spec.method.begin(), spec.method.end(), spec.method.begin(), ::toupper);
+    if (std::find(methods.begin(), methods.end(), spec.method) == methods.end())
     {
-        return error_object("Function 'put' expects argument 'payload' to be an object or string");
+        error = "Unsupported request method '" + method + "'";
+        return false;
     }
 
-    if (!headers.is_object())
+    if (!url.is_string())
     {
-        return error_object("Function 'put' expects argument 'headers' to be an object");
+        error = "Parameter 'url' must be a string";
+        return false;
     }
 
-    httplib::Client cli(url.get_string());
-#if defined(__APPLE__)
-    cli.enable_server_certificate_verification(false);
-#endif
-
-    httplib::Headers _headers;
-    for (auto &prop : headers.get_object()->values)
+    if (!parse_url(url.get_string(), spec.url, error) || !read_headers(headers, spec.headers, error))
     {
-        _headers.insert({prop.first, valueToString(prop.second)});
+        return false;
     }
 
-    httplib::Result res = httplib::Result(nullptr, httplib::Error());
+    if (payload.is_none())
+    {
+        return true;
+    }
 
-    if (payload.is_object())
+    spec.has_body = true;
+    if (payload.is_string())
+    {
+        spec.body = payload.get_string();
+    }
+    else if (payload.is_object() && (spec.method == "POST" || spec.method == "PUT"))
     {
-        httplib::MultipartFormDataItems items;
+        spec.multipart = true;
         for (auto &prop : payload.get_object()->values)
         {
-            items.push_back({prop.first, valueToString(prop.second), "", ""});
+            spec.items.push_back({prop.first, valueToString(prop.second), "", ""});
         }
-        res = cli.Put(endpoint.get_string(), _headers, items);
+    }
+    else if (payload.is_object())
+    {
+        spec.body = valueToString(payload, true);
     }
     else
     {
-        res = cli.Put(endpoint.get_string(), _headers, payload.get_string(), "");
+        error = "Parameter 'payload' must be an object or string";
+        return false;
     }
+    return true;
+}
 
-    Value response = object_val();
-    response.get_object()->keys = {"version", "status", "body", "location", "headers"};
-
-    if (!res)
+static Session *get_session(Value &session, std::string &error)
+{
+    if (session.is_none())
     {
-        response.get_object()->values["version"] = string_val("");
-        response.get_object()->values["status"] = number_val(-1);
-        response.get_object()->values["body"] = string_val("");
-        response.get_object()->values["location"] = string_val("");
-        response.get_object()->values["headers"] = list_val();
-        return response;
+        return &default_session;
     }
-
-    response.get_object()->values["version"] = string_val(res->version);
-    response.get_object()->values["status"] = number_val(res->status);
-    response.get_object()->values["body"] = string_val(res->body);
-    response.get_object()->values["location"] = string_val(res->location);
-    response.get_object()->values["headers"] = list_val();
-    for (auto &elem : res->headers)
+    if (!session.is_pointer())
     {
-        response.get_object()->values["headers"].get_list()->push_back(string_val(elem.first));
+        error = "Parameter 'session' must be a pointer";
+        return nullptr;
     }
-
-    return response;
+    Session *ptr = (Session *)session.get_pointer()->value;
+    if (!ptr)
+    {
+        error = "Session is closed";
+    }
+    return ptr;
 }
 
-extern "C" Value _patch(std::vector<Value> &args)
+// The original per-method entry points, now sent through the default session
+static Value request_with(const char *name, const std::string &method, std::vector<Value> &args, bool with_payload)
 {
-    int num_required_args = 4;
+    int num_required_args = with_payload ? 4 : 3;
 
     if (args.size() != num_required_args)
     {
-        return error_object("Function 'patch' expects " + std::to_string(num_required_args) + " argument(s)");
+        return error_object("Function '" + std::string(name) + "' expects " + std::to_string(num_required_args) + " argument(s)");
     }
 
     Value url = args[0];
     Value endpoint = args[1];
-    Value payload = args[2];
-    Value headers = args[3];
+    Value payload = with_payload ? args[2] : none_val();
+    Value headers = args[with_payload ? 3 : 2];
 
     if (!url.is_string())
     {
-        return error_object("Function 'patch' expects argument 'url' to be a string");
+        return error_object("Function '" + std::string(name) + "' expects argument 'url' to be a string");
     }
 
     if (!endpoint.is_string())
     {
-        return error_object("Function 'patch' expects argument 'endpoint' to be a string");
+        return error_object("Function '" + std::string(name) + "' expects argument 'endpoint' to be a string");
     }
 
-    if (!payload.is_object() && !payload.is_string())
+    Value full_url = string_val(url.get_string() + endpoint.get_string());
+    RequestSpec spec;
+    std::string error;
+    if (!read_request(method, full_url, payload, headers, spec, error))
     {
-        return error_object("Function 'patch' expects argument 'payload' to be an object or string");
+        return error_object("Function '" + std::string(name) + "': " + error);
     }
 
-    if (!headers.is_object())
-    {
-        return error_object("Function 'patch' expects argument 'headers' to be an object");
-    }
+    ResponseData data = perform(default_session, spec);
+    return response_value(data);
+}
 
-    httplib::Client cli(url.get_string());
-#if defined(__APPLE__)
-    cli.enable_server_certificate_verification(false);
-#endif
+extern "C" Value _get(std::vector<Value> &args)
+{
+    return request_with("get", "GET", args, false);
+}
 
-    httplib::Headers _headers;
-    for (auto &prop : headers.get_object()->values)
-    {
-        _headers.insert({prop.first, valueToString(prop.second)});
-    }
+extern "C" Value _post(std::vector<Value> &args)
+{
+    return request_with("post", "POST", args, true);
+}
 
-    std::string _payload;
+extern "C" Value _put(std::vector<Value> &args)
+{
+    return request_with("put", "PUT", args, true);
+}
 
-    if (payload.is_string())
-    {
-        _payload = payload.get_string();
-    }
-    else
+extern "C" Value _patch(std::vector<Value> &args)
+{
+    return request_with("patch", "PATCH", args, true);
+}
+
+extern "C" Value _delete(std::vector<Value> &args)
+{
+    return request_with("delete", "DELETE", args, false);
+}
+
+extern "C" Value _options(std::vector<Value> &args)
+{
+    return request_with("options", "OPTIONS", args, false);
+}
+
+extern "C" Value _head(std::vector<Value> &args)
+{
+    return request_with("head", "HEAD", args, false);
+}
+
+extern "C" Value url_parse(std::vector<Value> &args)
+{
+    int num_required_args = 1;
+
+    if (args.size() != num_required_args)
     {
-        _payload = valueToString(payload, true);
+        return error_object("Function 'url_parse' expects " + std::to_string(num_required_args) + " argument(s)");
     }
 
-    httplib::Result res = cli.Patch(endpoint.get_string(), _headers, _payload, "");
+    Value text = args[0];
 
-    Value response = object_val();
-    response.get_object()->keys = {"version", "status", "body", "location", "headers"};
-
-    if (!res)
+    if (!text.is_string())
     {
-        response.get_object()->values["version"] = string_val("");
-        response.get_object()->values["status"] = number_val(-1);
-        response.get_object()->values["body"] = string_val("");
-        response.get_object()->values["location"] = string_val("");
-        response.get_object()->values["headers"] = list_val();
-        return response;
+        return error_object("Parameter 'url' must be a string");
     }
 
-    response.get_object()->values["version"] = string_val(res->version);
-    response.get_object()->values["status"] = number_val(res->status);
-    response.get_object()->values["body"] = string_val(res->body);
-    response.get_object()->values["location"] = string_val(res->location);
-    response.get_object()->values["headers"] = list_val();
-    for (auto &elem : res->headers)
+    Url url;
+    std::string error;
+    if (!parse_url(text.get_string(), url, error))
     {
-        response.get_object()->values["headers"].get_list()->push_back(string_val(elem.first));
+        return error_object(error);
     }
 
-    return response;
+    Value parsed = object_val();
+    ObjectObj &object = *parsed.get_object();
+    object.keys = {"scheme", "host", "port", "path", "query", "fragment", "origin"};
+    object.values["scheme"] = string_val(url.scheme);
+    object.values["host"] = string_val(url.host);
+    object.values["port"] = number_val(url.port);
+    object.values["path"] = string_val(url.path);
+    object.values["query"] = string_val(url.query);
+    object.values["fragment"] = string_val(url.fragment);
+    object.values["origin"] = string_val(url.origin());
+    return parsed;
 }
 
-extern "C" Value _delete(std::vector<Value> &args)
+extern "C" Value session_new(std::vector<Value> &args)
 {
-    int num_required_args = 3;
+    int num_required_args = 1;
 
     if (args.size() != num_required_args)
     {
-        return error_object("Function 'delete' expects " + std::to_string(num_required_args) + " argument(s)");
+        return error_object("Function 'session_new' expects " + std::to_string(num_required_args) + " argument(s)");
     }
 
-    Value url = args[0];
-    Value endpoint = args[1];
-    Value headers = args[2];
+    Value options = args[0];
 
-    if (!url.is_string())
+    if (!options.is_object())
     {
-        return error_object("Function 'delete' expects argument 'url' to be a string");
+        return error_object("Parameter 'options' must be an object");
     }
 
-    if (!endpoint.is_string())
-    {
-        return error_object("Function 'delete' expects argument 'endpoint' to be a string");
-    }
+    auto session = std::make_unique<Session>();
+    auto &values = options.get_object()->values;
+    std::string error;
 
-    if (!headers.is_object())
+    if (values.count("timeout"))
     {
-        return error_object("Function 'delete' expects argument 'headers' to be a object");
+        if (!values["timeout"].is_number() || values["timeout"].get_number() <= 0)
+        {
+            return error_object("Option 'timeout' must be a positive number of seconds");
+        }
+        session->timeout = values["timeout"].get_number();
     }
-
-    httplib::Headers _headers;
-    for (auto &prop : headers.get_object()->values)
+    if (values.count("poolSize"))
     {
-        _headers.insert({prop.first, valueToString(prop.second)});
+        if (!values["poolSize"].is_number() || values["poolSize"].get_number() < 0)
+        {
+            return error_object("Option 'poolSize' must be a positive number");
+        }
+        session->pool_size = (size_t)values["poolSize"].get_number();
     }
-
-    httplib::Client cli(url.get_string());
-#if defined(__APPLE__)
-    cli.enable_server_certificate_verification(false);
-#endif
-
-    auto res = cli.Delete(endpoint.get_string(), _headers);
-
-    Value response = object_val();
-    response.get_object()->keys = {"version", "status", "body", "location", "headers"};
-
-    if (!res)
+    if (values.count("verify"))
     {
-        response.get_object()->values["version"] = string_val("");
-        response.get_object()->values["status"] = number_val(-1);
-        response.get_object()->values["body"] = string_val("");
-        response.get_object()->values["location"] = string_val("");
-        response.get_object()->values["headers"] = list_val();
-        return response;
+        if (!values["verify"].is_boolean())
+        {
+            return error_object("Option 'verify' must be a boolean");
+        }
+        session->verify = values["verify"].get_boolean();
     }
-
-    response.get_object()->values["version"] = string_val(res->version);
-    response.get_object()->values["status"] = number_val(res->status);
-    response.get_object()->values["body"] = string_val(res->body);
-    response.get_object()->values["location"] = string_val(res->location);
-    response.get_object()->values["headers"] = list_val();
-    for (auto &elem : res->headers)
+    if (values.count("headers") && !read_headers(values["headers"], session->headers, error))
     {
-        response.get_object()->values["headers"].get_list()->push_back(string_val(elem.first));
+        return error_object(error);
     }
 
-    return response;
+    Value handle = pointer_val();
+    handle.get_pointer()->value = session.release();
+    return handle;
 }
 
-extern "C" Value _options(std::vector<Value> &args)
+extern "C" Value session_close(std::vector<Value> &args)
 {
-    int num_required_args = 3;
+    int num_required_args = 1;
 
     if (args.size() != num_required_args)
     {
-        return error_object("Function 'options' expects " + std::to_string(num_required_args) + " argument(s)");
+        return error_object("Function 'session_close' expects " + std::to_string(num_required_args) + " argument(s)");
     }
 
-    Value url = args[0];
-    Value endpoint = args[1];
-    Value headers = args[2];
-
-    if (!url.is_string())
+    std::string error;
+    Session *session = get_session(args[0], error);
+    if (!session)
     {
-        return error_object("Function 'options' expects argument 'url' to be a string");
+        return error_object(error);
     }
 
-    if (!endpoint.is_string())
+    if (session == &default_session)
     {
-        return error_object("Function 'options' expects argument 'endpoint' to be a string");
+        std::lock_guard<std::mutex> lock(session->mutex);
+        session->idle.clear();
+        return none_val();
     }
 
-    if (!headers.is_object())
+    delete session;
+    args[0].get_pointer()->value = nullptr;
+    return none_val();
+}
+
+extern "C" Value request(std::vector<Value> &args)
+{
+    int num_required_args = 6;
+
+    if (args.size() != num_required_args)
     {
-        return error_object("Function 'options' expects argument 'headers' to be a object");
+        return error_object("Function 'request' expects " + std::to_string(num_required_args) + " argument(s)");
     }
 
-    httplib::Headers _headers;
-    for (auto &prop : headers.get_object()->values)
+    std::string error;
+    Session *session = get_session(args[0], error);
+    if (!session)
     {
-        _headers.insert({prop.first, valueToString(prop.second)});
+        return error_object(error);
     }
 
-    httplib::Client cli(url.get_string());
-#if defined(__APPLE__)
-    cli.enable_server_certificate_verification(false);
-#endif
+    Value method = args[1];
+    Value timeout = args[5];
 
-    auto res = cli.Options(endpoint.get_string(), _headers);
-
-    Value response = object_val();
-    response.get_object()->keys = {"version", "status", "body", "location", "headers"};
+    if (!method.is_string())
+    {
+        return error_object("Parameter 'method' must be a string");
+    }
 
-    if (!res)
+    if (!timeout.is_number())
     {
-        response.get_object()->values["version"] = string_val("");
-        response.get_object()->values["status"] = number_val(-1);
-        response.get_object()->values["body"] = string_val("");
-        response.get_object()->values["location"] = string_val("");
-        response.get_object()->values["headers"] = list_val();
-        return response;
+        return error_object("Parameter 'timeout' must be a number");
     }
 
-    response.get_object()->values["version"] = string_val(res->version);
-    response.get_object()->values["status"] = number_val(res->status);
-    response.get_object()->values["body"] = string_val(res->body);
-    response.get_object()->values["location"] = string_val(res->location);
-    response.get_object()->values["headers"] = list_val();
-    for (auto &elem : res->headers)
+    RequestSpec spec;
+    if (!read_request(method.get_string(), args[2], args[3], args[4], spec, error))
     {
-        response.get_object()->values["headers"].get_list()->push_back(string_val(elem.first));
+        return error_object(error);
     }
+    spec.timeout = timeout.get_number();
 
-    return response;
+    ResponseData data = perform(*session, spec);
+    return response_value(data);
 }
 
-extern "C" Value _head(std::vector<Value> &args)
+// Sends every request in the list on up to 'concurrency' threads and returns
+// the responses in the same order. Items are URL strings (sent as GET) or
+// objects with url and optional method, payload, headers and timeout
+extern "C" Value batch(std::vector<Value> &args)
 {
-    int num_required_args = 3;
+    int num_required_args = 4;
 
     if (args.size() != num_required_args)
     {
-        return error_object("Function 'head' expects " + std::to_string(num_required_args) + " argument(s)");
+        return error_object("Function 'batch' expects " + std::to_string(num_required_args) + " argument(s)");
     }
 
-    Value url = args[0];
-    Value endpoint = args[1];
-    Value headers = args[2];
-
-    if (!url.is_string())
+    std::string error;
+    Session *session = get_session(args[0], error);
+    if (!session)
     {
-        return error_object("Function 'head' expects argument 'url' to be a string");
+        return error_object(error);
     }
 
-    if (!endpoint.is_string())
+    Value requests = args[1];
+    Value concurrency = args[2];
+    Value timeout = args[3];
+
+    if (!requests.is_list())
     {
-        return error_object("Function 'head' expects argument 'endpoint' to be a string");
+        return error_object("Parameter 'requests' must be a list");
     }
 
-    if (!headers.is_object())
+    if (!concurrency.is_number() || concurrency.get_number() < 1)
     {
-        return error_object("Function 'head' expects argument 'headers' to be a object");
+        return error_object("Parameter 'concurrency' must be a number greater than 0");
     }
 
-    httplib::Headers _headers;
-    for (auto &prop : headers.get_object()->values)
+    if (!timeout.is_number())
     {
-        _headers.insert({prop.first, valueToString(prop.second)});
+        return error_object("Parameter 'timeout' must be a number");
     }
 
-    httplib::Client cli(url.get_string());
-#if defined(__APPLE__)
-    cli.enable_server_certificate_verification(false);
-#endif
-
-    auto res = cli.Head(endpoint.get_string(), _headers);
+    auto &items = *requests.get_list();
+    std::vector<RequestSpec> specs(items.size());
+    for (size_t i = 0; i < items.size(); i++)
+    {
+        Value item = items[i];
+        Value none = none_val();
+        bool ok;
+        if (item.is_string())
+        {
+            ok = read_request("GET", item, none, none, specs[i], error);
+        }
+        else if (item.is_object())
+        {
+            auto &values = item.get_object()->values;
+            Value method = values.count("method") ? values["method"] : string_val("GET");
+            Value url = values.count("url") ? values["url"] : none;
+            Value payload = values.count("payload") ? values["payload"] : none;
+            Value headers = values.count("headers") ? values["headers"] : none;
+            if (!method.is_string())
+            {
+                return error_object("Request " + std::to_string(i) + ": 'method' must be a string");
+            }
+            ok = read_request(method.get_string(), url, payload, headers, specs[i], error);
+            if (ok && values.count("timeout"))
+            {
+                ok = values["timeout"].is_number();
+                error = "'timeout' must be a number";
+                specs[i].timeout = ok ? values["timeout"].get_number() : 0;
+            }
+        }
+        else
+        {
+            ok = false;
+            error = "requests must be URL strings or objects";
+        }
+        if (!ok)
+        {
+            return error_object("Request " + std::to_string(i) + ": " + error);
+        }
+        if (specs[i].timeout <= 0)
+        {
+            specs[i].timeout = timeout.get_number();
+        }
+    }
 
-    Value response = object_val();
-    response.get_object()->keys = {"version", "status", "body", "location", "headers"};
+    std::vector<ResponseData> results(specs.size());
+    std::atomic<size_t> next(0);
+    auto worker = [&]()
+    {
+        size_t i;
+        while ((i = next++) < specs.size())
+        {
+            results[i] = perform(*session, specs[i]);
+        }
+    };
 
-    if (!res)
+    size_t count = std::min((size_t)concurrency.get_number(), specs.size());
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < count; t++)
     {
-        response.get_object()->values["version"] = string_val("");
-        response.get_object()->values["status"] = number_val(-1);
-        response.get_object()->values["body"] = string_val("");
-        response.get_object()->values["location"] = string_val("");
-        response.get_object()->values["headers"] = list_val();
-        return response;
+        threads.emplace_back(worker);
     }
-
-    response.get_object()->values["version"] = string_val(res->version);
-    response.get_object()->values["status"] = number_val(res->status);
-    response.get_object()->values["body"] = string_val(res->body);
-    response.get_object()->values["location"] = string_val(res->location);
-    response.get_object()->values["headers"] = list_val();
-    for (auto &elem : res->headers)
+    worker();
+    for (std::thread &thread : threads)
     {
-        response.get_object()->values["headers"].get_list()->push_back(string_val(elem.first));
+        thread.join();
     }
 
-    return response;
+    Value responses = list_val();
+    responses.get_list()->reserve(results.size());
+    for (ResponseData &data : results)
+    {
+        responses.get_list()->push_back(response_value(data));
+    }
+    return responses;
 }
 
 // VortexObj server(std::string name, std::vector<VortexObj> args) {
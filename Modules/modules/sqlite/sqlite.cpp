@@ -1,8 +1,6 @@
 #include <sqlite3.h>
 #include "include/Vortex.hpp"
 
-std::vector<Value> results;
-
 extern "C" Value connect(std::vector<Value> &args)
 {
     int num_required_args = 1;
@@ -39,6 +37,7 @@ extern "C" Value connect(std::vector<Value> &args)
 
 static int callback(void *data, int argc, char **argv, char **azColName)
 {
+    std::vector<Value> &results = *(std::vector<Value> *)data;
 
     Value columns = list_val();
     Value values = list_val();
@@ -67,8 +66,6 @@ extern "C" Value execute(std::vector<Value> &args)
         return error_object("Function 'execute' expects " + std::to_string(num_required_args) + " argument(s)");
     }
 
-    results.clear();
-
     Value v_db = args[0];
     Value v_stmnt = args[1];
 
@@ -83,10 +80,17 @@ extern "C" Value execute(std::vector<Value> &args)
 
     sqlite3 *db = (sqlite3 *)v_db.get_pointer()->value;
 
+    if (!db)
+    {
+        return error_object("Database is closed");
+    }
+
     char *zErrMsg = 0;
     int rc;
 
-    rc = sqlite3_exec(db, v_stmnt.get_string().c_str(), callback, 0, &zErrMsg);
+    Value res_list = list_val();
+
+    rc = sqlite3_exec(db, v_stmnt.get_string().c_str(), callback, res_list.get_list().get(), &zErrMsg);
 
     if (rc != SQLITE_OK)
     {
@@ -95,9 +99,6 @@ extern "C" Value execute(std::vector<Value> &args)
         return error_object(error_msg);
     }
 
-    Value res_list = list_val();
-    *res_list.get_list() = results;
-
     return res_list;
 }
 
@@ -107,11 +108,9 @@ extern "C" Value close(std::vector<Value> &args)
 
     if (args.size() != num_required_args)
     {
-        return error_object("Function 'execute' expects " + std::to_string(num_required_args) + " argument(s)");
+        return error_object("Function 'close' expects " + std::to_string(num_required_args) + " argument(s)");
     }
 
-    results.clear();
-
     Value v_db = args[0];
 
     if (!v_db.is_pointer())
@@ -121,7 +120,503 @@ extern "C" Value close(std::vector<Value> &args)
 
     sqlite3 *db = (sqlite3 *)v_db.get_pointer()->value;
 
-    sqlite3_close(db);
+    // Statements that are still open keep the connection alive until they
+    // are finalized
+    sqlite3_close_v2(db);
+    v_db.get_pointer()->value = nullptr;
 
     return none_val();
+}
+
+static sqlite3 *get_db(Value &v_db, std::string &error)
+{
+    if (!v_db.is_pointer())
+    {
+        error = "Parameter 'dbPtr' must be a pointer";
+        return nullptr;
+    }
+    sqlite3 *db = (sqlite3 *)v_db.get_pointer()->value;
+    if (!db)
+    {
+        error = "Database is closed";
+    }
+    return db;
+}
+
+static sqlite3_stmt *get_stmt(Value &v_stmt, std::string &error)
+{
+    if (!v_stmt.is_pointer())
+    {
+        error = "Parameter 'stmtPtr' must be a pointer";
+        return nullptr;
+    }
+    sqlite3_stmt *stmt = (sqlite3_stmt *)v_stmt.get_pointer()->value;
+    if (!stmt)
+    {
+        error = "Statement is finalized";
+    }
+    return stmt;
+}
+
+static sqlite3_stmt *prepare_single(sqlite3 *db, const std::string &sql, std::string &error)
+{
+    sqlite3_stmt *stmt = nullptr;
+    const char *tail = nullptr;
+    int rc = sqlite3_prepare_v2(db, sql.c_str(), (int)sql.size(), &stmt, &tail);
+    if (rc != SQLITE_OK)
+    {
+        error = "SQL Error: " + std::string(sqlite3_errmsg(db));
+        return nullptr;
+    }
+    if (!stmt)
+    {
+        error = "SQL Error: statement is empty";
+        return nullptr;
+    }
+    while (tail && *tail && isspace((unsigned char)*tail))
+    {
+        tail++;
+    }
+    if (tail && *tail && *tail != ';')
+    {
+        sqlite3_finalize(stmt);
+        error = "SQL Error: only one statement can be prepared at a time";
+        return nullptr;
+    }
+    return stmt;
+}
+
+static int bind_value(sqlite3_stmt *stmt, int index, Value &value)
+{
+    switch (value.type)
+    {
+    case ValueType::Number:
+    {
+        double number = value.get_number();
+        if (std::floor(number) == number && std::fabs(number) < 9.2e18)
+        {
+            return sqlite3_bind_int64(stmt, index, (sqlite3_int64)number);
+        }
+        return sqlite3_bind_double(stmt, index, number);
+    }
+    case ValueType::String:
+    {
+        const std::string &text = value.get_string();
+        return sqlite3_bind_text(stmt, index, text.data(), (int)text.size(), SQLITE_TRANSIENT);
+    }
+    case ValueType::Boolean:
+        return sqlite3_bind_int(stmt, index, value.get_boolean() ? 1 : 0);
+    case ValueType::None:
+        return sqlite3_bind_null(stmt, index);
+    default:
+        return SQLITE_MISMATCH;
+    }
+}
+
+// Binds a list by position, or an object by parameter name (:name, @name
+// or $name)
+static bool bind_params(sqlite3_stmt *stmt, Value &params, std::string &error)
+{
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+
+    int count = sqlite3_bind_parameter_count(stmt);
+
+    if (params.is_list())
+    {
+        std::vector<Value> &values = *params.get_list();
+        if ((int)values.size() != count)
+        {
+            error = "Statement expects " + std::to_string(count) + " parameter(s), got " + std::to_string(values.size());
+            return false;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            if (bind_value(stmt, i + 1, values[i]) != SQLITE_OK)
+            {
+                error = "Cannot bind parameter " + std::to_string(i + 1) + " of type " + values[i].type_repr();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    if (params.is_object())
+    {
+        auto &values = params.get_object()->values;
+        for (int i = 1; i <= count; i++)
+        {
+            const char *name = sqlite3_bind_parameter_name(stmt, i);
+            if (!name)
+            {
+                error = "Parameter " + std::to_string(i) + " has no name and cannot be bound from an object";
+                return false;
+            }
+            auto value = values.find(name + 1);
+            if (value == values.end())
+            {
+                error = "Missing value for parameter '" + std::string(name) + "'";
+                return false;
+            }
+            if (bind_value(stmt, i, value->second) != SQLITE_OK)
+            {
+                error = "Cannot bind parameter '" + std::string(name) + "' of type " + value->second.type_repr();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    error = "Parameter 'params' must be a list or object";
+    return false;
+}
+
+static Value column_value(sqlite3_stmt *stmt, int index)
+{
+    switch (sqlite3_column_type(stmt, index))
+    {
+    case SQLITE_INTEGER:
+        return number_val((double)sqlite3_column_int64(stmt, index));
+    case SQLITE_FLOAT:
+        return number_val(sqlite3_column_double(stmt, index));
+    case SQLITE_TEXT:
+    {
+        const char *text = (const char *)sqlite3_column_text(stmt, index);
+        return string_val(std::string(text, sqlite3_column_bytes(stmt, index)));
+    }
+    case SQLITE_BLOB:
+    {
+        const char *blob = (const char *)sqlite3_column_blob(stmt, index);
+        return string_val(blob ? std::string(blob, sqlite3_column_bytes(stmt, index)) : std::string());
+    }
+    default:
+        return none_val();
+    }
+}
+
+static Value row_value(sqlite3_stmt *stmt, bool as_object)
+{
+    int count = sqlite3_column_count(stmt);
+    if (!as_object)
+    {
+        Value row = list_val();
+        std::vector<Value> &values = *row.get_list();
+        values.reserve(count);
+        for (int i = 0; i < count; i++)
+        {
+            values.push_back(column_value(stmt, i));
+        }
+        return row;
+    }
+    Value row = object_val();
+    ObjectObj &object = *row.get_object();
+    for (int i = 0; i < count; i++)
+    {
+        std::string name = sqlite3_column_name(stmt, i);
+        auto [slot, inserted] = object.values.try_emplace(name);
+        if (inserted)
+        {
+            object.keys.push_back(name);
+        }
+        slot->second = column_value(stmt, i);
+    }
+    return row;
+}
+
+extern "C" Value prepare(std::vector<Value> &args)
+{
+    int num_required_args = 2;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'prepare' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    Value v_db = args[0];
+    Value v_stmnt = args[1];
+
+    std::string error;
+    sqlite3 *db = get_db(v_db, error);
+    if (!db)
+    {
+        return error_object(error);
+    }
+    if (!v_stmnt.is_string())
+    {
+        return error_object("Parameter 'statement' must be a string");
+    }
+
+    sqlite3_stmt *stmt = prepare_single(db, v_stmnt.get_string(), error);
+    if (!stmt)
+    {
+        return error_object(error);
+    }
+
+    Value stmt_ptr = pointer_val();
+    stmt_ptr.get_pointer()->value = stmt;
+
+    return stmt_ptr;
+}
+
+extern "C" Value bind(std::vector<Value> &args)
+{
+    int num_required_args = 2;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'bind' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    sqlite3_stmt *stmt = get_stmt(args[0], error);
+    if (!stmt)
+    {
+        return error_object(error);
+    }
+
+    if (!bind_params(stmt, args[1], error))
+    {
+        return error_object(error);
+    }
+
+    return none_val();
+}
+
+extern "C" Value step(std::vector<Value> &args)
+{
+    int num_required_args = 2;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'step' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    sqlite3_stmt *stmt = get_stmt(args[0], error);
+    if (!stmt)
+    {
+        return error_object(error);
+    }
+
+    Value v_as_object = args[1];
+
+    if (!v_as_object.is_boolean())
+    {
+        return error_object("Parameter 'asObject' must be a boolean");
+    }
+
+    int rc = sqlite3_step(stmt);
+
+    if (rc == SQLITE_ROW)
+    {
+        return row_value(stmt, v_as_object.get_boolean());
+    }
+    if (rc == SQLITE_DONE)
+    {
+        return none_val();
+    }
+
+    return error_object("SQL Error: " + std::string(sqlite3_errmsg(sqlite3_db_handle(stmt))));
+}
+
+extern "C" Value columns(std::vector<Value> &args)
+{
+    int num_required_args = 1;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'columns' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    sqlite3_stmt *stmt = get_stmt(args[0], error);
+    if (!stmt)
+    {
+        return error_object(error);
+    }
+
+    Value names = list_val();
+    int count = sqlite3_column_count(stmt);
+    for (int i = 0; i < count; i++)
+    {
+        names.get_list()->push_back(string_val(sqlite3_column_name(stmt, i)));
+    }
+
+    return names;
+}
+
+extern "C" Value reset(std::vector<Value> &args)
+{
+    int num_required_args = 1;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'reset' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    std::string error;
+    sqlite3_stmt *stmt = get_stmt(args[0], error);
+    if (!stmt)
+    {
+        return error_object(error);
+    }
+
+    sqlite3_reset(stmt);
+
+    return none_val();
+}
+
+extern "C" Value finalize(std::vector<Value> &args)
+{
+    int num_required_args = 1;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'finalize' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    Value v_stmt = args[0];
+
+    if (!v_stmt.is_pointer())
+    {
+        return error_object("Parameter 'stmtPtr' must be a pointer");
+    }
+
+    sqlite3_finalize((sqlite3_stmt *)v_stmt.get_pointer()->value);
+    v_stmt.get_pointer()->value = nullptr;
+
+    return none_val();
+}
+
+extern "C" Value query(std::vector<Value> &args)
+{
+    int num_required_args = 3;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'query' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    Value v_db = args[0];
+    Value v_stmnt = args[1];
+
+    std::string error;
+    sqlite3 *db = get_db(v_db, error);
+    if (!db)
+    {
+        return error_object(error);
+    }
+    if (!v_stmnt.is_string())
+    {
+        return error_object("Parameter 'statement' must be a string");
+    }
+
+    sqlite3_stmt *stmt = prepare_single(db, v_stmnt.get_string(), error);
+    if (!stmt)
+    {
+        return error_object(error);
+    }
+    if (!bind_params(stmt, args[2], error))
+    {
+        sqlite3_finalize(stmt);
+        return error_object(error);
+    }
+
+    Value rows = list_val();
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        rows.get_list()->push_back(row_value(stmt, true));
+    }
+    if (rc != SQLITE_DONE)
+    {
+        error = "SQL Error: " + std::string(sqlite3_errmsg(db));
+        sqlite3_finalize(stmt);
+        return error_object(error);
+    }
+
+    sqlite3_finalize(stmt);
+    return rows;
+}
+
+// Runs one statement for each set of parameters, reusing the prepared
+// statement. Unless a transaction is already open, all rows are written in
+// one transaction that is rolled back if any of them fails
+extern "C" Value executemany(std::vector<Value> &args)
+{
+    int num_required_args = 3;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'executemany' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    Value v_db = args[0];
+    Value v_stmnt = args[1];
+    Value v_rows = args[2];
+
+    std::string error;
+    sqlite3 *db = get_db(v_db, error);
+    if (!db)
+    {
+        return error_object(error);
+    }
+    if (!v_stmnt.is_string())
+    {
+        return error_object("Parameter 'statement' must be a string");
+    }
+    if (!v_rows.is_list())
+    {
+        return error_object("Parameter 'rows' must be a list");
+    }
+
+    sqlite3_stmt *stmt = prepare_single(db, v_stmnt.get_string(), error);
+    if (!stmt)
+    {
+        return error_object(error);
+    }
+
+    bool own_transaction = sqlite3_get_autocommit(db);
+    if (own_transaction)
+    {
+        sqlite3_exec(db, "BEGIN", nullptr, nullptr, nullptr);
+    }
+
+    double changes = 0;
+    std::vector<Value> &rows = *v_rows.get_list();
+    for (size_t i = 0; i < rows.size(); i++)
+    {
+        if (!bind_params(stmt, rows[i], error))
+        {
+            error = "Row " + std::to_string(i) + ": " + error;
+            break;
+        }
+        int rc = sqlite3_step(stmt);
+        if (rc != SQLITE_DONE && rc != SQLITE_ROW)
+        {
+            error = "SQL Error in row " + std::to_string(i) + ": " + std::string(sqlite3_errmsg(db));
+            break;
+        }
+        changes += sqlite3_changes(db);
+    }
+
+    sqlite3_finalize(stmt);
+
+    if (!error.empty())
+    {
+        if (own_transaction)
+        {
+            sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+        }
+        return error_object(error);
+    }
+
+    if (own_transaction && sqlite3_exec(db, "COMMIT", nullptr, nullptr, nullptr) != SQLITE_OK)
+    {
+        error = "SQL Error: " + std::string(sqlite3_errmsg(db));
+        sqlite3_exec(db, "ROLLBACK", nullptr, nullptr, nullptr);
+        return error_object(error);
+    }
+
+    return number_val(changes);
 }
\ No newline at end of file
@@ -3,8 +3,207 @@
 #include <iostream>
 #include <string>
 #include <algorithm>
+#include <cstring>
 #include "include/Vortex.hpp"
 
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define STRING_SSE2
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(_WIN32)
+#define STRING_AVX2
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define STRING_NEON
+#endif
+
+#define NOT_FOUND ((size_t)-1)
+
+// Substring search compares the first and last byte of the needle against a
+// whole block of the text at once, and only checks the bytes in between
+// where both match. x86-64 uses SSE2, or AVX2 when the CPU has it, and arm64
+// uses NEON. Other targets and the tail of the text use memchr and memcmp
+
+static size_t search_scalar(const char *text, size_t size, const char *needle, size_t length)
+{
+    if (size < length)
+    {
+        return NOT_FOUND;
+    }
+    const char *p = text;
+    const char *end = text + size - length + 1;
+    while (p < end)
+    {
+        p = (const char *)memchr(p, needle[0], end - p);
+        if (!p)
+        {
+            return NOT_FOUND;
+        }
+        if (memcmp(p + 1, needle + 1, length - 1) == 0)
+        {
+            return p - text;
+        }
+        p++;
+    }
+    return NOT_FOUND;
+}
+
+#ifdef STRING_SSE2
+static size_t search_sse2(const char *text, size_t size, const char *needle, size_t length)
+{
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[length - 1]);
+    size_t i = 0;
+    for (; i + length - 1 + 16 <= size; i += 16)
+    {
+        __m128i block_first = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i block_last = _mm_loadu_si128((const __m128i *)(text + i + length - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last)));
+        while (mask)
+        {
+            unsigned bit = __builtin_ctz(mask);
+            if (memcmp(text + i + bit + 1, needle + 1, length - 2) == 0)
+            {
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    size_t rest = search_scalar(text + i, size - i, needle, length);
+    return rest == NOT_FOUND ? NOT_FOUND : i + rest;
+}
+#endif
+
+#ifdef STRING_AVX2
+__attribute__((target("avx2"))) static size_t search_avx2(const char *text, size_t size, const char *needle, size_t length)
+{
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[length - 1]);
+    size_t i = 0;
+    for (; i + length - 1 + 32 <= size; i += 32)
+    {
+        __m256i block_first = _mm256_loadu_si256((const __m256i *)(text + i));
+        __m256i block_last = _mm256_loadu_si256((const __m256i *)(text + i + length - 1));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, block_first), _mm256_cmpeq_epi8(last, block_last)));
+        while (mask)
+        {
+            unsigned bit = __builtin_ctz(mask);
+            if (memcmp(text + i + bit + 1, needle + 1, length - 2) == 0)
+            {
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+    size_t rest = search_sse2(text + i, size - i, needle, length);
+    return rest == NOT_FOUND ? NOT_FOUND : i + rest;
+}
+
+static const bool has_avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+#ifdef STRING_NEON
+static size_t search_neon(const char *text, size_t size, const char *needle, size_t length)
+{
+    const uint8x16_t first = vdupq_n_u8(needle[0]);
+    const uint8x16_t last = vdupq_n_u8(needle[length - 1]);
+    size_t i = 0;
+    for (; i + length - 1 + 16 <= size; i += 16)
+    {
+        uint8x16_t block_first = vld1q_u8((const uint8_t *)(text + i));
+        uint8x16_t block_last = vld1q_u8((const uint8_t *)(text + i + length - 1));
+        uint8x16_t matches = vandq_u8(vceqq_u8(first, block_first), vceqq_u8(last, block_last));
+        // Four bits per byte
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(matches), 4)), 0);
+        while (mask)
+        {
+            unsigned bit = __builtin_ctzll(mask) >> 2;
+            if (memcmp(text + i + bit + 1, needle + 1, length - 2) == 0)
+            {
+                return i + bit;
+            }
+            mask &= ~(0xFull << (bit * 4));
+        }
+    }
+    size_t rest = search_scalar(text + i, size - i, needle, length);
+    return rest == NOT_FOUND ? NOT_FOUND : i + rest;
+}
+#endif
+
+// Offset of the first 'needle' at or after 'start', or NOT_FOUND
+static size_t search(const std::string &text, const std::string &needle, size_t start = 0)
+{
+    size_t size = text.size();
+    size_t length = needle.size();
+    if (start > size || length > size - start)
+    {
+        return NOT_FOUND;
+    }
+    if (length == 0)
+    {
+        return start;
+    }
+    const char *base = text.data() + start;
+    size_t found;
+    if (length == 1)
+    {
+        const char *p = (const char *)memchr(base, needle[0], size - start);
+        found = p ? p - base : NOT_FOUND;
+    }
+    else
+    {
+#if defined(STRING_AVX2)
+        found = has_avx2 ? search_avx2(base, size - start, needle.data(), length) : search_sse2(base, size - start, needle.data(), length);
+#elif defined(STRING_SSE2)
+        found = search_sse2(base, size - start, needle.data(), length);
+#elif defined(STRING_NEON)
+        found = search_neon(base, size - start, needle.data(), length);
+#else
+        found = search_scalar(base, size - start, needle.data(), length);
+#endif
+    }
+    return found == NOT_FOUND ? NOT_FOUND : start + found;
+}
+
+// ASCII case mapping, 'offset' is 'a' - 'A' to lower and the reverse to upper
+static void map_case(const char *src, char *dst, size_t size, char from, int offset)
+{
+    size_t i = 0;
+#if defined(STRING_SSE2)
+    // Bytes in [from, from + 25] land below -102 after the shift
+    const __m128i shift = _mm_set1_epi8((char)(128 - from));
+    const __m128i limit = _mm_set1_epi8(-128 + 26);
+    const __m128i delta = _mm_set1_epi8((char)offset);
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i in_range = _mm_cmplt_epi8(_mm_add_epi8(block, shift), limit);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_add_epi8(block, _mm_and_si128(in_range, delta)));
+    }
+#elif defined(STRING_NEON)
+    const uint8x16_t base = vdupq_n_u8((uint8_t)from);
+    const uint8x16_t limit = vdupq_n_u8(26);
+    const uint8x16_t delta = vdupq_n_u8((uint8_t)offset);
+    for (; i + 16 <= size; i += 16)
+    {
+        uint8x16_t block = vld1q_u8((const uint8_t *)(src + i));
+        uint8x16_t in_range = vcltq_u8(vsubq_u8(block, base), limit);
+        vst1q_u8((uint8_t *)(dst + i), vaddq_u8(block, vandq_u8(in_range, delta)));
+    }
+#endif
+    for (; i < size; i++)
+    {
+        unsigned char c = src[i];
+        dst[i] = (unsigned char)(c - from) < 26 ? c + offset : c;
+    }
+}
+
+static bool is_space(unsigned char c)
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+
 extern "C" Value split(std::vector<Value> &args)
 {
     int num_required_args = 2;
@@ -22,31 +221,21 @@ extern "C" Value split(std::vector<Value> &args)
         return error_object("Function 'split' expects args 'text', 'delimiter' to be strings");
     }
 
-    std::string &str = text.get_string();
-    std::string delim = delimiter.get_string();
-
-    if (delim == "")
-    {
-        delim = " ";
-    }
-
-    size_t pos_start = 0, pos_end, delim_len = delim.length();
-    std::string token;
+    const std::string &str = text.get_string();
+    static const std::string space = " ";
+    const std::string &delim = delimiter.get_string().empty() ? space : delimiter.get_string();
 
     Value res = list_val();
+    std::vector<Value> &tokens = *res.get_list();
 
-    while ((pos_end = str.find(delim, pos_start)) != std::string::npos)
+    // Each token is copied once, straight from the text
+    size_t pos_start = 0, pos_end;
+    while ((pos_end = search(str, delim, pos_start)) != NOT_FOUND)
     {
-        token = str.substr(pos_start, pos_end - pos_start);
-        pos_start = pos_end + delim_len;
-
-        Value str_val = string_val(token);
-
-        res.get_list()->push_back(str_val);
+        tokens.push_back(string_val(std::string(str.data() + pos_start, pos_end - pos_start)));
+        pos_start = pos_end + delim.size();
     }
-
-    auto last_str_val = string_val(str.substr(pos_start));
-    res.get_list()->push_back(last_str_val);
+    tokens.push_back(string_val(std::string(str.data() + pos_start, str.size() - pos_start)));
 
     return res;
 }
@@ -64,20 +253,26 @@ extern "C" Value trim(std::vector<Value> &args)
 
     if (!text.is_string())
     {
-        return error_object("Function 'chars' expects argument 'text' to be a string");
+        return error_object("Function 'trim' expects argument 'text' to be a string");
     }
 
-    Value new_string = string_val(text.get_string());
-
-    new_string.get_string().erase(new_string.get_string().begin(), std::find_if(new_string.get_string().begin(), new_string.get_string().end(), [](unsigned char ch)
-                                                                                { return !std::isspace(ch); }));
+    const std::string &str = text.get_string();
+    size_t start = 0, end = str.size();
+    while (start < end && is_space(str[start]))
+    {
+        start++;
+    }
+    while (end > start && is_space(str[end - 1]))
+    {
+        end--;
+    }
 
-    new_string.get_string().erase(std::find_if(new_string.get_string().rbegin(), new_string.get_string().rend(), [](unsigned char ch)
-                                               { return !std::isspace(ch); })
-                                      .base(),
-                                  new_string.get_string().end());
+    if (start == 0 && end == str.size())
+    {
+        return text;
+    }
 
-    return new_string;
+    return string_val(std::string(str.data() + start, end - start));
 }
 
 extern "C" Value chars(std::vector<Value> &args)
@@ -105,6 +300,29 @@ extern "C" Value chars(std::vector<Value> &args)
     return list;
 }
 
+static Value replace_all(const std::string &str, const std::string &from, const std::string &to, double limit)
+{
+    if (from.empty())
+    {
+        return string_val(str);
+    }
+
+    std::string result;
+    result.reserve(str.size());
+    size_t pos = 0, found;
+    double replaced = 0;
+    while ((limit < 0 || replaced < limit) && (found = search(str, from, pos)) != NOT_FOUND)
+    {
+        result.append(str, pos, found - pos);
+        result.append(to);
+        pos = found + from.size();
+        replaced++;
+    }
+    result.append(str, pos, std::string::npos);
+
+    return string_val(std::move(result));
+}
+
 extern "C" Value replaceAll(std::vector<Value> &args)
 {
     int num_required_args = 3;
@@ -123,25 +341,199 @@ extern "C" Value replaceAll(std::vector<Value> &args)
         return error_object("Function 'replaceAll' expects " + std::to_string(num_required_args) + " string argument(s)");
     }
 
-    std::string &from = _from.get_string();
-    std::string &to = _to.get_string();
-    std::string &str = _str.get_string();
+    return replace_all(_str.get_string(), _from.get_string(), _to.get_string(), -1);
+}
 
-    Value new_str = string_val(str);
+extern "C" Value replace(std::vector<Value> &args)
+{
+    int num_required_args = 4;
 
-    if (from.empty())
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'replace' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    Value &_str = args[0];
+    Value &_from = args[1];
+    Value &_to = args[2];
+    Value &_count = args[3];
+
+    if (!_str.is_string() || !_from.is_string() || !_to.is_string())
     {
-        return new_str;
+        return error_object("Function 'replace' expects args 'text', 'from', 'to' to be strings");
     }
 
-    size_t start_pos = 0;
-    while ((start_pos = new_str.get_string().find(from, start_pos)) != std::string::npos)
+    if (!_count.is_number())
     {
-        new_str.get_string().replace(start_pos, from.length(), to);
-        start_pos += to.length();
+        return error_object("Function 'replace' expects argument 'count' to be a number");
     }
 
-    return new_str;
+    return replace_all(_str.get_string(), _from.get_string(), _to.get_string(), _count.get_number());
+}
+
+extern "C" Value find(std::vector<Value> &args)
+{
+    int num_required_args = 3;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'find' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    Value &text = args[0];
+    Value &needle = args[1];
+    Value &start = args[2];
+
+    if (!text.is_string() || !needle.is_string())
+    {
+        return error_object("Function 'find' expects args 'text', 'substr' to be strings");
+    }
+
+    if (!start.is_number() || start.get_number() < 0)
+    {
+        return error_object("Function 'find' expects argument 'start' to be a positive number");
+    }
+
+    size_t found = search(text.get_string(), needle.get_string(), (size_t)start.get_number());
+
+    return number_val(found == NOT_FOUND ? -1 : (double)found);
+}
+
+extern "C" Value count(std::vector<Value> &args)
+{
+    int num_required_args = 2;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'count' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    Value &text = args[0];
+    Value &needle = args[1];
+
+    if (!text.is_string() || !needle.is_string())
+    {
+        return error_object("Function 'count' expects args 'text', 'substr' to be strings");
+    }
+
+    const std::string &str = text.get_string();
+    const std::string &substr = needle.get_string();
+
+    if (substr.empty())
+    {
+        return number_val(0);
+    }
+
+    double total = 0;
+    size_t pos = 0;
+    while ((pos = search(str, substr, pos)) != NOT_FOUND)
+    {
+        total++;
+        pos += substr.size();
+    }
+
+    return number_val(total);
+}
+
+extern "C" Value join(std::vector<Value> &args)
+{
+    int num_required_args = 2;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'join' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    Value &list = args[0];
+    Value &delimiter = args[1];
+
+    if (!list.is_list())
+    {
+        return error_object("Function 'join' expects argument 'list' to be a list");
+    }
+
+    if (!delimiter.is_string())
+    {
+        return error_object("Function 'join' expects argument 'delimiter' to be a string");
+    }
+
+    std::vector<Value> &items = *list.get_list();
+    const std::string &delim = delimiter.get_string();
+
+    size_t size = items.empty() ? 0 : delim.size() * (items.size() - 1);
+    for (Value &item : items)
+    {
+        if (item.is_string())
+        {
+            size += item.get_string().size();
+        }
+    }
+
+    std::string result;
+    result.reserve(size);
+    for (size_t i = 0; i < items.size(); i++)
+    {
+        if (i > 0)
+        {
+            result += delim;
+        }
+        if (items[i].is_string())
+        {
+            result += items[i].get_string();
+        }
+        else
+        {
+            result += toString(items[i]);
+        }
+    }
+
+    return string_val(std::move(result));
+}
+
+extern "C" Value startsWith(std::vector<Value> &args)
+{
+    int num_required_args = 2;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'startsWith' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    Value &text = args[0];
+    Value &prefix = args[1];
+
+    if (!text.is_string() || !prefix.is_string())
+    {
+        return error_object("Function 'startsWith' expects args 'text', 'start' to be strings");
+    }
+
+    const std::string &str = text.get_string();
+    const std::string &start = prefix.get_string();
+
+    return boolean_val(start.size() <= str.size() && memcmp(str.data(), start.data(), start.size()) == 0);
+}
+
+extern "C" Value endsWith(std::vector<Value> &args)
+{
+    int num_required_args = 2;
+
+    if (args.size() != num_required_args)
+    {
+        return error_object("Function 'endsWith' expects " + std::to_string(num_required_args) + " argument(s)");
+    }
+
+    Value &text = args[0];
+    Value &suffix = args[1];
+
+    if (!text.is_string() || !suffix.is_string())
+    {
+        return error_object("Function 'endsWith' expects args 'text', 'end' to be strings");
+    }
+
+    const std::string &str = text.get_string();
+    const std::string &end = suffix.get_string();
+
+    return boolean_val(end.size() <= str.size() && memcmp(str.data() + str.size() - end.size(), end.data(), end.size()) == 0);
 }
 
 extern "C" Value lower(std::vector<Value> &args)
@@ -160,13 +552,11 @@ extern "C" Value lower(std::vector<Value> &args)
         return error_object("Function 'lower' expects argument 'text' to be a string");
     }
 
-    std::string copy = std::string(text.get_string());
+    const std::string &str = text.get_string();
+    std::string copy(str.size(), '\0');
+    map_case(str.data(), copy.data(), str.size(), 'A', 'a' - 'A');
 
-    std::transform(copy.begin(), copy.end(), copy.begin(),
-                   [](unsigned char c)
-                   { return std::tolower(c); });
-
-    return string_val(copy);
+    return string_val(std::move(copy));
 }
 
 extern "C" Value upper(std::vector<Value> &args)
@@ -185,11 +575,9 @@ extern "C" Value upper(std::vector<Value> &args)
         return error_object("Function 'upper' expects argument 'text' to be a string");
     }
 
-    std::string copy = std::string(text.get_string());
-
-    std::transform(copy.begin(), copy.end(), copy.begin(),
-                   [](unsigned char c)
-                   { return std::toupper(c); });
+    const std::string &str = text.get_string();
+    std::string copy(str.size(), '\0');
+    map_case(str.data(), copy.data(), str.size(), 'a', 'A' - 'a');
 
-    return string_val(copy);
+    return string_val(std::move(copy));
 }
\ No newline at end of file
@@ -131,7 +131,7 @@ extern "C" Value __frame__(std::vector<Value> &args)
     obj.get_object()->values["name"] = string_val(frame.function->name);
     obj.get_object()->values["level"] = number_val(_vm->frames.size() - _depth);
     obj.get_object()->values["line"] = number_val(frame.function->chunk.lines[instr]);
-    obj.get_object()->values["path"] = string_val(frame.function->name == "" ? frame.name : frame.function->import_path);
+    obj.get_object()->values["path"] = string_val(frame.function->import_path);
     obj.get_object()->values["id"] = number_val(reinterpret_cast<intptr_t>(frame.function.get()));
     obj.get_object()->keys = {"name", "level", "line", "path", "id"};
     return obj;
@@ -9,7 +9,11 @@
 #define _WEBSOCKETPP_MINGW_THREAD_
 #endif
 
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <mutex>
+#include <thread>
 #include "../../../src/Node/Node.hpp"
 #include "../../../src/Lexer/Lexer.hpp"
 #include "../../../src/Parser/Parser.hpp"
@@ -69,6 +73,31 @@ static context_ptr on_tls_init()
     return ctx;
 }
 
+/* Callbacks */
+
+// Callbacks run on VMs kept for reuse. A callback started while another one
+// is running on the same thread takes a second VM
+static thread_local std::vector<std::unique_ptr<CallbackVM>> vm_pool;
+
+static bool call_function(Value func, std::vector<Value> arguments, Value *result = nullptr)
+{
+    std::unique_ptr<CallbackVM> caller;
+    if (vm_pool.empty())
+    {
+        caller = std::make_unique<CallbackVM>();
+    }
+    else
+    {
+        caller = std::move(vm_pool.back());
+        vm_pool.pop_back();
+    }
+
+    bool ok = caller->call(func, arguments.data(), arguments.size(), result);
+
+    vm_pool.push_back(std::move(caller));
+    return ok;
+}
+
 extern "C" Value _client_init(std::vector<Value> &args)
 {
     int num_required_args = 0;
@@ -213,30 +242,7 @@ extern "C" Value _client_on_message(std::vector<Value> &args)
 
     auto on_message_func = [func](websocketpp::connection_hdl hdl, message_ptr msg)
     {
-        VM func_vm;
-        std::shared_ptr<FunctionObj> main = std::make_shared<FunctionObj>();
-        main->name = "";
-        main->arity = 0;
-        main->chunk = Chunk();
-        CallFrame main_frame;
-        main_frame.function = main;
-        main_frame.sp = 0;
-        main_frame.ip = main->chunk.code.data();
-        main_frame.frame_start = 0;
-        func_vm.frames.push_back(main_frame);
-
-        add_constant(main->chunk, func);
-        add_constant(main->chunk, string_val(msg->get_payload()));
-        add_opcode(main->chunk, OP_LOAD_CONST, 1, 0);
-        add_opcode(main->chunk, OP_LOAD_CONST, 0, 0);
-        add_opcode(main->chunk, OP_CALL, 1, 0);
-
-        add_code(main->chunk, OP_EXIT, 0);
-
-        auto offsets = instruction_offsets(main_frame.function->chunk);
-        main_frame.function->instruction_offsets = offsets;
-
-        evaluate(func_vm);
+        call_function(func, {string_val(msg->get_payload())});
     };
 
     c->set_message_handler(on_message_func);
@@ -275,28 +281,7 @@ extern "C" Value _client_on_open(std::vector<Value> &args)
 
     auto on_open_func = [func](websocketpp::connection_hdl hdl)
     {
-        VM func_vm;
-        std::shared_ptr<FunctionObj> main = std::make_shared<FunctionObj>();
-        main->name = "";
-        main->arity = 0;
-        main->chunk = Chunk();
-        CallFrame main_frame;
-        main_frame.function = main;
-        main_frame.sp = 0;
-        main_frame.ip = main->chunk.code.data();
-        main_frame.frame_start = 0;
-        func_vm.frames.push_back(main_frame);
-
-        add_constant(main->chunk, func);
-        add_opcode(main->chunk, OP_LOAD_CONST, 0, 0);
-        add_opcode(main->chunk, OP_CALL, 0, 0);
-
-        add_code(main->chunk, OP_EXIT, 0);
-
-        auto offsets = instruction_offsets(main_frame.function->chunk);
-        main_frame.function->instruction_offsets = offsets;
-
-        evaluate(func_vm);
+        call_function(func, {});
     };
 
     c->set_open_handler(on_open_func);
@@ -343,30 +328,7 @@ extern "C" Value _client_on_close(std::vector<Value> &args)
         close_object.get_object()->values["status"] = number_val(status);
         close_object.get_object()->values["reason"] = string_val(reason);
 
-        VM func_vm;
-        std::shared_ptr<FunctionObj> main = std::make_shared<FunctionObj>();
-        main->name = "";
-        main->arity = 0;
-        main->chunk = Chunk();
-        CallFrame main_frame;
-        main_frame.function = main;
-        main_frame.sp = 0;
-        main_frame.ip = main->chunk.code.data();
-        main_frame.frame_start = 0;
-        func_vm.frames.push_back(main_frame);
-
-        add_constant(main->chunk, func);
-        add_constant(main->chunk, close_object);
-        add_opcode(main->chunk, OP_LOAD_CONST, 1, 0);
-        add_opcode(main->chunk, OP_LOAD_CONST, 0, 0);
-        add_opcode(main->chunk, OP_CALL, 1, 0);
-
-        add_code(main->chunk, OP_EXIT, 0);
-
-        auto offsets = instruction_offsets(main_frame.function->chunk);
-        main_frame.function->instruction_offsets = offsets;
-
-        evaluate(func_vm);
+        call_function(func, {close_object});
     };
 
     c->set_close_handler(on_close_func);
@@ -413,30 +375,7 @@ extern "C" Value _client_on_fail(std::vector<Value> &args)
         close_object.get_object()->values["status"] = number_val(status);
         close_object.get_object()->values["reason"] = string_val(reason);
 
-        VM func_vm;
-        std::shared_ptr<FunctionObj> main = std::make_shared<FunctionObj>();
-        main->name = "";
-        main->arity = 0;
-        main->chunk = Chunk();
-        CallFrame main_frame;
-        main_frame.function = main;
-        main_frame.sp = 0;
-        main_frame.ip = main->chunk.code.data();
-        main_frame.frame_start = 0;
-        func_vm.frames.push_back(main_frame);
-
-        add_constant(main->chunk, func);
-        add_constant(main->chunk, close_object);
-        add_opcode(main->chunk, OP_LOAD_CONST, 1, 0);
-        add_opcode(main->chunk, OP_LOAD_CONST, 0, 0);
-        add_opcode(main->chunk, OP_CALL, 1, 0);
-
-        add_code(main->chunk, OP_EXIT, 0);
-
-        auto offsets = instruction_offsets(main_frame.function->chunk);
-        main_frame.function->instruction_offsets = offsets;
-
-        evaluate(func_vm);
+        call_function(func, {close_object});
     };
 
     c->set_fail_handler(on_fail_func);
@@ -538,16 +477,200 @@ extern "C" Value _client_close(std::vector<Value> &args)
 
 struct connection_data
 {
-    int sessionId;
+    int sessionId = 0;
     std::string name;
 };
 
 typedef std::map<websocketpp::connection_hdl, connection_data, std::owner_less<websocketpp::connection_hdl>> con_list;
 
+// Callbacks and the natives they call run on the worker threads while the
+// I/O thread accepts and drops connections, m_servers_lock guards the maps
+std::mutex m_servers_lock;
+
 std::map<server *, con_list> m_servers;
 
 int m_next_sessionid;
 
+enum server_callback
+{
+    CALLBACK_OPEN,
+    CALLBACK_MESSAGE,
+    CALLBACK_FAIL,
+    CALLBACK_CLOSE,
+    CALLBACK_VALIDATE,
+    CALLBACK_COUNT
+};
+
+// Callbacks are copied, all together, each time one is set: one set for
+// every worker and one for the I/O thread. The I/O thread runs the originals
+// only when it is the thread that set them, which waits in listen meanwhile
+struct server_callbacks
+{
+    std::vector<Value> originals = std::vector<Value>(CALLBACK_COUNT, none_val());
+    std::vector<std::vector<Value>> copies;
+    std::thread::id owner;
+    bool listening = false;
+    // The set the I/O thread runs, chosen when listen starts
+    std::vector<Value> *io = nullptr;
+};
+
+std::map<server *, server_callbacks> m_callbacks;
+
+// Server callbacks run on worker threads rather than on the I/O thread. Each
+// worker has its own queue and a connection always uses the same one, so its
+// callbacks run one at a time in the order its events arrived
+struct worker_pool
+{
+    struct worker
+    {
+        std::mutex lock;
+        std::condition_variable ready;
+        std::deque<std::function<void(std::vector<Value> &)>> tasks;
+        bool stopping = false;
+        std::vector<Value> callbacks;
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<worker>> workers;
+
+    // Each worker runs its own copy of the callbacks, so workers share no
+    // heap values with each other or with the program
+    worker_pool(std::vector<std::vector<Value>> &copies)
+    {
+        for (auto &callbacks : copies)
+        {
+            auto w = std::make_unique<worker>();
+            w->callbacks = callbacks;
+            worker *current = w.get();
+            w->thread = std::thread([current]()
+                                    {
+                for (;;)
+                {
+                    std::function<void(std::vector<Value> &)> task;
+                    {
+                        std::unique_lock<std::mutex> lock(current->lock);
+                        current->ready.wait(lock, [current]()
+                                            { return current->stopping || !current->tasks.empty(); });
+                        if (current->tasks.empty())
+                        {
+                            return;
+                        }
+                        task = std::move(current->tasks.front());
+                        current->tasks.pop_front();
+                    }
+                    task(current->callbacks);
+                } });
+            workers.push_back(std::move(w));
+        }
+    }
+
+    void post(int key, std::function<void(std::vector<Value> &)> task)
+    {
+        worker &w = *workers[(unsigned)key % workers.size()];
+        {
+            std::lock_guard<std::mutex> lock(w.lock);
+            w.tasks.push_back(std::move(task));
+        }
+        w.ready.notify_one();
+    }
+
+    // Runs what is still queued, then joins
+    ~worker_pool()
+    {
+        for (auto &w : workers)
+        {
+            {
+                std::lock_guard<std::mutex> lock(w->lock);
+                w->stopping = true;
+            }
+            w->ready.notify_one();
+        }
+        for (auto &w : workers)
+        {
+            w->thread.join();
+        }
+    }
+};
+
+// Worker count per server, 0 runs callbacks on the I/O thread
+std::map<server *, int> m_workers;
+
+std::map<server *, std::unique_ptr<worker_pool>> m_pools;
+
+// The callbacks the I/O thread runs, set while the server is listening
+static std::vector<Value> &io_callbacks(server *s)
+{
+    std::lock_guard<std::mutex> lock(m_servers_lock);
+    return *m_callbacks[s].io;
+}
+
+static void dispatch(server *s, int session, std::function<void(std::vector<Value> &)> task)
+{
+    worker_pool *pool = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_servers_lock);
+        auto it = m_pools.find(s);
+        if (it != m_pools.end())
+        {
+            pool = it->second.get();
+        }
+    }
+
+    if (!pool)
+    {
+        task(io_callbacks(s));
+        return;
+    }
+
+    pool->post(session, std::move(task));
+}
+
+static Value connection_object(const connection_data &data)
+{
+    Value data_obj = object_val();
+    data_obj.get_object()->keys = {"id", "name"};
+    data_obj.get_object()->values["id"] = number_val(data.sessionId);
+    data_obj.get_object()->values["name"] = string_val(data.name);
+    return data_obj;
+}
+
+static Value set_callback(server *s, server_callback callback, Value func)
+{
+    std::lock_guard<std::mutex> lock(m_servers_lock);
+    server_callbacks &callbacks = m_callbacks[s];
+
+    if (callbacks.listening)
+    {
+        return error_object("Callbacks cannot be set while the server is listening");
+    }
+
+    callbacks.originals[callback] = func;
+    callbacks.owner = std::this_thread::get_id();
+    callbacks.copies.clear();
+    for (int i = 0; i <= m_workers[s]; i++)
+    {
+        callbacks.copies.push_back(thread_copy(callbacks.originals));
+    }
+
+    return none_val();
+}
+
+// Frames sent by a server are not masked, so a broadcast frames the message
+// once and queues the same buffer on every connection
+static server::message_ptr prepare_text_frame(std::string const &payload)
+{
+    typedef websocketpp::config::asio_tls::message_type message_type;
+    server::message_ptr msg = websocketpp::lib::make_shared<message_type>(message_type::con_msg_man_ptr(), websocketpp::frame::opcode::text, 0);
+
+    websocketpp::frame::basic_header header(websocketpp::frame::opcode::text, payload.size(), true, false, false);
+    websocketpp::frame::extended_header extended(payload.size());
+    msg->set_header(websocketpp::frame::prepare_header(header, extended));
+    msg->set_payload(payload);
+    msg->set_prepared(true);
+
+    return msg;
+}
+
 enum tls_mode
 {
     MOZILLA_INTERMEDIATE = 1,
@@ -616,13 +739,32 @@ context_ptr server_on_tls_init(tls_mode mode, websocketpp::connection_hdl hdl)
 
 extern "C" Value _server(std::vector<Value> &args)
 {
-    int num_required_args = 0;
+    int num_required_args = 1;
 
     if (args.size() != num_required_args)
     {
         return error_object("Function 'server' expects " + std::to_string(num_required_args) + " argument(s)");
     }
 
+    Value options = args[0];
+
+    if (!options.is_object())
+    {
+        return error_object("Function 'server' expects argument 'options' to be an object");
+    }
+
+    int workers = 1;
+    auto &option_values = options.get_object()->values;
+
+    if (option_values.count("workers"))
+    {
+        if (!option_values["workers"].is_number() || option_values["workers"].get_number() < 0)
+        {
+            return error_object("Option 'workers' must be a number of at least 0");
+        }
+        workers = (int)option_values["workers"].get_number();
+    }
+
     server *s = new server();
 
     s->clear_access_channels(websocketpp::log::alevel::frame_header);
@@ -634,7 +776,11 @@ extern "C" Value _server(std::vector<Value> &args)
     // Initialize ASIO
     s->init_asio();
 
-    m_servers[s] = con_list();
+    {
+        std::lock_guard<std::mutex> lock(m_servers_lock);
+        m_servers[s] = con_list();
+        m_workers[s] = workers;
+    }
 
     Value server_object = object_val();
     server_object.get_object()->keys = {"server_ptr", "running"};
@@ -692,9 +838,46 @@ extern "C" Value _server_listen(std::vector<Value> &args)
     // Start the server accept loop
     s->start_accept();
 
+    {
+        std::lock_guard<std::mutex> lock(m_servers_lock);
+        server_callbacks &callbacks = m_callbacks[s];
+        if (callbacks.copies.empty())
+        {
+            callbacks.copies.resize(m_workers[s] + 1, callbacks.originals);
+        }
+
+        callbacks.listening = true;
+        callbacks.io = callbacks.owner == std::this_thread::get_id() ? &callbacks.originals : &callbacks.copies.back();
+
+        if (m_workers[s] > 0)
+        {
+            std::vector<std::vector<Value>> copies(callbacks.copies.begin(), callbacks.copies.end() - 1);
+            m_pools[s] = std::make_unique<worker_pool>(copies);
+        }
+    }
+
     // Start the ASIO io_service run loop
     s->run();
 
+    // Let the workers finish the callbacks still queued
+    std::unique_ptr<worker_pool> pool;
+    {
+        std::lock_guard<std::mutex> lock(m_servers_lock);
+        auto it = m_pools.find(s);
+        if (it != m_pools.end())
+        {
+            pool = std::move(it->second);
+            m_pools.erase(it);
+        }
+    }
+    pool.reset();
+
+    {
+        std::lock_guard<std::mutex> lock(m_servers_lock);
+        m_callbacks[s].listening = false;
+        m_callbacks[s].io = nullptr;
+    }
+
     return none_val();
 }
 
@@ -783,6 +966,8 @@ extern "C" Value _server_send(std::vector<Value> &args)
         return none_val();
     }
 
+    std::lock_guard<std::mutex> lock(m_servers_lock);
+
     for (auto it = m_servers[s].begin(); it != m_servers[s].end(); ++it)
     {
         if ((it->second).sessionId == id.get_number())
@@ -848,16 +1033,34 @@ extern "C" Value _server_broadcast(std::vector<Value> &args)
         return none_val();
     }
 
+    if (!websocketpp::utf8_validator::validate(message.get_string()))
+    {
+        return error_object("Function 'broadcast' expects argument 'message' to be valid UTF-8");
+    }
+
+    server::message_ptr frame = prepare_text_frame(message.get_string());
+
+    std::lock_guard<std::mutex> lock(m_servers_lock);
+
     for (auto it = m_servers[s].begin(); it != m_servers[s].end(); ++it)
     {
         try
         {
             auto con = s->get_con_from_hdl(it->first);
-            if (con->get_state() == websocketpp::session::state::open)
+            if (con->get_state() != websocketpp::session::state::open)
+            {
+                continue;
+            }
+
+            // hybi00 clients use a different framing
+            if (con->get_request_header("Sec-WebSocket-Version").empty())
             {
                 s->send(it->first, message.get_string(), websocketpp::frame::opcode::text);
             }
-            break;
+            else
+            {
+                con->send(frame);
+            }
         }
         catch (...)
         {
@@ -909,7 +1112,13 @@ extern "C" Value _server_on_validate(std::vector<Value> &args)
 
     server *s = (server *)_server->values["server_ptr"].get_pointer()->value;
 
-    auto on_validate_func = [func, s](websocketpp::connection_hdl hdl)
+    Value error = set_callback(s, CALLBACK_VALIDATE, func);
+    if (error.is_object())
+    {
+        return error;
+    }
+
+    auto on_validate_func = [s](websocketpp::connection_hdl hdl)
     {
         server::connection_ptr con = s->get_con_from_hdl(hdl);
         auto &req = con->get_request();
@@ -924,59 +1133,23 @@ extern "C" Value _server_on_validate(std::vector<Value> &args)
             header_internal_object->values[header.first] = string_val(header.second);
         }
 
-        connection_data &data = m_servers[s][hdl];
-
         std::string endpoint = con->get_remote_endpoint();
-        data.name = endpoint;
+        connection_data data;
 
-        Value data_obj = object_val();
-        data_obj.get_object()->keys = {"id", "name"};
-        data_obj.get_object()->values["id"] = number_val(data.sessionId);
-        data_obj.get_object()->values["name"] = string_val(data.name);
-
-        VM func_vm;
-        std::shared_ptr<FunctionObj> main = std::make_shared<FunctionObj>();
-        main->name = "";
-        main->arity = 0;
-        main->chunk = Chunk();
-        CallFrame main_frame;
-        main_frame.function = main;
-        main_frame.sp = 0;
-        main_frame.ip = main->chunk.code.data();
-        main_frame.frame_start = 0;
-        func_vm.frames.push_back(main_frame);
-
-        add_constant(main->chunk, func);
-        add_constant(main->chunk, data_obj);
-        add_constant(main->chunk, header_object);
-        add_opcode(main->chunk, OP_LOAD_CONST, 2, 0);
-        add_opcode(main->chunk, OP_LOAD_CONST, 1, 0);
-        add_opcode(main->chunk, OP_LOAD_CONST, 0, 0);
-        add_opcode(main->chunk, OP_CALL, 2, 0);
-
-        add_code(main->chunk, OP_EXIT, 0);
-
-        auto offsets = instruction_offsets(main_frame.function->chunk);
-        main_frame.function->instruction_offsets = offsets;
-
-        evaluate(func_vm);
-
-        if (func_vm.stack.size() == 0)
         {
-            m_servers[s].erase(hdl);
-            return false;
+            std::lock_guard<std::mutex> lock(m_servers_lock);
+            connection_data &entry = m_servers[s][hdl];
+            entry.name = endpoint;
+            data = entry;
         }
 
-        if (!func_vm.stack.back().is_boolean())
-        {
-            m_servers[s].erase(hdl);
-            return false;
-        }
-
-        bool res = func_vm.stack.back().get_boolean();
+        // The handshake waits for the answer, so this one runs on the I/O thread
+        Value result;
+        bool res = call_function(io_callbacks(s)[CALLBACK_VALIDATE], {connection_object(data), header_object}, &result) && result.is_boolean() && result.get_boolean();
 
         if (!res)
         {
+            std::lock_guard<std::mutex> lock(m_servers_lock);
             m_servers[s].erase(hdl);
         }
 
@@ -1029,7 +1202,13 @@ extern "C" Value _server_on_open(std::vector<Value> &args)
 
     server *s = (server *)_server->values["server_ptr"].get_pointer()->value;
 
-    auto on_open_func = [func, s](websocketpp::connection_hdl hdl)
+    Value error = set_callback(s, CALLBACK_OPEN, func);
+    if (error.is_object())
+    {
+        return error;
+    }
+
+    auto on_open_func = [s](websocketpp::connection_hdl hdl)
     {
         connection_data data;
 
@@ -1040,37 +1219,13 @@ extern "C" Value _server_on_open(std::vector<Value> &args)
 
         data.name = endpoint;
 
-        m_servers[s][hdl] = data;
-
-        Value data_obj = object_val();
-        data_obj.get_object()->keys = {"id", "name"};
-        data_obj.get_object()->values["id"] = number_val(data.sessionId);
-        data_obj.get_object()->values["name"] = string_val(data.name);
-
-        VM func_vm;
-        std::shared_ptr<FunctionObj> main = std::make_shared<FunctionObj>();
-        main->name = "";
-        main->arity = 0;
-        main->chunk = Chunk();
-        CallFrame main_frame;
-        main_frame.function = main;
-        main_frame.sp = 0;
-        main_frame.ip = main->chunk.code.data();
-        main_frame.frame_start = 0;
-        func_vm.frames.push_back(main_frame);
-
-        add_constant(main->chunk, func);
-        add_constant(main->chunk, data_obj);
-        add_opcode(main->chunk, OP_LOAD_CONST, 1, 0);
-        add_opcode(main->chunk, OP_LOAD_CONST, 0, 0);
-        add_opcode(main->chunk, OP_CALL, 1, 0);
-
-        add_code(main->chunk, OP_EXIT, 0);
-
-        auto offsets = instruction_offsets(main_frame.function->chunk);
-        main_frame.function->instruction_offsets = offsets;
-
-        evaluate(func_vm);
+        {
+            std::lock_guard<std::mutex> lock(m_servers_lock);
+            m_servers[s][hdl] = data;
+        }
+
+        dispatch(s, data.sessionId, [data](std::vector<Value> &callbacks)
+                 { call_function(callbacks[CALLBACK_OPEN], {connection_object(data)}); });
     };
 
     s->set_open_handler(on_open_func);
@@ -1119,40 +1274,32 @@ extern "C" Value _server_on_message(std::vector<Value> &args)
 
     server *s = (server *)_server->values["server_ptr"].get_pointer()->value;
 
-    auto on_message_func = [s, func](websocketpp::connection_hdl hdl, message_ptr msg)
+    Value error = set_callback(s, CALLBACK_MESSAGE, func);
+    if (error.is_object())
     {
-        connection_data &data = m_servers[s][hdl];
-
-        VM func_vm;
-        std::shared_ptr<FunctionObj> main = std::make_shared<FunctionObj>();
-        main->name = "";
-        main->arity = 0;
-        main->chunk = Chunk();
-        CallFrame main_frame;
-        main_frame.function = main;
-        main_frame.sp = 0;
-        main_frame.ip = main->chunk.code.data();
-        main_frame.frame_start = 0;
-        func_vm.frames.push_back(main_frame);
+        return error;
+    }
 
-        Value payload = object_val();
-        payload.get_object()->keys = {"id", "name", "data"};
-        payload.get_object()->values["id"] = number_val(data.sessionId);
-        payload.get_object()->values["name"] = string_val(data.name);
-        payload.get_object()->values["data"] = string_val(msg->get_payload());
+    auto on_message_func = [s](websocketpp::connection_hdl hdl, message_ptr msg)
+    {
+        connection_data data;
 
-        add_constant(main->chunk, func);
-        add_constant(main->chunk, payload);
-        add_opcode(main->chunk, OP_LOAD_CONST, 1, 0);
-        add_opcode(main->chunk, OP_LOAD_CONST, 0, 0);
-        add_opcode(main->chunk, OP_CALL, 1, 0);
+        {
+            std::lock_guard<std::mutex> lock(m_servers_lock);
+            data = m_servers[s][hdl];
+        }
 
-        add_code(main->chunk, OP_EXIT, 0);
+        std::string text = std::move(msg->get_raw_payload());
 
-        auto offsets = instruction_offsets(main_frame.function->chunk);
-        main_frame.function->instruction_offsets = offsets;
+        dispatch(s, data.sessionId, [data, text](std::vector<Value> &callbacks)
+                 {
+            Value payload = object_val();
+            payload.get_object()->keys = {"id", "name", "data"};
+            payload.get_object()->values["id"] = number_val(data.sessionId);
+            payload.get_object()->values["name"] = string_val(data.name);
+            payload.get_object()->values["data"] = string_val(text);
 
-        evaluate(func_vm);
+            call_function(callbacks[CALLBACK_MESSAGE], {payload}); });
     };
 
     s->set_message_handler(on_message_func);
@@ -1201,41 +1348,24 @@ extern "C" Value _server_on_fail(std::vector<Value> &args)
 
     server *s = (server *)_server->values["server_ptr"].get_pointer()->value;
 
-    auto on_fail_func = [s, func](websocketpp::connection_hdl hdl)
+    Value error = set_callback(s, CALLBACK_FAIL, func);
+    if (error.is_object())
     {
-        connection_data &data = m_servers[s][hdl];
-
-        Value data_obj = object_val();
-        data_obj.get_object()->keys = {"id", "name"};
-        data_obj.get_object()->values["id"] = number_val(data.sessionId);
-        data_obj.get_object()->values["name"] = string_val(data.name);
-
-        m_servers[s].erase(hdl);
-
-        VM func_vm;
-        std::shared_ptr<FunctionObj> main = std::make_shared<FunctionObj>();
-        main->name = "";
-        main->arity = 0;
-        main->chunk = Chunk();
-        CallFrame main_frame;
-        main_frame.function = main;
-        main_frame.sp = 0;
-        main_frame.ip = main->chunk.code.data();
-        main_frame.frame_start = 0;
-        func_vm.frames.push_back(main_frame);
-
-        add_constant(main->chunk, func);
-        add_constant(main->chunk, data_obj);
-        add_opcode(main->chunk, OP_LOAD_CONST, 1, 0);
-        add_opcode(main->chunk, OP_LOAD_CONST, 0, 0);
-        add_opcode(main->chunk, OP_CALL, 1, 0);
+        return error;
+    }
 
-        add_code(main->chunk, OP_EXIT, 0);
+    auto on_fail_func = [s](websocketpp::connection_hdl hdl)
+    {
+        connection_data data;
 
-        auto offsets = instruction_offsets(main_frame.function->chunk);
-        main_frame.function->instruction_offsets = offsets;
+        {
+            std::lock_guard<std::mutex> lock(m_servers_lock);
+            data = m_servers[s][hdl];
+            m_servers[s].erase(hdl);
+        }
 
-        evaluate(func_vm);
+        dispatch(s, data.sessionId, [data](std::vector<Value> &callbacks)
+                 { call_function(callbacks[CALLBACK_FAIL], {connection_object(data)}); });
     };
 
     s->set_fail_handler(on_fail_func);
@@ -1284,44 +1414,27 @@ extern "C" Value _server_on_close(std::vector<Value> &args)
 
     server *s = (server *)_server->values["server_ptr"].get_pointer()->value;
 
-    auto on_close_func = [s, func](websocketpp::connection_hdl hdl)
+    Value error = set_callback(s, CALLBACK_CLOSE, func);
+    if (error.is_object())
     {
-        connection_data &data = m_servers[s][hdl];
+        return error;
+    }
 
-        Value data_obj = object_val();
-        data_obj.get_object()->keys = {"id", "name"};
-        data_obj.get_object()->values["id"] = number_val(data.sessionId);
-        data_obj.get_object()->values["name"] = string_val(data.name);
+    auto on_close_func = [s](websocketpp::connection_hdl hdl)
+    {
+        connection_data data;
+
+        {
+            std::lock_guard<std::mutex> lock(m_servers_lock);
+            data = m_servers[s][hdl];
+            m_servers[s].erase(hdl);
+        }
 
         std::cout << "Closing connection " << data.name
                   << " with id " << data.sessionId << std::endl;
 
-        m_servers[s].erase(hdl);
-
-        VM func_vm;
-        std::shared_ptr<FunctionObj> main = std::make_shared<FunctionObj>();
-        main->name = "";
-        main->arity = 0;
-        main->chunk = Chunk();
-        CallFrame main_frame;
-        main_frame.function = main;
-        main_frame.sp = 0;
-        main_frame.ip = main->chunk.code.data();
-        main_frame.frame_start = 0;
-        func_vm.frames.push_back(main_frame);
-
-        add_constant(main->chunk, func);
-        add_constant(main->chunk, data_obj);
-        add_opcode(main->chunk, OP_LOAD_CONST, 1, 0);
-        add_opcode(main->chunk, OP_LOAD_CONST, 0, 0);
-        add_opcode(main->chunk, OP_CALL, 1, 0);
-
-        add_code(main->chunk, OP_EXIT, 0);
-
-        auto offsets = instruction_offsets(main_frame.function->chunk);
-        main_frame.function->instruction_offsets = offsets;
-
-        evaluate(func_vm);
+        dispatch(s, data.sessionId, [data](std::vector<Value> &callbacks)
+                 { call_function(callbacks[CALLBACK_CLOSE], {connection_object(data)}); });
     };
 
     s->set_close_handler(on_close_func);
@@ -1361,6 +1474,8 @@ extern "C" Value _server_get_clients(std::vector<Value> &args)
 
     Value clients_list = list_val();
 
+    std::lock_guard<std::mutex> lock(m_servers_lock);
+
     for (auto it = m_servers[s].begin(); it != m_servers[s].end(); ++it)
     {
         Value client_object = object_val();
@@ -1415,6 +1530,8 @@ extern "C" Value _server_close_connection(std::vector<Value> &args)
         return none_val();
     }
 
+    std::lock_guard<std::mutex> lock(m_servers_lock);
+
     for (auto it = m_servers[s].begin(); it != m_servers[s].end(); ++it)
     {
         if ((it->second).sessionId == id.get_number())
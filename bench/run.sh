@@ -0,0 +1,192 @@
+#!/bin/sh
+
+# Runs the programs in bench/ and reports the median and p95 wall time, heap
+# allocations and peak RSS of each as JSON, then compares them with a baseline
+#
+#   bench/run.sh [-n runs] [-o results] [-b baseline] [-t threshold] [-s] [case ...]
+#
+#   -n  runs per case (default 5)
+#   -o  where to write the results (default bench/results.json)
+#   -b  baseline to compare with (default bench/baseline.json)
+#   -t  slowdown in percent, or growth in allocations, that counts as a
+#       regression (default 10)
+#   -s  save the results as the new baseline
+#
+# The interpreter is built into bench/build first, set VORTEX to the path of
+# an existing one to skip that. Exits with 1 if any case regressed.
+
+cd "$(dirname "$0")/.." || exit 1
+
+RUNS=5
+OUTPUT=bench/results.json
+BASELINE=bench/baseline.json
+THRESHOLD=10
+SAVE=0
+
+usage()
+{
+    sed -n '3,16p' "$0" | sed 's/^# \{0,1\}//'
+}
+
+while getopts "n:o:b:t:sh" opt; do
+    case $opt in
+        n) RUNS=$OPTARG ;;
+        o) OUTPUT=$OPTARG ;;
+        b) BASELINE=$OPTARG ;;
+        t) THRESHOLD=$OPTARG ;;
+        s) SAVE=1 ;;
+        h) usage; exit 0 ;;
+        *) usage; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+CASES="$*"
+if [ -z "$CASES" ]; then
+    CASES=$(ls bench/*.vtx | sed 's|^bench/||; s|\.vtx$||')
+fi
+
+build()
+{
+    echo "Compiling Vortex..."
+    mkdir -p bench/build
+    case "`uname`" in
+        'Linux') FLAGS="-stdlib=libc++ -pthread -ldl" ;;
+        *) FLAGS="" ;;
+    esac
+    ${CXX:-clang++} \
+    -Ofast \
+    -Wno-everything \
+    -std=c++20 \
+    $FLAGS \
+    src/Node/Node.cpp \
+    src/Lexer/Lexer.cpp \
+    src/Parser/Parser.cpp \
+    src/Bytecode/Bytecode.cpp \
+    src/Bytecode/Generator.cpp \
+    src/Heap/Heap.cpp \
+    src/Heap/Snapshot.cpp \
+    src/Profiler/Profiler.cpp \
+    src/Profiler/OpcodeStats.cpp \
+    src/Profiler/Tracer.cpp \
+    src/Image/Image.cpp \
+    src/Jit/Jit.cpp \
+    src/VirtualMachine/VirtualMachine.cpp \
+    src/utils/utils.cpp \
+    main.cpp \
+    -o bench/build/vortex || { echo 'Compilation failed' ; exit 1; }
+}
+
+if [ -z "$VORTEX" ]; then
+    build
+    VORTEX=bench/build/vortex
+fi
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# One '"case": {...}' line per case
+: > "$TMP/cases"
+for case in $CASES; do
+    if [ ! -f "bench/$case.vtx" ]; then
+        echo "No such benchmark: $case"
+        exit 1
+    fi
+    printf "%-12s" "$case"
+    : > "$TMP/stats"
+    error=""
+    run=0
+    while [ $run -lt "$RUNS" ]; do
+        if ! "$VORTEX" "bench/$case.vtx" --stats > /dev/null 2> "$TMP/stderr"; then
+            error=$(grep -v '^vortex-stats' "$TMP/stderr" | head -1 | sed 's/\\/\\\\/g; s/"/\\"/g')
+            [ -z "$error" ] && error="exited with an error"
+            break
+        fi
+        grep '^vortex-stats' "$TMP/stderr" | sed 's/[{},:"]/ /g' >> "$TMP/stats"
+        printf "."
+        run=$((run + 1))
+    done
+
+    if [ -n "$error" ]; then
+        echo " failed: $error"
+        echo "\"$case\": {\"error\": \"$error\"}" >> "$TMP/cases"
+        continue
+    fi
+
+    # Fields: vortex-stats time T allocations A peak_rss_kb R
+    awk '{ print $3, $5, $7 }' "$TMP/stats" | sort -n | awk -v name="$case" '
+        { time[NR] = $1; allocations[NR] = $2; if ($3 > rss) rss = $3 }
+        END {
+            median = NR % 2 ? time[(NR + 1) / 2] : (time[NR / 2] + time[NR / 2 + 1]) / 2
+            p95 = int(NR * 0.95) < NR * 0.95 ? int(NR * 0.95) + 1 : int(NR * 0.95)
+            printf "\"%s\": {\"median\": %.6f, \"p95\": %.6f, \"allocations\": %d, \"peak_rss_kb\": %d}\n", name, median, time[p95], allocations[1], rss
+        }' >> "$TMP/cases"
+    echo " done"
+done
+
+{
+    echo "{"
+    echo "  \"runs\": $RUNS,"
+    echo "  \"cases\": {"
+    sed 's/^/    /; $!s/$/,/' "$TMP/cases"
+    echo "  }"
+    echo "}"
+} > "$OUTPUT"
+echo "Results written to $OUTPUT"
+echo
+
+if [ "$SAVE" = 1 ]; then
+    cp "$OUTPUT" "$BASELINE"
+    echo "Baseline saved to $BASELINE"
+    echo
+fi
+
+# Both files keep one case per line, see above
+awk -v threshold="$THRESHOLD" -v baseline="$BASELINE" '
+    function field(line, key,    rest) {
+        if (!match(line, "\"" key "\": [^,}]*")) return ""
+        rest = substr(line, RSTART, RLENGTH)
+        sub(/^[^:]*: */, "", rest)
+        gsub(/"/, "", rest)
+        return rest
+    }
+    function name(line) {
+        match(line, /"[^"]*"/)
+        return substr(line, RSTART + 1, RLENGTH - 2)
+    }
+    FILENAME == baseline && /"median"/ {
+        base_time[name($0)] = field($0, "median")
+        base_allocations[name($0)] = field($0, "allocations")
+        next
+    }
+    FILENAME == baseline { next }
+    /"median"|"error"/ {
+        if (!header++) {
+            printf "%-12s %10s %10s %10s %8s %12s %8s %12s\n", "case", "median", "p95", "baseline", "change", "allocations", "change", "peak rss kb"
+        }
+        case_name = name($0)
+        if ($0 ~ /"error"/) {
+            printf "%-12s %s\n", case_name, "error: " field($0, "error")
+            next
+        }
+        median = field($0, "median")
+        allocations = field($0, "allocations")
+        if (case_name in base_time) {
+            change = base_time[case_name] > 0 ? 100 * (median - base_time[case_name]) / base_time[case_name] : 0
+            allocation_change = base_allocations[case_name] > 0 ? 100 * (allocations - base_allocations[case_name]) / base_allocations[case_name] : 0
+            flag = ""
+            if (change > threshold || allocation_change > threshold) {
+                flag = "  REGRESSION"
+                regressions++
+            }
+            printf "%-12s %10.4f %10.4f %10.4f %+7.1f%% %12d %+7.1f%% %12d%s\n", case_name, median, field($0, "p95"), base_time[case_name], change, allocations, allocation_change, field($0, "peak_rss_kb"), flag
+        } else {
+            printf "%-12s %10.4f %10.4f %10s %8s %12d %8s %12d\n", case_name, median, field($0, "p95"), "-", "-", allocations, "-", field($0, "peak_rss_kb")
+        }
+    }
+    END {
+        if (regressions) {
+            printf "\n%d case(s) regressed by more than %s%%\n", regressions, threshold
+            exit 1
+        }
+    }' $( [ -f "$BASELINE" ] && echo "$BASELINE" ) "$OUTPUT"
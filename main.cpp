@@ -1,12 +1,17 @@
 #include <iostream>
 #include <fstream>
 #include <filesystem>
+#include <chrono>
 #include "src/Lexer/Lexer.hpp"
 #include "src/Parser/Parser.hpp"
 #include "src/Bytecode/Bytecode.hpp"
 #include "src/Bytecode/Generator.hpp"
 #include "src/VirtualMachine/VirtualMachine.hpp"
 
+#if defined(__APPLE__) || defined(__linux__)
+#include <sys/resource.h>
+#endif
+
 enum CompType
 {
     DEV,
@@ -15,6 +20,26 @@ enum CompType
 
 CompType type = CompType::INTERP;
 
+static auto start_time = std::chrono::steady_clock::now();
+
+// One machine readable line for bench/run.sh
+static void print_stats()
+{
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    long long peak_rss_kb = 0;
+#if defined(__APPLE__)
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    peak_rss_kb = usage.ru_maxrss / 1024;
+#elif defined(__linux__)
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    peak_rss_kb = usage.ru_maxrss;
+#endif
+    fprintf(stderr, "vortex-stats {\"time\": %.6f, \"allocations\": %lld, \"peak_rss_kb\": %lld}\n",
+            elapsed, pool_allocations(), peak_rss_kb);
+}
+
 int main(int argc, char **argv)
 {
     if (type == CompType::DEV)
@@ -37,7 +62,7 @@ int main(int argc, char **argv)
         main->arity = 0;
         main->chunk = Chunk();
         CallFrame main_frame;
-        main_frame.name = "source.vtx";
+        main->import_path = "source.vtx";
         main_frame.function = main;
         main_frame.sp = 0;
         main_frame.ip = main->chunk.code.data();
@@ -66,6 +91,10 @@ int main(int argc, char **argv)
         std::string path = argv[1];
         std::vector<std::string> args;
         std::string import_path;
+        std::string profile_path;
+        std::string trace_path;
+        std::string snapshot_path;
+        std::string image_path;
 
         if (argc > 1)
         {
@@ -90,44 +119,113 @@ int main(int argc, char **argv)
                     import_path = args[i + 1];
                 }
             }
+            if (arg == "--stats")
+            {
+                atexit(print_stats);
+            }
+            if (arg == "--profile")
+            {
+                profile_path = std::filesystem::absolute(std::filesystem::path(path).stem().string() + ".profile").string();
+            }
+            if (arg == "--trace")
+            {
+                trace_path = std::filesystem::absolute(std::filesystem::path(path).stem().string() + ".trace.json").string();
+            }
+            if (arg == "--jit" && !jit_enable())
+            {
+                std::cout << "JIT compilation is not supported on this platform\n";
+            }
+            if (arg == "--snapshot" || arg == "--image")
+            {
+                if (i == args.size() - 1)
+                {
+                    std::cout << "Invalid image path";
+                    return 1;
+                }
+                (arg == "--snapshot" ? snapshot_path : image_path) = std::filesystem::absolute(args[i + 1]).string();
+            }
         }
 
-        Lexer lexer(path);
-        lexer.tokenize();
-
+        std::string source_path = std::filesystem::absolute(path).lexically_normal().string();
         auto parent_path = std::filesystem::path(path).parent_path();
-        if (parent_path != "")
+
+        VM vm;
+        std::shared_ptr<FunctionObj> main;
+        if (image_path != "")
         {
-            std::filesystem::current_path(parent_path);
+            std::string error;
+            main = image_load(vm, image_path, source_path, error);
+            if (!main)
+            {
+                std::cerr << "Not using image: " << error << "\n";
+            }
         }
 
-        Parser parser(lexer.nodes, lexer.file_name);
-        parser.parse(0, "_");
-        parser.remove_op_node(";");
-        auto ast = parser.nodes;
+        if (main)
+        {
+            if (parent_path != "")
+            {
+                std::filesystem::current_path(parent_path);
+            }
+            main->chunk.import_path = import_path;
+            main->import_path = path;
+        }
+        else
+        {
+            Lexer lexer(path);
+            lexer.tokenize();
+
+            if (parent_path != "")
+            {
+                std::filesystem::current_path(parent_path);
+            }
+
+            Parser parser(lexer.nodes, lexer.file_name);
+            parser.parse(0, "_");
+            parser.remove_op_node(";");
+
+            main = std::make_shared<FunctionObj>();
+            main->name = "";
+            main->arity = 0;
+            main->chunk = Chunk();
+            main->chunk.import_path = import_path;
+            main->import_path = path;
+
+            generate_bytecode(parser.nodes, main->chunk, path);
+            main->instruction_offsets = instruction_offsets(main->chunk);
+            add_code(main->chunk, OP_EXIT);
+        }
 
-        VM vm;
-        std::shared_ptr<FunctionObj> main = std::make_shared<FunctionObj>();
-        main->name = "";
-        main->arity = 0;
-        main->chunk = Chunk();
-        main->chunk.import_path = import_path;
         CallFrame main_frame;
-        main_frame.name = path;
         main_frame.function = main;
         main_frame.sp = 0;
         main_frame.ip = main->chunk.code.data();
         main_frame.frame_start = 0;
+        vm.frames.push_back(main_frame);
 
         vm.argc = argc;
         vm.argv = argv;
 
-        generate_bytecode(parser.nodes, main_frame.function->chunk, path);
-        auto offsets = instruction_offsets(main_frame.function->chunk);
-        main_frame.function->instruction_offsets = offsets;
-        vm.frames.push_back(main_frame);
-        add_code(main_frame.function->chunk, OP_EXIT);
-        evaluate(vm);
+        if (snapshot_path != "" && !image_snapshot(vm, snapshot_path, source_path))
+        {
+            std::cout << "Cannot snapshot " << path << "\n";
+        }
+
+        if (profile_path != "" && !profiler_start(profile_path))
+        {
+            std::cout << "Profiling is not supported on this platform\n";
+        }
+
+        if (trace_path != "")
+        {
+            tracer_start();
+            tracer_dump_at_exit(trace_path);
+        }
+
+        if (evaluate(vm) != EVALUATE_OK)
+        {
+            image_discard();
+        }
 
         exit(0);
     }
@@ -12,6 +12,13 @@ src/Lexer/Lexer.cpp \
 src/Parser/Parser.cpp \
 src/Bytecode/Bytecode.cpp \
 src/Bytecode/Generator.cpp \
+src/Heap/Heap.cpp \
+src/Heap/Snapshot.cpp \
+src/Profiler/Profiler.cpp \
+src/Profiler/OpcodeStats.cpp \
+src/Profiler/Tracer.cpp \
+src/Image/Image.cpp \
+src/Jit/Jit.cpp \
 src/VirtualMachine/VirtualMachine.cpp \
 src/utils/utils.cpp \
 main.cpp \
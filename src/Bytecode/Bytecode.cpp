@@ -25,7 +25,7 @@ Value number_val(double value)
 Value string_val(std::string value)
 {
     Value val(String);
-    val.value = value;
+    val.value = pool_make<std::string>(std::move(value));
     return val;
 }
 
@@ -278,12 +278,6 @@ int disassemble_instruction(Chunk &chunk, int offset)
         return simple_instruction("OP_RETURN", offset);
     case OP_YIELD:
         return simple_instruction("OP_YIELD", offset);
-    case OP_TRY_BEGIN:
-        return op_code_instruction("OP_TRY_BEGIN", chunk, offset);
-    case OP_TRY_END:
-        return simple_instruction("OP_TRY_END", offset);
-    case OP_CATCH_BEGIN:
-        return simple_instruction("OP_CATCH_BEGIN", offset);
     case OP_LOAD_GLOBAL:
         return op_code_instruction("OP_LOAD_GLOBAL", chunk, offset);
     case OP_LOAD_CONST:
@@ -410,14 +404,24 @@ int disassemble_instruction(Chunk &chunk, int offset)
     }
 }
 
-void disassemble_chunk(Chunk &chunk, std::string name)
+void disassemble_chunk(Chunk &chunk, std::string name, std::vector<uint64_t> *counts)
 {
     printf("== %s ==\n", name.c_str());
 
     for (int offset = 0; offset < chunk.code.size();)
     {
+        if (counts)
+        {
+            uint64_t count = offset < counts->size() ? (*counts)[offset] : 0;
+            printf("%12llu ", (unsigned long long)count);
+        }
         offset = disassemble_instruction(chunk, offset);
     }
+
+    for (auto &entry : chunk.exception_table)
+    {
+        printf("  try [%04d, %04d) -> %04d depth %d\n", entry.start, entry.end, entry.handler, entry.depth);
+    }
 }
 
 int advance(Chunk &chunk, int offset)
@@ -435,12 +439,6 @@ int advance(Chunk &chunk, int offset)
         return offset + 1;
     case OP_YIELD:
         return offset + 1;
-    case OP_TRY_BEGIN:
-        return offset + 5;
-    case OP_TRY_END:
-        return offset + 1;
-    case OP_CATCH_BEGIN:
-        return offset + 1;
     case OP_LOAD_GLOBAL:
         return offset + 5;
     case OP_LOAD_CONST:
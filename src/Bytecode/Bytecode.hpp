@@ -6,6 +6,7 @@
 #include <cmath>
 #include <string>
 #include "../Node/Node.hpp"
+#include "../Heap/Heap.hpp"
 
 #define value_ptr std::shared_ptr<Value>
 
@@ -79,10 +80,7 @@ enum OpCode
     OP_HOOK_ONCHANGE,
     OP_HOOK_CLOSURE_ONCHANGE,
     OP_HOOK_ONACCESS,
-    OP_HOOK_CLOSURE_ONACCESS,
-    OP_TRY_BEGIN,
-    OP_TRY_END,
-    OP_CATCH_BEGIN
+    OP_HOOK_CLOSURE_ONACCESS
 };
 
 enum ValueType
@@ -104,6 +102,14 @@ struct Closure;
 
 std::string toString(Value value);
 
+struct ExceptionHandler
+{
+    int start;
+    int end;
+    int handler;
+    int depth;
+};
+
 struct Chunk
 {
     std::vector<uint8_t> code;
@@ -111,6 +117,7 @@ struct Chunk
     std::vector<Value> constants;
     std::vector<std::string> variables;
     std::vector<std::string> public_variables;
+    std::vector<ExceptionHandler> exception_table;
     std::string import_path;
 };
 
@@ -137,6 +144,8 @@ struct FunctionObj
     bool generator_init = false;
     bool generator_done = false;
     bool is_type_generator = false;
+    std::vector<Value> generator_stack;
+    int generator_ip = 0;
     std::string import_path;
 };
 
@@ -186,17 +195,22 @@ struct ValueHooks
 
 std::string toString(Value value);
 
-static long long int v_counter = 0;
+// String buffers are shared between copies of a Value and never written
+// in place while shared, see Value::get_mutable_string
+static const std::shared_ptr<std::string> &empty_string()
+{
+    static const std::shared_ptr<std::string> empty = pool_make<std::string>();
+    return empty;
+}
 
 struct Value
 {
     ValueType type;
     Meta meta;
     ValueHooks hooks;
-    long long int id;
     std::variant<
         double,
-        std::string,
+        std::shared_ptr<std::string>,
         bool,
         std::shared_ptr<std::vector<Value>>,
         std::shared_ptr<FunctionObj>,
@@ -208,33 +222,35 @@ struct Value
 
     Value() : type(None)
     {
-        id = ++v_counter;
     }
     Value(ValueType type) : type(type)
     {
-        id = ++v_counter;
         switch (type)
         {
         case Number:
             value = 0.0f;
             break;
         case String:
-            value = "";
+            value = empty_string();
             break;
         case Boolean:
             value = false;
             break;
         case List:
-            value = std::make_shared<std::vector<Value>>();
+            value = pool_make<std::vector<Value>>();
+            heap_track(std::get<std::shared_ptr<std::vector<Value>>>(value), CELL_LIST);
             break;
         case Type:
-            value = std::make_shared<TypeObj>();
+            value = pool_make<TypeObj>();
+            heap_track(std::get<std::shared_ptr<TypeObj>>(value), CELL_TYPE);
             break;
         case Object:
-            value = std::make_shared<ObjectObj>();
+            value = pool_make<ObjectObj>();
+            heap_track(std::get<std::shared_ptr<ObjectObj>>(value), CELL_OBJECT);
             break;
         case Function:
-            value = std::make_shared<FunctionObj>();
+            value = pool_make<FunctionObj>();
+            heap_track(std::get<std::shared_ptr<FunctionObj>>(value), CELL_FUNCTION);
             break;
         case Native:
             value = std::make_shared<NativeFunctionObj>();
@@ -251,9 +267,18 @@ struct Value
     {
         return std::get<double>(this->value);
     }
-    std::string &get_string()
+    const std::string &get_string()
     {
-        return std::get<std::string>(this->value);
+        return *std::get<std::shared_ptr<std::string>>(this->value);
+    }
+    std::string &get_mutable_string()
+    {
+        auto &str = std::get<std::shared_ptr<std::string>>(this->value);
+        if (str.use_count() > 1)
+        {
+            str = pool_make<std::string>(*str);
+        }
+        return *str;
     }
     bool &get_boolean()
     {
@@ -409,7 +434,7 @@ static int op_code_instruction(std::string name, Chunk &chunk, int offset);
 
 int disassemble_instruction(Chunk &chunk, int offset);
 
-void disassemble_chunk(Chunk &chunk, std::string name);
+void disassemble_chunk(Chunk &chunk, std::string name, std::vector<uint64_t> *counts = nullptr);
 
 int advance(Chunk &chunk, int offset);
 
@@ -2,8 +2,9 @@
 #include "Bytecode.hpp"
 #include "../Node/Node.hpp"
 
-std::shared_ptr<Compiler> current = std::make_shared<Compiler>();
-std::shared_ptr<Compiler> prev;
+// Imports and eval compile on whichever thread runs them
+thread_local std::shared_ptr<Compiler> current = std::make_shared<Compiler>();
+thread_local std::shared_ptr<Compiler> prev;
 
 void gen_literal(Chunk &chunk, node_ptr node)
 {
@@ -379,25 +380,23 @@ void gen_id(Chunk &chunk, node_ptr node, int global_flag)
 
 int gen_try_catch(Chunk &chunk, node_ptr node)
 {
-    int try_begin_instruction = chunk.code.size() + 1;
-    add_opcode(chunk, OP_TRY_BEGIN, 0, node->line);
-    // begin_scope();
+    ExceptionHandler entry;
+    entry.depth = current->variableCount;
+    entry.start = chunk.code.size();
+    begin_scope();
     generate_bytecode(node->_Node.TryCatch().try_body->_Node.Object().elements, chunk);
-    // end_scope(chunk);
-    add_code(chunk, OP_TRY_END, node->line);
+    end_scope(chunk);
+    entry.end = chunk.code.size();
     int jump_instruction = chunk.code.size() + 1;
     add_opcode(chunk, OP_JUMP, 0, node->line);
 
-    int catch_offset = chunk.code.size() - try_begin_instruction - 4;
-    // int catch_offset = chunk.code.size();
-    uint8_t *catch_bytes = int_to_bytes(catch_offset);
-    patch_bytes(chunk, try_begin_instruction, catch_bytes);
+    // Nested entries are pushed first, so the innermost handler wins
+    entry.handler = chunk.code.size();
+    chunk.exception_table.push_back(entry);
 
     begin_scope();
 
-    add_code(chunk, OP_CATCH_BEGIN, node->line);
-
-    // error object
+    // The VM unwinds to entry.depth and pushes the error object
     if (node->_Node.TryCatch().catch_keyword->_Node.FunctionCall().args.size() > 1)
     {
         error("Catch keyword expects 0 or 1 arguments", chunk, node);
@@ -405,16 +404,14 @@ int gen_try_catch(Chunk &chunk, node_ptr node)
     if (node->_Node.TryCatch().catch_keyword->_Node.FunctionCall().args.size() == 1)
     {
         std::string error_var_name = node->_Node.TryCatch().catch_keyword->_Node.FunctionCall().args[0]->_Node.ID().value;
-        add_constant_code(chunk, object_val());
         declareVariable(error_var_name, false, true, chunk, node);
-        add_code(chunk, OP_SWAP_TOS, node->line);
-        add_opcode(chunk, OP_SET_FORCE, resolve_variable(error_var_name), node->line);
-        // add_code(chunk, OP_POP, node->line); // pop the error object off the stack
-        // add_code(chunk, OP_POP, node->line); // pop the original empty object off the stack
+    }
+    else
+    {
+        add_code(chunk, OP_POP, node->line);
     }
 
     generate_bytecode(node->_Node.TryCatch().catch_body->_Node.Object().elements, chunk);
-    add_code(chunk, OP_POP, node->line); // pop the error object off the stack
 
     end_scope(chunk);
 
@@ -0,0 +1,447 @@
+#include <chrono>
+#include <unordered_map>
+#include <mutex>
+#include "Heap.hpp"
+#include "../Bytecode/Bytecode.hpp"
+
+thread_local Heap heap;
+std::atomic<int> heap_shared_threads = 0;
+
+template <typename F>
+static void visit_value(Value &value, F &visit);
+
+// Hook and 'this' boxes are not cells, a box held by a single Value is
+// treated as part of that Value and one shared by several is left opaque
+template <typename F>
+static void visit_box(std::shared_ptr<Value> &box, F &visit)
+{
+    if (box && box.use_count() == 1)
+    {
+        visit_value(*box, visit);
+    }
+}
+
+template <typename F>
+static void visit_value(Value &value, F &visit)
+{
+    if (auto list = std::get_if<std::shared_ptr<std::vector<Value>>>(&value.value))
+    {
+        visit(list->get());
+    }
+    else if (auto object = std::get_if<std::shared_ptr<ObjectObj>>(&value.value))
+    {
+        visit(object->get());
+    }
+    else if (auto function = std::get_if<std::shared_ptr<FunctionObj>>(&value.value))
+    {
+        visit(function->get());
+    }
+    else if (auto type = std::get_if<std::shared_ptr<TypeObj>>(&value.value))
+    {
+        visit(type->get());
+    }
+    visit_box(value.hooks.onChangeHook, visit);
+    visit_box(value.hooks.onAccessHook, visit);
+}
+
+template <typename F>
+static void visit_children(HeapCell &cell, F &visit)
+{
+    switch (cell.kind)
+    {
+    case CELL_LIST:
+    {
+        for (auto &value : *(std::vector<Value> *)cell.ptr)
+        {
+            visit_value(value, visit);
+        }
+        break;
+    }
+    case CELL_OBJECT:
+    {
+        auto object = (ObjectObj *)cell.ptr;
+        for (auto &prop : object->values)
+        {
+            visit_value(prop.second, visit);
+        }
+        if (object->type)
+        {
+            visit(object->type.get());
+        }
+        break;
+    }
+    case CELL_TYPE:
+    {
+        auto type = (TypeObj *)cell.ptr;
+        for (auto &prop : type->types)
+        {
+            visit_value(prop.second, visit);
+        }
+        for (auto &prop : type->defaults)
+        {
+            visit_value(prop.second, visit);
+        }
+        break;
+    }
+    case CELL_FUNCTION:
+    {
+        auto function = (FunctionObj *)cell.ptr;
+        for (auto &value : function->chunk.constants)
+        {
+            visit_value(value, visit);
+        }
+        for (auto &value : function->default_values)
+        {
+            visit_value(value, visit);
+        }
+        for (auto &value : function->generator_stack)
+        {
+            visit_value(value, visit);
+        }
+        for (auto &closure : function->closed_vars)
+        {
+            visit(closure.get());
+        }
+        visit_box(function->object, visit);
+        break;
+    }
+    case CELL_CLOSURE:
+    {
+        visit_value(((Closure *)cell.ptr)->closed, visit);
+        break;
+    }
+    }
+}
+
+void heap_visit_children(HeapCell &cell, const std::function<void(void *)> &visit)
+{
+    visit_children(cell, visit);
+}
+
+void heap_visit_value(Value &value, const std::function<void(void *)> &visit)
+{
+    visit_value(value, visit);
+}
+
+static void clear_cell(HeapCell &cell)
+{
+    switch (cell.kind)
+    {
+    case CELL_LIST:
+        ((std::vector<Value> *)cell.ptr)->clear();
+        break;
+    case CELL_OBJECT:
+    {
+        auto object = (ObjectObj *)cell.ptr;
+        object->values.clear();
+        object->keys.clear();
+        object->type.reset();
+        break;
+    }
+    case CELL_TYPE:
+    {
+        auto type = (TypeObj *)cell.ptr;
+        type->types.clear();
+        type->defaults.clear();
+        break;
+    }
+    case CELL_FUNCTION:
+    {
+        auto function = (FunctionObj *)cell.ptr;
+        function->chunk.constants.clear();
+        function->default_values.clear();
+        function->generator_stack.clear();
+        function->closed_vars.clear();
+        function->object.reset();
+        break;
+    }
+    case CELL_CLOSURE:
+    {
+        auto closure = (Closure *)cell.ptr;
+        closure->closed = Value();
+        closure->location = &closure->closed;
+        break;
+    }
+    }
+}
+
+// Collects the given generation and all younger ones. A cell is garbage when
+// every strong reference to it comes from other cells being collected, so
+// anything held by the stack, frames, globals, closures, the import cache or
+// native code keeps it and everything it reaches alive
+int heap_collect(int generation)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<HeapCell> cells;
+    for (int i = 0; i <= generation; i++)
+    {
+        cells.insert(cells.end(), std::make_move_iterator(heap.generations[i].begin()), std::make_move_iterator(heap.generations[i].end()));
+        heap.generations[i].clear();
+        heap.counts[i] = 0;
+    }
+    if (generation + 1 < HEAP_GENERATIONS)
+    {
+        heap.counts[generation + 1]++;
+    }
+
+    std::vector<std::shared_ptr<void>> locked;
+    std::unordered_map<void *, int> index;
+    locked.reserve(cells.size());
+    index.reserve(cells.size());
+    int live = 0;
+    for (auto &cell : cells)
+    {
+        auto ref = cell.ref.lock();
+        if (!ref || index.count(cell.ptr))
+        {
+            continue;
+        }
+        index[cell.ptr] = live;
+        locked.push_back(std::move(ref));
+        if (&cells[live] != &cell)
+        {
+            cells[live] = std::move(cell);
+        }
+        live++;
+    }
+    cells.resize(live);
+
+    int promote_to = generation + 1 < HEAP_GENERATIONS ? generation + 1 : generation;
+    int collected = 0;
+
+    if (heap.enabled)
+    {
+        std::vector<long> refs(live);
+        for (int i = 0; i < live; i++)
+        {
+            refs[i] = locked[i].use_count() - 1;
+        }
+
+        auto subtract = [&](void *ptr)
+        {
+            auto it = index.find(ptr);
+            if (it != index.end())
+            {
+                refs[it->second]--;
+            }
+        };
+        for (auto &cell : cells)
+        {
+            visit_children(cell, subtract);
+        }
+
+        std::vector<bool> reachable(live, false);
+        std::vector<int> worklist;
+        for (int i = 0; i < live; i++)
+        {
+            if (refs[i] > 0)
+            {
+                reachable[i] = true;
+                worklist.push_back(i);
+            }
+        }
+        auto mark = [&](void *ptr)
+        {
+            auto it = index.find(ptr);
+            if (it != index.end() && !reachable[it->second])
+            {
+                reachable[it->second] = true;
+                worklist.push_back(it->second);
+            }
+        };
+        while (!worklist.empty())
+        {
+            int i = worklist.back();
+            worklist.pop_back();
+            visit_children(cells[i], mark);
+        }
+
+        // Every cell is still locked here, so clearing one can only drop
+        // counts on the others and never frees memory another clear touches
+        for (int i = 0; i < live; i++)
+        {
+            if (!reachable[i])
+            {
+                clear_cell(cells[i]);
+                collected++;
+            }
+            else
+            {
+                heap.generations[promote_to].push_back(std::move(cells[i]));
+            }
+        }
+    }
+    else
+    {
+        heap.generations[promote_to].insert(heap.generations[promote_to].end(), std::make_move_iterator(cells.begin()), std::make_move_iterator(cells.end()));
+    }
+
+    locked.clear();
+
+    heap.stats.collections[generation]++;
+    heap.stats.collected += collected;
+    heap.stats.tracked = 0;
+    for (auto &gen : heap.generations)
+    {
+        heap.stats.tracked += gen.size();
+    }
+    heap.stats.total_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    return collected;
+}
+
+void heap_release(size_t mark)
+{
+    auto &young = heap.generations[0];
+    if (mark >= young.size())
+    {
+        return;
+    }
+    int released = young.size() - mark;
+    heap.counts[0] = heap.counts[0] > released ? heap.counts[0] - released : 0;
+    young.erase(young.begin() + mark, young.end());
+}
+
+void heap_collect_pending()
+{
+    if (heap_shared_threads > 0)
+    {
+        return;
+    }
+    heap.pending = false;
+
+    int generation = 0;
+    for (int i = HEAP_GENERATIONS - 1; i > 0; i--)
+    {
+        if (heap.counts[i] > heap.thresholds[i])
+        {
+            generation = i;
+            break;
+        }
+    }
+    heap_collect(generation);
+}
+
+#define POOL_CLASSES (POOL_MAX_SIZE / POOL_GRANULE)
+
+struct PoolBlock
+{
+    PoolBlock *next;
+};
+
+// Trivially destructible so blocks freed during thread teardown still have
+// somewhere to go
+static thread_local PoolBlock *pool_lists[POOL_CLASSES];
+
+static thread_local long long pool_allocated;
+
+static std::mutex pool_mutex;
+static PoolBlock *pool_shared_lists[POOL_CLASSES];
+static long long pool_shared_allocated;
+
+struct PoolSpill
+{
+    bool armed = false;
+
+    ~PoolSpill()
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        pool_shared_allocated += pool_allocated;
+        pool_allocated = 0;
+        for (int i = 0; i < POOL_CLASSES; i++)
+        {
+            while (pool_lists[i])
+            {
+                PoolBlock *block = pool_lists[i];
+                pool_lists[i] = block->next;
+                block->next = pool_shared_lists[i];
+                pool_shared_lists[i] = block;
+            }
+        }
+    }
+};
+
+static thread_local PoolSpill pool_spill;
+
+// Using pool_spill constructs it and registers its destructor, a thread that
+// only frees blocks needs that as much as one that allocates. The flag is
+// trivial, so the hot paths only test it
+static thread_local bool pool_armed;
+
+static void pool_arm()
+{
+    pool_spill.armed = true;
+    pool_armed = true;
+}
+
+static PoolBlock *pool_refill(int size_class)
+{
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    if (pool_shared_lists[size_class])
+    {
+        PoolBlock *list = pool_shared_lists[size_class];
+        pool_shared_lists[size_class] = nullptr;
+        return list;
+    }
+
+    size_t block_size = (size_class + 1) * POOL_GRANULE;
+    char *chunk = (char *)::operator new(POOL_CHUNK_SIZE);
+    PoolBlock *list = nullptr;
+    for (size_t offset = POOL_CHUNK_SIZE - POOL_CHUNK_SIZE % block_size; offset >= block_size; offset -= block_size)
+    {
+        PoolBlock *block = (PoolBlock *)(chunk + offset - block_size);
+        block->next = list;
+        list = block;
+    }
+    return list;
+}
+
+void *pool_allocate(size_t size)
+{
+    pool_allocated++;
+    if (size > POOL_MAX_SIZE)
+    {
+        return ::operator new(size);
+    }
+
+    if (!pool_armed)
+    {
+        pool_arm();
+    }
+
+    int size_class = (size - 1) / POOL_GRANULE;
+    PoolBlock *block = pool_lists[size_class];
+    if (!block)
+    {
+        block = pool_refill(size_class);
+    }
+    pool_lists[size_class] = block->next;
+    return block;
+}
+
+void pool_free(void *block, size_t size)
+{
+    if (size > POOL_MAX_SIZE)
+    {
+        ::operator delete(block);
+        return;
+    }
+
+    if (!pool_armed)
+    {
+        pool_arm();
+    }
+
+    int size_class = (size - 1) / POOL_GRANULE;
+    PoolBlock *freed = (PoolBlock *)block;
+    freed->next = pool_lists[size_class];
+    pool_lists[size_class] = freed;
+}
+
+// This thread's allocations plus those of threads that have finished
+long long pool_allocations()
+{
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    return pool_allocated + pool_shared_allocated;
+}
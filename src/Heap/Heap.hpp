@@ -0,0 +1,144 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+
+// Heap cells stay reference counted, the heap only finds and breaks cycles.
+// Every List, Object, Type, Function and Closure created by the interpreter
+// is registered here, modules may create cells that are never registered.
+
+#define HEAP_GENERATIONS 3
+
+struct VM;
+struct Value;
+
+enum CellKind
+{
+    CELL_LIST,
+    CELL_OBJECT,
+    CELL_TYPE,
+    CELL_FUNCTION,
+    CELL_CLOSURE
+};
+
+struct HeapCell
+{
+    std::weak_ptr<void> ref;
+    void *ptr;
+    CellKind kind;
+};
+
+struct HeapStats
+{
+    long long collections[HEAP_GENERATIONS] = {0, 0, 0};
+    long long collected = 0;
+    long long tracked = 0;
+    double total_time = 0;
+};
+
+struct Heap
+{
+    std::vector<HeapCell> generations[HEAP_GENERATIONS];
+    int thresholds[HEAP_GENERATIONS] = {2000, 10, 10};
+    int counts[HEAP_GENERATIONS] = {0, 0, 0};
+    bool enabled = true;
+    bool pending = false;
+    int nesting = 0;
+    HeapStats stats;
+    // VMs running on this thread, outermost first
+    std::vector<VM *> vms;
+    // Every sample_interval-th cell has its allocation site recorded
+    int sample_interval = 0;
+    int sample_countdown = 0;
+};
+
+extern thread_local Heap heap;
+
+// Number of threads other than the owner that may be touching shared cells,
+// collection is deferred while this is non-zero
+extern std::atomic<int> heap_shared_threads;
+
+void heap_sample(const std::shared_ptr<void> &cell);
+
+template <typename T>
+inline void heap_track(const std::shared_ptr<T> &cell, CellKind kind)
+{
+    heap.generations[0].push_back({cell, cell.get(), kind});
+    if (++heap.counts[0] > heap.thresholds[0])
+    {
+        heap.pending = true;
+    }
+    if (heap.sample_interval && --heap.sample_countdown <= 0)
+    {
+        heap_sample(cell);
+    }
+}
+
+// Stops tracking the cells registered since the young generation held mark
+// cells, for cells made on this thread and handed to another one
+void heap_release(size_t mark);
+
+int heap_collect(int generation = HEAP_GENERATIONS - 1);
+void heap_collect_pending();
+void heap_visit_children(HeapCell &cell, const std::function<void(void *)> &visit);
+void heap_visit_value(Value &value, const std::function<void(void *)> &visit);
+
+inline void heap_safe_point()
+{
+    if (heap.pending && heap.nesting <= 1)
+    {
+        heap_collect_pending();
+    }
+}
+
+// Cells are carved from per-thread size-class free lists. Blocks may be
+// freed by another thread than the one that allocated them, so pool memory
+// is never handed back to the system and a thread's free lists are passed
+// on to the other threads when it exits
+
+#define POOL_GRANULE 16
+#define POOL_MAX_SIZE 1024
+#define POOL_CHUNK_SIZE (64 * 1024)
+
+void *pool_allocate(size_t size);
+void pool_free(void *block, size_t size);
+long long pool_allocations();
+
+template <typename T>
+struct PoolAllocator
+{
+    typedef T value_type;
+
+    PoolAllocator() = default;
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U> &) {}
+
+    T *allocate(size_t n)
+    {
+        return (T *)pool_allocate(n * sizeof(T));
+    }
+    void deallocate(T *block, size_t n)
+    {
+        pool_free(block, n * sizeof(T));
+    }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U> &) const
+    {
+        return true;
+    }
+    template <typename U>
+    bool operator!=(const PoolAllocator<U> &) const
+    {
+        return false;
+    }
+};
+
+template <typename T, typename... Args>
+inline std::shared_ptr<T> pool_make(Args &&...args)
+{
+    return std::allocate_shared<T>(PoolAllocator<T>(), std::forward<Args>(args)...);
+}
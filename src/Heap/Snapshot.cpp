@@ -0,0 +1,555 @@
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <algorithm>
+#include "Snapshot.hpp"
+#include "../VirtualMachine/VirtualMachine.hpp"
+
+static const char *kind_names[] = {"list", "object", "type", "function", "closure"};
+
+struct SnapshotNode
+{
+    std::string address;
+    std::string kind;
+    size_t size;
+    std::string label;
+    std::vector<std::string> retainers;
+};
+
+struct SnapshotGroup
+{
+    std::string kind;
+    std::string label;
+    long long count = 0;
+    long long size = 0;
+    std::vector<std::string> retainers;
+};
+
+static std::string address_of(void *ptr)
+{
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%p", ptr);
+    return buffer;
+}
+
+static std::string object_label(ObjectObj &object)
+{
+    std::string label = object.type_name != "" ? object.type_name + " {" : "{";
+    for (int i = 0; i < object.keys.size() && i < 4; i++)
+    {
+        label += (i > 0 ? ", " : "") + object.keys[i];
+    }
+    if (object.keys.size() > 4)
+    {
+        label += ", ...";
+    }
+    return label + "}";
+}
+
+static std::string cell_label(HeapCell &cell)
+{
+    switch (cell.kind)
+    {
+    case CELL_LIST:
+        return "list";
+    case CELL_OBJECT:
+        return object_label(*(ObjectObj *)cell.ptr);
+    case CELL_TYPE:
+        return "type " + ((TypeObj *)cell.ptr)->name;
+    case CELL_FUNCTION:
+        return profiler_function_label(*(FunctionObj *)cell.ptr);
+    case CELL_CLOSURE:
+        return "closure " + ((Closure *)cell.ptr)->name;
+    }
+    return "";
+}
+
+// Strings are shared between Values, so their bytes are counted by every
+// holder and sizes are an upper bound
+static size_t value_size(Value &value)
+{
+    size_t size = sizeof(Value);
+    if (value.is_string())
+    {
+        size += value.get_string().size();
+    }
+    return size;
+}
+
+static size_t cell_size(HeapCell &cell)
+{
+    switch (cell.kind)
+    {
+    case CELL_LIST:
+    {
+        auto list = (std::vector<Value> *)cell.ptr;
+        size_t size = sizeof(std::vector<Value>) + (list->capacity() - list->size()) * sizeof(Value);
+        for (auto &value : *list)
+        {
+            size += value_size(value);
+        }
+        return size;
+    }
+    case CELL_OBJECT:
+    {
+        auto object = (ObjectObj *)cell.ptr;
+        size_t size = sizeof(ObjectObj);
+        for (auto &prop : object->values)
+        {
+            size += value_size(prop.second) + 2 * prop.first.size() + sizeof(std::string) * 2;
+        }
+        return size;
+    }
+    case CELL_TYPE:
+    {
+        auto type = (TypeObj *)cell.ptr;
+        size_t size = sizeof(TypeObj);
+        for (auto &prop : type->types)
+        {
+            size += value_size(prop.second) + prop.first.size() + sizeof(std::string);
+        }
+        for (auto &prop : type->defaults)
+        {
+            size += value_size(prop.second) + prop.first.size() + sizeof(std::string);
+        }
+        return size;
+    }
+    case CELL_FUNCTION:
+    {
+        auto function = (FunctionObj *)cell.ptr;
+        size_t size = sizeof(FunctionObj) + function->chunk.code.capacity() + function->chunk.lines.capacity() * sizeof(int);
+        size += function->closed_vars.size() * sizeof(std::shared_ptr<Closure>);
+        for (auto &value : function->chunk.constants)
+        {
+            size += value_size(value);
+        }
+        for (auto &value : function->generator_stack)
+        {
+            size += value_size(value);
+        }
+        return size;
+    }
+    case CELL_CLOSURE:
+        return sizeof(Closure);
+    }
+    return 0;
+}
+
+static std::string clean(std::string text)
+{
+    std::replace_if(text.begin(), text.end(), [](char c)
+                    { return c == '\t' || c == '\n' || c == '|'; },
+                    ' ');
+    return text;
+}
+
+static std::vector<SnapshotNode> walk_heap()
+{
+    std::vector<HeapCell *> cells;
+    std::vector<std::shared_ptr<void>> locked;
+    std::unordered_map<void *, int> index;
+    for (auto &generation : heap.generations)
+    {
+        for (auto &cell : generation)
+        {
+            auto ref = cell.ref.lock();
+            if (!ref || index.count(cell.ptr))
+            {
+                continue;
+            }
+            index[cell.ptr] = cells.size();
+            cells.push_back(&cell);
+            locked.push_back(std::move(ref));
+        }
+    }
+
+    std::vector<SnapshotNode> nodes(cells.size());
+    std::vector<long> refs(cells.size());
+    for (int i = 0; i < cells.size(); i++)
+    {
+        nodes[i] = {address_of(cells[i]->ptr), kind_names[cells[i]->kind], cell_size(*cells[i]), clean(cell_label(*cells[i])), {}};
+        refs[i] = locked[i].use_count() - 1;
+    }
+
+    std::string retainer;
+    std::function<void(void *)> retain = [&](void *ptr)
+    {
+        auto it = index.find(ptr);
+        if (it == index.end())
+        {
+            return;
+        }
+        refs[it->second]--;
+        auto &retainers = nodes[it->second].retainers;
+        if (retainers.size() < SNAPSHOT_MAX_RETAINERS && std::find(retainers.begin(), retainers.end(), retainer) == retainers.end())
+        {
+            retainers.push_back(retainer);
+        }
+    };
+
+    for (int i = 0; i < cells.size(); i++)
+    {
+        retainer = "@" + nodes[i].address;
+        heap_visit_children(*cells[i], retain);
+    }
+
+    for (VM *vm : heap.vms)
+    {
+        retainer = "stack";
+        for (auto &value : vm->stack)
+        {
+            heap_visit_value(value, retain);
+        }
+        for (auto &frame : vm->frames)
+        {
+            retainer = "frame " + clean(profiler_function_label(*frame.function));
+            retain(frame.function.get());
+        }
+        for (auto &global : vm->globals)
+        {
+            retainer = "global " + clean(global.first);
+            heap_visit_value(global.second, retain);
+        }
+        for (auto &closure : vm->closed_values)
+        {
+            retainer = "open closure " + clean(closure->name);
+            retain(closure.get());
+        }
+        for (auto &cached : vm->import_cache)
+        {
+            retainer = "import " + clean(std::filesystem::path(cached.first).filename().string());
+            heap_visit_value(cached.second.import_object, retain);
+            for (auto &global : cached.second.import_globals)
+            {
+                heap_visit_value(global.second, retain);
+            }
+        }
+    }
+
+    for (int i = 0; i < nodes.size(); i++)
+    {
+        if (refs[i] > 0 && nodes[i].retainers.size() < SNAPSHOT_MAX_RETAINERS)
+        {
+            nodes[i].retainers.push_back("external");
+        }
+    }
+
+    return nodes;
+}
+
+// '@address' retainers are shown as the cell they point to
+static std::string describe_retainer(std::string &retainer, std::unordered_map<std::string, SnapshotNode *> &by_address)
+{
+    if (retainer.empty() || retainer[0] != '@')
+    {
+        return retainer;
+    }
+    auto it = by_address.find(retainer.substr(1));
+    if (it == by_address.end())
+    {
+        return retainer;
+    }
+    auto node = it->second;
+    return node->kind == node->label ? node->kind : node->kind + " " + node->label;
+}
+
+static std::vector<SnapshotGroup> group_nodes(std::vector<SnapshotNode> &nodes, std::unordered_map<std::string, SnapshotNode *> &by_address)
+{
+    std::unordered_map<std::string, SnapshotGroup> groups;
+    for (auto &node : nodes)
+    {
+        auto &group = groups[node.kind + "\t" + node.label];
+        group.kind = node.kind;
+        group.label = node.label;
+        group.count++;
+        group.size += node.size;
+        for (auto &retainer : node.retainers)
+        {
+            std::string description = describe_retainer(retainer, by_address);
+            if (group.retainers.size() < 3 && std::find(group.retainers.begin(), group.retainers.end(), description) == group.retainers.end())
+            {
+                group.retainers.push_back(description);
+            }
+        }
+    }
+
+    std::vector<SnapshotGroup> sorted;
+    for (auto &group : groups)
+    {
+        sorted.push_back(group.second);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](auto &a, auto &b)
+              { return a.size != b.size ? a.size > b.size : a.count > b.count; });
+    return sorted;
+}
+
+static Value group_value(SnapshotGroup &group)
+{
+    Value entry = object_val();
+    auto &obj = entry.get_object();
+    obj->keys = {"kind", "label", "count", "size", "retainers"};
+    obj->values["kind"] = string_val(group.kind);
+    obj->values["label"] = string_val(group.label);
+    obj->values["count"] = number_val(group.count);
+    obj->values["size"] = number_val(group.size);
+    obj->values["retainers"] = list_val();
+    for (auto &retainer : group.retainers)
+    {
+        obj->values["retainers"].get_list()->push_back(string_val(retainer));
+    }
+    return entry;
+}
+
+Value heap_snapshot(std::string path)
+{
+    // Nothing may be allocated while cells are being walked
+    std::vector<SnapshotNode> nodes = walk_heap();
+
+    if (path != "")
+    {
+        std::ofstream file(path);
+        if (!file)
+        {
+            return error_object("Cannot open '" + path + "' for writing");
+        }
+        file << "vortex-heap-snapshot 1\n";
+        for (auto &node : nodes)
+        {
+            file << node.address << "\t" << node.kind << "\t" << node.size << "\t" << node.label << "\t";
+            for (int i = 0; i < node.retainers.size(); i++)
+            {
+                file << (i > 0 ? "|" : "") << node.retainers[i];
+            }
+            file << "\n";
+        }
+    }
+
+    std::unordered_map<std::string, SnapshotNode *> by_address;
+    for (auto &node : nodes)
+    {
+        by_address[node.address] = &node;
+    }
+    std::vector<SnapshotGroup> groups = group_nodes(nodes, by_address);
+
+    Value result = object_val();
+    auto &obj = result.get_object();
+    obj->keys = {"count", "size", "kinds", "top"};
+    obj->values["kinds"] = object_val();
+    obj->values["top"] = list_val();
+
+    long long total = 0;
+    auto &kinds = obj->values["kinds"].get_object();
+    for (auto kind : kind_names)
+    {
+        long long count = 0;
+        long long size = 0;
+        for (auto &node : nodes)
+        {
+            if (node.kind == kind)
+            {
+                count++;
+                size += node.size;
+            }
+        }
+        total += size;
+        Value entry = object_val();
+        entry.get_object()->keys = {"count", "size"};
+        entry.get_object()->values["count"] = number_val(count);
+        entry.get_object()->values["size"] = number_val(size);
+        kinds->keys.push_back(kind);
+        kinds->values[kind] = entry;
+    }
+    obj->values["count"] = number_val(nodes.size());
+    obj->values["size"] = number_val(total);
+
+    for (int i = 0; i < groups.size() && i < SNAPSHOT_REPORT_ROWS; i++)
+    {
+        obj->values["top"].get_list()->push_back(group_value(groups[i]));
+    }
+
+    return result;
+}
+
+static bool read_snapshot(std::string path, std::vector<SnapshotNode> &nodes)
+{
+    std::ifstream file(path);
+    std::string line;
+    if (!file || !std::getline(file, line) || line != "vortex-heap-snapshot 1")
+    {
+        return false;
+    }
+    while (std::getline(file, line))
+    {
+        std::vector<std::string> fields;
+        std::stringstream stream(line);
+        std::string field;
+        while (std::getline(stream, field, '\t'))
+        {
+            fields.push_back(field);
+        }
+        if (fields.size() < 4)
+        {
+            return false;
+        }
+        SnapshotNode node = {fields[0], fields[1], (size_t)std::stoull(fields[2]), fields[3], {}};
+        if (fields.size() > 4)
+        {
+            std::stringstream retainers(fields[4]);
+            while (std::getline(retainers, field, '|'))
+            {
+                node.retainers.push_back(field);
+            }
+        }
+        nodes.push_back(node);
+    }
+    return true;
+}
+
+// Count and size changes per kind and label. Retainers are taken from cells
+// that only exist in the later snapshot
+Value heap_snapshot_diff(std::string before, std::string after)
+{
+    std::vector<SnapshotNode> before_nodes;
+    std::vector<SnapshotNode> after_nodes;
+    if (!read_snapshot(before, before_nodes))
+    {
+        return error_object("'" + before + "' is not a heap snapshot");
+    }
+    if (!read_snapshot(after, after_nodes))
+    {
+        return error_object("'" + after + "' is not a heap snapshot");
+    }
+
+    std::unordered_map<std::string, SnapshotNode *> before_addresses;
+    for (auto &node : before_nodes)
+    {
+        before_addresses[node.address] = &node;
+    }
+    std::unordered_map<std::string, SnapshotNode *> after_addresses;
+    for (auto &node : after_nodes)
+    {
+        after_addresses[node.address] = &node;
+    }
+
+    std::unordered_map<std::string, SnapshotGroup> groups;
+    for (auto &node : before_nodes)
+    {
+        auto &group = groups[node.kind + "\t" + node.label];
+        group.kind = node.kind;
+        group.label = node.label;
+        group.count--;
+        group.size -= node.size;
+    }
+    for (auto &node : after_nodes)
+    {
+        auto &group = groups[node.kind + "\t" + node.label];
+        group.kind = node.kind;
+        group.label = node.label;
+        group.count++;
+        group.size += node.size;
+
+        auto previous = before_addresses.find(node.address);
+        if (previous != before_addresses.end() && previous->second->kind == node.kind)
+        {
+            continue;
+        }
+        for (auto &retainer : node.retainers)
+        {
+            std::string description = describe_retainer(retainer, after_addresses);
+            if (group.retainers.size() < 3 && std::find(group.retainers.begin(), group.retainers.end(), description) == group.retainers.end())
+            {
+                group.retainers.push_back(description);
+            }
+        }
+    }
+
+    std::vector<SnapshotGroup> changed;
+    for (auto &group : groups)
+    {
+        if (group.second.count != 0 || group.second.size != 0)
+        {
+            changed.push_back(group.second);
+        }
+    }
+    std::sort(changed.begin(), changed.end(), [](auto &a, auto &b)
+              { return a.size != b.size ? a.size > b.size : a.count > b.count; });
+
+    Value result = list_val();
+    for (auto &group : changed)
+    {
+        result.get_list()->push_back(group_value(group));
+    }
+    return result;
+}
+
+struct AllocationSite
+{
+    long long samples = 0;
+    std::vector<std::weak_ptr<void>> sampled;
+    size_t prune_at = 64;
+};
+
+static thread_local std::unordered_map<std::string, AllocationSite> allocation_sites;
+
+void heap_sampling(int interval)
+{
+    heap.sample_interval = interval;
+    heap.sample_countdown = interval;
+    allocation_sites.clear();
+}
+
+void heap_sample(const std::shared_ptr<void> &cell)
+{
+    heap.sample_countdown = heap.sample_interval;
+
+    std::string site = "<native>";
+    if (!heap.vms.empty() && heap.vms.back()->frames.size() > 0)
+    {
+        VM &vm = *heap.vms.back();
+        site = profiler_frame_label(vm.frames.back(), heap.vms.size() == 1 && vm.frames.size() == 1, false);
+    }
+
+    auto &entry = allocation_sites[site];
+    entry.samples++;
+    entry.sampled.push_back(cell);
+    if (entry.sampled.size() >= entry.prune_at)
+    {
+        std::erase_if(entry.sampled, [](auto &ref)
+                      { return ref.expired(); });
+        entry.prune_at = std::max((size_t)64, entry.sampled.size() * 2);
+    }
+}
+
+// Sampled counts scaled by the interval, so both are estimates
+Value heap_allocation_sites()
+{
+    // Building the result must not sample itself
+    int interval = heap.sample_interval;
+    heap.sample_interval = 0;
+
+    std::vector<std::pair<std::string, AllocationSite *>> sites;
+    for (auto &site : allocation_sites)
+    {
+        sites.push_back({site.first, &site.second});
+    }
+    std::sort(sites.begin(), sites.end(), [](auto &a, auto &b)
+              { return a.second->samples > b.second->samples; });
+
+    Value result = list_val();
+    for (auto &[site, entry] : sites)
+    {
+        long long live = std::count_if(entry->sampled.begin(), entry->sampled.end(), [](auto &ref)
+                                       { return !ref.expired(); });
+        Value value = object_val();
+        auto &obj = value.get_object();
+        obj->keys = {"site", "samples", "allocations", "live"};
+        obj->values["site"] = string_val(site);
+        obj->values["samples"] = number_val(entry->samples);
+        obj->values["allocations"] = number_val(entry->samples * interval);
+        obj->values["live"] = number_val(live * interval);
+        result.get_list()->push_back(value);
+    }
+
+    heap.sample_interval = interval;
+    return result;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include "Heap.hpp"
+#include "../Bytecode/Bytecode.hpp"
+
+// Heap snapshots list every live registered cell with its shallow size and
+// what retains it: other cells, or roots in the VMs running on this thread
+// (stack, frames, globals, open closures and the import cache). References
+// the walk cannot account for, such as native code or another thread, are
+// reported as 'external'
+
+#define SNAPSHOT_MAX_RETAINERS 8
+#define SNAPSHOT_REPORT_ROWS 20
+
+Value heap_snapshot(std::string path);
+Value heap_snapshot_diff(std::string before, std::string after);
+
+void heap_sampling(int interval);
+Value heap_allocation_sites();
@@ -0,0 +1,862 @@
+#include <mutex>
+#include <unordered_set>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <filesystem>
+#include "Image.hpp"
+#include "../VirtualMachine/VirtualMachine.hpp"
+
+#define IMAGE_MAGIC "vortex-image"
+#define IMAGE_OPCODES (OP_HOOK_CLOSURE_ONACCESS + 1)
+
+enum ImageNative : uint8_t
+{
+    IMAGE_NATIVE_BUILTIN,
+    IMAGE_NATIVE_LIBRARY
+};
+
+struct ImageSource
+{
+    std::string path;
+    uint64_t size;
+    int64_t modified;
+};
+
+struct NativeSymbol
+{
+    std::string library;
+    std::string symbol;
+};
+
+// Cells are written once, the first time they are reached, and referred to
+// by their number after that so shared cells and cycles come back as they
+// were. Number 0 stands for a missing cell
+struct ImageWriter
+{
+    std::string data;
+    std::unordered_map<const void *, uint32_t> ids;
+    // Written cells are kept alive so their addresses are not reused
+    std::vector<std::shared_ptr<void>> cells;
+    std::string error;
+
+    void u8(uint8_t value)
+    {
+        data.push_back(value);
+    }
+    void u32(uint32_t value)
+    {
+        data.append((char *)&value, sizeof(value));
+    }
+    void i64(int64_t value)
+    {
+        data.append((char *)&value, sizeof(value));
+    }
+    void f64(double value)
+    {
+        data.append((char *)&value, sizeof(value));
+    }
+    void string(const std::string &value)
+    {
+        u32(value.size());
+        data.append(value);
+    }
+    // Writes the cell's number, true if its contents have to follow
+    bool cell(const std::shared_ptr<void> &cell)
+    {
+        if (!cell)
+        {
+            u32(0);
+            return false;
+        }
+        auto found = ids.find(cell.get());
+        if (found != ids.end())
+        {
+            u32(found->second);
+            return false;
+        }
+        cells.push_back(cell);
+        ids[cell.get()] = cells.size();
+        u32(cells.size());
+        return true;
+    }
+};
+
+struct ImageReader
+{
+    const std::string &data;
+    size_t position = 0;
+    std::vector<std::shared_ptr<void>> cells;
+    std::unordered_map<std::string, void *> libraries;
+    std::string error;
+
+    ImageReader(const std::string &data) : data(data)
+    {
+    }
+
+    bool take(void *out, size_t size)
+    {
+        if (error != "" || data.size() - position < size)
+        {
+            fail("the image is truncated");
+            memset(out, 0, size);
+            return false;
+        }
+        memcpy(out, data.data() + position, size);
+        position += size;
+        return true;
+    }
+    void fail(std::string message)
+    {
+        if (error == "")
+        {
+            error = message;
+        }
+    }
+    uint8_t u8()
+    {
+        uint8_t value;
+        take(&value, sizeof(value));
+        return value;
+    }
+    uint32_t u32()
+    {
+        uint32_t value;
+        take(&value, sizeof(value));
+        return value;
+    }
+    int64_t i64()
+    {
+        int64_t value;
+        take(&value, sizeof(value));
+        return value;
+    }
+    double f64()
+    {
+        double value;
+        take(&value, sizeof(value));
+        return value;
+    }
+    // Counts are checked against what is left so a damaged image cannot ask
+    // for huge allocations
+    uint32_t count()
+    {
+        uint32_t value = u32();
+        if (value > data.size() - position)
+        {
+            fail("the image is damaged");
+            return 0;
+        }
+        return value;
+    }
+    std::string string()
+    {
+        uint32_t size = count();
+        std::string value = data.substr(position, size);
+        position += size;
+        return value;
+    }
+    // Returns the cell a number refers to, or sets is_new if its contents
+    // follow and the caller has to make and register it
+    std::shared_ptr<void> cell(uint32_t id, bool &is_new)
+    {
+        is_new = false;
+        if (id == 0 || error != "")
+        {
+            return nullptr;
+        }
+        if (id <= cells.size())
+        {
+            return cells[id - 1];
+        }
+        if (id != cells.size() + 1)
+        {
+            fail("the image is damaged");
+            return nullptr;
+        }
+        is_new = true;
+        return nullptr;
+    }
+};
+
+bool image_recording = false;
+
+static std::mutex image_mutex;
+static VM *image_vm = nullptr;
+static std::string image_path;
+// Never freed, the cells it keeps cannot be released once the heap's thread
+// locals are gone at exit
+static ImageWriter &image_writer = *new ImageWriter();
+static std::vector<ImageSource> image_sources;
+static std::unordered_set<std::string> image_stamped;
+static std::unordered_set<std::string> image_saved;
+static std::unordered_map<NativeFunction, NativeSymbol> image_natives;
+
+static bool stamp(std::string path, ImageSource &source)
+{
+    std::error_code error;
+    source.path = path;
+    source.size = std::filesystem::file_size(path, error);
+    if (error)
+    {
+        return false;
+    }
+    source.modified = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+    return !error;
+}
+
+static void write_value(ImageWriter &writer, Value &value);
+static void write_at_exit();
+
+static void write_values(ImageWriter &writer, std::vector<Value> &values)
+{
+    writer.u32(values.size());
+    for (auto &value : values)
+    {
+        write_value(writer, value);
+    }
+}
+
+static void write_strings(ImageWriter &writer, std::vector<std::string> &strings)
+{
+    writer.u32(strings.size());
+    for (auto &string : strings)
+    {
+        writer.string(string);
+    }
+}
+
+static void write_map(ImageWriter &writer, std::unordered_map<std::string, Value> &map)
+{
+    writer.u32(map.size());
+    for (auto &entry : map)
+    {
+        writer.string(entry.first);
+        write_value(writer, entry.second);
+    }
+}
+
+static void write_box(ImageWriter &writer, std::shared_ptr<Value> &box)
+{
+    if (writer.cell(box))
+    {
+        write_value(writer, *box);
+    }
+}
+
+static void write_type(ImageWriter &writer, std::shared_ptr<TypeObj> &type)
+{
+    if (writer.cell(type))
+    {
+        writer.string(type->name);
+        write_map(writer, type->types);
+        write_map(writer, type->defaults);
+    }
+}
+
+static void write_closure(ImageWriter &writer, std::shared_ptr<Closure> &closure)
+{
+    if (writer.cell(closure))
+    {
+        writer.string(closure->name);
+        writer.string(closure->frame_name);
+        writer.u8(closure->is_local);
+        writer.u32(closure->index);
+        write_value(writer, *closure->location);
+    }
+}
+
+static void write_function(ImageWriter &writer, std::shared_ptr<FunctionObj> &function)
+{
+    if (!writer.cell(function))
+    {
+        return;
+    }
+    Chunk &chunk = function->chunk;
+    writer.string(function->name);
+    writer.u32(function->arity);
+    writer.u32(function->defaults);
+    writer.string(std::string(chunk.code.begin(), chunk.code.end()));
+    writer.u32(chunk.lines.size());
+    for (int line : chunk.lines)
+    {
+        writer.u32(line);
+    }
+    write_values(writer, chunk.constants);
+    write_strings(writer, chunk.variables);
+    write_strings(writer, chunk.public_variables);
+    writer.u32(chunk.exception_table.size());
+    for (auto &handler : chunk.exception_table)
+    {
+        writer.u32(handler.start);
+        writer.u32(handler.end);
+        writer.u32(handler.handler);
+        writer.u32(handler.depth);
+    }
+    writer.string(chunk.import_path);
+    writer.u32(function->instruction_offsets.size());
+    for (int offset : function->instruction_offsets)
+    {
+        writer.u32(offset);
+    }
+    writer.u32(function->closed_var_indexes.size());
+    for (auto &var : function->closed_var_indexes)
+    {
+        writer.string(var.name);
+        writer.u32(var.index);
+        writer.u8(var.is_local);
+    }
+    writer.u32(function->closed_vars.size());
+    for (auto &closure : function->closed_vars)
+    {
+        write_closure(writer, closure);
+    }
+    write_values(writer, function->default_values);
+    write_box(writer, function->object);
+    write_strings(writer, function->params);
+    writer.u8(function->is_generator);
+    writer.u8(function->generator_init);
+    writer.u8(function->generator_done);
+    writer.u8(function->is_type_generator);
+    write_values(writer, function->generator_stack);
+    writer.u32(function->generator_ip);
+    writer.string(function->import_path);
+}
+
+static void write_native(ImageWriter &writer, NativeFunctionObj &native)
+{
+    writer.string(native.name);
+    const char *builtin = builtin_name(native.function);
+    if (builtin)
+    {
+        writer.u8(IMAGE_NATIVE_BUILTIN);
+        writer.string(builtin);
+        return;
+    }
+    auto found = image_natives.find(native.function);
+    if (found == image_natives.end())
+    {
+        writer.error = "native function '" + native.name + "' was not loaded with load_lib";
+        return;
+    }
+    writer.u8(IMAGE_NATIVE_LIBRARY);
+    writer.string(found->second.library);
+    writer.string(found->second.symbol);
+}
+
+static void write_value(ImageWriter &writer, Value &value)
+{
+    if (writer.error != "")
+    {
+        return;
+    }
+    writer.u8(value.type);
+    writer.u8(value.meta.unpack | value.meta.packer << 1 | value.meta.is_const << 2 | value.meta.temp_non_const << 3);
+    writer.u8((value.hooks.onChangeHook != nullptr) | (value.hooks.onAccessHook != nullptr) << 1);
+    if (value.hooks.onChangeHook)
+    {
+        write_box(writer, value.hooks.onChangeHook);
+        writer.string(value.hooks.onChangeHookName);
+    }
+    if (value.hooks.onAccessHook)
+    {
+        write_box(writer, value.hooks.onAccessHook);
+        writer.string(value.hooks.onAccessHookName);
+    }
+
+    switch (value.type)
+    {
+    case Number:
+        writer.f64(value.get_number());
+        break;
+    case String:
+        writer.string(value.get_string());
+        break;
+    case Boolean:
+        writer.u8(value.get_boolean());
+        break;
+    case List:
+        if (writer.cell(value.get_list()))
+        {
+            write_values(writer, *value.get_list());
+        }
+        break;
+    case Type:
+        write_type(writer, value.get_type());
+        break;
+    case Object:
+    {
+        auto &object = value.get_object();
+        if (writer.cell(object))
+        {
+            write_type(writer, object->type);
+            writer.string(object->type_name);
+            write_strings(writer, object->keys);
+            write_map(writer, object->values);
+        }
+        break;
+    }
+    case Function:
+        write_function(writer, value.get_function());
+        break;
+    case Native:
+        write_native(writer, *value.get_native());
+        break;
+    case Pointer:
+        writer.error = "pointers cannot be saved";
+        break;
+    default:
+        break;
+    }
+}
+
+bool image_snapshot(VM &vm, std::string path, std::string source_path)
+{
+    ImageSource source;
+    if (!stamp(source_path, source))
+    {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(image_mutex);
+    image_vm = &vm;
+    image_path = path;
+    image_sources.push_back(source);
+    Value main;
+    main.type = Function;
+    main.value = vm.frames[0].function;
+    write_value(image_writer, main);
+    image_recording = true;
+    atexit(write_at_exit);
+    return true;
+}
+
+void image_record_import(VM &vm, std::string &absolute_path)
+{
+    std::lock_guard<std::mutex> lock(image_mutex);
+    if (!image_recording)
+    {
+        return;
+    }
+    ImageSource source;
+    if (image_stamped.insert(absolute_path).second && stamp(absolute_path, source))
+    {
+        image_sources.push_back(source);
+    }
+    if (&vm != image_vm)
+    {
+        return;
+    }
+
+    // Imports made by the import itself are moved into this cache with it
+    for (auto &entry : vm.import_cache)
+    {
+        if (!image_saved.insert(entry.first).second)
+        {
+            continue;
+        }
+        image_writer.u8(1);
+        image_writer.string(entry.first);
+        write_value(image_writer, entry.second.import_object);
+        std::unordered_map<std::string, Value> globals = entry.second.import_globals;
+        globals.erase("__vm__");
+        write_map(image_writer, globals);
+        if (image_writer.error != "")
+        {
+            fprintf(stderr, "Cannot snapshot '%s': %s\n", entry.first.c_str(), image_writer.error.c_str());
+            image_recording = false;
+            return;
+        }
+    }
+}
+
+void image_register_native(NativeFunction function, std::string library, std::string symbol)
+{
+    std::lock_guard<std::mutex> lock(image_mutex);
+    image_natives[function] = {library, symbol};
+}
+
+void image_discard()
+{
+    std::lock_guard<std::mutex> lock(image_mutex);
+    image_recording = false;
+    image_path = "";
+}
+
+static void write_at_exit()
+{
+    std::lock_guard<std::mutex> lock(image_mutex);
+    if (!image_recording || image_path == "")
+    {
+        return;
+    }
+    image_recording = false;
+
+    ImageWriter header;
+    header.string(IMAGE_MAGIC);
+    header.u32(IMAGE_VERSION);
+    header.u32(IMAGE_OPCODES);
+    header.u32(image_sources.size());
+    for (auto &source : image_sources)
+    {
+        header.string(source.path);
+        header.i64(source.size);
+        header.i64(source.modified);
+    }
+
+    std::ofstream file(image_path, std::ios::binary);
+    file << header.data << image_writer.data << (char)0;
+    if (!file)
+    {
+        fprintf(stderr, "Could not write image to %s\n", image_path.c_str());
+        return;
+    }
+    fprintf(stderr, "Image written to %s\n", image_path.c_str());
+}
+
+static Value read_value(ImageReader &reader);
+
+static std::vector<Value> read_values(ImageReader &reader)
+{
+    std::vector<Value> values(reader.count());
+    for (auto &value : values)
+    {
+        value = read_value(reader);
+    }
+    return values;
+}
+
+static std::vector<std::string> read_strings(ImageReader &reader)
+{
+    std::vector<std::string> strings(reader.count());
+    for (auto &string : strings)
+    {
+        string = reader.string();
+    }
+    return strings;
+}
+
+static void read_map(ImageReader &reader, std::unordered_map<std::string, Value> &map)
+{
+    uint32_t count = reader.count();
+    for (uint32_t i = 0; i < count && reader.error == ""; i++)
+    {
+        std::string key = reader.string();
+        map[key] = read_value(reader);
+    }
+}
+
+static std::shared_ptr<Value> read_box(ImageReader &reader)
+{
+    bool is_new;
+    auto cell = reader.cell(reader.u32(), is_new);
+    if (!is_new)
+    {
+        return std::static_pointer_cast<Value>(cell);
+    }
+    auto box = std::make_shared<Value>();
+    reader.cells.push_back(box);
+    *box = read_value(reader);
+    return box;
+}
+
+static std::shared_ptr<TypeObj> read_type(ImageReader &reader)
+{
+    bool is_new;
+    auto cell = reader.cell(reader.u32(), is_new);
+    if (!is_new)
+    {
+        return std::static_pointer_cast<TypeObj>(cell);
+    }
+    Value value(Type);
+    auto &type = value.get_type();
+    reader.cells.push_back(type);
+    type->name = reader.string();
+    read_map(reader, type->types);
+    read_map(reader, type->defaults);
+    return type;
+}
+
+static std::shared_ptr<Closure> read_closure(ImageReader &reader)
+{
+    bool is_new;
+    auto cell = reader.cell(reader.u32(), is_new);
+    if (!is_new)
+    {
+        return std::static_pointer_cast<Closure>(cell);
+    }
+    auto closure = pool_make<Closure>();
+    heap_track(closure, CELL_CLOSURE);
+    reader.cells.push_back(closure);
+    closure->name = reader.string();
+    closure->frame_name = reader.string();
+    closure->is_local = reader.u8();
+    closure->index = reader.u32();
+    closure->location = &closure->closed;
+    closure->initial_location = &closure->closed;
+    closure->closed = read_value(reader);
+    return closure;
+}
+
+static std::shared_ptr<FunctionObj> read_function(ImageReader &reader)
+{
+    bool is_new;
+    auto cell = reader.cell(reader.u32(), is_new);
+    if (!is_new)
+    {
+        return std::static_pointer_cast<FunctionObj>(cell);
+    }
+    Value value(Function);
+    auto function = value.get_function();
+    reader.cells.push_back(function);
+    Chunk &chunk = function->chunk;
+    function->name = reader.string();
+    function->arity = reader.u32();
+    function->defaults = reader.u32();
+    std::string code = reader.string();
+    chunk.code.assign(code.begin(), code.end());
+    chunk.lines.resize(reader.count());
+    for (int &line : chunk.lines)
+    {
+        line = reader.u32();
+    }
+    chunk.constants = read_values(reader);
+    chunk.variables = read_strings(reader);
+    chunk.public_variables = read_strings(reader);
+    chunk.exception_table.resize(reader.count());
+    for (auto &handler : chunk.exception_table)
+    {
+        handler.start = reader.u32();
+        handler.end = reader.u32();
+        handler.handler = reader.u32();
+        handler.depth = reader.u32();
+    }
+    chunk.import_path = reader.string();
+    function->instruction_offsets.resize(reader.count());
+    for (int &offset : function->instruction_offsets)
+    {
+        offset = reader.u32();
+    }
+    function->closed_var_indexes.resize(reader.count());
+    for (auto &var : function->closed_var_indexes)
+    {
+        var.name = reader.string();
+        var.index = reader.u32();
+        var.is_local = reader.u8();
+    }
+    function->closed_vars.resize(reader.count());
+    for (auto &closure : function->closed_vars)
+    {
+        closure = read_closure(reader);
+    }
+    function->default_values = read_values(reader);
+    function->object = read_box(reader);
+    function->params = read_strings(reader);
+    function->is_generator = reader.u8();
+    function->generator_init = reader.u8();
+    function->generator_done = reader.u8();
+    function->is_type_generator = reader.u8();
+    function->generator_stack = read_values(reader);
+    function->generator_ip = reader.u32();
+    function->import_path = reader.string();
+    return function;
+}
+
+static NativeFunction find_symbol(ImageReader &reader, std::string library, std::string symbol)
+{
+#if __APPLE__ || __linux__
+    void *&handle = reader.libraries[library];
+    if (!handle)
+    {
+        handle = dlopen(library.c_str(), RTLD_LAZY);
+    }
+    return handle ? (NativeFunction)dlsym(handle, symbol.c_str()) : nullptr;
+#else
+    void *&handle = reader.libraries[library];
+    if (!handle)
+    {
+        handle = LoadLibrary(TEXT(library.c_str()));
+    }
+    return handle ? (NativeFunction)GetProcAddress((HINSTANCE)handle, symbol.c_str()) : nullptr;
+#endif
+}
+
+static void read_native(ImageReader &reader, NativeFunctionObj &native)
+{
+    native.name = reader.string();
+    if (reader.u8() == IMAGE_NATIVE_BUILTIN)
+    {
+        std::string name = reader.string();
+        native.function = builtin_function(name);
+        if (!native.function && reader.error == "")
+        {
+            reader.fail("there is no builtin '" + name + "'");
+        }
+        return;
+    }
+    std::string library = reader.string();
+    std::string symbol = reader.string();
+    if (reader.error != "")
+    {
+        return;
+    }
+    native.function = find_symbol(reader, library, symbol);
+    if (!native.function)
+    {
+        reader.fail("function '" + symbol + "' could not be loaded from '" + library + "'");
+        return;
+    }
+    image_register_native(native.function, library, symbol);
+}
+
+static Value read_value(ImageReader &reader)
+{
+    uint8_t type = reader.u8();
+    uint8_t meta = reader.u8();
+    uint8_t hooks = reader.u8();
+    if (reader.error != "" || type > None)
+    {
+        reader.fail("the image is damaged");
+        return none_val();
+    }
+
+    Value value((ValueType)type);
+    value.meta.unpack = meta & 1;
+    value.meta.packer = meta & 2;
+    value.meta.is_const = meta & 4;
+    value.meta.temp_non_const = meta & 8;
+    if (hooks & 1)
+    {
+        value.hooks.onChangeHook = read_box(reader);
+        value.hooks.onChangeHookName = reader.string();
+    }
+    if (hooks & 2)
+    {
+        value.hooks.onAccessHook = read_box(reader);
+        value.hooks.onAccessHookName = reader.string();
+    }
+
+    bool is_new;
+    switch (value.type)
+    {
+    case Number:
+        value.get_number() = reader.f64();
+        break;
+    case String:
+        value.value = pool_make<std::string>(reader.string());
+        break;
+    case Boolean:
+        value.get_boolean() = reader.u8();
+        break;
+    case List:
+    {
+        auto cell = reader.cell(reader.u32(), is_new);
+        if (!is_new)
+        {
+            value.get_list() = std::static_pointer_cast<std::vector<Value>>(cell);
+            break;
+        }
+        reader.cells.push_back(value.get_list());
+        *value.get_list() = read_values(reader);
+        break;
+    }
+    case Type:
+        value.get_type() = read_type(reader);
+        break;
+    case Object:
+    {
+        auto cell = reader.cell(reader.u32(), is_new);
+        if (!is_new)
+        {
+            value.get_object() = std::static_pointer_cast<ObjectObj>(cell);
+            break;
+        }
+        auto object = value.get_object();
+        reader.cells.push_back(object);
+        object->type = read_type(reader);
+        object->type_name = reader.string();
+        object->keys = read_strings(reader);
+        read_map(reader, object->values);
+        break;
+    }
+    case Function:
+        value.get_function() = read_function(reader);
+        break;
+    case Native:
+        read_native(reader, *value.get_native());
+        break;
+    case Pointer:
+        reader.fail("the image is damaged");
+        break;
+    default:
+        break;
+    }
+
+    // Numbers leave a missing cell if the image was cut short
+    if (reader.error != "")
+    {
+        return none_val();
+    }
+    return value;
+}
+
+std::shared_ptr<FunctionObj> image_load(VM &vm, std::string path, std::string source_path, std::string &error)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        error = "cannot open '" + path + "'";
+        return nullptr;
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    std::string data = buffer.str();
+
+    ImageReader reader(data);
+    if (reader.string() != IMAGE_MAGIC || reader.u32() != IMAGE_VERSION || reader.u32() != IMAGE_OPCODES)
+    {
+        error = "'" + path + "' is not an image made by this version of Vortex";
+        return nullptr;
+    }
+
+    uint32_t sources = reader.count();
+    for (uint32_t i = 0; i < sources && reader.error == ""; i++)
+    {
+        ImageSource saved;
+        saved.path = reader.string();
+        saved.size = reader.i64();
+        saved.modified = reader.i64();
+        ImageSource current;
+        if (i == 0 && saved.path != source_path)
+        {
+            error = "the image was made from '" + saved.path + "'";
+            return nullptr;
+        }
+        if (reader.error == "" && (!stamp(saved.path, current) || current.size != saved.size || current.modified != saved.modified))
+        {
+            error = "'" + saved.path + "' has changed since the image was made";
+            return nullptr;
+        }
+    }
+
+    Value main = read_value(reader);
+    std::unordered_map<std::string, CachedImport> imports;
+    while (reader.error == "" && reader.u8() == 1)
+    {
+        std::string import_path = reader.string();
+        CachedImport &cached = imports[import_path];
+        cached.import_object = read_value(reader);
+        read_map(reader, cached.import_globals);
+    }
+
+    if (reader.error != "" || !main.is_function())
+    {
+        error = reader.error != "" ? reader.error : "the image is damaged";
+        return nullptr;
+    }
+
+    for (auto &entry : imports)
+    {
+        vm.import_cache[entry.first] = entry.second;
+    }
+    return main.get_function();
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include "../Bytecode/Bytecode.hpp"
+
+struct VM;
+
+// An image holds a program's compiled main function and the modules it
+// imported, taken as each import finished so later changes made by the
+// program are not saved. Booting from the image skips compiling the program
+// and lexing, compiling and running those modules. Natives are saved by
+// name and looked up again, from the builtins or with the library and
+// symbol load_lib found them through. Pointers cannot be saved, a program
+// holding one in an imported module cannot be imaged
+
+#define IMAGE_VERSION 1
+
+extern bool image_recording;
+
+bool image_snapshot(VM &vm, std::string image_path, std::string source_path);
+void image_record_import(VM &vm, std::string &absolute_path);
+void image_register_native(NativeFunction function, std::string library, std::string symbol);
+void image_discard();
+
+std::shared_ptr<FunctionObj> image_load(VM &vm, std::string image_path, std::string source_path, std::string &error);
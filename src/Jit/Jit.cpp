@@ -0,0 +1,699 @@
+#include <cstring>
+#include <cmath>
+#include <unordered_set>
+#include "Jit.hpp"
+#include "../VirtualMachine/VirtualMachine.hpp"
+
+bool jit_enabled = false;
+
+#ifndef JIT_SUPPORTED
+
+bool jit_enable()
+{
+    return false;
+}
+
+void jit_loop(VM &vm, CallFrame *frame, uint8_t *back_edge)
+{
+}
+
+#else
+
+#include <sys/mman.h>
+
+enum JitState
+{
+    JIT_COUNTING,
+    JIT_COMPILED,
+    JIT_FAILED
+};
+
+// Where compiled code hands back to the interpreter. Consts holds the
+// is_const flag of every local and temporary at that point, the compiled
+// code only carries numbers
+struct JitExit
+{
+    int offset;
+    int depth;
+    std::vector<uint8_t> consts;
+};
+
+static thread_local size_t jit_code_size = 0;
+
+struct JitCode
+{
+    void *memory = nullptr;
+    size_t size = 0;
+
+    JitCode() = default;
+    JitCode(const JitCode &) = delete;
+    JitCode &operator=(const JitCode &) = delete;
+    ~JitCode()
+    {
+        if (memory)
+        {
+            munmap(memory, size);
+            jit_code_size -= size;
+        }
+    }
+};
+
+typedef int (*JitFunction)(double *frame);
+
+struct JitLoop
+{
+    FunctionObj *owner = nullptr;
+    std::weak_ptr<FunctionObj> function;
+    JitState state = JIT_COUNTING;
+    int count = 0;
+    int guard_failures = 0;
+    int entry_depth = 0;
+    int frame_size = 0;
+    // Locals the loop reads or writes, with the is_const flag they were
+    // compiled for
+    std::vector<int> slots;
+    std::vector<uint8_t> slot_consts;
+    std::vector<int> written;
+    // Nested OP_LOOPs record the frame's stack depth for break and continue
+    std::vector<std::pair<int, int>> loops;
+    std::vector<JitExit> exits;
+    std::unique_ptr<JitCode> code;
+};
+
+// Keyed by the address of the loop's OP_JUMP_BACK, each thread compiles the
+// loops it runs. An entry whose function is gone is dropped when its address
+// comes up again, and all of them whenever the map doubles
+static thread_local std::unordered_map<uint8_t *, JitLoop> jit_loops;
+static thread_local size_t jit_sweep_size = JIT_SWEEP_SIZE;
+static thread_local std::vector<double> jit_frame;
+
+bool jit_enable()
+{
+    jit_enabled = true;
+    return true;
+}
+
+// Instructions address the frame through rbx, slot i lives at [rbx + 8 * i]
+struct JitAssembler
+{
+    std::vector<uint8_t> code;
+
+    void bytes(std::initializer_list<uint8_t> values)
+    {
+        code.insert(code.end(), values);
+    }
+    void u32(uint32_t value)
+    {
+        code.insert(code.end(), (uint8_t *)&value, (uint8_t *)&value + sizeof(value));
+    }
+    void u64(uint64_t value)
+    {
+        code.insert(code.end(), (uint8_t *)&value, (uint8_t *)&value + sizeof(value));
+    }
+    // prefix 0F op xmm, [rbx + disp32]
+    void sse(uint8_t prefix, uint8_t op, int xmm, int slot)
+    {
+        bytes({prefix, 0x0F, op, (uint8_t)(0x83 | xmm << 3)});
+        u32(slot * 8);
+    }
+    void load(int xmm, int slot)
+    {
+        sse(0xF2, 0x10, xmm, slot);
+    }
+    void store(int slot, int xmm)
+    {
+        sse(0xF2, 0x11, xmm, slot);
+    }
+    void constant(int slot, double value)
+    {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        bytes({0x48, 0xB8});
+        u64(bits);
+        bytes({0x48, 0x89, 0x83});
+        u32(slot * 8);
+    }
+    void call(void *function)
+    {
+        bytes({0x48, 0xB8});
+        u64((uint64_t)function);
+        bytes({0xFF, 0xD0});
+    }
+    // Returns where the rel32 operand goes, condition 0 is an unconditional jmp
+    int jump(uint8_t condition)
+    {
+        if (condition)
+        {
+            bytes({0x0F, condition});
+        }
+        else
+        {
+            bytes({0xE9});
+        }
+        u32(0);
+        return code.size() - 4;
+    }
+    void patch(int fixup, int target)
+    {
+        int32_t relative = target - (fixup + 4);
+        memcpy(&code[fixup], &relative, sizeof(relative));
+    }
+};
+
+#define JCC_JB 0x82
+#define JCC_JAE 0x83
+#define JCC_JE 0x84
+#define JCC_JNE 0x85
+#define JCC_JBE 0x86
+#define JCC_JA 0x87
+#define JCC_JP 0x8A
+
+struct JitCompiler
+{
+    JitLoop &loop;
+    FunctionObj &function;
+    int start;
+    int end;
+    int entry_depth;
+    JitAssembler assembler;
+    std::unordered_map<int, int> native;
+    std::unordered_map<int, std::vector<uint8_t>> labels;
+    std::vector<std::pair<int, int>> label_fixups;
+    std::vector<std::pair<int, int>> exit_fixups;
+    std::vector<uint8_t> state;
+    std::vector<bool> referenced;
+    std::vector<bool> written;
+
+    JitCompiler(JitLoop &loop, FunctionObj &function, int start, int end, int entry_depth)
+        : loop(loop), function(function), start(start), end(end), entry_depth(entry_depth),
+          referenced(entry_depth), written(entry_depth)
+    {
+    }
+
+    int operand(int offset)
+    {
+        auto &code = function.chunk.code;
+        return bytes_to_int(code[offset + 1], code[offset + 2], code[offset + 3], code[offset + 4]);
+    }
+
+    int top()
+    {
+        return state.size() - 1;
+    }
+
+    // Jumps to a target inside the loop, or out to the interpreter
+    bool branch(uint8_t condition, int from, int target)
+    {
+        if (target < start || target > end)
+        {
+            int fixup = assembler.jump(condition);
+            exit_fixups.push_back({fixup, (int)loop.exits.size()});
+            loop.exits.push_back({target, (int)state.size(), state});
+            return true;
+        }
+        auto label = labels.find(target);
+        if (label != labels.end() && label->second != state)
+        {
+            return false;
+        }
+        if (target <= from)
+        {
+            if (!native.count(target))
+            {
+                return false;
+            }
+            int fixup = assembler.jump(condition);
+            assembler.patch(fixup, native[target]);
+            return true;
+        }
+        labels[target] = state;
+        label_fixups.push_back({assembler.jump(condition), target});
+        return true;
+    }
+
+    // Emits a jump for when the comparison is true, flags come from ucomisd
+    bool compare_branch(uint8_t op, bool when, int from, int target)
+    {
+        switch (op)
+        {
+        case OP_LT:
+            assembler.load(0, top() + 2);
+            assembler.sse(0x66, 0x2E, 0, top() + 1);
+            return branch(when ? JCC_JA : JCC_JBE, from, target);
+        case OP_LT_EQ:
+            assembler.load(0, top() + 2);
+            assembler.sse(0x66, 0x2E, 0, top() + 1);
+            return branch(when ? JCC_JAE : JCC_JB, from, target);
+        case OP_GT:
+            assembler.load(0, top() + 1);
+            assembler.sse(0x66, 0x2E, 0, top() + 2);
+            return branch(when ? JCC_JA : JCC_JBE, from, target);
+        case OP_GT_EQ:
+            assembler.load(0, top() + 1);
+            assembler.sse(0x66, 0x2E, 0, top() + 2);
+            return branch(when ? JCC_JAE : JCC_JB, from, target);
+        default:
+        {
+            // Unordered compares set ZF and PF, NaN is never equal
+            assembler.load(0, top() + 1);
+            assembler.sse(0x66, 0x2E, 0, top() + 2);
+            bool equal = (op == OP_EQ_EQ) == when;
+            if (equal)
+            {
+                assembler.bytes({0x7A, 0x06});
+                return branch(JCC_JE, from, target);
+            }
+            return branch(JCC_JP, from, target) && branch(JCC_JNE, from, target);
+        }
+        }
+    }
+
+    bool compile(Value *frame_values)
+    {
+        auto &code = function.chunk.code;
+        std::unordered_set<int> targets;
+        for (int offset = start; offset <= end; offset = advance(function.chunk, offset))
+        {
+            uint8_t op = code[offset];
+            if (op == OP_JUMP || op == OP_POP_JUMP_IF_FALSE || op == OP_POP_JUMP_IF_TRUE)
+            {
+                targets.insert(offset + 5 + operand(offset));
+            }
+            else if (op == OP_JUMP_BACK)
+            {
+                targets.insert(offset + 5 - operand(offset));
+            }
+        }
+
+        for (int i = 0; i < entry_depth; i++)
+        {
+            state.push_back(frame_values[i].meta.is_const);
+        }
+        labels[start] = state;
+
+        // push rbx; mov rbx, rdi
+        assembler.bytes({0x53, 0x48, 0x89, 0xFB});
+
+        int max_depth = entry_depth;
+        bool reachable = true;
+        int offset = start;
+        while (offset <= end)
+        {
+            uint8_t op = code[offset];
+            int next = advance(function.chunk, offset);
+
+            auto label = labels.find(offset);
+            if (label != labels.end())
+            {
+                if (reachable && label->second != state)
+                {
+                    return false;
+                }
+                state = label->second;
+                reachable = true;
+            }
+            if (!reachable)
+            {
+                if (targets.count(offset))
+                {
+                    return false;
+                }
+                offset = next;
+                continue;
+            }
+            native[offset] = assembler.code.size();
+            if (targets.count(offset))
+            {
+                labels[offset] = state;
+            }
+
+            switch (op)
+            {
+            case OP_LOAD:
+            {
+                int slot = operand(offset);
+                if (slot < 0 || slot >= entry_depth)
+                {
+                    return false;
+                }
+                referenced[slot] = true;
+                assembler.load(0, slot);
+                assembler.store(state.size(), 0);
+                uint8_t is_const = state[slot];
+                state.push_back(is_const);
+                break;
+            }
+            case OP_LOAD_CONST:
+            {
+                int index = operand(offset);
+                // Parameters are passed in the first constants
+                if (index < function.arity || index >= function.chunk.constants.size())
+                {
+                    return false;
+                }
+                Value &constant = function.chunk.constants[index];
+                if (!constant.is_number() || constant.hooks.onChangeHook || constant.hooks.onAccessHook ||
+                    constant.meta.unpack || constant.meta.packer || constant.meta.temp_non_const)
+                {
+                    return false;
+                }
+                assembler.constant(state.size(), constant.get_number());
+                state.push_back(constant.meta.is_const);
+                break;
+            }
+            case OP_SET:
+            case OP_SET_FORCE:
+            {
+                int slot = operand(offset);
+                if (slot < 0 || slot >= entry_depth || state.size() <= entry_depth)
+                {
+                    return false;
+                }
+                // Leave the error to the interpreter
+                if (op == OP_SET && state[slot])
+                {
+                    return false;
+                }
+                referenced[slot] = true;
+                written[slot] = true;
+                assembler.load(0, top());
+                assembler.store(slot, 0);
+                state[slot] = op == OP_SET ? 0 : state.back();
+                break;
+            }
+            case OP_POP:
+            {
+                if (state.size() <= entry_depth)
+                {
+                    return false;
+                }
+                state.pop_back();
+                break;
+            }
+            case OP_ADD:
+            case OP_SUBTRACT:
+            case OP_MULTIPLY:
+            case OP_DIVIDE:
+            case OP_MOD:
+            case OP_POW:
+            case OP_AND:
+            case OP_OR:
+            {
+                if (state.size() < entry_depth + 2)
+                {
+                    return false;
+                }
+                int left = top() - 1;
+                int right = top();
+                assembler.load(0, left);
+                if (op == OP_ADD || op == OP_SUBTRACT || op == OP_MULTIPLY || op == OP_DIVIDE)
+                {
+                    uint8_t instruction = op == OP_ADD ? 0x58 : op == OP_SUBTRACT ? 0x5C
+                                                          : op == OP_MULTIPLY   ? 0x59
+                                                                                : 0x5E;
+                    assembler.sse(0xF2, instruction, 0, right);
+                }
+                else if (op == OP_MOD || op == OP_POW)
+                {
+                    assembler.load(1, right);
+                    assembler.call(op == OP_MOD ? (void *)(double (*)(double, double))fmod : (void *)(double (*)(double, double))pow);
+                }
+                else
+                {
+                    // cvttsd2si eax, xmm0; cvttsd2si ecx, xmm1; and/or eax, ecx; cvtsi2sd xmm0, eax
+                    assembler.load(1, right);
+                    assembler.bytes({0xF2, 0x0F, 0x2C, 0xC0, 0xF2, 0x0F, 0x2C, 0xC9});
+                    assembler.bytes({(uint8_t)(op == OP_AND ? 0x21 : 0x09), 0xC8});
+                    assembler.bytes({0xF2, 0x0F, 0x2A, 0xC0});
+                }
+                assembler.store(left, 0);
+                state.pop_back();
+                state.back() = 0;
+                break;
+            }
+            case OP_NEGATE:
+            {
+                if (state.size() <= entry_depth)
+                {
+                    return false;
+                }
+                // Flip the sign bit: mov rax, imm64; xor [rbx + disp32], rax
+                assembler.bytes({0x48, 0xB8});
+                assembler.u64(0x8000000000000000ull);
+                assembler.bytes({0x48, 0x31, 0x83});
+                assembler.u32(top() * 8);
+                state.back() = 0;
+                break;
+            }
+            case OP_EQ_EQ:
+            case OP_NOT_EQ:
+            case OP_LT:
+            case OP_LT_EQ:
+            case OP_GT:
+            case OP_GT_EQ:
+            {
+                // Only comparisons that feed a conditional jump, the boolean
+                // never exists
+                uint8_t jump = next <= end ? code[next] : OP_EXIT;
+                if ((jump != OP_POP_JUMP_IF_FALSE && jump != OP_POP_JUMP_IF_TRUE) || targets.count(next) ||
+                    state.size() < entry_depth + 2)
+                {
+                    return false;
+                }
+                state.pop_back();
+                state.pop_back();
+                int after = advance(function.chunk, next);
+                if (!compare_branch(op, jump == OP_POP_JUMP_IF_TRUE, next, after + operand(next)))
+                {
+                    return false;
+                }
+                next = after;
+                break;
+            }
+            case OP_JUMP:
+            {
+                if (!branch(0, offset, next + operand(offset)))
+                {
+                    return false;
+                }
+                reachable = false;
+                break;
+            }
+            case OP_JUMP_BACK:
+            {
+                int target = next - operand(offset);
+                if (target < start || !branch(0, offset, target))
+                {
+                    return false;
+                }
+                reachable = false;
+                break;
+            }
+            case OP_LOOP:
+                loop.loops.push_back({offset, (int)state.size()});
+                break;
+            case OP_LOOP_END:
+            case OP_ITER:
+                break;
+            case OP_RETURN:
+            {
+                int fixup = assembler.jump(0);
+                exit_fixups.push_back({fixup, (int)loop.exits.size()});
+                loop.exits.push_back({offset, (int)state.size(), state});
+                reachable = false;
+                break;
+            }
+            default:
+                return false;
+            }
+
+            max_depth = std::max(max_depth, (int)state.size() + 1);
+            offset = next;
+        }
+
+        if (reachable || offset != end + 5)
+        {
+            return false;
+        }
+
+        for (auto &fixup : label_fixups)
+        {
+            if (!native.count(fixup.second))
+            {
+                return false;
+            }
+            assembler.patch(fixup.first, native[fixup.second]);
+        }
+        std::vector<int> stubs;
+        for (int i = 0; i < loop.exits.size(); i++)
+        {
+            // mov eax, exit; pop rbx; ret
+            stubs.push_back(assembler.code.size());
+            assembler.bytes({0xB8});
+            assembler.u32(i);
+            assembler.bytes({0x5B, 0xC3});
+        }
+        for (auto &fixup : exit_fixups)
+        {
+            assembler.patch(fixup.first, stubs[fixup.second]);
+        }
+
+        for (int i = 0; i < entry_depth; i++)
+        {
+            if (referenced[i])
+            {
+                loop.slots.push_back(i);
+                loop.slot_consts.push_back(frame_values[i].meta.is_const);
+            }
+            if (written[i])
+            {
+                loop.written.push_back(i);
+            }
+        }
+        loop.entry_depth = entry_depth;
+        loop.frame_size = max_depth;
+        return install();
+    }
+
+    bool install()
+    {
+        size_t page = 4096;
+        size_t size = (assembler.code.size() + page - 1) / page * page;
+        if (jit_code_size + size > JIT_CODE_LIMIT)
+        {
+            return false;
+        }
+        void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+        if (memory == MAP_FAILED)
+        {
+            return false;
+        }
+        memcpy(memory, assembler.code.data(), assembler.code.size());
+        if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0)
+        {
+            munmap(memory, size);
+            return false;
+        }
+        loop.code = std::make_unique<JitCode>();
+        loop.code->memory = memory;
+        loop.code->size = size;
+        jit_code_size += size;
+        return true;
+    }
+};
+
+static bool guard(JitLoop &loop, Value *frame_values)
+{
+    for (int i = 0; i < loop.slots.size(); i++)
+    {
+        Value &value = frame_values[loop.slots[i]];
+        if (!value.is_number() || value.hooks.onChangeHook || value.hooks.onAccessHook || value.meta.unpack ||
+            value.meta.packer || value.meta.temp_non_const || value.meta.is_const != loop.slot_consts[i])
+        {
+            return false;
+        }
+        jit_frame[loop.slots[i]] = value.get_number();
+    }
+    return true;
+}
+
+static void jit_sweep()
+{
+    for (auto it = jit_loops.begin(); it != jit_loops.end();)
+    {
+        if (it->second.function.expired())
+        {
+            it = jit_loops.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    jit_sweep_size = std::max((size_t)JIT_SWEEP_SIZE, jit_loops.size() * 2);
+}
+
+void jit_loop(VM &vm, CallFrame *frame, uint8_t *back_edge)
+{
+    auto found = jit_loops.find(back_edge);
+    if (found != jit_loops.end() && (found->second.owner != frame->function.get() || found->second.function.expired()))
+    {
+        jit_loops.erase(found);
+        found = jit_loops.end();
+    }
+    if (found == jit_loops.end())
+    {
+        if (jit_loops.size() >= jit_sweep_size)
+        {
+            jit_sweep();
+        }
+        found = jit_loops.emplace(back_edge, JitLoop()).first;
+        found->second.owner = frame->function.get();
+        found->second.function = frame->function;
+    }
+    JitLoop &loop = found->second;
+    if (loop.state == JIT_FAILED)
+    {
+        return;
+    }
+
+    auto &chunk = frame->function->chunk;
+    Value *frame_values = vm.stack.data() + frame->frame_start;
+    int depth = vm.stack.size() - frame->frame_start;
+    if (loop.state == JIT_COUNTING)
+    {
+        if (++loop.count < JIT_HOT_LOOP)
+        {
+            return;
+        }
+        int end = back_edge - chunk.code.data();
+        int start = frame->ip - chunk.code.data();
+        JitCompiler compiler(loop, *frame->function, start, end, depth);
+        if (!compiler.compile(frame_values))
+        {
+            loop.state = JIT_FAILED;
+            loop.exits.clear();
+            return;
+        }
+        loop.state = JIT_COMPILED;
+    }
+
+    if (jit_frame.size() < loop.frame_size)
+    {
+        jit_frame.resize(loop.frame_size);
+    }
+    if (depth != loop.entry_depth || !guard(loop, frame_values))
+    {
+        if (++loop.guard_failures >= JIT_MAX_GUARD_FAILURES)
+        {
+            loop.state = JIT_FAILED;
+            loop.code.reset();
+        }
+        return;
+    }
+    loop.guard_failures = 0;
+
+    int exit = ((JitFunction)loop.code->memory)(jit_frame.data());
+    JitExit &state = loop.exits[exit];
+
+    for (int slot : loop.written)
+    {
+        Value &value = frame_values[slot];
+        std::get<double>(value.value) = jit_frame[slot];
+        value.meta = Meta();
+        value.meta.is_const = state.consts[slot];
+    }
+    for (auto &nested : loop.loops)
+    {
+        memcpy(chunk.code.data() + nested.first + 1, &nested.second, sizeof(nested.second));
+    }
+    for (int i = loop.entry_depth; i < state.depth; i++)
+    {
+        Value value = number_val(jit_frame[i]);
+        value.meta.is_const = state.consts[i];
+        vm.stack.push_back(std::move(value));
+    }
+    frame->ip = chunk.code.data() + state.offset;
+}
+
+#endif
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+
+struct VM;
+struct CallFrame;
+
+// Loops whose back edge is taken JIT_HOT_LOOP times are compiled to x86-64,
+// one template per opcode over unboxed doubles. Only loops made entirely of
+// number loads, stores, arithmetic, comparisons and jumps are compiled, so
+// every value inside stays a number. Guards run when the loop is entered:
+// a local that is not a plain number, has hooks or would break a const
+// leaves the loop to the interpreter. Leaving the compiled code writes the
+// numbers back and resumes the interpreter at the instruction that left
+
+#define JIT_HOT_LOOP 1000
+#define JIT_MAX_GUARD_FAILURES 16
+#define JIT_CODE_LIMIT (16 << 20)
+// Loops tracked per thread before those of freed functions are dropped
+#define JIT_SWEEP_SIZE 256
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define JIT_SUPPORTED
+#endif
+
+extern bool jit_enabled;
+
+bool jit_enable();
+void jit_loop(VM &vm, CallFrame *frame, uint8_t *back_edge);
@@ -0,0 +1,385 @@
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+#include "OpcodeStats.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <x86intrin.h>
+#define OPCODE_RDTSC
+#endif
+
+static const char *opcode_names[] = {
+    "OP_RETURN",
+    "OP_YIELD",
+    "OP_LOAD_CONST",
+    "OP_LOAD_THIS",
+    "OP_NEGATE",
+    "OP_ADD",
+    "OP_SUBTRACT",
+    "OP_MULTIPLY",
+    "OP_DIVIDE",
+    "OP_MOD",
+    "OP_POW",
+    "OP_AND",
+    "OP_OR",
+    "OP_NOT",
+    "OP_EQ_EQ",
+    "OP_NOT_EQ",
+    "OP_LT_EQ",
+    "OP_GT_EQ",
+    "OP_LT",
+    "OP_GT",
+    "OP_RANGE",
+    "OP_DOT",
+    "OP_STORE_VAR",
+    "OP_LOAD",
+    "OP_LOAD_GLOBAL",
+    "OP_LOAD_CLOSURE",
+    "OP_SET",
+    "OP_SET_FORCE",
+    "OP_SET_PROPERTY",
+    "OP_SET_CLOSURE",
+    "OP_MAKE_CLOSURE",
+    "OP_MAKE_TYPE",
+    "OP_MAKE_TYPED",
+    "OP_MAKE_OBJECT",
+    "OP_MAKE_FUNCTION",
+    "OP_MAKE_CONST",
+    "OP_MAKE_NON_CONST",
+    "OP_TYPE_DEFAULTS",
+    "OP_POP",
+    "OP_POP_CLOSE",
+    "OP_JUMP_IF_FALSE",
+    "OP_JUMP_IF_TRUE",
+    "OP_POP_JUMP_IF_FALSE",
+    "OP_POP_JUMP_IF_TRUE",
+    "OP_JUMP",
+    "OP_JUMP_BACK",
+    "OP_EXIT",
+    "OP_BREAK",
+    "OP_CONTINUE",
+    "OP_BUILD_LIST",
+    "OP_ACCESSOR",
+    "OP_LEN",
+    "OP_CALL",
+    "OP_CALL_METHOD",
+    "OP_IMPORT",
+    "OP_UNPACK",
+    "OP_REMOVE_PUSH",
+    "OP_SWAP_TOS",
+    "OP_LOOP",
+    "OP_LOOP_END",
+    "OP_ITER",
+    "OP_HOOK_ONCHANGE",
+    "OP_HOOK_CLOSURE_ONCHANGE",
+    "OP_HOOK_ONACCESS",
+    "OP_HOOK_CLOSURE_ONACCESS"};
+
+#define OPCODE_COUNT (sizeof(opcode_names) / sizeof(opcode_names[0]))
+static_assert(OPCODE_COUNT == OP_HOOK_CLOSURE_ONACCESS + 1, "opcode_names is out of sync with OpCode");
+
+const char *opcode_name(uint8_t op)
+{
+    return op < OPCODE_COUNT ? opcode_names[op] : "OP_UNKNOWN";
+}
+
+// Functions are rebuilt from their template on every closure, so counts are
+// keyed by where the code came from rather than by FunctionObj
+struct FunctionStats
+{
+    std::string name;
+    std::string path;
+    int line;
+    std::vector<uint8_t> code;
+    std::vector<uint64_t> counts;
+};
+
+struct OpcodeStats
+{
+    uint64_t counts[OPCODE_COUNT] = {};
+    uint64_t cycles[OPCODE_COUNT] = {};
+    uint64_t histogram[OPCODE_COUNT][OPCODE_HISTOGRAM_BUCKETS] = {};
+    std::unordered_map<std::string, FunctionStats> functions;
+};
+
+static OpcodeStats opcode_shared;
+static std::mutex opcode_mutex;
+
+static void merge_stats(OpcodeStats &into, OpcodeStats &from)
+{
+    for (int op = 0; op < OPCODE_COUNT; op++)
+    {
+        into.counts[op] += from.counts[op];
+        into.cycles[op] += from.cycles[op];
+        for (int b = 0; b < OPCODE_HISTOGRAM_BUCKETS; b++)
+        {
+            into.histogram[op][b] += from.histogram[op][b];
+        }
+    }
+    for (auto &[key, function] : from.functions)
+    {
+        auto &target = into.functions[key];
+        if (target.counts.empty())
+        {
+            target = function;
+            continue;
+        }
+        for (int i = 0; i < target.counts.size() && i < function.counts.size(); i++)
+        {
+            target.counts[i] += function.counts[i];
+        }
+    }
+}
+
+// Futures count into their own thread's stats and hand them over on exit
+struct ThreadOpcodeStats
+{
+    OpcodeStats stats;
+    FunctionObj *last_function = nullptr;
+    uint8_t *last_code = nullptr;
+    std::vector<uint64_t> *last_counts = nullptr;
+    int last_op = -1;
+    uint64_t last_time = 0;
+
+    ~ThreadOpcodeStats()
+    {
+        std::lock_guard<std::mutex> lock(opcode_mutex);
+        merge_stats(opcode_shared, stats);
+    }
+};
+
+static thread_local ThreadOpcodeStats opcode_thread;
+
+static std::string function_key(FunctionObj &function)
+{
+    auto &chunk = function.chunk;
+    int line = chunk.lines.empty() ? 0 : chunk.lines[0];
+    return function.import_path + ":" + function.name + ":" + std::to_string(line) + ":" + std::to_string(chunk.code.size());
+}
+
+static std::vector<uint64_t> *function_counts(OpcodeStats &stats, FunctionObj &function)
+{
+    auto &entry = stats.functions[function_key(function)];
+    if (entry.counts.empty())
+    {
+        entry.name = function.name;
+        entry.path = function.import_path;
+        entry.line = function.chunk.lines.empty() ? 0 : function.chunk.lines[0];
+        entry.code = function.chunk.code;
+        entry.counts.resize(function.chunk.code.size());
+    }
+    return &entry.counts;
+}
+
+static inline uint64_t read_timer()
+{
+#ifdef OPCODE_RDTSC
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+void opcode_stats_record(FunctionObj *function, int offset, uint8_t op)
+{
+    auto &thread = opcode_thread;
+
+#ifdef OPCODE_TIMING
+    uint64_t now = read_timer();
+    if (thread.last_op >= 0)
+    {
+        uint64_t elapsed = now - thread.last_time;
+        int bucket = elapsed == 0 ? 0 : std::min(64 - __builtin_clzll(elapsed), OPCODE_HISTOGRAM_BUCKETS - 1);
+        thread.stats.cycles[thread.last_op] += elapsed;
+        thread.stats.histogram[thread.last_op][bucket]++;
+    }
+    thread.last_time = now;
+#endif
+    thread.last_op = op < OPCODE_COUNT ? op : -1;
+
+    if (op < OPCODE_COUNT)
+    {
+        thread.stats.counts[op]++;
+    }
+
+    if (function != thread.last_function || function->chunk.code.data() != thread.last_code)
+    {
+        thread.last_function = function;
+        thread.last_code = function->chunk.code.data();
+        thread.last_counts = function_counts(thread.stats, *function);
+    }
+    if (offset < thread.last_counts->size())
+    {
+        (*thread.last_counts)[offset]++;
+    }
+}
+
+std::vector<uint64_t> *opcode_stats_counts(FunctionObj &function)
+{
+    auto found = opcode_thread.stats.functions.find(function_key(function));
+    if (found == opcode_thread.stats.functions.end())
+    {
+        return nullptr;
+    }
+    return &found->second.counts;
+}
+
+// This thread's counts plus those handed over by finished futures
+static OpcodeStats collect_stats()
+{
+    OpcodeStats total;
+    merge_stats(total, opcode_thread.stats);
+    std::lock_guard<std::mutex> lock(opcode_mutex);
+    merge_stats(total, opcode_shared);
+    return total;
+}
+
+struct HotInstruction
+{
+    FunctionStats *function;
+    int offset;
+    uint64_t count;
+};
+
+static std::vector<HotInstruction> hot_instructions(OpcodeStats &stats, int limit)
+{
+    std::vector<HotInstruction> hot;
+    for (auto &[key, function] : stats.functions)
+    {
+        for (int offset = 0; offset < function.counts.size(); offset++)
+        {
+            if (function.counts[offset] > 0)
+            {
+                hot.push_back({&function, offset, function.counts[offset]});
+            }
+        }
+    }
+    std::sort(hot.begin(), hot.end(), [](auto &a, auto &b)
+              { return a.count != b.count ? a.count > b.count : a.offset < b.offset; });
+    if (hot.size() > limit)
+    {
+        hot.resize(limit);
+    }
+    return hot;
+}
+
+static const char *hot_opcode(HotInstruction &hot)
+{
+    uint8_t op = hot.function->code[hot.offset];
+    return op < OPCODE_COUNT ? opcode_names[op] : "?";
+}
+
+static std::string hot_label(HotInstruction &hot)
+{
+    std::string file = std::filesystem::path(hot.function->path).filename().string();
+    std::string name = hot.function->name != "" ? hot.function->name : "<main>";
+    return name + " (" + file + ":" + std::to_string(hot.function->line) + ") @" + std::to_string(hot.offset);
+}
+
+void opcode_stats_report()
+{
+    OpcodeStats stats = collect_stats();
+
+    uint64_t total = 0;
+    std::vector<int> ops;
+    for (int op = 0; op < OPCODE_COUNT; op++)
+    {
+        total += stats.counts[op];
+        if (stats.counts[op] > 0)
+        {
+            ops.push_back(op);
+        }
+    }
+    if (total == 0)
+    {
+        return;
+    }
+    std::sort(ops.begin(), ops.end(), [&](int a, int b)
+              { return stats.counts[a] > stats.counts[b]; });
+
+    fprintf(stderr, "\n== opcode stats: %llu instructions ==\n", (unsigned long long)total);
+    fprintf(stderr, "%-26s %14s %7s", "opcode", "count", "%");
+#ifdef OPCODE_TIMING
+    fprintf(stderr, " %12s %8s", "total", "avg");
+#endif
+    fprintf(stderr, "\n");
+    for (int op : ops)
+    {
+        fprintf(stderr, "%-26s %14llu %6.2f%%", opcode_names[op], (unsigned long long)stats.counts[op], 100.0 * stats.counts[op] / total);
+#ifdef OPCODE_TIMING
+        fprintf(stderr, " %12llu %8.1f", (unsigned long long)stats.cycles[op], (double)stats.cycles[op] / stats.counts[op]);
+#endif
+        fprintf(stderr, "\n");
+    }
+
+#ifdef OPCODE_TIMING
+    fprintf(stderr, "\n== opcode time histogram (log2 buckets) ==\n");
+    for (int op : ops)
+    {
+        fprintf(stderr, "%-26s", opcode_names[op]);
+        for (int b = 0; b < OPCODE_HISTOGRAM_BUCKETS; b++)
+        {
+            if (stats.histogram[op][b] > 0)
+            {
+                fprintf(stderr, " <2^%d:%llu", b, (unsigned long long)stats.histogram[op][b]);
+            }
+        }
+        fprintf(stderr, "\n");
+    }
+#endif
+
+    fprintf(stderr, "\n== hot instructions ==\n");
+    for (auto &hot : hot_instructions(stats, OPCODE_REPORT_ROWS))
+    {
+        fprintf(stderr, "%14llu %6.2f%%  %-26s %s\n", (unsigned long long)hot.count, 100.0 * hot.count / total, hot_opcode(hot), hot_label(hot).c_str());
+    }
+}
+
+Value opcode_stats_value()
+{
+    OpcodeStats stats = collect_stats();
+
+    Value result = object_val();
+    auto &obj = result.get_object();
+    obj->keys = {"opcodes", "hot"};
+    obj->values["opcodes"] = object_val();
+    obj->values["hot"] = list_val();
+
+    auto &opcodes = obj->values["opcodes"].get_object();
+    for (int op = 0; op < OPCODE_COUNT; op++)
+    {
+        if (stats.counts[op] == 0)
+        {
+            continue;
+        }
+        Value entry = object_val();
+        auto &entry_obj = entry.get_object();
+        entry_obj->keys = {"count", "cycles", "histogram"};
+        entry_obj->values["count"] = number_val(stats.counts[op]);
+        entry_obj->values["cycles"] = number_val(stats.cycles[op]);
+        entry_obj->values["histogram"] = list_val();
+        for (int b = 0; b < OPCODE_HISTOGRAM_BUCKETS; b++)
+        {
+            entry_obj->values["histogram"].get_list()->push_back(number_val(stats.histogram[op][b]));
+        }
+        opcodes->keys.push_back(opcode_names[op]);
+        opcodes->values[opcode_names[op]] = entry;
+    }
+
+    for (auto &hot : hot_instructions(stats, OPCODE_REPORT_ROWS))
+    {
+        Value entry = object_val();
+        auto &entry_obj = entry.get_object();
+        entry_obj->keys = {"function", "path", "line", "offset", "opcode", "count"};
+        entry_obj->values["function"] = string_val(hot.function->name);
+        entry_obj->values["path"] = string_val(hot.function->path);
+        entry_obj->values["line"] = number_val(hot.function->line);
+        entry_obj->values["offset"] = number_val(hot.offset);
+        entry_obj->values["opcode"] = string_val(hot_opcode(hot));
+        entry_obj->values["count"] = number_val(hot.count);
+        obj->values["hot"].get_list()->push_back(entry);
+    }
+
+    return result;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "../Bytecode/Bytecode.hpp"
+
+// Instrumented build: count every instruction executed by run(), per opcode
+// and per function offset. OPCODE_TIMING adds a cycle histogram per opcode,
+// measured from the start of one instruction to the start of the next
+
+// #define OPCODE_STATS
+// #define OPCODE_TIMING
+
+#define OPCODE_HISTOGRAM_BUCKETS 32
+#define OPCODE_REPORT_ROWS 30
+
+const char *opcode_name(uint8_t op);
+void opcode_stats_record(FunctionObj *function, int offset, uint8_t op);
+std::vector<uint64_t> *opcode_stats_counts(FunctionObj &function);
+void opcode_stats_report();
+Value opcode_stats_value();
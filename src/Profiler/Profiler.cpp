@@ -0,0 +1,258 @@
+#include <mutex>
+#include <set>
+#include <fstream>
+#include <filesystem>
+#include "Profiler.hpp"
+#include "../VirtualMachine/VirtualMachine.hpp"
+
+#if defined(__APPLE__) || defined(__linux__)
+#include <csignal>
+#include <sys/time.h>
+#define PROFILER_SUPPORTED
+#endif
+
+#define PROFILER_REPORT_ROWS 40
+
+std::atomic<int> vm_events = 0;
+bool profiler_enabled = false;
+
+static std::string profiler_output;
+static int profiler_frequency = 1000;
+static std::mutex profiler_mutex;
+static std::unordered_map<std::string, long long> profiler_stacks;
+static long long profiler_total = 0;
+
+// VMs currently inside evaluate() on this thread, outermost first, with the
+// native each one is calling, so hooks, comparators and imports are reported
+// under the frames that started them
+struct ProfiledVM
+{
+    VM *vm;
+    std::string *native;
+};
+static thread_local std::vector<ProfiledVM> profiler_vms;
+
+#ifdef PROFILER_SUPPORTED
+static void profiler_handler(int)
+{
+    vm_events.fetch_add(1, std::memory_order_relaxed);
+}
+#endif
+
+bool profiler_start(std::string output_path, int frequency)
+{
+#ifdef PROFILER_SUPPORTED
+    profiler_output = output_path;
+    profiler_frequency = frequency;
+
+    struct sigaction action = {};
+    action.sa_handler = profiler_handler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, nullptr) != 0)
+    {
+        return false;
+    }
+
+    struct itimerval timer = {};
+    timer.it_interval.tv_usec = 1000000 / frequency;
+    timer.it_value.tv_usec = 1000000 / frequency;
+    if (setitimer(ITIMER_PROF, &timer, nullptr) != 0)
+    {
+        return false;
+    }
+
+    profiler_enabled = true;
+    atexit(profiler_write);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void profiler_enter(VM &vm)
+{
+    if (profiler_enabled)
+    {
+        profiler_vms.push_back({&vm, nullptr});
+    }
+}
+
+void profiler_leave()
+{
+    if (profiler_enabled && !profiler_vms.empty())
+    {
+        profiler_vms.pop_back();
+    }
+}
+
+void profiler_native_begin(std::string &name)
+{
+    if (profiler_enabled && !profiler_vms.empty())
+    {
+        profiler_vms.back().native = &name;
+    }
+}
+
+void profiler_native_end()
+{
+    if (profiler_enabled && !profiler_vms.empty())
+    {
+        profiler_check();
+        profiler_vms.back().native = nullptr;
+    }
+}
+
+std::string profiler_frame_label(CallFrame &frame, bool entry, bool executing)
+{
+    auto &function = frame.function;
+    auto &lines = function->chunk.lines;
+    int line = 0;
+    if (!lines.empty())
+    {
+        int offset = frame.ip - function->chunk.code.data() - (executing ? 0 : 1);
+        offset = std::clamp(offset, 0, (int)lines.size() - 1);
+        // Some generated instructions carry no line of their own
+        while (offset > 0 && lines[offset] == 0)
+        {
+            offset--;
+        }
+        line = lines[offset];
+    }
+    std::string file = std::filesystem::path(function->import_path).filename().string();
+    std::string name = function->name != "" ? function->name : entry ? "<main>" : "<lambda>";
+    return name + " (" + file + ":" + std::to_string(line) + ")";
+}
+
+std::string profiler_function_label(FunctionObj &function)
+{
+    int line = 0;
+    for (int l : function.chunk.lines)
+    {
+        if (l != 0)
+        {
+            line = l;
+            break;
+        }
+    }
+    std::string file = std::filesystem::path(function.import_path).filename().string();
+    std::string name = function.name != "" ? function.name : "<lambda>";
+    return name + " (" + file + ":" + std::to_string(line) + ")";
+}
+
+void profiler_sample()
+{
+    int ticks = vm_events.fetch_and(~VM_EVENT_TICKS, std::memory_order_relaxed) & VM_EVENT_TICKS;
+    if (ticks == 0 || profiler_vms.empty())
+    {
+        return;
+    }
+
+    std::string stack;
+    for (int v = 0; v < profiler_vms.size(); v++)
+    {
+        VM &vm = *profiler_vms[v].vm;
+        std::string *native = profiler_vms[v].native;
+        bool innermost = v == profiler_vms.size() - 1 && !native;
+        // Nested VMs start with a synthetic entry frame that only makes the call
+        for (int f = v == 0 ? 0 : 1; f < vm.frames.size(); f++)
+        {
+            if (!stack.empty())
+            {
+                stack += ";";
+            }
+            stack += profiler_frame_label(vm.frames[f], v == 0 && f == 0, innermost && f == vm.frames.size() - 1);
+        }
+        if (native)
+        {
+            stack += ";[native] " + *native;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(profiler_mutex);
+    profiler_stacks[stack] += ticks;
+    profiler_total += ticks;
+}
+
+// 'name (file:line)' to 'name (file)'
+static std::string function_key(const std::string &frame)
+{
+    size_t colon = frame.find_last_of(':');
+    if (colon == std::string::npos || frame.back() != ')')
+    {
+        return frame;
+    }
+    return frame.substr(0, colon) + ")";
+}
+
+static void write_table(std::ofstream &report, std::string title, std::string column, std::unordered_map<std::string, long long> &counts)
+{
+    std::vector<std::pair<std::string, long long>> rows(counts.begin(), counts.end());
+    std::sort(rows.begin(), rows.end(), [](auto &a, auto &b)
+              { return a.second > b.second; });
+
+    report << title << "\n";
+    report << "  samples       %  " << column << "\n";
+    char buffer[64];
+    for (int i = 0; i < rows.size() && i < PROFILER_REPORT_ROWS; i++)
+    {
+        snprintf(buffer, sizeof(buffer), "%9lld  %5.1f%%  ", rows[i].second, 100.0 * rows[i].second / profiler_total);
+        report << buffer << rows[i].first << "\n";
+    }
+    report << "\n";
+}
+
+void profiler_write()
+{
+    if (!profiler_enabled)
+    {
+        return;
+    }
+    profiler_enabled = false;
+
+#ifdef PROFILER_SUPPORTED
+    struct itimerval timer = {};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+#endif
+
+    std::lock_guard<std::mutex> lock(profiler_mutex);
+
+    std::unordered_map<std::string, long long> self;
+    std::unordered_map<std::string, long long> cumulative;
+    std::ofstream folded(profiler_output + ".folded");
+    for (auto &[stack, count] : profiler_stacks)
+    {
+        folded << stack << " " << count << "\n";
+
+        std::vector<std::string> frames;
+        size_t start = 0;
+        size_t end;
+        while ((end = stack.find(';', start)) != std::string::npos)
+        {
+            frames.push_back(stack.substr(start, end - start));
+            start = end + 1;
+        }
+        frames.push_back(stack.substr(start));
+
+        self[frames.back()] += count;
+        std::set<std::string> seen;
+        for (auto &frame : frames)
+        {
+            std::string key = function_key(frame);
+            if (seen.insert(key).second)
+            {
+                cumulative[key] += count;
+            }
+        }
+    }
+
+    std::ofstream report(profiler_output + ".txt");
+    report << "Vortex profile: " << profiler_total << " samples, CPU timer at " << profiler_frequency << " Hz\n\n";
+    if (profiler_total > 0)
+    {
+        write_table(report, "Self time by line", "location", self);
+        write_table(report, "Total time by function", "function", cumulative);
+    }
+
+    fprintf(stderr, "Profile written to %s.txt and %s.folded\n", profiler_output.c_str(), profiler_output.c_str());
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+
+struct VM;
+struct CallFrame;
+struct FunctionObj;
+
+// Ticks are counted by a SIGPROF handler and turned into samples by the VM
+// that next checks them, so stacks are only ever read from VM code
+
+// The dispatch loop tests this one word before each instruction. The low
+// bits count pending profiler ticks, VM_EVENT_TRACE is set while the tracer
+// records
+#define VM_EVENT_TRACE (1 << 30)
+#define VM_EVENT_TICKS (VM_EVENT_TRACE - 1)
+
+extern std::atomic<int> vm_events;
+extern bool profiler_enabled;
+
+bool profiler_start(std::string output_path, int frequency = 1000);
+void profiler_write();
+
+void profiler_enter(VM &vm);
+void profiler_leave();
+void profiler_native_begin(std::string &name);
+void profiler_native_end();
+void profiler_sample();
+// 'name (file:line)' for the instruction a frame is at
+std::string profiler_frame_label(CallFrame &frame, bool entry, bool executing);
+// 'name (file:line)' for where a function is defined
+std::string profiler_function_label(FunctionObj &function);
+
+inline void profiler_check()
+{
+    if (vm_events.load(std::memory_order_relaxed) & VM_EVENT_TICKS)
+    {
+        profiler_sample();
+    }
+}
@@ -0,0 +1,379 @@
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include "Tracer.hpp"
+#include "OpcodeStats.hpp"
+#include "Profiler.hpp"
+#include "../VirtualMachine/VirtualMachine.hpp"
+
+// Depths of nested VMs start past the deepest frame an outer VM can reach
+#define TRACE_DEPTH_STRIDE (FRAMES_MAX + 2)
+#define TRACE_NO_VALUE 255
+#define TRACE_FUNCTION_CACHE 256
+
+enum TraceEventType : uint8_t
+{
+    TRACE_INSTRUCTION,
+    TRACE_CALL,
+    TRACE_RETURN,
+    TRACE_NATIVE_BEGIN,
+    TRACE_NATIVE_END,
+    TRACE_IMPORT_BEGIN,
+    TRACE_IMPORT_END
+};
+
+struct TraceEvent
+{
+    uint64_t time;
+    uint32_t name;
+    int32_t offset;
+    int32_t depth;
+    TraceEventType type;
+    uint8_t opcode;
+    uint8_t top;
+};
+
+struct CachedFunction
+{
+    FunctionObj *function;
+    uint8_t *code;
+    uint32_t name;
+};
+
+struct TraceBuffer
+{
+    std::vector<TraceEvent> events;
+    std::atomic<uint64_t> head = 0;
+    int generation = -1;
+    int tid;
+    std::string thread_name;
+    CachedFunction functions[TRACE_FUNCTION_CACHE] = {};
+    std::unordered_map<std::string, uint32_t> names;
+};
+
+std::atomic<bool> tracer_enabled = false;
+
+static std::mutex trace_mutex;
+// Buffers outlive their threads so futures that have finished still show up
+static std::vector<std::unique_ptr<TraceBuffer>> trace_buffers;
+static std::vector<std::string> trace_names;
+static std::unordered_map<std::string, uint32_t> trace_name_ids;
+static std::atomic<int> trace_generation = 0;
+static int trace_capacity = TRACE_DEFAULT_CAPACITY;
+static std::string trace_exit_path;
+static const std::thread::id trace_main_thread = std::this_thread::get_id();
+
+static thread_local TraceBuffer *trace_buffer = nullptr;
+
+static const char *value_type_names[] = {"Number", "String", "Boolean", "List", "Type", "Object", "Function", "Native", "Pointer", "None"};
+
+bool tracer_start(int capacity)
+{
+    if (capacity <= 0)
+    {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    trace_capacity = capacity;
+    trace_generation++;
+    tracer_enabled = true;
+    vm_events.fetch_or(VM_EVENT_TRACE);
+    return true;
+}
+
+void tracer_stop()
+{
+    tracer_enabled = false;
+    vm_events.fetch_and(~VM_EVENT_TRACE);
+}
+
+static TraceBuffer &thread_buffer()
+{
+    if (!trace_buffer)
+    {
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        trace_buffers.push_back(std::make_unique<TraceBuffer>());
+        trace_buffer = trace_buffers.back().get();
+        trace_buffer->tid = trace_buffers.size();
+        trace_buffer->thread_name = std::this_thread::get_id() == trace_main_thread ? "main" : "thread " + std::to_string(trace_buffer->tid);
+    }
+    int generation = trace_generation.load(std::memory_order_relaxed);
+    if (trace_buffer->generation != generation)
+    {
+        trace_buffer->events.assign(trace_capacity, {});
+        trace_buffer->head = 0;
+        trace_buffer->generation = generation;
+    }
+    return *trace_buffer;
+}
+
+static uint32_t intern(TraceBuffer &buffer, const std::string &name)
+{
+    auto found = buffer.names.find(name);
+    if (found != buffer.names.end())
+    {
+        return found->second;
+    }
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    auto it = trace_name_ids.find(name);
+    uint32_t id;
+    if (it == trace_name_ids.end())
+    {
+        id = trace_names.size();
+        trace_names.push_back(name);
+        trace_name_ids[name] = id;
+    }
+    else
+    {
+        id = it->second;
+    }
+    buffer.names[name] = id;
+    return id;
+}
+
+static uint32_t function_name(TraceBuffer &buffer, FunctionObj *function)
+{
+    auto &cached = buffer.functions[((uintptr_t)function >> 4) % TRACE_FUNCTION_CACHE];
+    if (cached.function != function || cached.code != function->chunk.code.data())
+    {
+        cached = {function, function->chunk.code.data(), intern(buffer, profiler_function_label(*function))};
+    }
+    return cached.name;
+}
+
+static inline int32_t depth(VM &vm)
+{
+    return heap.nesting * TRACE_DEPTH_STRIDE + vm.frames.size();
+}
+
+static inline void record(TraceBuffer &buffer, TraceEvent event)
+{
+    event.time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    uint64_t head = buffer.head.load(std::memory_order_relaxed);
+    buffer.events[head % buffer.events.size()] = event;
+    buffer.head.store(head + 1, std::memory_order_release);
+}
+
+void tracer_instruction(VM &vm, CallFrame *frame)
+{
+    TraceBuffer &buffer = thread_buffer();
+    TraceEvent event = {};
+    event.type = TRACE_INSTRUCTION;
+    event.name = function_name(buffer, frame->function.get());
+    event.offset = frame->ip - frame->function->chunk.code.data();
+    event.depth = depth(vm);
+    event.opcode = *frame->ip;
+    event.top = vm.stack.size() > 0 ? vm.stack.back().type : TRACE_NO_VALUE;
+    record(buffer, event);
+}
+
+void tracer_call(VM &vm, CallFrame *frame)
+{
+    TraceBuffer &buffer = thread_buffer();
+    TraceEvent event = {};
+    event.type = TRACE_CALL;
+    event.name = function_name(buffer, frame->function.get());
+    event.depth = depth(vm);
+    record(buffer, event);
+}
+
+void tracer_return(VM &vm)
+{
+    TraceBuffer &buffer = thread_buffer();
+    TraceEvent event = {};
+    event.type = TRACE_RETURN;
+    event.depth = depth(vm);
+    record(buffer, event);
+}
+
+void tracer_native_begin(VM &vm, std::string &name)
+{
+    TraceBuffer &buffer = thread_buffer();
+    TraceEvent event = {};
+    event.type = TRACE_NATIVE_BEGIN;
+    event.name = intern(buffer, "[native] " + name);
+    event.depth = depth(vm) + 1;
+    record(buffer, event);
+}
+
+void tracer_native_end(VM &vm)
+{
+    TraceBuffer &buffer = thread_buffer();
+    TraceEvent event = {};
+    event.type = TRACE_NATIVE_END;
+    event.depth = depth(vm) + 1;
+    record(buffer, event);
+}
+
+void tracer_import_begin(VM &vm, std::string &path)
+{
+    TraceBuffer &buffer = thread_buffer();
+    TraceEvent event = {};
+    event.type = TRACE_IMPORT_BEGIN;
+    event.name = intern(buffer, "[import] " + path);
+    event.depth = depth(vm) + 1;
+    record(buffer, event);
+}
+
+void tracer_import_end(VM &vm)
+{
+    TraceBuffer &buffer = thread_buffer();
+    TraceEvent event = {};
+    event.type = TRACE_IMPORT_END;
+    event.depth = depth(vm) + 1;
+    record(buffer, event);
+}
+
+static std::string escape(const std::string &text)
+{
+    std::string out;
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += c;
+        }
+        else if ((unsigned char)c < 0x20)
+        {
+            char buffer[8];
+            snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+            out += buffer;
+        }
+        else
+        {
+            out += c;
+        }
+    }
+    return out;
+}
+
+struct OpenSpan
+{
+    int32_t depth;
+    uint64_t time;
+};
+
+// Chrome trace-event format, load the file in chrome://tracing or Perfetto
+bool tracer_dump(std::string path)
+{
+    std::ofstream file(path);
+    if (!file)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    int generation = trace_generation.load();
+
+    uint64_t base = UINT64_MAX;
+    for (auto &buffer : trace_buffers)
+    {
+        uint64_t head = buffer->head.load(std::memory_order_acquire);
+        if (buffer->generation == generation && head > 0)
+        {
+            uint64_t first = head > buffer->events.size() ? head - buffer->events.size() : 0;
+            base = std::min(base, buffer->events[first % buffer->events.size()].time);
+        }
+    }
+
+    bool first_event = true;
+    auto emit = [&](std::string event)
+    {
+        file << (first_event ? "\n" : ",\n") << event;
+        first_event = false;
+    };
+    char ts[32];
+    auto timestamp = [&](uint64_t time)
+    {
+        snprintf(ts, sizeof(ts), "%.3f", (time - base) / 1000.0);
+        return std::string(ts);
+    };
+
+    file << "{\"traceEvents\": [";
+    for (auto &buffer : trace_buffers)
+    {
+        uint64_t head = buffer->head.load(std::memory_order_acquire);
+        if (buffer->generation != generation || head == 0)
+        {
+            continue;
+        }
+        std::string tid = std::to_string(buffer->tid);
+        std::string thread = "\"pid\": 1, \"tid\": " + tid;
+        emit("{\"name\": \"thread_name\", \"ph\": \"M\", " + thread + ", \"args\": {\"name\": \"" + escape(buffer->thread_name) + "\"}}");
+
+        std::vector<OpenSpan> open;
+        auto close = [&](int32_t depth, uint64_t time)
+        {
+            while (!open.empty() && open.back().depth >= depth)
+            {
+                emit("{\"ph\": \"E\", \"ts\": " + timestamp(time) + ", " + thread + "}");
+                open.pop_back();
+            }
+        };
+
+        size_t capacity = buffer->events.size();
+        uint64_t start = head > capacity ? head - capacity : 0;
+        uint64_t last = 0;
+        for (uint64_t i = start; i < head; i++)
+        {
+            TraceEvent &event = buffer->events[i % capacity];
+            last = event.time;
+            switch (event.type)
+            {
+            case TRACE_INSTRUCTION:
+            {
+                close(event.depth + 1, event.time);
+                std::string top = event.top < sizeof(value_type_names) / sizeof(value_type_names[0]) ? value_type_names[event.top] : "empty";
+                emit("{\"name\": \"" + std::string(opcode_name(event.opcode)) + "\", \"cat\": \"instruction\", \"ph\": \"i\", \"s\": \"t\", \"ts\": " + timestamp(event.time) + ", " + thread +
+                     ", \"args\": {\"function\": \"" + escape(trace_names[event.name]) + "\", \"ip\": " + std::to_string(event.offset) + ", \"top\": \"" + top + "\"}}");
+                break;
+            }
+            case TRACE_CALL:
+            case TRACE_NATIVE_BEGIN:
+            case TRACE_IMPORT_BEGIN:
+            {
+                close(event.depth, event.time);
+                std::string category = event.type == TRACE_CALL ? "call" : event.type == TRACE_NATIVE_BEGIN ? "native"
+                                                                                                            : "import";
+                emit("{\"name\": \"" + escape(trace_names[event.name]) + "\", \"cat\": \"" + category + "\", \"ph\": \"B\", \"ts\": " + timestamp(event.time) + ", " + thread + "}");
+                open.push_back({event.depth, event.time});
+                break;
+            }
+            default:
+            {
+                // Ends whose beginning was overwritten or came before tracing started are dropped
+                close(event.depth + 1, event.time);
+                if (!open.empty() && open.back().depth == event.depth)
+                {
+                    close(event.depth, event.time);
+                }
+                break;
+            }
+            }
+        }
+        close(INT32_MIN, last);
+    }
+    file << "\n],\n\"displayTimeUnit\": \"ns\"}\n";
+    return true;
+}
+
+static void dump_at_exit()
+{
+    tracer_stop();
+    if (tracer_dump(trace_exit_path))
+    {
+        fprintf(stderr, "Trace written to %s\n", trace_exit_path.c_str());
+    }
+    else
+    {
+        fprintf(stderr, "Could not write trace to %s\n", trace_exit_path.c_str());
+    }
+}
+
+void tracer_dump_at_exit(std::string path)
+{
+    trace_exit_path = path;
+    atexit(dump_at_exit);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+
+struct VM;
+struct CallFrame;
+
+// Events are appended to a ring buffer owned by the recording thread, so
+// recording takes no locks and only the newest events of each thread are
+// kept. Calls, returns, natives and imports carry the depth they happen at,
+// frames unwound by an error are closed when the dump next sees a shallower
+// event
+
+#define TRACE_DEFAULT_CAPACITY (1 << 16)
+
+extern std::atomic<bool> tracer_enabled;
+
+bool tracer_start(int capacity = TRACE_DEFAULT_CAPACITY);
+void tracer_stop();
+bool tracer_dump(std::string path);
+void tracer_dump_at_exit(std::string path);
+
+void tracer_instruction(VM &vm, CallFrame *frame);
+void tracer_call(VM &vm, CallFrame *frame);
+void tracer_return(VM &vm);
+void tracer_native_begin(VM &vm, std::string &name);
+void tracer_native_end(VM &vm);
+void tracer_import_begin(VM &vm, std::string &path);
+void tracer_import_end(VM &vm);
+
+inline bool tracing()
+{
+    return tracer_enabled.load(std::memory_order_relaxed);
+}
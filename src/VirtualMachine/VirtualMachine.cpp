@@ -1,162 +1,154 @@
 #include "VirtualMachine.hpp"
 
-int internal_stack_count = 0;
+// Nesting of evaluate() calls on this thread, for hooks, imports and futures
+thread_local int internal_stack_count = 0;
 
 void push(VM &vm, Value &value)
 {
     vm.stack.push_back(value);
-    vm.sp = &vm.stack.back();
 }
 
 Value pop(VM &vm)
 {
     Value value = std::move(vm.stack.back());
     vm.stack.pop_back();
-    vm.sp--;
     return value;
 }
 
-Value pop_close(VM &vm)
+// Closes every closure pointing at base or above it. Only open closures are
+// kept in vm.closed_values, a closed one lives on in the functions using it
+static void close_values(VM &vm, Value *base)
 {
-    Value &v = vm.stack.back();
-    for (auto &closure : vm.closed_values)
+    if (vm.closed_values.empty())
     {
-        if (closure->location == &v)
+        return;
+    }
+    std::erase_if(vm.closed_values, [base](std::shared_ptr<Closure> &closure)
+                  {
+        if (closure->location < base)
         {
-            closure->closed = v;
-            closure->location = &closure->closed;
-            break;
+            return false;
         }
-    }
+        closure->closed = *closure->location;
+        closure->location = &closure->closed;
+        return true; });
+}
+
+Value pop_close(VM &vm)
+{
+    close_values(vm, &vm.stack.back());
     Value value = std::move(vm.stack.back());
     vm.stack.pop_back();
-    vm.sp--;
     return value;
 }
 
-static void runtimeError(VM &vm, std::string message, std::string error_type, ...)
+// Arithmetic fast paths write the result into the left operand's slot and
+// drop the right operand, so number-number ops never build a new Value
+
+static inline void number_result(VM &vm, Value &slot, double result)
 {
-    int last_frame = vm.frames.size() - 1;
-    CallFrame &frame = vm.frames[last_frame];
+    std::get<double>(slot.value) = result;
+    slot.meta = Meta();
+    if (slot.hooks.onChangeHook || slot.hooks.onAccessHook)
+    {
+        slot.hooks = ValueHooks();
+    }
+    vm.stack.pop_back();
+}
 
-    if (frame.function->is_generator && frame.function->generator_init)
+static inline void boolean_result(VM &vm, Value &slot, bool result)
+{
+    slot.type = Boolean;
+    slot.value = result;
+    slot.meta = Meta();
+    if (slot.hooks.onChangeHook || slot.hooks.onAccessHook)
     {
-        frame = *vm.gen_frames[frame.function->name];
+        slot.hooks = ValueHooks();
     }
+    vm.stack.pop_back();
+}
 
-    int num_try_blocks = vm.try_instructions.size();
+static __attribute__((noinline)) void concat_strings(VM &vm)
+{
+    Value v2 = pop(vm);
+    Value v1 = pop(vm);
+    Value value = string_val(v1.get_string() + v2.get_string());
+    push(vm, value);
+}
 
-    if (num_try_blocks > 0)
+// One-character strings are shared from a table instead of allocated per access
+static Value char_string(char c)
+{
+    static const std::vector<std::shared_ptr<std::string>> table = []
     {
-        vm.status = 2;
-
-        size_t instr = frame.ip - frame.function->chunk.code.data() - 1;
+        std::vector<std::shared_ptr<std::string>> chars;
+        for (int i = 0; i < 256; i++)
+        {
+            chars.push_back(pool_make<std::string>(1, (char)i));
+        }
+        return chars;
+    }();
 
-        Value error_obj = object_val();
-        error_obj.get_object()->keys = {"message", "type", "line", "path"};
-        error_obj.get_object()->values["message"] = string_val(message);
-        error_obj.get_object()->values["type"] = string_val(error_type);
-        error_obj.get_object()->values["line"] = number_val(frame.function->chunk.lines[instr]);
-        error_obj.get_object()->values["path"] = string_val(frame.function->name == "" ? frame.name : frame.function->import_path);
+    Value value;
+    value.type = String;
+    value.value = table[(unsigned char)c];
+    return value;
+}
 
-        int current_offset = (int)(size_t)(frame.ip - &frame.function->chunk.code[0]);
-        int instruction_index = std::find(frame.function->instruction_offsets.begin(), frame.function->instruction_offsets.end(), current_offset) - frame.function->instruction_offsets.begin();
-        int instruction = frame.function->instruction_offsets[instruction_index];
-        int _instruction = frame.function->chunk.code[instruction];
+static __attribute__((noinline)) std::string operand_error(VM &vm, std::string op)
+{
+    Value v2 = pop(vm);
+    Value v1 = pop(vm);
+    return "Cannot perform operation '" + op + "' on values: " + v1.value_repr() + " (" + v1.type_repr() + "), " + v2.value_repr() + " (" + v2.type_repr() + ")";
+}
 
-        int try_count = 1;
-        int diff;
+static bool runtimeError(VM &vm, std::string message, std::string error_type, ...)
+{
+    CallFrame &error_frame = vm.frames.back();
+    size_t error_instr = error_frame.ip - error_frame.function->chunk.code.data() - 1;
 
-        instruction_index++;
+    for (int i = vm.frames.size() - 1; i >= 0; i--)
+    {
+        CallFrame &frame = vm.frames[i];
+        auto &chunk = frame.function->chunk;
+        int offset = frame.ip - chunk.code.data() - 1;
 
-        while (true)
+        for (auto &entry : chunk.exception_table)
         {
-            if (instruction_index == 0)
+            if (offset < entry.start || offset >= entry.end)
             {
-                int to_clean = vm.stack.size() - frame.sp;
-                for (int i = 0; i < to_clean; i++)
-                {
-                    vm.stack.pop_back();
-                }
-
-                last_frame -= 1;
-                frame = vm.frames[last_frame];
-
-                if (frame.function->is_generator && frame.function->generator_init)
-                {
-                    frame = *vm.gen_frames[frame.function->name];
-                }
-
-                current_offset = (int)(size_t)(frame.ip - &frame.function->chunk.code[0]);
-                instruction_index = std::find(frame.function->instruction_offsets.begin(), frame.function->instruction_offsets.end(), current_offset) - frame.function->instruction_offsets.begin();
-                instruction = frame.function->instruction_offsets[instruction_index];
-                _instruction = frame.function->chunk.code[instruction];
-                instruction_index++;
-            }
-            instruction_index--;
-            instruction = frame.function->instruction_offsets[instruction_index];
-            diff = instruction - frame.function->instruction_offsets[instruction_index - 1];
-            frame.ip -= diff;
-            _instruction = frame.function->chunk.code[instruction];
-
-            if (_instruction == OP_TRY_END)
-            {
-                try_count++;
-            }
-            if (_instruction == OP_TRY_BEGIN)
-            {
-                try_count--;
-                if (try_count == 0)
-                {
-                    break;
-                }
+                continue;
             }
-        }
-
-        push(vm, error_obj);
 
-        instruction_index--;
-
-        while (true)
-        {
-            instruction_index++;
-            instruction = frame.function->instruction_offsets[instruction_index];
-            _instruction = frame.function->chunk.code[instruction];
-            frame.ip += diff;
-            diff = frame.function->instruction_offsets[instruction_index + 1] - instruction;
+            Value error_obj = object_val();
+            error_obj.get_object()->keys = {"message", "type", "line", "path"};
+            error_obj.get_object()->values["message"] = string_val(message);
+            error_obj.get_object()->values["type"] = string_val(error_type);
+            error_obj.get_object()->values["line"] = number_val(error_frame.function->chunk.lines[error_instr]);
+            error_obj.get_object()->values["path"] = string_val(error_frame.function->import_path);
 
-            if (_instruction == OP_TRY_BEGIN)
+            // Generators unwound mid-body cannot be resumed
+            for (int j = vm.frames.size() - 1; j > i; j--)
             {
-                try_count++;
-            }
-            if (_instruction == OP_CATCH_BEGIN)
-            {
-                try_count--;
-                if (try_count == 0)
+                auto &function = vm.frames[j].function;
+                if (function->is_generator)
                 {
-                    break;
+                    function->generator_done = true;
                 }
             }
-        }
-        vm.try_instructions.pop_back();
+            vm.frames.erase(vm.frames.begin() + i + 1, vm.frames.end());
 
-        if (frame.function->is_generator && frame.function->generator_init)
-        {
-            *vm.gen_frames[frame.function->name] = frame;
-        }
+            close_values(vm, vm.stack.data() + frame.frame_start + entry.depth);
+            vm.stack.erase(vm.stack.begin() + frame.frame_start + entry.depth, vm.stack.end());
 
-        while (vm.frames.size() > last_frame + 1)
-        {
-            vm.frames.pop_back();
+            push(vm, error_obj);
+            frame.ip = chunk.code.data() + entry.handler;
+            return true;
         }
-
-        return;
-    }
-    else
-    {
-        vm.status = 1;
     }
 
+    vm.status = 1;
+
     va_list args;
     va_start(args, error_type);
     vfprintf(stderr, (error_type + ": " + message).c_str(), args);
@@ -187,7 +179,7 @@ static void runtimeError(VM &vm, std::string message, std::string error_type, ..
 
         if (function->name == "")
         {
-            std::string name = frame->name;
+            std::string name = function->import_path;
             if (name == "")
             {
                 name = "script";
@@ -207,6 +199,96 @@ static void runtimeError(VM &vm, std::string message, std::string error_type, ..
             }
         }
     }
+
+    return false;
+}
+
+struct Builtin
+{
+    const char *name;
+    NativeFunction function;
+};
+
+static const Builtin builtins[] = {
+    {"eval", eval_builtin},
+    {"print", print_builtin},
+    {"println", println_builtin},
+    {"clock", clock_builtin},
+    {"string", to_string_builtin},
+    {"number", to_number_builtin},
+    {"insert", insert_builtin},
+    {"append", append_builtin},
+    {"remove", remove_builtin},
+    {"remove_prop", remove_prop_builtin},
+    {"dis", dis_builtin},
+    {"length", length_builtin},
+    {"info", info_builtin},
+    {"id", id_builtin},
+    {"type", type_builtin},
+    {"copy", copy_builtin},
+    {"pure", pure_builtin},
+    {"sort", sort_builtin},
+    {"__future__", future_builtin},
+    {"__get_future__", get_future_builtin},
+    {"__check_future__", check_future_builtin},
+    {"exit", exit_builtin},
+    {"error", error_builtin},
+    {"Error", error_type_builtin},
+    {"load_lib", load_lib_builtin},
+    {"__gc_collect__", gc_collect_builtin},
+    {"__gc_stats__", gc_stats_builtin},
+    {"__gc_config__", gc_config_builtin},
+    {"__opcode_stats__", opcode_stats_builtin},
+    {"__heap_snapshot__", heap_snapshot_builtin},
+    {"__heap_diff__", heap_diff_builtin},
+    {"__alloc_sampling__", alloc_sampling_builtin},
+    {"__alloc_sites__", alloc_sites_builtin},
+    {"__trace_start__", trace_start_builtin},
+    {"__trace_stop__", trace_stop_builtin},
+    {"__trace_dump__", trace_dump_builtin},
+};
+
+// Globals a VM does not define itself are looked up here, so VMs started
+// for hooks and callbacks do not have to register every builtin
+static const std::unordered_map<std::string, Value> &builtin_globals()
+{
+    static const std::unordered_map<std::string, Value> globals = []
+    {
+        std::unordered_map<std::string, Value> globals;
+        for (auto &builtin : builtins)
+        {
+            Value native = native_val();
+            native.get_native()->function = builtin.function;
+            native.get_native()->name = builtin.name;
+            globals[builtin.name] = native;
+        }
+        return globals;
+    }();
+    return globals;
+}
+
+NativeFunction builtin_function(std::string name)
+{
+    for (auto &builtin : builtins)
+    {
+        if (builtin.name == name)
+        {
+            return builtin.function;
+        }
+    }
+    return nullptr;
+}
+
+const char *builtin_name(NativeFunction function)
+{
+    for (auto &builtin : builtins)
+    {
+        if (builtin.function == function)
+        {
+            return builtin.name;
+        }
+    }
+    return nullptr;
 }
 
 static void define_native(VM &vm, std::string name, NativeFunction function)
@@ -222,12 +304,18 @@ static void define_global(VM &vm, std::string name, Value value)
     vm.globals[name] = value;
 }
 
-static EvaluateResult run(VM &vm)
+// Kept out of line so the dispatch loop only pays for the test of vm_events
+static __attribute__((noinline, cold)) void instruction_events(VM &vm, CallFrame *frame)
 {
-#define READ_BYTE() (*frame->ip++)
-#define READ_INT() (bytes_to_int(READ_BYTE(), READ_BYTE(), READ_BYTE(), READ_BYTE()))
-#define READ_CONSTANT() (frame->function->chunk.constants[READ_INT()])
+    profiler_check();
+    if (tracing())
+    {
+        tracer_instruction(vm, frame);
+    }
+}
 
+static EvaluateResult run(VM &vm)
+{
     // Define globals
     define_global(vm, "String", type_val("String"));
     define_global(vm, "Number", type_val("Number"));
@@ -241,39 +329,53 @@ static EvaluateResult run(VM &vm)
     vm_ptr.get_pointer()->value = &vm;
     define_global(vm, "__vm__", vm_ptr);
 
-    // Define native functions
-    define_native(vm, "eval", eval_builtin);
-    define_native(vm, "print", print_builtin);
-    define_native(vm, "println", println_builtin);
-    define_native(vm, "clock", clock_builtin);
-    define_native(vm, "string", to_string_builtin);
-    define_native(vm, "number", to_number_builtin);
-    define_native(vm, "insert", insert_builtin);
-    define_native(vm, "append", append_builtin);
-    define_native(vm, "remove", remove_builtin);
-    define_native(vm, "remove_prop", remove_prop_builtin);
-    define_native(vm, "dis", dis_builtin);
-    define_native(vm, "length", length_builtin);
-    define_native(vm, "info", info_builtin);
-    define_native(vm, "id", id_builtin);
-    define_native(vm, "type", type_builtin);
-    define_native(vm, "copy", copy_builtin);
-    define_native(vm, "pure", pure_builtin);
-    define_native(vm, "sort", sort_builtin);
-    define_native(vm, "__future__", future_builtin);
-    define_native(vm, "__get_future__", get_future_builtin);
-    define_native(vm, "__check_future__", check_future_builtin);
-    define_native(vm, "exit", exit_builtin);
-    define_native(vm, "error", error_builtin);
-    define_native(vm, "Error", error_type_builtin);
-    define_native(vm, "load_lib", load_lib_builtin);
-
     CallFrame *frame = &vm.frames.back();
     frame->ip = frame->function->chunk.code.data();
     frame->frame_start = vm.stack.size();
 
     for (;;)
     {
+        try
+        {
+            return execute(vm);
+        }
+        catch (StackOverflow &)
+        {
+            if (!runtimeError(vm, "Stack size limit exceeded", "RecursionError"))
+            {
+                return EVALUATE_RUNTIME_ERROR;
+            }
+        }
+    }
+}
+
+static EvaluateResult execute(VM &vm)
+{
+#define READ_BYTE() (*frame->ip++)
+#define READ_INT() (bytes_to_int(READ_BYTE(), READ_BYTE(), READ_BYTE(), READ_BYTE()))
+#define READ_CONSTANT() (frame->function->chunk.constants[READ_INT()])
+#define RUNTIME_ERROR(...)                    \
+    do                                        \
+    {                                         \
+        if (!runtimeError(vm, __VA_ARGS__))   \
+        {                                     \
+            return EVALUATE_RUNTIME_ERROR;    \
+        }                                     \
+        frame = &vm.frames.back();            \
+        goto next_instruction;                \
+    } while (0)
+
+    CallFrame *frame = &vm.frames.back();
+
+    for (;;)
+    {
+        if (vm_events.load(std::memory_order_relaxed))
+        {
+            instruction_events(vm, frame);
+        }
+#ifdef OPCODE_STATS
+        opcode_stats_record(frame->function.get(), frame->ip - frame->function->chunk.code.data(), *frame->ip);
+#endif
 #ifdef DEBUG_TRACE_EXECUTION
         printf("          ");
         printf("[ ");
@@ -291,11 +393,13 @@ static EvaluateResult run(VM &vm)
         {
         case OP_EXIT:
         {
-            for (auto &closure : vm.closed_values)
+            close_values(vm, vm.stack.data());
+#ifdef OPCODE_STATS
+            if (heap.nesting == 1)
             {
-                closure->closed = *closure->location;
-                closure->location = &closure->closed;
+                opcode_stats_report();
             }
+#endif
             return EVALUATE_OK;
         }
         case OP_RETURN:
@@ -308,14 +412,7 @@ static EvaluateResult run(VM &vm)
 
             if (return_value.is_object() && return_value.get_object()->type_name == "Error")
             {
-                runtimeError(vm, return_value.get_object()->values["message"].get_string());
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
+                RUNTIME_ERROR(return_value.get_object()->values["message"].get_string());
             }
 
             return_value.meta.temp_non_const = false;
@@ -323,23 +420,17 @@ static EvaluateResult run(VM &vm)
             {
                 return_value.get_object()->type_name = frame->function->name;
             }
-            int to_clean = vm.stack.size() - frame->sp;
             int instruction_index = frame->instruction_index;
-            for (int i = 0; i < to_clean; i++)
+            if (vm.stack.size() > frame->sp)
             {
-                Value &value = vm.stack.back();
-                for (auto &closure : vm.closed_values)
-                {
-                    if (closure->location == &value)
-                    {
-                        closure->closed = value;
-                        closure->location = &closure->closed;
-                        break;
-                    }
-                }
-                vm.stack.pop_back();
+                close_values(vm, vm.stack.data() + frame->sp);
+                vm.stack.erase(vm.stack.begin() + frame->sp, vm.stack.end());
             }
 
+            if (tracing())
+            {
+                tracer_return(vm);
+            }
             vm.frames.pop_back();
             frame = &vm.frames.back();
             frame->ip = &frame->function->chunk.code[instruction_index];
@@ -348,47 +439,24 @@ static EvaluateResult run(VM &vm)
         }
         case OP_YIELD:
         {
-            frame->gen_stack.clear();
             Value return_value = pop(vm);
-            int to_clean = vm.stack.size() - frame->sp;
             int instruction_index = frame->instruction_index;
-            for (int i = 0; i < to_clean; i++)
+            auto &function = frame->function;
+            close_values(vm, vm.stack.data() + frame->sp);
+            auto frame_begin = vm.stack.begin() + frame->sp;
+            function->generator_stack.assign(std::make_move_iterator(frame_begin), std::make_move_iterator(vm.stack.end()));
+            vm.stack.erase(frame_begin, vm.stack.end());
+            function->generator_ip = frame->ip - function->chunk.code.data();
+            if (tracing())
             {
-                Value &value = vm.stack.back();
-                for (auto &closure : vm.closed_values)
-                {
-                    if (closure->location == &value)
-                    {
-                        closure->closed = value;
-                        closure->location = &closure->closed;
-                        break;
-                    }
-                }
-                frame->gen_stack.insert(frame->gen_stack.begin(), value);
-                vm.stack.pop_back();
+                tracer_return(vm);
             }
-            *vm.gen_frames[frame->function->name] = *frame;
             vm.frames.pop_back();
             frame = &vm.frames.back();
             frame->ip = &frame->function->chunk.code[instruction_index];
             push(vm, return_value);
             break;
         }
-        case OP_TRY_BEGIN:
-        {
-            int index = READ_INT();
-            vm.try_instructions.push_back(index);
-            break;
-        }
-        case OP_TRY_END:
-        {
-            vm.try_instructions.pop_back();
-            break;
-        }
-        case OP_CATCH_BEGIN:
-        {
-            break;
-        }
         case OP_LOAD_THIS:
         {
             if (!frame->function->object)
@@ -426,13 +494,13 @@ static EvaluateResult run(VM &vm)
                 obj.get_object()->values["name"] = string_val(value.hooks.onAccessHookName);
 
                 VM func_vm;
-                std::shared_ptr<FunctionObj> main = std::make_shared<FunctionObj>();
+                std::shared_ptr<FunctionObj> main = pool_make<FunctionObj>();
                 main->name = "";
                 main->arity = 0;
                 main->chunk = Chunk();
                 main->chunk.import_path = frame->function->chunk.import_path;
                 CallFrame main_frame;
-                main_frame.name = frame->name;
+                main->import_path = frame->function->import_path;
                 main_frame.function = main;
                 main_frame.sp = 0;
                 main_frame.ip = main->chunk.code.data();
@@ -473,14 +541,7 @@ static EvaluateResult run(VM &vm)
             {
                 if (!value.meta.temp_non_const)
                 {
-                    runtimeError(vm, "Cannot modify const");
-                    if (vm.status == 2)
-                    {
-                        vm.status = 0;
-                        break;
-                    }
-
-                    return EVALUATE_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Cannot modify const");
                 }
             }
             if (value.hooks.onChangeHook)
@@ -499,13 +560,13 @@ static EvaluateResult run(VM &vm)
                 vm.stack[index + frame->frame_start] = new_value;
 
                 VM func_vm;
-                std::shared_ptr<FunctionObj> main = std::make_shared<FunctionObj>();
+                std::shared_ptr<FunctionObj> main = pool_make<FunctionObj>();
                 main->name = "";
                 main->arity = 0;
                 main->chunk = Chunk();
                 main->chunk.import_path = frame->function->chunk.import_path;
                 CallFrame main_frame;
-                main_frame.name = frame->name;
+                main->import_path = frame->function->import_path;
                 main_frame.function = main;
                 main_frame.sp = 0;
                 main_frame.ip = main->chunk.code.data();
@@ -561,28 +622,14 @@ static EvaluateResult run(VM &vm)
             {
                 if (!container.meta.temp_non_const)
                 {
-                    runtimeError(vm, "Cannot modify const");
-                    if (vm.status == 2)
-                    {
-                        vm.status = 0;
-                        break;
-                    }
-
-                    return EVALUATE_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Cannot modify const");
                 }
             }
             if (container.is_object())
             {
                 if (!accessor.is_string())
                 {
-                    runtimeError(vm, "Object accessor must be a string - accessor used: " + accessor.value_repr() + " (" + accessor.type_repr() + ")");
-                    if (vm.status == 2)
-                    {
-                        vm.status = 0;
-                        break;
-                    }
-
-                    return EVALUATE_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Object accessor must be a string - accessor used: " + accessor.value_repr() + " (" + accessor.type_repr() + ")");
                 }
                 Value current = container.get_object()->values[accessor.get_string()];
 
@@ -608,13 +655,13 @@ static EvaluateResult run(VM &vm)
                     obj.get_object()->values["current"].hooks.onChangeHook = nullptr;
 
                     VM func_vm;
-                    std::shared_ptr<FunctionObj> main = std::make_shared<FunctionObj>();
+                    std::shared_ptr<FunctionObj> main = pool_make<FunctionObj>();
                     main->name = "";
                     main->arity = 0;
                     main->chunk = Chunk();
                     main->chunk.import_path = frame->function->chunk.import_path;
                     CallFrame main_frame;
-                    main_frame.name = frame->name;
+                    main->import_path = frame->function->import_path;
                     main_frame.function = main;
                     main_frame.sp = 0;
                     main_frame.ip = main->chunk.code.data();
@@ -650,7 +697,7 @@ static EvaluateResult run(VM &vm)
                     container.get_object()->values[accessor.get_string()] = obj.get_object()->values["current"];
                     break;
                 }
-                std::string &accessor_string = accessor.get_string();
+                const std::string &accessor_string = accessor.get_string();
                 auto &keys = container.get_object()->keys;
                 if (!current.is_none())
                 {
@@ -666,14 +713,7 @@ static EvaluateResult run(VM &vm)
             {
                 if (!accessor.is_number())
                 {
-                    runtimeError(vm, "List accessor must be a number - accessor used: " + accessor.value_repr() + " (" + accessor.type_repr() + ")");
-                    if (vm.status == 2)
-                    {
-                        vm.status = 0;
-                        break;
-                    }
-
-                    return EVALUATE_RUNTIME_ERROR;
+                    RUNTIME_ERROR("List accessor must be a number - accessor used: " + accessor.value_repr() + " (" + accessor.type_repr() + ")");
                 }
                 auto &list = *container.get_list();
                 int acc = accessor.get_number();
@@ -694,27 +734,13 @@ static EvaluateResult run(VM &vm)
             {
                 if (!accessor.is_number())
                 {
-                    runtimeError(vm, "String accessor must be a number - accessor used: " + accessor.value_repr() + " (" + accessor.type_repr() + ")");
-                    if (vm.status == 2)
-                    {
-                        vm.status = 0;
-                        break;
-                    }
-
-                    return EVALUATE_RUNTIME_ERROR;
+                    RUNTIME_ERROR("String accessor must be a number - accessor used: " + accessor.value_repr() + " (" + accessor.type_repr() + ")");
                 }
                 if (!value.is_string())
                 {
-                    runtimeError(vm, "String values must be of type string - value used: " + value.value_repr() + " (" + value.type_repr() + ")");
-                    if (vm.status == 2)
-                    {
-                        vm.status = 0;
-                        break;
-                    }
-
-                    return EVALUATE_RUNTIME_ERROR;
+                    RUNTIME_ERROR("String values must be of type string - value used: " + value.value_repr() + " (" + value.type_repr() + ")");
                 }
-                auto &string = container.get_string();
+                auto &string = container.get_mutable_string();
                 int acc = accessor.get_number();
                 // TODO: Fix this
                 if (acc < 0)
@@ -732,14 +758,7 @@ static EvaluateResult run(VM &vm)
             }
             else
             {
-                runtimeError(vm, "Object is not accessible: " + container.value_repr() + " (" + container.type_repr() + ")");
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
+                RUNTIME_ERROR("Object is not accessible: " + container.value_repr() + " (" + container.type_repr() + ")");
             }
             // push(vm, value);
             push(vm, container);
@@ -749,31 +768,28 @@ static EvaluateResult run(VM &vm)
         {
             int flag = READ_INT();
             Value name = pop(vm);
-            std::string &name_str = name.get_string();
-            if (!vm.globals.count(name_str))
+            const std::string &name_str = name.get_string();
+            auto global = vm.globals.find(name_str);
+            if (global == vm.globals.end())
             {
-                if (flag == 0)
+                auto builtin = builtin_globals().find(name_str);
+                if (builtin != builtin_globals().end())
                 {
-                    runtimeError(vm, "Global '" + name_str + "' is undefined");
-                    // pop(vm);
-                    if (vm.status == 2)
-                    {
-                        vm.status = 0;
-                        break;
-                    }
-
-                    return EVALUATE_RUNTIME_ERROR;
+                    Value native = builtin->second;
+                    push(vm, native);
+                    break;
                 }
-                else if (flag == 1)
+                if (flag == 0)
                 {
-                    Value none = none_val();
-                    push(vm, none);
-                    break;
+                    RUNTIME_ERROR("Global '" + name_str + "' is undefined");
                 }
+                Value none = none_val();
+                push(vm, none);
+                break;
             }
-            push(vm, vm.globals[name_str]);
+            push(vm, global->second);
 
-            auto value = vm.globals[name_str];
+            auto value = global->second;
 
             if (value.hooks.onAccessHook)
             {
@@ -786,13 +802,13 @@ static EvaluateResult run(VM &vm)
                 obj.get_object()->values["name"] = string_val(value.hooks.onAccessHookName);
 
                 VM func_vm;
-                std::shared_ptr<FunctionObj> main = std::make_shared<FunctionObj>();
+                std::shared_ptr<FunctionObj> main = pool_make<FunctionObj>();
                 main->name = "";
                 main->arity = 0;
                 main->chunk = Chunk();
                 main->chunk.import_path = frame->function->chunk.import_path;
                 CallFrame main_frame;
-                main_frame.name = frame->name;
+                main->import_path = frame->function->import_path;
                 main_frame.function = main;
                 main_frame.sp = 0;
                 main_frame.ip = main->chunk.code.data();
@@ -840,14 +856,7 @@ static EvaluateResult run(VM &vm)
                 {
                     if (!tos.is_object())
                     {
-                        runtimeError(vm, "Cannot unpack non-object value - value: " + tos.value_repr() + " (" + tos.type_repr() + ")");
-                        if (vm.status == 2)
-                        {
-                            vm.status = 0;
-                            break;
-                        }
-
-                        return EVALUATE_RUNTIME_ERROR;
+                        RUNTIME_ERROR("Cannot unpack non-object value - value: " + tos.value_repr() + " (" + tos.type_repr() + ")");
                     }
                     tos = pop(vm);
                     size--;
@@ -872,14 +881,7 @@ static EvaluateResult run(VM &vm)
                 Value prop_name = pop(vm);
                 if (!prop_name.is_string())
                 {
-                    runtimeError(vm, "Object keys must evaluate to strings - key used: " + prop_name.value_repr() + " (" + prop_name.type_repr() + ")");
-                    if (vm.status == 2)
-                    {
-                        vm.status = 0;
-                        break;
-                    }
-
-                    return EVALUATE_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Object keys must evaluate to strings - key used: " + prop_name.value_repr() + " (" + prop_name.type_repr() + ")");
                 }
                 // object_obj->keys.insert(object_obj->keys.begin(), prop_name.get_string());
                 if (_keys.insert(prop_name.get_string()).second)
@@ -898,7 +900,7 @@ static EvaluateResult run(VM &vm)
             Value function = pop(vm);
             // std::string base_name = frame->name.substr(frame->name.find_last_of("/\\") + 1);
             // function.get_function()->import_path = std::filesystem::current_path().string() + "/" + base_name;
-            function.get_function()->import_path = frame->name;
+            function.get_function()->import_path = frame->function->import_path;
             // function.get_function()->import_path = std::filesystem::absolute(frame->name);
             for (int i = 0; i < count; i++)
             {
@@ -974,83 +976,39 @@ static EvaluateResult run(VM &vm)
             closure_obj->instruction_offsets = function->instruction_offsets;
             closure_obj->closed_vars = std::vector<std::shared_ptr<Closure>>();
 
-            // auto compare_closures = [](const std::shared_ptr<Closure> &cl1, const std::shared_ptr<Closure> &cl2)
-            // {
-            //     return cl1->initial_location == cl2->initial_location;
-            // };
-
-            // auto pred = [](const std::shared_ptr<Closure> &cl1, const std::shared_ptr<Closure> &cl2)
-            // {
-            //     return cl1->initial_location < cl2->initial_location;
-            // };
-
-            // std::sort(vm.closed_values.begin(), vm.closed_values.end(), pred);
-
-            // auto new_vec = std::unique(vm.closed_values.begin(), vm.closed_values.end(), compare_closures);
-
-            // std::cout << vm.closed_values.size() << std::endl;
-
-            // vm.closed_values.erase(new_vec, vm.closed_values.end());
-
             for (auto &var : closure_obj->closed_var_indexes)
             {
-                int index = var.index;
-                bool is_local = var.is_local;
-                Value *value_pointer;
-                if (is_local)
-                {
-                    value_pointer = &vm.stack[index + frame->frame_start];
-                }
-                else
-                {
-                    value_pointer = frame->function->closed_vars[index]->location;
-                }
-                auto hoisted = std::make_shared<Closure>();
-                hoisted->location = value_pointer;
-                hoisted->frame_name = frame->name;
-                hoisted->name = var.name;
-                hoisted->index = var.index;
-                hoisted->is_local = var.is_local;
-                hoisted->initial_location = value_pointer;
-
-                if (vm.closed_values.size() == 0)
+                // Captures of captures share the enclosing function's closure
+                if (!var.is_local)
                 {
-                    closure_obj->closed_vars.push_back(hoisted);
-                    vm.closed_values.push_back(hoisted);
+                    closure_obj->closed_vars.push_back(frame->function->closed_vars[var.index]);
+                    continue;
                 }
-                else
-                {
-                    bool found = false;
 
-                    for (auto &cl : vm.closed_values)
+                Value *value_pointer = &vm.stack[var.index + frame->frame_start];
+                std::shared_ptr<Closure> hoisted;
+                for (auto &cl : vm.closed_values)
+                {
+                    if (cl->location == value_pointer)
                     {
-                        if (cl->location == value_pointer)
-                        {
-                            closure_obj->closed_vars.push_back(cl);
-                            found = true;
-                            break;
-                        }
+                        hoisted = cl;
+                        break;
                     }
+                }
 
-                    if (!found)
-                    {
-                        bool f = false;
-                        for (auto &cl : vm.closed_values)
-                        {
-                            if (cl->initial_location == value_pointer)
-                            {
-                                cl = hoisted;
-                                f = true;
-                            }
-                        }
-                        if (!f)
-                        {
-                            vm.closed_values.push_back(hoisted);
-                        }
-                        closure_obj->closed_vars.push_back(hoisted);
-                        // vm.closed_values.push_back(hoisted);
-                    }
+                if (!hoisted)
+                {
+                    hoisted = pool_make<Closure>();
+                    hoisted->location = value_pointer;
+                    hoisted->frame_name = frame->function->import_path;
+                    hoisted->name = var.name;
+                    hoisted->index = var.index;
+                    hoisted->is_local = var.is_local;
+                    hoisted->initial_location = value_pointer;
+                    heap_track(hoisted, CELL_CLOSURE);
+                    vm.closed_values.push_back(hoisted);
                 }
+                closure_obj->closed_vars.push_back(hoisted);
             }
 
             function->closed_vars = closure_obj->closed_vars;
@@ -1074,13 +1032,13 @@ static EvaluateResult run(VM &vm)
                 obj.get_object()->values["name"] = string_val(value.hooks.onAccessHookName);
 
                 VM func_vm;
-                std::shared_ptr<FunctionObj> main = std::make_shared<FunctionObj>();
+                std::shared_ptr<FunctionObj> main = pool_make<FunctionObj>();
                 main->name = "";
                 main->arity = 0;
                 main->chunk = Chunk();
                 main->chunk.import_path = frame->function->chunk.import_path;
                 CallFrame main_frame;
-                main_frame.name = frame->name;
+                main->import_path = frame->function->import_path;
                 main_frame.function = main;
                 main_frame.sp = 0;
                 main_frame.ip = main->chunk.code.data();
@@ -1121,14 +1079,7 @@ static EvaluateResult run(VM &vm)
             {
                 if (!value.meta.temp_non_const)
                 {
-                    runtimeError(vm, "Cannot modify const");
-                    if (vm.status == 2)
-                    {
-                        vm.status = 0;
-                        break;
-                    }
-
-                    return EVALUATE_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Cannot modify const");
                 }
             }
             if (value.hooks.onChangeHook)
@@ -1150,13 +1101,13 @@ static EvaluateResult run(VM &vm)
                 *frame->function->closed_vars[index]->location = new_value;
 
                 VM func_vm;
-                std::shared_ptr<FunctionObj> main = std::make_shared<FunctionObj>();
+                std::shared_ptr<FunctionObj> main = pool_make<FunctionObj>();
                 main->name = "";
                 main->arity = 0;
                 main->chunk = Chunk();
                 main->chunk.import_path = frame->function->chunk.import_path;
                 CallFrame main_frame;
-                main_frame.name = frame->name;
+                main->import_path = frame->function->import_path;
                 main_frame.function = main;
                 main_frame.sp = 0;
                 main_frame.ip = main->chunk.code.data();
@@ -1242,8 +1193,13 @@ static EvaluateResult run(VM &vm)
         }
         case OP_JUMP_BACK:
         {
+            heap_safe_point();
             int offset = READ_INT();
             frame->ip -= offset;
+            if (jit_enabled && !tracing())
+            {
+                jit_loop(vm, frame, frame->ip + offset - 5);
+            }
             break;
         }
         case OP_POP:
@@ -1258,7 +1214,8 @@ static EvaluateResult run(VM &vm)
         }
         case OP_LOOP:
         {
-            int stack_size = vm.stack.size();
+            // Relative to the frame, a resumed generator has a new base
+            int stack_size = vm.stack.size() - frame->frame_start;
             uint8_t *bytes = int_to_bytes(stack_size);
             for (int i = 0; i < 4; i++)
             {
@@ -1303,7 +1260,7 @@ static EvaluateResult run(VM &vm)
                 }
             }
             READ_BYTE();
-            int stack_size_start = READ_INT();
+            int stack_size_start = frame->frame_start + READ_INT();
             int to_pop = vm.stack.size() - stack_size_start;
 
             for (int i = 0; i < to_pop; i++)
@@ -1379,7 +1336,7 @@ static EvaluateResult run(VM &vm)
             }
 
             READ_BYTE();
-            int stack_size_start = READ_INT();
+            int stack_size_start = frame->frame_start + READ_INT();
             int to_pop = vm.stack.size() - stack_size_start;
 
             for (int i = 0; i < to_pop; i++)
@@ -1436,14 +1393,7 @@ static EvaluateResult run(VM &vm)
                 {
                     if (!v.is_list())
                     {
-                        runtimeError(vm, "Operand must be a list - value: " + v.value_repr() + " (" + v.type_repr() + ")");
-                        if (vm.status == 2)
-                        {
-                            vm.status = 0;
-                            break;
-                        }
-
-                        return EVALUATE_RUNTIME_ERROR;
+                        RUNTIME_ERROR("Operand must be a list - value: " + v.value_repr() + " (" + v.type_repr() + ")");
                     }
 
                     for (int i = (*v.get_list()).size() - 1; i >= 0; i--)
@@ -1475,14 +1425,7 @@ static EvaluateResult run(VM &vm)
                     push(vm, _container);
                     break;
                 }
-                runtimeError(vm, "Object is not accessible: " + _container.value_repr() + " (" + _container.type_repr() + ")");
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
+                RUNTIME_ERROR("Object is not accessible: " + _container.value_repr() + " (" + _container.type_repr() + ")");
             }
 
             if (_container.is_list())
@@ -1495,14 +1438,7 @@ static EvaluateResult run(VM &vm)
                 }
                 if (!_index.is_number())
                 {
-                    runtimeError(vm, "Accessor must be a number - accessor used: " + _index.value_repr() + " (" + _index.type_repr() + ")");
-                    if (vm.status == 2)
-                    {
-                        vm.status = 0;
-                        break;
-                    }
-
-                    return EVALUATE_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Accessor must be a number - accessor used: " + _index.value_repr() + " (" + _index.type_repr() + ")");
                 }
                 int index = _index.get_number();
                 auto &list = _container.get_list();
@@ -1520,16 +1456,9 @@ static EvaluateResult run(VM &vm)
             {
                 if (!_index.is_string())
                 {
-                    runtimeError(vm, "Accessor must be a string - accessor used: " + _index.value_repr() + " (" + _index.type_repr() + ")");
-                    if (vm.status == 2)
-                    {
-                        vm.status = 0;
-                        break;
-                    }
-
-                    return EVALUATE_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Accessor must be a string - accessor used: " + _index.value_repr() + " (" + _index.type_repr() + ")");
                 }
-                std::string &index = _index.get_string();
+                const std::string &index = _index.get_string();
                 auto &object = _container.get_object();
                 if (!object->values.count(index))
                 {
@@ -1552,13 +1481,13 @@ static EvaluateResult run(VM &vm)
                         obj.get_object()->values["name"] = string_val(value.hooks.onAccessHookName);
 
                         VM func_vm;
-                        std::shared_ptr<FunctionObj> main = std::make_shared<FunctionObj>();
+                        std::shared_ptr<FunctionObj> main = pool_make<FunctionObj>();
                         main->name = "";
                         main->arity = 0;
                         main->chunk = Chunk();
                         main->chunk.import_path = frame->function->chunk.import_path;
                         CallFrame main_frame;
-                        main_frame.name = frame->name;
+                        main->import_path = frame->function->import_path;
                         main_frame.function = main;
                         main_frame.sp = 0;
                         main_frame.ip = main->chunk.code.data();
@@ -1601,14 +1530,7 @@ static EvaluateResult run(VM &vm)
                 }
                 if (!_index.is_number())
                 {
-                    runtimeError(vm, "Accessor must be a number - accessor used: " + _index.value_repr() + " (" + _index.type_repr() + ")");
-                    if (vm.status == 2)
-                    {
-                        vm.status = 0;
-                        break;
-                    }
-
-                    return EVALUATE_RUNTIME_ERROR;
+                    RUNTIME_ERROR("Accessor must be a number - accessor used: " + _index.value_repr() + " (" + _index.type_repr() + ")");
                 }
                 int index = _index.get_number();
                 auto &string = _container.get_string();
@@ -1619,7 +1541,7 @@ static EvaluateResult run(VM &vm)
                 }
                 else
                 {
-                    Value str = string_val(std::string(1, string[index]));
+                    Value str = char_string(string[index]);
                     push(vm, str);
                 }
             }
@@ -1635,14 +1557,7 @@ static EvaluateResult run(VM &vm)
             Value list = pop(vm);
             if (!list.is_list())
             {
-                runtimeError(vm, "Operand must be a list - value: " + list.value_repr() + " (" + list.type_repr() + ")");
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
+                RUNTIME_ERROR("Operand must be a list - value: " + list.value_repr() + " (" + list.type_repr() + ")");
             }
             Value value = number_val(list.get_list()->size());
             push(vm, value);
@@ -1653,14 +1568,7 @@ static EvaluateResult run(VM &vm)
             Value &value = vm.stack.back();
             if (!value.is_list() && !value.is_object())
             {
-                runtimeError(vm, "Operand must be a list or object - value: " + value.value_repr() + " (" + value.type_repr() + ")");
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
+                RUNTIME_ERROR("Operand must be a list or object - value: " + value.value_repr() + " (" + value.type_repr() + ")");
             }
             value.meta.unpack = true;
             break;
@@ -1684,6 +1592,7 @@ static EvaluateResult run(VM &vm)
         }
         case OP_CALL:
         {
+            heap_safe_point();
             int param_num = READ_INT();
             Value function = pop(vm);
 
@@ -1707,19 +1616,21 @@ static EvaluateResult run(VM &vm)
                         args.push_back(arg);
                     }
                 }
+                profiler_native_begin(native_function->name);
+                if (tracing())
+                {
+                    tracer_native_begin(vm, native_function->name);
+                }
                 Value result = native_function->function(args);
+                if (tracing())
+                {
+                    tracer_native_end(vm);
+                }
+                profiler_native_end();
 
                 if (result.is_object() && result.get_object()->type_name == "Error")
                 {
-                    runtimeError(vm, result.get_object()->values["message"].get_string(), result.get_object()->values["type"].get_string());
-
-                    if (vm.status == 2)
-                    {
-                        vm.status = 0;
-                        break;
-                    }
-
-                    return EVALUATE_RUNTIME_ERROR;
+                    RUNTIME_ERROR(result.get_object()->values["message"].get_string(), result.get_object()->values["type"].get_string());
                 }
 
                 push(vm, result);
@@ -1732,27 +1643,13 @@ static EvaluateResult run(VM &vm)
                 {
                     pop(vm);
                 }
-                runtimeError(vm, "Object is not callable: " + function.value_repr() + " (" + function.type_repr() + ")");
-
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
+                RUNTIME_ERROR("Object is not callable: " + function.value_repr() + " (" + function.type_repr() + ")");
             }
 
             int status = call_function(vm, function, param_num, frame);
 
             if (status != 0)
             {
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
                 return EVALUATE_RUNTIME_ERROR;
             }
             break;
@@ -1802,19 +1699,21 @@ static EvaluateResult run(VM &vm)
                         args.push_back(arg);
                     }
                 }
+                profiler_native_begin(native_function->name);
+                if (tracing())
+                {
+                    tracer_native_begin(vm, native_function->name);
+                }
                 Value result = native_function->function(args);
+                if (tracing())
+                {
+                    tracer_native_end(vm);
+                }
+                profiler_native_end();
 
                 if (result.is_object() && result.get_object()->type_name == "Error")
                 {
-                    runtimeError(vm, result.get_object()->values["message"].get_string(), result.get_object()->values["type"].get_string());
-
-                    if (vm.status == 2)
-                    {
-                        vm.status = 0;
-                        break;
-                    }
-
-                    return EVALUATE_RUNTIME_ERROR;
+                    RUNTIME_ERROR(result.get_object()->values["message"].get_string(), result.get_object()->values["type"].get_string());
                 }
                 push(vm, result);
                 break;
@@ -1826,27 +1725,13 @@ static EvaluateResult run(VM &vm)
                 {
                     pop(vm);
                 }
-                runtimeError(vm, "Object is not callable: " + function.value_repr() + " (" + function.type_repr() + ")");
-
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
+                RUNTIME_ERROR("Object is not callable: " + function.value_repr() + " (" + function.type_repr() + ")");
             }
 
             int status = call_function(vm, function, param_num, frame, std::make_shared<Value>(object));
 
             if (status != 0)
             {
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
                 return EVALUATE_RUNTIME_ERROR;
             }
 
@@ -1901,18 +1786,11 @@ static EvaluateResult run(VM &vm)
                     }
                     catch (...)
                     {
-                        runtimeError(vm, "No such file or directory: '" + parent_path.string() + "'", "ImportError");
-                        if (vm.status == 2)
-                        {
-                            vm.status = 0;
-                            break;
-                        }
-
-                        return EVALUATE_RUNTIME_ERROR;
+                        RUNTIME_ERROR("No such file or directory: '" + parent_path.string() + "'", "ImportError");
                     }
 
                     VM import_vm;
-                    std::shared_ptr<FunctionObj> main = std::make_shared<FunctionObj>();
+                    std::shared_ptr<FunctionObj> main = pool_make<FunctionObj>();
                     main->name = "";
                     main->arity = 0;
                     main->chunk = Chunk();
@@ -1920,7 +1798,7 @@ static EvaluateResult run(VM &vm)
                     CallFrame main_frame;
                     // main_frame.name = frame->name;
                     // main_frame.name = path.get_string();
-                    main_frame.name = std::filesystem::current_path().string() + "/" + path.get_string().substr(path.get_string().find_last_of("/\\") + 1);
+                    main->import_path = std::filesystem::current_path().string() + "/" + path.get_string().substr(path.get_string().find_last_of("/\\") + 1);
                     main_frame.function = main;
                     main_frame.sp = 0;
                     main_frame.ip = main->chunk.code.data();
@@ -1932,7 +1810,15 @@ static EvaluateResult run(VM &vm)
                     add_code(main_frame.function->chunk, OP_EXIT);
                     auto offsets = instruction_offsets(main_frame.function->chunk);
                     main_frame.function->instruction_offsets = offsets;
+                    if (tracing())
+                    {
+                        tracer_import_begin(vm, main->import_path);
+                    }
                     evaluate(import_vm);
+                    if (tracing())
+                    {
+                        tracer_import_end(vm);
+                    }
 
                     if (import_vm.status != 0)
                     {
@@ -1964,6 +1850,10 @@ static EvaluateResult run(VM &vm)
                     cached.import_object = import_obj;
                     cached.import_globals = import_vm.globals;
                     vm.import_cache[absolute_path] = cached;
+                    if (image_recording)
+                    {
+                        image_record_import(vm, absolute_path);
+                    }
 
                     for (int i = 0; i < import_vm.frames[0].function->chunk.public_variables.size(); i++)
                     {
@@ -2012,18 +1902,11 @@ static EvaluateResult run(VM &vm)
                     }
                     catch (...)
                     {
-                        runtimeError(vm, "No such file or directory: '" + parent_path.string() + "'", "ImportError");
-                        if (vm.status == 2)
-                        {
-                            vm.status = 0;
-                            break;
-                        }
-
-                        return EVALUATE_RUNTIME_ERROR;
+                        RUNTIME_ERROR("No such file or directory: '" + parent_path.string() + "'", "ImportError");
                     }
 
                     VM import_vm;
-                    std::shared_ptr<FunctionObj> main = std::make_shared<FunctionObj>();
+                    std::shared_ptr<FunctionObj> main = pool_make<FunctionObj>();
                     main->name = "";
                     main->arity = 0;
                     main->chunk = Chunk();
@@ -2031,7 +1914,7 @@ static EvaluateResult run(VM &vm)
                     CallFrame main_frame;
                     // main_frame.name = frame->name;
                     // main_frame.name = path.get_string();
-                    main_frame.name = std::filesystem::current_path().string() + "/" + path.get_string().substr(path.get_string().find_last_of("/\\") + 1);
+                    main->import_path = std::filesystem::current_path().string() + "/" + path.get_string().substr(path.get_string().find_last_of("/\\") + 1);
                     main_frame.function = main;
                     main_frame.sp = 0;
                     main_frame.ip = main->chunk.code.data();
@@ -2043,7 +1926,15 @@ static EvaluateResult run(VM &vm)
                     add_code(main_frame.function->chunk, OP_EXIT);
                     auto offsets = instruction_offsets(main_frame.function->chunk);
                     main_frame.function->instruction_offsets = offsets;
+                    if (tracing())
+                    {
+                        tracer_import_begin(vm, main->import_path);
+                    }
                     evaluate(import_vm);
+                    if (tracing())
+                    {
+                        tracer_import_end(vm);
+                    }
 
                     for (auto &c : import_vm.import_cache)
                     {
@@ -2080,6 +1971,10 @@ static EvaluateResult run(VM &vm)
                     cached.import_object = import_obj;
                     cached.import_globals = import_vm.globals;
                     vm.import_cache[absolute_path] = cached;
+                    if (image_recording)
+                    {
+                        image_record_import(vm, absolute_path);
+                    }
 
                     push(vm, import_obj);
 
@@ -2121,15 +2016,7 @@ static EvaluateResult run(VM &vm)
                             continue;
                         }
 
-                        runtimeError(vm, "Cannot import variable '" + name + "' from '" + path_string + "'", "ImportError");
-
-                        if (vm.status == 2)
-                        {
-                            vm.status = 0;
-                            break;
-                        }
-
-                        return EVALUATE_RUNTIME_ERROR;
+                        RUNTIME_ERROR("Cannot import variable '" + name + "' from '" + path_string + "'", "ImportError");
                     }
 
                     break;
@@ -2153,25 +2040,18 @@ static EvaluateResult run(VM &vm)
                 }
                 catch (...)
                 {
-                    runtimeError(vm, "No such file or directory: '" + parent_path.string() + "'", "ImportError");
-                    if (vm.status == 2)
-                    {
-                        vm.status = 0;
-                        break;
-                    }
-
-                    return EVALUATE_RUNTIME_ERROR;
+                    RUNTIME_ERROR("No such file or directory: '" + parent_path.string() + "'", "ImportError");
                 }
 
                 VM import_vm;
-                std::shared_ptr<FunctionObj> main = std::make_shared<FunctionObj>();
+                std::shared_ptr<FunctionObj> main = pool_make<FunctionObj>();
                 main->name = "";
                 main->arity = 0;
                 main->chunk = Chunk();
                 main->chunk.import_path = frame->function->chunk.import_path;
                 CallFrame main_frame;
                 // main_frame.name = frame->name;
-                main_frame.name = std::filesystem::current_path().string() + "/" + path.get_string().substr(path.get_string().find_last_of("/\\") + 1);
+                main->import_path = std::filesystem::current_path().string() + "/" + path.get_string().substr(path.get_string().find_last_of("/\\") + 1);
                 main_frame.function = main;
                 main_frame.sp = 0;
                 main_frame.ip = main->chunk.code.data();
@@ -2183,7 +2063,15 @@ static EvaluateResult run(VM &vm)
                 add_code(main_frame.function->chunk, OP_EXIT);
                 auto offsets = instruction_offsets(main_frame.function->chunk);
                 main_frame.function->instruction_offsets = offsets;
+                if (tracing())
+                {
+                    tracer_import_begin(vm, main->import_path);
+                }
                 evaluate(import_vm);
+                if (tracing())
+                {
+                    tracer_import_end(vm);
+                }
 
                 for (auto &c : import_vm.import_cache)
                 {
@@ -2220,6 +2108,10 @@ static EvaluateResult run(VM &vm)
                 cached.import_object = import_obj;
                 cached.import_globals = import_vm.globals;
                 vm.import_cache[absolute_path] = cached;
+                if (image_recording)
+                {
+                    image_record_import(vm, absolute_path);
+                }
 
                 for (auto &name : names)
                 {
@@ -2236,14 +2128,7 @@ static EvaluateResult run(VM &vm)
 
                     if (!found)
                     {
-                        runtimeError(vm, "Cannot import variable '" + name + "' from '" + path.get_string() + "'", "ImportError");
-                        if (vm.status == 2)
-                        {
-                            vm.status = 0;
-                            break;
-                        }
-
-                        return EVALUATE_RUNTIME_ERROR;
+                        RUNTIME_ERROR("Cannot import variable '" + name + "' from '" + path.get_string() + "'", "ImportError");
                     }
                 }
 
@@ -2258,14 +2143,7 @@ static EvaluateResult run(VM &vm)
             Value function = pop(vm);
             if (!name.is_string())
             {
-                runtimeError(vm, "Hook expects second argument to evaluate to a string", "HookError");
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
+                RUNTIME_ERROR("Hook expects second argument to evaluate to a string", "HookError");
             }
             if (index == -1)
             {
@@ -2288,14 +2166,7 @@ static EvaluateResult run(VM &vm)
                     break;
                 }
 
-                runtimeError(vm, "Unnamed hook only works with objects", "HookError");
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
+                RUNTIME_ERROR("Unnamed hook only works with objects", "HookError");
             }
 
             vm.stack[index + frame->frame_start].hooks.onChangeHook = std::make_shared<Value>(function);
@@ -2310,14 +2181,7 @@ static EvaluateResult run(VM &vm)
             Value function = pop(vm);
             if (!name.is_string())
             {
-                runtimeError(vm, "Hook expects second argument to evaluate to a string", "HookError");
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
+                RUNTIME_ERROR("Hook expects second argument to evaluate to a string", "HookError");
             }
 
             if (index == -1)
@@ -2341,14 +2205,7 @@ static EvaluateResult run(VM &vm)
                     break;
                 }
 
-                runtimeError(vm, "Unnamed hook only works with objects", "HookError");
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
+                RUNTIME_ERROR("Unnamed hook only works with objects", "HookError");
             }
 
             (*frame->function->closed_vars[index]->location).hooks.onChangeHook = std::make_shared<Value>(function);
@@ -2363,14 +2220,7 @@ static EvaluateResult run(VM &vm)
             Value function = pop(vm);
             if (!name.is_string())
             {
-                runtimeError(vm, "Hook expects second argument to evaluate to a string", "HookError");
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
+                RUNTIME_ERROR("Hook expects second argument to evaluate to a string", "HookError");
             }
 
             if (index == -1)
@@ -2395,14 +2245,7 @@ static EvaluateResult run(VM &vm)
                     break;
                 }
 
-                runtimeError(vm, "Unnamed hook only works with objects", "HookError");
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
+                RUNTIME_ERROR("Unnamed hook only works with objects", "HookError");
             }
 
             vm.stack[index + frame->frame_start].hooks.onAccessHook = std::make_shared<Value>(function);
@@ -2417,14 +2260,7 @@ static EvaluateResult run(VM &vm)
             Value function = pop(vm);
             if (!name.is_string())
             {
-                runtimeError(vm, "Hook expects second argument to evaluate to a string", "HookError");
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
+                RUNTIME_ERROR("Hook expects second argument to evaluate to a string", "HookError");
             }
 
             if (index == -1)
@@ -2448,14 +2284,7 @@ static EvaluateResult run(VM &vm)
                     break;
                 }
 
-                runtimeError(vm, "Unnamed hook only works with objects", "HookError");
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
+                RUNTIME_ERROR("Unnamed hook only works with objects", "HookError");
             }
 
             (*frame->function->closed_vars[index]->location).hooks.onAccessHook = std::make_shared<Value>(function);
@@ -2468,14 +2297,7 @@ static EvaluateResult run(VM &vm)
             Value constant = pop(vm);
             if (!constant.is_number())
             {
-                runtimeError(vm, "Operand must be a number: " + constant.value_repr() + " (" + constant.type_repr() + ")");
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
+                RUNTIME_ERROR("Operand must be a number: " + constant.value_repr() + " (" + constant.type_repr() + ")");
             }
             Value value = number_val(-constant.get_number());
             push(vm, value);
@@ -2495,14 +2317,6 @@ static EvaluateResult run(VM &vm)
                 Value value = boolean_val(false);
                 push(vm, value);
                 break;
-                // runtimeError(vm, "Operand must be a boolean: " + constant.value_repr() + " (" + constant.type_repr() + ")");
-                // if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
             }
             Value value = boolean_val(!constant.get_boolean());
             push(vm, value);
@@ -2510,254 +2324,185 @@ static EvaluateResult run(VM &vm)
         }
         case OP_ADD:
         {
-            Value v2 = pop(vm);
-            Value v1 = pop(vm);
-            if (v1.is_string() && v2.is_string())
+            Value &v2 = vm.stack.back();
+            Value &v1 = *(&v2 - 1);
+            if (v1.is_number() && v2.is_number())
             {
-                Value value = string_val(v1.get_string() + v2.get_string());
-                push(vm, value);
+                number_result(vm, v1, v1.get_number() + v2.get_number());
                 break;
             }
-            if (!v1.is_number() || !v2.is_number())
+            if (v1.is_string() && v2.is_string())
             {
-                runtimeError(vm, "Cannot perform operation '+' on values: " + v1.value_repr() + " (" + v1.type_repr() + "), " + v2.value_repr() + " (" + v2.type_repr() + ")");
-
-                if (vm.status == 2)
+                // `s += x` compiles to LOAD s, <x>, ADD, SET s. If the local and
+                // this operand are the only owners of the buffer, the old string
+                // is about to be dropped anyway, so append in place
+                if (*frame->ip == OP_SET)
                 {
-                    vm.status = 0;
-                    break;
+                    int index = bytes_to_int(frame->ip[1], frame->ip[2], frame->ip[3], frame->ip[4]);
+                    Value &local = vm.stack[index + frame->frame_start];
+                    auto &buffer = std::get<std::shared_ptr<std::string>>(v1.value);
+                    if (local.is_string() && !local.meta.is_const && !local.hooks.onChangeHook && buffer.use_count() == 2 && std::get<std::shared_ptr<std::string>>(local.value) == buffer)
+                    {
+                        buffer->append(v2.get_string());
+                        v1.meta = Meta();
+                        v1.hooks = ValueHooks();
+                        vm.stack.pop_back();
+                        break;
+                    }
                 }
-
-                return EVALUATE_RUNTIME_ERROR;
+                concat_strings(vm);
+                break;
             }
-            Value value = number_val(v1.get_number() + v2.get_number());
-            push(vm, value);
-            break;
+            RUNTIME_ERROR(operand_error(vm, "+"));
         }
         case OP_SUBTRACT:
         {
-            Value v2 = pop(vm);
-            Value v1 = pop(vm);
-            if (!v1.is_number() || !v2.is_number())
+            Value &v2 = vm.stack.back();
+            Value &v1 = *(&v2 - 1);
+            if (v1.is_number() && v2.is_number())
             {
-                runtimeError(vm, "Cannot perform operation '-' on values: " + v1.value_repr() + " (" + v1.type_repr() + "), " + v2.value_repr() + " (" + v2.type_repr() + ")");
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
+                number_result(vm, v1, v1.get_number() - v2.get_number());
+                break;
             }
-            Value value = number_val(v1.get_number() - v2.get_number());
-            push(vm, value);
-            break;
+            RUNTIME_ERROR(operand_error(vm, "-"));
         }
         case OP_MULTIPLY:
         {
-            Value v2 = pop(vm);
-            Value v1 = pop(vm);
-            if (!v1.is_number() || !v2.is_number())
+            Value &v2 = vm.stack.back();
+            Value &v1 = *(&v2 - 1);
+            if (v1.is_number() && v2.is_number())
             {
-                runtimeError(vm, "Cannot perform operation '*' on values: " + v1.value_repr() + " (" + v1.type_repr() + "), " + v2.value_repr() + " (" + v2.type_repr() + ")");
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
+                number_result(vm, v1, v1.get_number() * v2.get_number());
+                break;
             }
-            Value value = number_val(v1.get_number() * v2.get_number());
-            push(vm, value);
-            break;
+            RUNTIME_ERROR(operand_error(vm, "*"));
         }
         case OP_DIVIDE:
         {
-            Value v2 = pop(vm);
-            Value v1 = pop(vm);
-            if (!v1.is_number() || !v2.is_number())
+            Value &v2 = vm.stack.back();
+            Value &v1 = *(&v2 - 1);
+            if (v1.is_number() && v2.is_number())
             {
-                runtimeError(vm, "Cannot perform operation '/' on values: " + v1.value_repr() + " (" + v1.type_repr() + "), " + v2.value_repr() + " (" + v2.type_repr() + ")");
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
+                number_result(vm, v1, v1.get_number() / v2.get_number());
+                break;
             }
-            Value value = number_val(v1.get_number() / v2.get_number());
-            push(vm, value);
-            break;
+            RUNTIME_ERROR(operand_error(vm, "/"));
         }
         case OP_MOD:
         {
-            Value v2 = pop(vm);
-            Value v1 = pop(vm);
-            if (!v1.is_number() || !v2.is_number())
+            Value &v2 = vm.stack.back();
+            Value &v1 = *(&v2 - 1);
+            if (v1.is_number() && v2.is_number())
             {
-                runtimeError(vm, "Cannot perform operation '%' on values: " + v1.value_repr() + " (" + v1.type_repr() + "), " + v2.value_repr() + " (" + v2.type_repr() + ")");
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
+                number_result(vm, v1, fmod(v1.get_number(), v2.get_number()));
+                break;
             }
-            Value value = number_val(fmod(v1.get_number(), v2.get_number()));
-            push(vm, value);
-            break;
+            RUNTIME_ERROR(operand_error(vm, "%"));
         }
         case OP_POW:
         {
-            Value v2 = pop(vm);
-            Value v1 = pop(vm);
-            if (!v1.is_number() || !v2.is_number())
+            Value &v2 = vm.stack.back();
+            Value &v1 = *(&v2 - 1);
+            if (v1.is_number() && v2.is_number())
             {
-                runtimeError(vm, "Cannot perform operation '^' on values: " + v1.value_repr() + " (" + v1.type_repr() + "), " + v2.value_repr() + " (" + v2.type_repr() + ")");
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
+                number_result(vm, v1, pow(v1.get_number(), v2.get_number()));
+                break;
             }
-            Value value = number_val(pow(v1.get_number(), v2.get_number()));
-            push(vm, value);
-            break;
+            RUNTIME_ERROR(operand_error(vm, "^"));
         }
         case OP_AND:
         {
-            Value v2 = pop(vm);
-            Value v1 = pop(vm);
-            if (!v1.is_number() || !v2.is_number())
+            Value &v2 = vm.stack.back();
+            Value &v1 = *(&v2 - 1);
+            if (v1.is_number() && v2.is_number())
             {
-                runtimeError(vm, "Cannot perform operation '&' on values: " + v1.value_repr() + " (" + v1.type_repr() + "), " + v2.value_repr() + " (" + v2.type_repr() + ")");
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
+                number_result(vm, v1, (int)v1.get_number() & (int)v2.get_number());
+                break;
             }
-            Value value = number_val((int)v1.get_number() & (int)v2.get_number());
-            push(vm, value);
-            break;
+            RUNTIME_ERROR(operand_error(vm, "&"));
         }
         case OP_OR:
         {
-            Value v2 = pop(vm);
-            Value v1 = pop(vm);
-            if (!v1.is_number() || !v2.is_number())
+            Value &v2 = vm.stack.back();
+            Value &v1 = *(&v2 - 1);
+            if (v1.is_number() && v2.is_number())
             {
-                runtimeError(vm, "Cannot perform operation '|' on values: " + v1.value_repr() + " (" + v1.type_repr() + "), " + v2.value_repr() + " (" + v2.type_repr() + ")");
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
+                number_result(vm, v1, (int)v1.get_number() | (int)v2.get_number());
+                break;
             }
-            Value value = number_val((int)v1.get_number() | (int)v2.get_number());
-            push(vm, value);
-            break;
+            RUNTIME_ERROR(operand_error(vm, "|"));
         }
         case OP_EQ_EQ:
         {
-            Value v2 = pop(vm);
-            Value v1 = pop(vm);
+            Value &v2 = vm.stack.back();
+            Value &v1 = *(&v2 - 1);
+            if (v1.is_number() && v2.is_number())
+            {
+                boolean_result(vm, v1, v1.get_number() == v2.get_number());
+                break;
+            }
             Value value = boolean_val(is_equal(v1, v2));
-            push(vm, value);
+            vm.stack.pop_back();
+            vm.stack.back() = value;
             break;
         }
         case OP_NOT_EQ:
         {
-            Value v2 = pop(vm);
-            Value v1 = pop(vm);
+            Value &v2 = vm.stack.back();
+            Value &v1 = *(&v2 - 1);
+            if (v1.is_number() && v2.is_number())
+            {
+                boolean_result(vm, v1, v1.get_number() != v2.get_number());
+                break;
+            }
             Value value = boolean_val(!is_equal(v1, v2));
-            push(vm, value);
+            vm.stack.pop_back();
+            vm.stack.back() = value;
             break;
         }
         case OP_LT_EQ:
         {
-            Value v2 = pop(vm);
-            Value v1 = pop(vm);
-            if (!v1.is_number() || !v2.is_number())
+            Value &v2 = vm.stack.back();
+            Value &v1 = *(&v2 - 1);
+            if (v1.is_number() && v2.is_number())
             {
-                runtimeError(vm, "Cannot perform operation '<=' on values: " + v1.value_repr() + " (" + v1.type_repr() + "), " + v2.value_repr() + " (" + v2.type_repr() + ")");
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
+                boolean_result(vm, v1, v1.get_number() <= v2.get_number());
+                break;
             }
-            Value value = boolean_val(v1.get_number() <= v2.get_number());
-            push(vm, value);
-            break;
+            RUNTIME_ERROR(operand_error(vm, "<="));
         }
         case OP_GT_EQ:
         {
-            Value v2 = pop(vm);
-            Value v1 = pop(vm);
-            if (!v1.is_number() || !v2.is_number())
+            Value &v2 = vm.stack.back();
+            Value &v1 = *(&v2 - 1);
+            if (v1.is_number() && v2.is_number())
             {
-                runtimeError(vm, "Cannot perform operation '>=' on values: " + v1.value_repr() + " (" + v1.type_repr() + "), " + v2.value_repr() + " (" + v2.type_repr() + ")");
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
+                boolean_result(vm, v1, v1.get_number() >= v2.get_number());
+                break;
             }
-            Value value = boolean_val(v1.get_number() >= v2.get_number());
-            push(vm, value);
-            break;
+            RUNTIME_ERROR(operand_error(vm, ">="));
         }
         case OP_LT:
         {
-            Value v2 = pop(vm);
-            Value v1 = pop(vm);
-            if (!v1.is_number() || !v2.is_number())
+            Value &v2 = vm.stack.back();
+            Value &v1 = *(&v2 - 1);
+            if (v1.is_number() && v2.is_number())
             {
-                runtimeError(vm, "Cannot perform operation '<' on values: " + v1.value_repr() + " (" + v1.type_repr() + "), " + v2.value_repr() + " (" + v2.type_repr() + ")");
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
+                boolean_result(vm, v1, v1.get_number() < v2.get_number());
+                break;
             }
-            Value value = boolean_val(v1.get_number() < v2.get_number());
-            push(vm, value);
-            break;
+            RUNTIME_ERROR(operand_error(vm, "<"));
         }
         case OP_GT:
         {
-            Value v2 = pop(vm);
-            Value v1 = pop(vm);
-            if (!v1.is_number() || !v2.is_number())
+            Value &v2 = vm.stack.back();
+            Value &v1 = *(&v2 - 1);
+            if (v1.is_number() && v2.is_number())
             {
-                runtimeError(vm, "Cannot perform operation '>' on values: " + v1.value_repr() + " (" + v1.type_repr() + "), " + v2.value_repr() + " (" + v2.type_repr() + ")");
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
+                boolean_result(vm, v1, v1.get_number() > v2.get_number());
+                break;
             }
-            Value value = boolean_val(v1.get_number() > v2.get_number());
-            push(vm, value);
-            break;
+            RUNTIME_ERROR(operand_error(vm, ">"));
         }
         case OP_RANGE:
         {
@@ -2765,14 +2510,7 @@ static EvaluateResult run(VM &vm)
             Value v1 = pop(vm);
             if (!v1.is_number() || !v2.is_number())
             {
-                runtimeError(vm, "Cannot perform operation '..' on values: " + v1.value_repr() + " (" + v1.type_repr() + "), " + v2.value_repr() + " (" + v2.type_repr() + ")");
-                if (vm.status == 2)
-                {
-                    vm.status = 0;
-                    break;
-                }
-
-                return EVALUATE_RUNTIME_ERROR;
+                RUNTIME_ERROR("Cannot perform operation '..' on values: " + v1.value_repr() + " (" + v1.type_repr() + "), " + v2.value_repr() + " (" + v2.type_repr() + ")");
             }
             Value value = list_val();
             auto &list_value = value.get_list();
@@ -2784,11 +2522,13 @@ static EvaluateResult run(VM &vm)
             break;
         }
         }
+    next_instruction:;
     }
 
 #undef READ_BYTE
 #undef READ_INT
 #undef READ_CONSTANT
+#undef RUNTIME_ERROR
 }
 
 EvaluateResult evaluate(VM &vm)
@@ -2799,9 +2539,81 @@ EvaluateResult evaluate(VM &vm)
         std::cout << "InternalError: Internal stack size limit exceeded";
         return EVALUATE_RUNTIME_ERROR;
     }
-    auto res = run(vm);
-    internal_stack_count--;
-    return res;
+    heap.nesting++;
+    heap.vms.push_back(&vm);
+    profiler_enter(vm);
+    auto res = run(vm);
+    profiler_leave();
+    heap.vms.pop_back();
+    heap.nesting--;
+    internal_stack_count--;
+    return res;
+}
+
+bool CallbackVM::call(Value &function, Value *arguments, int count, Value *result)
+{
+    if (mains.size() <= count)
+    {
+        mains.resize(count + 1);
+    }
+    std::shared_ptr<FunctionObj> main = mains[count];
+    if (!main)
+    {
+        main = mains[count] = std::make_shared<FunctionObj>();
+        main->name = "";
+        main->arity = 0;
+        main->chunk = Chunk();
+        for (int i = 0; i <= count; i++)
+        {
+            add_constant(main->chunk, none_val());
+        }
+        for (int i = count; i >= 0; i--)
+        {
+            add_opcode(main->chunk, OP_LOAD_CONST, i, 0);
+        }
+        add_opcode(main->chunk, OP_CALL, count, 0);
+        add_code(main->chunk, OP_EXIT, 0);
+        main->instruction_offsets = instruction_offsets(main->chunk);
+    }
+
+    auto &constants = main->chunk.constants;
+    constants[0] = function;
+    for (int i = 0; i < count; i++)
+    {
+        constants[i + 1] = arguments[i];
+    }
+
+    vm.stack.clear();
+    vm.frames.clear();
+    vm.status = 0;
+    CallFrame main_frame;
+    main_frame.function = main;
+    main_frame.sp = 0;
+    main_frame.ip = main->chunk.code.data();
+    main_frame.frame_start = 0;
+    vm.frames.push_back(main_frame);
+
+    bool ok = evaluate(vm) == EVALUATE_OK && vm.stack.size() > 0;
+    if (ok && result)
+    {
+        *result = vm.stack.back();
+    }
+
+    // A runtime error leaves closures pointing into the stack, which the next
+    // call reuses, so close them as OP_EXIT would have
+    for (auto &closure : vm.closed_values)
+    {
+        closure->closed = *closure->location;
+        closure->location = &closure->closed;
+    }
+    vm.closed_values.clear();
+    vm.stack.clear();
+    vm.frames.clear();
+    for (auto &constant : constants)
+    {
+        constant = none_val();
+    }
+    return ok;
 }
 
 bool is_equal(Value &v1, Value &v2)
@@ -2862,13 +2674,22 @@ void freeVM(VM &vm)
     //
 }
 
-static int call_function(VM &vm, Value &function, int param_num, CallFrame *&frame, std::shared_ptr<Value> object)
+static int call_error(VM &vm, CallFrame *&frame, std::string message, std::string error_type = "GenericError")
 {
-    if (vm.frames.size() > vm.call_stack_limit)
+    if (!runtimeError(vm, message, error_type))
     {
-        runtimeError(vm, "Stack size limit exceeded", "RecursionError");
         return -1;
     }
+    frame = &vm.frames.back();
+    return 0;
+}
+
+static int call_function(VM &vm, Value &function, int param_num, CallFrame *&frame, std::shared_ptr<Value> object)
+{
+    if (vm.frames.size() > vm.call_stack_limit || vm.stack.capacity() - vm.stack.size() < STACK_HEADROOM)
+    {
+        return call_error(vm, frame, "Stack size limit exceeded", "RecursionError");
+    }
 
     auto &function_obj = function.get_function();
     int positional_args = function_obj->arity - function_obj->defaults;
@@ -2942,8 +2763,7 @@ static int call_function(VM &vm, Value &function, int param_num, CallFrame *&fra
 
         if ((param_num < positional_args) || (param_num > function_obj->arity))
         {
-            runtimeError(vm, "Function '" + function_obj->name + "' expects " + std::to_string(function_obj->arity) + " argument(s)");
-            return -1;
+            return call_error(vm, frame, "Function '" + function_obj->name + "' expects " + std::to_string(function_obj->arity) + " argument(s)");
         }
 
         if (param_num < function_obj->arity)
@@ -2967,21 +2787,10 @@ static int call_function(VM &vm, Value &function, int param_num, CallFrame *&fra
         auto function_copy = copy(function);
         auto &function_copy_obj = function_copy.get_function();
         function_copy_obj->generator_init = true;
-        auto call_frame = std::make_shared<CallFrame>();
-        call_frame->frame_start = vm.stack.size();
-        call_frame->function = function_copy_obj;
-        call_frame->sp = vm.stack.size();
-        call_frame->ip = function_copy_obj->chunk.code.data();
-
-        function_copy_obj->name = function_copy_obj->name + "_" + std::to_string(vm.coro_count++);
-
-        int instruction_index = frame->ip - &frame->function->chunk.code[0];
-        call_frame->instruction_index = instruction_index;
-
-        auto offsets = instruction_offsets(call_frame->function->chunk);
-        call_frame->function->instruction_offsets = offsets;
-
-        vm.gen_frames[function_copy_obj->name] = call_frame;
+        function_copy_obj->generator_ip = 0;
+        function_copy_obj->generator_stack.clear();
+        function_copy_obj->import_path = function_obj->import_path;
+        function_copy_obj->instruction_offsets = function_obj->instruction_offsets;
 
         push(vm, function_copy);
         return 0;
@@ -2994,22 +2803,18 @@ static int call_function(VM &vm, Value &function, int param_num, CallFrame *&fra
     }
     else if (function_obj->is_generator && function_obj->generator_init)
     {
-        auto &call_frame = vm.gen_frames[function_obj->name];
-        call_frame->frame_start = vm.stack.size();
-        call_frame->sp = vm.stack.size();
-
         if (param_num > 1)
         {
-            runtimeError(vm, "Coroutine can only be called with one argument for parameter '_value'");
+            return call_error(vm, frame, "Coroutine can only be called with one argument for parameter '_value'");
         }
 
         int _value_index = -1;
 
         if (param_num == 1)
         {
-            for (int i = 0; i < call_frame->function->chunk.variables.size(); i++)
+            for (int i = 0; i < function_obj->chunk.variables.size(); i++)
             {
-                if (call_frame->function->chunk.variables[i] == "_value")
+                if (function_obj->chunk.variables[i] == "_value")
                 {
                     _value_index = i;
                     break;
@@ -3018,39 +2823,41 @@ static int call_function(VM &vm, Value &function, int param_num, CallFrame *&fra
 
             if (_value_index == -1)
             {
-                runtimeError(vm, "Missing variable '_value'");
+                return call_error(vm, frame, "Missing variable '_value'");
             }
 
-            call_frame->function->chunk.constants[_value_index] = pop(vm);
-            call_frame->frame_start--;
-            call_frame->sp--;
+            function_obj->chunk.constants[_value_index] = pop(vm);
         }
 
-        for (int i = 0; i < call_frame->gen_stack.size(); i++)
+        CallFrame call_frame;
+        call_frame.frame_start = vm.stack.size();
+        call_frame.function = function_obj;
+        call_frame.sp = vm.stack.size();
+        call_frame.ip = function_obj->chunk.code.data() + function_obj->generator_ip;
+
+        auto &saved = function_obj->generator_stack;
+        if (_value_index >= 0 && _value_index < saved.size())
         {
-            Value &value = call_frame->gen_stack[i];
-            if (i == _value_index)
-            {
-                push(vm, call_frame->function->chunk.constants[_value_index]);
-            }
-            else
-            {
-                push(vm, value);
-            }
+            saved[_value_index] = function_obj->chunk.constants[_value_index];
         }
+        vm.stack.append(std::make_move_iterator(saved.begin()), std::make_move_iterator(saved.end()));
+        saved.clear();
 
         int instruction_index = frame->ip - &frame->function->chunk.code[0];
-        call_frame->instruction_index = instruction_index;
+        call_frame.instruction_index = instruction_index;
 
-        vm.frames.push_back(*call_frame);
-        frame = &*call_frame;
+        vm.frames.push_back(call_frame);
+        frame = &vm.frames.back();
+        if (tracing())
+        {
+            tracer_call(vm, frame);
+        }
         return 0;
     }
 
     CallFrame call_frame;
     call_frame.frame_start = vm.stack.size();
     call_frame.function = function_obj;
-    call_frame.name = function_obj->import_path;
     if (object)
     {
         call_frame.function->object = object;
@@ -3063,6 +2870,10 @@ static int call_function(VM &vm, Value &function, int param_num, CallFrame *&fra
 
     vm.frames.push_back(call_frame);
     frame = &vm.frames.back();
+    if (tracing())
+    {
+        tracer_call(vm, frame);
+    }
 
     return 0;
 }
@@ -3096,12 +2907,12 @@ static Value eval_builtin(std::vector<Value> &args)
     auto ast = parser.nodes;
 
     VM vm;
-    std::shared_ptr<FunctionObj> main = std::make_shared<FunctionObj>();
+    std::shared_ptr<FunctionObj> main = pool_make<FunctionObj>();
     main->name = "";
     main->arity = 0;
     main->chunk = Chunk();
     CallFrame main_frame;
-    main_frame.name = "_eval";
+    main->import_path = "_eval";
     main_frame.function = main;
     main_frame.sp = 0;
     main_frame.ip = main->chunk.code.data();
@@ -3181,7 +2992,11 @@ static Value dis_builtin(std::vector<Value> &args)
     }
 
     std::cout << '\n';
+#ifdef OPCODE_STATS
+    disassemble_chunk(function.get_function()->chunk, function.get_function()->name, opcode_stats_counts(*function.get_function()));
+#else
     disassemble_chunk(function.get_function()->chunk, function.get_function()->name);
+#endif
 
     return none_val();
 }
@@ -3304,7 +3119,7 @@ static Value insert_builtin(std::vector<Value> &args)
         obj.get_object()->values["current"].hooks.onChangeHook = nullptr;
 
         VM func_vm;
-        std::shared_ptr<FunctionObj> main = std::make_shared<FunctionObj>();
+        std::shared_ptr<FunctionObj> main = pool_make<FunctionObj>();
         main->name = "";
         main->arity = 0;
         main->chunk = Chunk();
@@ -3388,7 +3203,7 @@ static Value append_builtin(std::vector<Value> &args)
         obj.get_object()->values["current"].hooks.onChangeHook = nullptr;
 
         VM func_vm;
-        std::shared_ptr<FunctionObj> main = std::make_shared<FunctionObj>();
+        std::shared_ptr<FunctionObj> main = pool_make<FunctionObj>();
         main->name = "";
         main->arity = 0;
         main->chunk = Chunk();
@@ -3487,7 +3302,7 @@ static Value remove_builtin(std::vector<Value> &args)
         obj.get_object()->values["current"].hooks.onChangeHook = nullptr;
 
         VM func_vm;
-        std::shared_ptr<FunctionObj> main = std::make_shared<FunctionObj>();
+        std::shared_ptr<FunctionObj> main = pool_make<FunctionObj>();
         main->name = "";
         main->arity = 0;
         main->chunk = Chunk();
@@ -3550,7 +3365,7 @@ static Value remove_prop_builtin(std::vector<Value> &args)
         return error_object("Function 'remove_prop' expects argument 'name' to be a string");
     }
 
-    std::string &_name = name.get_string();
+    const std::string &_name = name.get_string();
     auto &_obj = obj.get_object();
 
     _obj->values.erase(_name);
@@ -3721,9 +3536,50 @@ static Value id_builtin(std::vector<Value> &args)
         return error_object("Function 'id' expects 1 argument");
     }
 
-    Value value = args[0];
+    Value &value = args[0];
+    size_t id = 0;
+
+    // Reference types are identified by their heap object, primitives by value
+    switch (value.type)
+    {
+    case Number:
+        id = std::hash<double>()(value.get_number());
+        break;
+    case String:
+        id = std::hash<std::string>()(value.get_string());
+        break;
+    case Boolean:
+        id = value.get_boolean();
+        break;
+    case List:
+        id = (size_t)value.get_list().get();
+        break;
+    case Type:
+        id = (size_t)value.get_type().get();
+        break;
+    case Object:
+        id = (size_t)value.get_object().get();
+        break;
+    case Function:
+        id = (size_t)value.get_function().get();
+        break;
+    case Native:
+        id = (size_t)value.get_native().get();
+        break;
+    case Pointer:
+        id = (size_t)value.get_pointer().get();
+        break;
+    default:
+        break;
+    }
+
+    if (value.type <= Boolean)
+    {
+        id = id * 31 + value.type;
+    }
 
-    return number_val(value.id);
+    // Keep the id exactly representable as a Number
+    return number_val(id & ((1ULL << 53) - 1));
 }
 
 static Value load_lib_builtin(std::vector<Value> &args)
@@ -3774,6 +3630,10 @@ static Value load_lib_builtin(std::vector<Value> &args)
         {
             return error_object("Module error: Function '" + name.get_string() + "' is not defined in the C module '" + path.get_string() + "'");
         }
+        if (image_recording)
+        {
+            image_register_native(fn, std::filesystem::absolute(path.get_string()).string(), name.get_string());
+        }
         Value native = native_val();
         native.get_native()->function = fn;
         obj->values[name.get_string()] = native;
@@ -3811,6 +3671,10 @@ static Value load_lib_builtin(std::vector<Value> &args)
         {
             return error_object("Module error: Function '" + name.get_string() + "' is not defined in the C module '" + path.get_string() + "'");
         }
+        if (image_recording)
+        {
+            image_register_native(fn, std::filesystem::absolute(path_str).string(), name.get_string());
+        }
         Value native = native_val();
         native.get_native()->function = fn;
         obj->values[name.get_string()] = native;
@@ -3836,6 +3700,8 @@ Value copy(Value &value)
         new_func.get_function()->default_values = value.get_function()->default_values;
         new_func.get_function()->generator_done = value.get_function()->generator_done;
         new_func.get_function()->generator_init = value.get_function()->generator_init;
+        new_func.get_function()->generator_stack = value.get_function()->generator_stack;
+        new_func.get_function()->generator_ip = value.get_function()->generator_ip;
         new_func.get_function()->is_generator = value.get_function()->is_generator;
         new_func.get_function()->defaults = value.get_function()->defaults;
         new_func.get_function()->is_type_generator = value.get_function()->is_type_generator;
@@ -3878,6 +3744,164 @@ Value copy(Value &value)
     }
 }
 
+// Each list, object, type, function and closure reached is copied once, so
+// values that shared a cell in the original share its copy
+struct ThreadCopy
+{
+    std::unordered_map<void *, Value> cells;
+    std::unordered_map<Closure *, std::shared_ptr<Closure>> closures;
+
+    Value copy(Value &value)
+    {
+        Value result = value;
+        if (value.hooks.onChangeHook)
+        {
+            result.hooks.onChangeHook = std::make_shared<Value>(copy(*value.hooks.onChangeHook));
+        }
+        if (value.hooks.onAccessHook)
+        {
+            result.hooks.onAccessHook = std::make_shared<Value>(copy(*value.hooks.onAccessHook));
+        }
+
+        switch (value.type)
+        {
+        case List:
+        {
+            auto &list = value.get_list();
+            if (!cells.count(list.get()))
+            {
+                Value new_list = list_val();
+                cells[list.get()] = new_list;
+                for (auto &item : *list)
+                {
+                    new_list.get_list()->push_back(copy(item));
+                }
+            }
+            result.value = cells[list.get()].value;
+            break;
+        }
+        case Object:
+        {
+            auto &object = value.get_object();
+            if (!cells.count(object.get()))
+            {
+                Value new_object = object_val();
+                cells[object.get()] = new_object;
+                auto &new_object_obj = new_object.get_object();
+                new_object_obj->keys = object->keys;
+                new_object_obj->type_name = object->type_name;
+                if (object->type)
+                {
+                    Value type;
+                    type.type = Type;
+                    type.value = object->type;
+                    new_object_obj->type = copy(type).get_type();
+                }
+                for (auto &prop : object->values)
+                {
+                    new_object_obj->values[prop.first] = copy(prop.second);
+                }
+            }
+            result.value = cells[object.get()].value;
+            break;
+        }
+        case Type:
+        {
+            auto &type = value.get_type();
+            if (!cells.count(type.get()))
+            {
+                Value new_type = type_val(type->name);
+                cells[type.get()] = new_type;
+                for (auto &prop : type->types)
+                {
+                    new_type.get_type()->types[prop.first] = copy(prop.second);
+                }
+                for (auto &prop : type->defaults)
+                {
+                    new_type.get_type()->defaults[prop.first] = copy(prop.second);
+                }
+            }
+            result.value = cells[type.get()].value;
+            break;
+        }
+        case Function:
+        {
+            auto &function = value.get_function();
+            if (!cells.count(function.get()))
+            {
+                Value new_function = function_val();
+                cells[function.get()] = new_function;
+                auto &new_function_obj = new_function.get_function();
+                *new_function_obj = *function;
+                // Constants hold the functions defined in the body, which are
+                // completed in place when the body runs
+                for (auto &constant : new_function_obj->chunk.constants)
+                {
+                    constant = copy(constant);
+                }
+                for (auto &default_value : new_function_obj->default_values)
+                {
+                    default_value = copy(default_value);
+                }
+                for (auto &item : new_function_obj->generator_stack)
+                {
+                    item = copy(item);
+                }
+                for (auto &closure : new_function_obj->closed_vars)
+                {
+                    closure = copy(closure);
+                }
+                if (new_function_obj->object)
+                {
+                    new_function_obj->object = std::make_shared<Value>(copy(*new_function_obj->object));
+                }
+            }
+            result.value = cells[function.get()].value;
+            break;
+        }
+        default:
+            break;
+        }
+        return result;
+    }
+
+    std::shared_ptr<Closure> copy(std::shared_ptr<Closure> &closure)
+    {
+        if (closures.count(closure.get()))
+        {
+            return closures[closure.get()];
+        }
+        auto new_closure = pool_make<Closure>();
+        closures[closure.get()] = new_closure;
+        new_closure->name = closure->name;
+        new_closure->frame_name = closure->frame_name;
+        new_closure->is_local = closure->is_local;
+        new_closure->index = closure->index;
+        new_closure->location = &new_closure->closed;
+        new_closure->initial_location = &new_closure->closed;
+        heap_track(new_closure, CELL_CLOSURE);
+        new_closure->closed = copy(*closure->location);
+        return new_closure;
+    }
+};
+
+std::vector<Value> thread_copy(std::vector<Value> &values)
+{
+    // The copies are never collected here, this thread's collector would
+    // otherwise walk cells the other thread is changing
+    size_t mark = heap.generations[0].size();
+
+    ThreadCopy copier;
+    std::vector<Value> copies;
+    for (auto &value : values)
+    {
+        copies.push_back(copier.copy(value));
+    }
+
+    heap_release(mark);
+    return copies;
+}
+
 static Value copy_builtin(std::vector<Value> &args)
 {
     if (args.size() != 1)
@@ -3926,7 +3950,7 @@ static Value sort_builtin(std::vector<Value> &args)
     Value new_list = copy(value);
 
     VM func_vm;
-    std::shared_ptr<FunctionObj> main = std::make_shared<FunctionObj>();
+    std::shared_ptr<FunctionObj> main = pool_make<FunctionObj>();
     main->name = "";
     main->arity = 0;
     main->chunk = Chunk();
@@ -4092,10 +4116,13 @@ static Value future_builtin(std::vector<Value> &args)
 
     VM *_vm = (VM *)(vm.get_pointer()->value);
 
+    // Values are shared with the future's thread, so no thread collects
+    // cycles until it finishes
+    heap_shared_threads++;
     auto _future = std::async(std::launch::async, [vm = std::move(_vm), func = std::move(func)]() mutable
                               {
         VM func_vm;
-        std::shared_ptr<FunctionObj> main = std::make_shared<FunctionObj>();
+        std::shared_ptr<FunctionObj> main = pool_make<FunctionObj>();
         main->name = "";
         main->arity = 0;
         main->chunk = Chunk();
@@ -4117,7 +4144,9 @@ static Value future_builtin(std::vector<Value> &args)
 
         evaluate(func_vm);
 
-        return func_vm.stack.back(); })
+        Value result = func_vm.stack.back();
+        heap_shared_threads--;
+        return result; })
                        .share();
 
     auto f = new std::shared_future<Value>(_future);
@@ -4181,4 +4210,225 @@ static Value check_future_builtin(std::vector<Value> &args)
     }
 
     return boolean_val(false);
-}
\ No newline at end of file
+}
+
+static Value gc_collect_builtin(std::vector<Value> &args)
+{
+    if (args.size() != 1)
+    {
+        return error_object("Function '__gc_collect__' expects 1 argument");
+    }
+
+    Value generation = args[0];
+
+    if (!generation.is_number() || generation.get_number() < 0 || generation.get_number() >= HEAP_GENERATIONS)
+    {
+        return error_object("Function '__gc_collect__' expects argument 'generation' to be a number between 0 and " + std::to_string(HEAP_GENERATIONS - 1));
+    }
+
+    if (heap_shared_threads > 0 || heap.nesting > 1)
+    {
+        return number_val(0);
+    }
+
+    return number_val(heap_collect((int)generation.get_number()));
+}
+
+static Value gc_stats_builtin(std::vector<Value> &args)
+{
+    if (args.size() != 0)
+    {
+        return error_object("Function '__gc_stats__' expects 0 arguments");
+    }
+
+    Value stats = object_val();
+    auto &obj = stats.get_object();
+    obj->keys = {"enabled", "tracked", "collected", "collections", "thresholds", "time", "allocations"};
+    obj->values["enabled"] = boolean_val(heap.enabled);
+    obj->values["tracked"] = number_val(heap.stats.tracked);
+    obj->values["collected"] = number_val(heap.stats.collected);
+    obj->values["collections"] = list_val();
+    obj->values["thresholds"] = list_val();
+    for (int i = 0; i < HEAP_GENERATIONS; i++)
+    {
+        obj->values["collections"].get_list()->push_back(number_val(heap.stats.collections[i]));
+        obj->values["thresholds"].get_list()->push_back(number_val(heap.thresholds[i]));
+    }
+    obj->values["time"] = number_val(heap.stats.total_time);
+    obj->values["allocations"] = number_val(pool_allocations());
+    return stats;
+}
+
+static Value heap_snapshot_builtin(std::vector<Value> &args)
+{
+    if (args.size() != 1)
+    {
+        return error_object("Function '__heap_snapshot__' expects 1 argument");
+    }
+
+    Value path = args[0];
+
+    if (!path.is_string() && !path.is_none())
+    {
+        return error_object("Function '__heap_snapshot__' expects argument 'path' to be a string or None");
+    }
+
+    return heap_snapshot(path.is_string() ? path.get_string() : "");
+}
+
+static Value heap_diff_builtin(std::vector<Value> &args)
+{
+    if (args.size() != 2)
+    {
+        return error_object("Function '__heap_diff__' expects 2 arguments");
+    }
+
+    Value before = args[0];
+    Value after = args[1];
+
+    if (!before.is_string() || !after.is_string())
+    {
+        return error_object("Function '__heap_diff__' expects arguments 'before' and 'after' to be strings");
+    }
+
+    return heap_snapshot_diff(before.get_string(), after.get_string());
+}
+
+static Value alloc_sampling_builtin(std::vector<Value> &args)
+{
+    if (args.size() != 1)
+    {
+        return error_object("Function '__alloc_sampling__' expects 1 argument");
+    }
+
+    Value interval = args[0];
+
+    if (!interval.is_number() || interval.get_number() < 0)
+    {
+        return error_object("Function '__alloc_sampling__' expects argument 'interval' to be a non-negative number");
+    }
+
+    heap_sampling((int)interval.get_number());
+    return none_val();
+}
+
+static Value alloc_sites_builtin(std::vector<Value> &args)
+{
+    if (args.size() != 0)
+    {
+        return error_object("Function '__alloc_sites__' expects 0 arguments");
+    }
+
+    return heap_allocation_sites();
+}
+
+static Value trace_start_builtin(std::vector<Value> &args)
+{
+    if (args.size() != 1)
+    {
+        return error_object("Function '__trace_start__' expects 1 argument");
+    }
+
+    Value capacity = args[0];
+
+    if (!capacity.is_number() || capacity.get_number() < 1)
+    {
+        return error_object("Function '__trace_start__' expects argument 'capacity' to be a positive number");
+    }
+
+    tracer_start((int)capacity.get_number());
+    return none_val();
+}
+
+static Value trace_stop_builtin(std::vector<Value> &args)
+{
+    if (args.size() != 0)
+    {
+        return error_object("Function '__trace_stop__' expects 0 arguments");
+    }
+
+    tracer_stop();
+    return none_val();
+}
+
+static Value trace_dump_builtin(std::vector<Value> &args)
+{
+    if (args.size() != 1)
+    {
+        return error_object("Function '__trace_dump__' expects 1 argument");
+    }
+
+    Value path = args[0];
+
+    if (!path.is_string())
+    {
+        return error_object("Function '__trace_dump__' expects argument 'path' to be a string");
+    }
+
+    if (!tracer_dump(path.get_string()))
+    {
+        return error_object("Cannot open '" + path.get_string() + "' for writing");
+    }
+    return none_val();
+}
+
+static Value opcode_stats_builtin(std::vector<Value> &args)
+{
+    if (args.size() != 0)
+    {
+        return error_object("Function '__opcode_stats__' expects 0 arguments");
+    }
+
+#ifdef OPCODE_STATS
+    return opcode_stats_value();
+#else
+    return error_object("Function '__opcode_stats__' requires an interpreter built with OPCODE_STATS defined");
+#endif
+}
+
+static Value gc_config_builtin(std::vector<Value> &args)
+{
+    if (args.size() != 2)
+    {
+        return error_object("Function '__gc_config__' expects 2 arguments");
+    }
+
+    Value enabled = args[0];
+    Value thresholds = args[1];
+
+    if (!enabled.is_boolean() && !enabled.is_none())
+    {
+        return error_object("Function '__gc_config__' expects argument 'enabled' to be a boolean or None");
+    }
+
+    if (thresholds.is_list())
+    {
+        auto &list = *thresholds.get_list();
+        if (list.size() != HEAP_GENERATIONS)
+        {
+            return error_object("Function '__gc_config__' expects argument 'thresholds' to have " + std::to_string(HEAP_GENERATIONS) + " values");
+        }
+        for (auto &threshold : list)
+        {
+            if (!threshold.is_number() || threshold.get_number() < 1)
+            {
+                return error_object("Function '__gc_config__' expects argument 'thresholds' to contain positive numbers");
+            }
+        }
+        for (int i = 0; i < HEAP_GENERATIONS; i++)
+        {
+            heap.thresholds[i] = (int)list[i].get_number();
+        }
+    }
+    else if (!thresholds.is_none())
+    {
+        return error_object("Function '__gc_config__' expects argument 'thresholds' to be a list or None");
+    }
+
+    if (enabled.is_boolean())
+    {
+        heap.enabled = enabled.get_boolean();
+    }
+
+    return none_val();
+}
@@ -11,6 +11,12 @@
 #include "../Parser/Parser.hpp"
 #include "../Bytecode/Bytecode.hpp"
 #include "../Bytecode/Generator.hpp"
+#include "../Profiler/Profiler.hpp"
+#include "../Profiler/OpcodeStats.hpp"
+#include "../Profiler/Tracer.hpp"
+#include "../Heap/Snapshot.hpp"
+#include "../Image/Image.hpp"
+#include "../Jit/Jit.hpp"
 
 #define GCC_COMPILER (defined(__GNUC__) && !defined(__clang__))
 
@@ -30,15 +36,131 @@
 
 // #define DEBUG_TRACE_EXECUTION
 
+#define STACK_MAX 100000
+#define STACK_HEADROOM 256
+#define FRAMES_MAX 3000
+
+// Thrown when a push would run past the end of a stack, run() reports it as
+// a RecursionError so it can be caught like any other error
+struct StackOverflow
+{
+};
+
+// Value and frame stacks are allocated once per VM and never move, closures
+// and the frames keep raw pointers into them
+template <typename T>
+struct FixedStack
+{
+    T *items;
+    T *top;
+    T *limit;
+
+    FixedStack(size_t capacity)
+    {
+        items = top = (T *)::operator new(capacity * sizeof(T));
+        limit = items + capacity;
+    }
+    ~FixedStack()
+    {
+        clear();
+        ::operator delete(items);
+    }
+    FixedStack(const FixedStack &) = delete;
+    FixedStack &operator=(const FixedStack &) = delete;
+
+    [[noreturn]] static void overflow()
+    {
+        throw StackOverflow();
+    }
+
+    void push_back(const T &item)
+    {
+        if (top == limit)
+        {
+            overflow();
+        }
+        new (top++) T(item);
+    }
+    void push_back(T &&item)
+    {
+        if (top == limit)
+        {
+            overflow();
+        }
+        new (top++) T(std::move(item));
+    }
+    void pop_back()
+    {
+        (--top)->~T();
+    }
+    T &back()
+    {
+        return top[-1];
+    }
+    T &operator[](size_t index)
+    {
+        return items[index];
+    }
+    size_t size() const
+    {
+        return top - items;
+    }
+    size_t capacity() const
+    {
+        return limit - items;
+    }
+    bool empty() const
+    {
+        return top == items;
+    }
+    T *data()
+    {
+        return items;
+    }
+    T *begin()
+    {
+        return items;
+    }
+    T *end()
+    {
+        return top;
+    }
+    void erase(T *first, T *last)
+    {
+        T *new_top = std::move(last, top, first);
+        while (top != new_top)
+        {
+            pop_back();
+        }
+    }
+    void erase(T *position)
+    {
+        erase(position, position + 1);
+    }
+    template <typename Iterator>
+    void append(Iterator first, Iterator last)
+    {
+        for (; first != last; ++first)
+        {
+            push_back(*first);
+        }
+    }
+    void clear()
+    {
+        while (top != items)
+        {
+            pop_back();
+        }
+    }
+};
+
 struct CallFrame
 {
-    std::string name;
     std::shared_ptr<FunctionObj> function;
     uint8_t *ip;
     int frame_start;
     int sp;
     int instruction_index;
-    std::vector<Value> gen_stack;
 };
 
 struct CachedImport
@@ -48,25 +170,19 @@ struct CachedImport
 };
 struct VM
 {
-    std::vector<Value> stack;
-    Value *sp;
-    /* Possibly change to array with specified MAX_DEPTH */
-    std::vector<CallFrame> frames;
-    std::unordered_map<std::string, std::shared_ptr<CallFrame>> gen_frames;
+    FixedStack<Value> stack;
+    FixedStack<CallFrame> frames;
     std::vector<Value *> objects;
     std::unordered_map<std::string, Value> globals;
     int status = 0;
     std::vector<std::shared_ptr<Closure>> closed_values;
-    int coro_count = 0;
-    std::vector<int> try_instructions;
-    int call_stack_limit = 3000;
+    int call_stack_limit = FRAMES_MAX;
     std::unordered_map<std::string, CachedImport> import_cache;
     int argc = 0;
     char **argv;
 
-    VM()
+    VM() : stack(STACK_MAX), frames(FRAMES_MAX + 1)
     {
-        stack.reserve(100000);
     }
 };
 
@@ -77,16 +193,34 @@ enum EvaluateResult
     EVALUATE_RUNTIME_ERROR
 };
 
+// Calls Vortex functions from native code on a VM kept for reuse, each arity
+// with a prebuilt main function that calls constant 0 with constants
+// 1..arity, so a call only swaps those constants. A call made while another
+// one is running on the same CallbackVM needs a second one
+struct CallbackVM
+{
+    VM vm;
+    std::vector<std::shared_ptr<FunctionObj>> mains;
+
+    // Returns false if the function raised an error, otherwise stores what it
+    // returned in 'result' when given
+    bool call(Value &function, Value *arguments, int count, Value *result = nullptr);
+};
+
 void push(VM &vm, Value &value);
 Value pop(VM &vm);
 Value pop_close(VM &vm);
 
-static void runtimeError(VM &vm, std::string message, std::string error_type = "GenericError", ...);
+static bool runtimeError(VM &vm, std::string message, std::string error_type = "GenericError", ...);
 static void define_global(VM &vm, std::string name, Value value);
 static void define_native(VM &vm, std::string name, NativeFunction function);
 static EvaluateResult run(VM &vm);
+static EvaluateResult execute(VM &vm);
 EvaluateResult evaluate(VM &vm);
 
+NativeFunction builtin_function(std::string name);
+const char *builtin_name(NativeFunction function);
+
 static int call_function(VM &vm, Value &function, int param_num, CallFrame *&frame, std::shared_ptr<Value> object = nullptr);
 
 void freeVM(VM &vm);
@@ -94,6 +228,11 @@ void freeVM(VM &vm);
 bool is_equal(Value &v1, Value &v2);
 bool is_falsey(Value &value);
 Value copy(Value &value);
+// Copies values for a VM on another thread. Lists, objects, types, functions,
+// the functions defined inside them and their captured variables are all
+// copied, so the copies share no heap cells with the originals. The copies
+// are not tracked by this thread's heap
+std::vector<Value> thread_copy(std::vector<Value> &values);
 Value error_object(std::string message, std::string error_type = "GenericError");
 
 static Value eval_builtin(std::vector<Value> &args);
@@ -121,4 +260,16 @@ static Value error_type_builtin(std::vector<Value> &args);
 
 static Value future_builtin(std::vector<Value> &args);
 static Value get_future_builtin(std::vector<Value> &args);
-static Value check_future_builtin(std::vector<Value> &args);
\ No newline at end of file
+static Value check_future_builtin(std::vector<Value> &args);
+
+static Value gc_collect_builtin(std::vector<Value> &args);
+static Value gc_stats_builtin(std::vector<Value> &args);
+static Value gc_config_builtin(std::vector<Value> &args);
+static Value opcode_stats_builtin(std::vector<Value> &args);
+static Value heap_snapshot_builtin(std::vector<Value> &args);
+static Value heap_diff_builtin(std::vector<Value> &args);
+static Value alloc_sampling_builtin(std::vector<Value> &args);
+static Value alloc_sites_builtin(std::vector<Value> &args);
+static Value trace_start_builtin(std::vector<Value> &args);
+static Value trace_stop_builtin(std::vector<Value> &args);
+static Value trace_dump_builtin(std::vector<Value> &args);
@@ -0,0 +1,148 @@
+#!/bin/sh
+
+# Runs the regression scripts in tests/ and compares what each prints with
+# the .out file next to it
+#
+#   tests/run.sh [-j] [-u] [case ...]
+#
+#   -j  also run every case with --jit, which must print the same output
+#   -u  write the current output as the expected output instead of comparing
+#
+# A case is a script's path below tests/ without .vtx, e.g. generators or
+# modules/json/stream. Scripts run from their own directory with stdout and
+# stderr combined. Scripts under tests/modules/<name>/ need that module to be
+# built (see Modules/) and are skipped otherwise. Lines of output matching a
+# pattern in <case>.ignore, such as timestamped logs from native libraries,
+# are left out of the comparison.
+#
+# The interpreter is built into tests/build first, set VORTEX to the path of
+# an existing one to skip that. Exits with 1 if any case failed.
+
+cd "$(dirname "$0")/.." || exit 1
+
+JIT=0
+UPDATE=0
+
+usage()
+{
+    sed -n '3,19p' "$0" | sed 's/^# \{0,1\}//'
+}
+
+while getopts "juh" opt; do
+    case $opt in
+        j) JIT=1 ;;
+        u) UPDATE=1 ;;
+        h) usage; exit 0 ;;
+        *) usage; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+CASES="$*"
+if [ -z "$CASES" ]; then
+    CASES=$(find tests -name '*.vtx' ! -path 'tests/build/*' | sort | sed 's|^tests/||; s|\.vtx$||')
+fi
+
+build()
+{
+    echo "Compiling Vortex..."
+    mkdir -p tests/build
+    case "`uname`" in
+        'Linux') FLAGS="-stdlib=libc++ -pthread -ldl" ;;
+        *) FLAGS="" ;;
+    esac
+    ${CXX:-clang++} \
+    -Ofast \
+    -Wno-everything \
+    -std=c++20 \
+    $FLAGS \
+    src/Node/Node.cpp \
+    src/Lexer/Lexer.cpp \
+    src/Parser/Parser.cpp \
+    src/Bytecode/Bytecode.cpp \
+    src/Bytecode/Generator.cpp \
+    src/Heap/Heap.cpp \
+    src/Heap/Snapshot.cpp \
+    src/Profiler/Profiler.cpp \
+    src/Profiler/OpcodeStats.cpp \
+    src/Profiler/Tracer.cpp \
+    src/Image/Image.cpp \
+    src/Jit/Jit.cpp \
+    src/VirtualMachine/VirtualMachine.cpp \
+    src/utils/utils.cpp \
+    main.cpp \
+    -o tests/build/vortex || { echo 'Compilation failed' ; exit 1; }
+}
+
+if [ -z "$VORTEX" ]; then
+    build
+    VORTEX=tests/build/vortex
+fi
+VORTEX=$(cd "$(dirname "$VORTEX")" && pwd)/$(basename "$VORTEX")
+
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# run <script> <case> [flag] writes the output to $TMP/out
+run()
+{
+    (cd "$(dirname "$1")" && "$VORTEX" "$(basename "$1")" $3) > "$TMP/out" 2>&1
+    if [ -f "tests/$2.ignore" ]; then
+        grep -Ev -f "tests/$2.ignore" "$TMP/out" > "$TMP/kept"
+        mv "$TMP/kept" "$TMP/out"
+    fi
+}
+
+passed=0
+failed=0
+skipped=0
+for case in $CASES; do
+    script="tests/$case.vtx"
+    expected="tests/$case.out"
+    if [ ! -f "$script" ]; then
+        echo "No such test: $case"
+        exit 1
+    fi
+    printf "%-32s" "$case"
+
+    module=$(echo "$case" | sed -n 's|^modules/\([^/]*\)/.*|\1|p')
+    if [ -n "$module" ] && [ ! -f "Modules/modules/$module/bin/$module" ]; then
+        echo " skipped, the $module module is not built"
+        skipped=$((skipped + 1))
+        continue
+    fi
+
+    run "$script" "$case"
+
+    if [ "$UPDATE" = 1 ]; then
+        cp "$TMP/out" "$expected"
+        echo " updated"
+        continue
+    fi
+
+    result=ok
+    if [ ! -f "$expected" ] || ! cmp -s "$TMP/out" "$expected"; then
+        result=FAILED
+        diff "$expected" "$TMP/out" 2>&1 | head -20 | sed 's/^/    /' > "$TMP/diff"
+    elif [ "$JIT" = 1 ]; then
+        run "$script" "$case" --jit
+        if ! cmp -s "$TMP/out" "$expected"; then
+            result="FAILED with --jit"
+            diff "$expected" "$TMP/out" 2>&1 | head -20 | sed 's/^/    /' > "$TMP/diff"
+        fi
+    fi
+
+    echo " $result"
+    if [ "$result" = ok ]; then
+        passed=$((passed + 1))
+    else
+        cat "$TMP/diff"
+        failed=$((failed + 1))
+    fi
+done
+
+[ "$UPDATE" = 1 ] && exit 0
+
+echo
+echo "$passed passed, $failed failed, $skipped skipped"
+[ "$failed" = 0 ]
@@ -16,6 +16,13 @@ build()
     "$PWD"/src/Parser/Parser.cpp \
     "$PWD"/src/Bytecode/Bytecode.cpp \
     "$PWD"/src/Bytecode/Generator.cpp \
+    "$PWD"/src/Heap/Heap.cpp \
+    "$PWD"/src/Heap/Snapshot.cpp \
+    "$PWD"/src/Profiler/Profiler.cpp \
+    "$PWD"/src/Profiler/OpcodeStats.cpp \
+    "$PWD"/src/Profiler/Tracer.cpp \
+    "$PWD"/src/Image/Image.cpp \
+    "$PWD"/src/Jit/Jit.cpp \
     "$PWD"/src/VirtualMachine/VirtualMachine.cpp \
     "$PWD"/src/utils/utils.cpp \
     "$PWD"/main.cpp \